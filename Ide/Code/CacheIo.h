@@ -0,0 +1,152 @@
+#ifndef _CACHE_IO_H_
+#define _CACHE_IO_H_
+
+/// Gets the size and modification time used to decide if a cached copy of
+/// a file is still current.
+inline bool CacheStat(const char *Path, int64 &Size, uint64 &Modified)
+{
+	#ifdef POSIX
+	struct stat s;
+	if (stat(Path, &s) || !S_ISREG(s.st_mode))
+		return false;
+	Size = s.st_size;
+	#ifdef LINUX
+	Modified = (uint64)s.st_mtim.tv_sec * 1000000000 + s.st_mtim.tv_nsec;
+	#else
+	Modified = s.st_mtime;
+	#endif
+	#else
+	GDirectory Dir;
+	if (!Dir.First(Path, NULL))
+		return false;
+	Size = Dir.GetSize();
+	Modified = Dir.GetLastWriteTime();
+	#endif
+	return true;
+}
+
+/// Appends binary values to a memory buffer, for the IDE's on disk caches.
+struct CacheWriter
+{
+	// 'Buf' is grown in large steps ahead of 'Used', because growing a GArray
+	// zeros all its spare space each time.
+	GArray<uint8> Buf;
+	size_t Used;
+
+	CacheWriter()
+	{
+		Used = 0;
+	}
+
+	/// The number of bytes written so far.
+	size_t Length()
+	{
+		return Used;
+	}
+
+	/// Access to already written bytes, e.g. to patch in a count.
+	uint8 *At(size_t i)
+	{
+		return i < Used ? Buf.AddressOf(i) : NULL;
+	}
+
+	void Bytes(const void *p, size_t len)
+	{
+		if (!len)
+			return;
+		if (Used + len > Buf.Length())
+			Buf.Length(MAX(Used + len, MAX(Buf.Length() << 1, 256)));
+		memcpy(Buf.AddressOf(Used), p, len);
+		Used += len;
+	}
+
+	template<typename T>
+	void Int(T i)
+	{
+		Bytes(&i, sizeof(i));
+	}
+
+	void VarInt(uint32 i)
+	{
+		uint8 b[5];
+		size_t len = 0;
+		while (i >= 0x80)
+		{
+			b[len++] = (uint8) (i | 0x80);
+			i >>= 7;
+		}
+		b[len++] = (uint8)i;
+		Bytes(b, len);
+	}
+
+	void Str(const GString &s)
+	{
+		Int((uint32)s.Length());
+		Bytes(s.Get(), s.Length());
+	}
+
+	bool Save(const char *File)
+	{
+		GFile f;
+		if (!f.Open(File, O_WRITE))
+			return false;
+		f.SetSize(0);
+		return f.Write(Buf.AddressOf(), Used) == (ssize_t)Used;
+	}
+};
+
+/// Reads values written by CacheWriter, bounds checking as it goes. Once a 
+/// read fails 'Ok' stays false.
+struct CacheReader
+{
+	const uint8 *s, *e;
+	bool Ok;
+
+	CacheReader(const char *p, size_t len)
+	{
+		s = (const uint8*)p;
+		e = s + len;
+		Ok = p != NULL;
+	}
+
+	bool Bytes(void *p, size_t len)
+	{
+		if (!Ok || (size_t)(e - s) < len)
+			return Ok = false;
+		memcpy(p, s, len);
+		s += len;
+		return true;
+	}
+
+	template<typename T>
+	bool Int(T &i)
+	{
+		return Bytes(&i, sizeof(i));
+	}
+
+	bool VarInt(uint32 &i)
+	{
+		i = 0;
+		for (int Shift = 0; Ok && s < e && Shift < 32; Shift += 7)
+		{
+			uint8 b = *s++;
+			i |= (uint32)(b & 0x7f) << Shift;
+			if (!(b & 0x80))
+				return true;
+		}
+		return Ok = false;
+	}
+
+	bool Str(GString &out)
+	{
+		uint32 Len = 0;
+		if (!Int(Len) ||
+			(size_t)(e - s) < Len ||
+			!out.Set((const char*)s, Len))
+			return Ok = false;
+		s += Len;
+		return true;
+	}
+};
+
+#endif
@@ -9,8 +9,12 @@
 #include "GEdit.h"
 #include "GCheckBox.h"
 #include "GTextLabel.h"
+#include "FindIndex.h"
+#include "LFileWalker.h"
 
 #define DEBUG_HIST		0
+#define FIF_MAX_WORKERS	16	// Upper bound on search threads
+#define FIF_FLUSH_MS	300	// Min time between posting results to the app
 
 /////////////////////////////////////////////////////////////////////////////////////
 FindInFiles::FindInFiles(AppWnd *app, FindParams *params)
@@ -208,131 +212,407 @@ int FindInFiles::OnNotify(GViewI *v, int f)
 }
 
 /////////////////////////////////////////////////////////////////////////////////////
+class FindInFilesThreadPrivate;
+
+/// Literal substring matcher for the search workers. Case sensitive searches
+/// go through memmem/memchr (vectorised in the C library), case insensitive
+/// ones use a Horspool skip table built over case folded bytes.
+class FifMatcher
+{
+	GString Text;
+	size_t Len;
+	bool MatchCase;
+	uchar Fold[256];
+	size_t Skip[256];
+
+public:
+	FifMatcher(const char *text, bool matchCase)
+	{
+		Text = text;
+		Len = Text.Length();
+		MatchCase = matchCase;
+
+		for (int i=0; i<256; i++)
+		{
+			Fold[i] = MatchCase ? i : tolower(i);
+			Skip[i] = Len;
+		}
+		
+		const uchar *p = (const uchar*) Text.Get();
+		for (size_t i=0; Len > 0 && i < Len - 1; i++)
+		{
+			size_t Shift = Len - 1 - i;
+			Skip[p[i]] = Shift;
+			if (!MatchCase)
+			{
+				Skip[tolower(p[i])] = Shift;
+				Skip[toupper(p[i])] = Shift;
+			}
+		}
+	}
+
+	size_t Length() { return Len; }
+
+	/// \returns the first match in [s,e) or NULL.
+	const char *Find(const char *s, const char *e)
+	{
+		if (!Len || e - s < (ssize_t)Len)
+			return NULL;
+
+		const uchar *p = (const uchar*) Text.Get();
+		if (MatchCase)
+		{
+			#ifdef __GLIBC__
+			return (const char*) memmem(s, e - s, p, Len);
+			#else
+			const char *Last = e - Len;
+			while (s <= Last)
+			{
+				s = (const char*) memchr(s, p[0], Last - s + 1);
+				if (!s)
+					break;
+				if (!memcmp(s, p, Len))
+					return s;
+				s++;
+			}
+			return NULL;
+			#endif
+		}
+
+		const uchar *h = (const uchar*) s;
+		const uchar *Last = (const uchar*) e - Len;
+		uchar End = Fold[p[Len-1]];
+		while (h <= Last)
+		{
+			uchar c = h[Len-1];
+			if (Fold[c] == End)
+			{
+				size_t i = 0;
+				while (i < Len - 1 && Fold[h[i]] == Fold[p[i]])
+					i++;
+				if (i == Len - 1)
+					return (const char*) h;
+			}
+			h += Skip[c];
+		}
+
+		return NULL;
+	}
+};
+
+/// Read only copy of a file's contents. On POSIX systems the file is read into
+/// a buffer owned by the worker and reused between files. It isn't memory
+/// mapped because a file truncated while mapped would fault the search thread.
+class FifFileView
+{
+	GAutoString Str;
+
+public:
+	const char *Start;
+	size_t Len;
+
+	FifFileView()
+	{
+		Start = NULL;
+		Len = 0;
+	}
+
+	bool Open(const char *File, GArray<char> &Buf)
+	{
+		#ifdef POSIX
+		int Fd = open(File, O_RDONLY);
+		if (Fd < 0)
+			return false;
+		
+		bool Status = false;
+		struct stat s;
+		if (fstat(Fd, &s) == 0 && S_ISREG(s.st_mode))
+		{
+			// The size is only a hint, the file can change while it's read.
+			size_t Used = 0;
+			if (Buf.Length() < (size_t)s.st_size + 1)
+				Buf.Length((size_t)s.st_size + 1);
+
+			ssize_t r;
+			while ((r = read(Fd, &Buf[Used], Buf.Length() - Used)) > 0)
+			{
+				Used += r;
+				if (Used == Buf.Length())
+					Buf.Length(Used << 1);
+			}
+
+			if (r == 0)
+			{
+				Start = &Buf[0];
+				Len = Used;
+				Status = true;
+			}
+		}
+		close(Fd);
+		if (Status)
+			return true;
+		#endif
+
+		// Fall back to reading the whole file
+		Str.Reset(ReadTextFile(File));
+		if (!Str)
+			return false;
+		Start = Str;
+		Len = strlen(Str);
+		return true;
+	}
+};
+
+/// One of the threads in the search pool, takes files off the shared queue
+/// until the directory walk is done and the queue is empty.
+class FindInFilesWorker : public LThread
+{
+	FindInFilesThreadPrivate *d;
+
+public:
+	FindInFilesWorker(FindInFilesThreadPrivate *priv) : LThread("FindInFilesWorker")
+	{
+		d = priv;
+		Run();
+	}
+
+	int Main();
+};
+
 class FindInFilesThreadPrivate
 {
 public:
 	int AppHnd;
+	FindIndex *Index;
 	GAutoPtr<FindParams> Params;
+	GAutoPtr<FifMatcher> Matcher;
 	bool Loop, Busy;
+	GArray<const char*> Ext;
+
+	// Work queue, fed by the directory walk and drained by the workers
+	LMutex QueueLock;
+	GArray<GString> Queue;
+	size_t QueuePos;
+	bool WalkDone;
+	LThreadEvent QueueEvent;
+	GArray<FindInFilesWorker*> Workers;
+
+	// Results, posted to the app at a bounded rate
+	LMutex ResultLock;
 	GStringPipe Pipe;
 	int64 Last;
-};
-
-FindInFilesThread::FindInFilesThread(int AppHnd) : GEventTargetThread("FindInFiles")
-{
-	d = new FindInFilesThreadPrivate;
-	d->AppHnd = AppHnd;
-	d->Loop = true;
-	d->Busy = false;
-	d->Last = 0;
-}
+	
+	FindInFilesThreadPrivate() :
+		QueueLock("FindInFiles.Queue"),
+		ResultLock("FindInFiles.Results")
+	{
+		AppHnd = 0;
+		Index = NULL;
+		Loop = true;
+		Busy = false;
+		QueuePos = 0;
+		WalkDone = false;
+		Last = 0;
+	}
 
-FindInFilesThread::~FindInFilesThread()
-{
-	DeleteObj(d);
-}
+	void AddFile(const char *File)
+	{
+		if (QueueLock.Lock(_FL))
+		{
+			Queue.New() = File;
+			QueueLock.Unlock();
+			QueueEvent.Signal();
+		}
+	}
 
-void FindInFilesThread::SearchFile(char *File)
-{
-	if (File && ValidStr(d->Params->Text))
+	bool NextFile(GString &File)
 	{
-		char *Doc = ReadTextFile(File);
-		if (Doc)
+		while (Loop)
 		{
-			int Len = d->Params->Text.Length();
-			const char *Text = d->Params->Text;
-			
-			char *LineStart = 0;
-			int Line = 0;
-			for (char *s = Doc; *s && d->Loop; s++)
+			bool Done = false;
+			if (QueueLock.Lock(_FL))
 			{
-				if (*s == '\n')
+				if (QueuePos < Queue.Length())
 				{
-					Line++;
-					LineStart = 0;
-				}
-				else
-				{
-					if (!LineStart)
-						LineStart = s;
-						
-					bool Match = false;
-					if (d->Params->MatchCase)
-					{
-						if (Text[0] == *s)
-						{
-							Match = strncmp(s, Text, Len) == 0;
-						}
-					}
-					else
-					{
-						if (toupper(Text[0]) == toupper(*s))
-						{
-							Match = strnicmp(s, Text, Len) == 0;
-						}
-					}
-					
-					if (Match)
-					{
-						char *Eol = s + Len;
-						while (*Eol && *Eol != '\n') Eol++;
-						int LineLen = Eol - LineStart;						
-						
-						bool StartOk = true;
-						bool EndOk = true;
-						if (d->Params->MatchWord)
-						{
-							if (s > Doc)
-							{
-								StartOk = IsWordBoundry(s[-1]);
-							}
-							
-							EndOk = IsWordBoundry(s[Len]);
-						}
-						
-						if (StartOk && EndOk)
-						{
-							static char Buf[1024];
-							int Chars = snprintf(Buf, sizeof(Buf), "%s:%i:%.*s\n", File, Line + 1, LineLen, LineStart);
-							d->Pipe.Push(Buf, Chars);
-							
-							int64 Now = LgiCurrentTime();
-							if (Now > d->Last  + 500)
-							{
-								GEventSinkMap::Dispatch.PostEvent(d->AppHnd, M_APPEND_TEXT, (GMessage::Param)d->Pipe.NewStr(), 2);
-							}
-						}
-						s = Eol - 1;
-					}
+					File = Queue[QueuePos];
+					Queue[QueuePos++].Empty();
+					QueueLock.Unlock();
+					return true;
 				}
+				Done = WalkDone;
+				QueueLock.Unlock();
 			}
+			if (Done)
+				break;
+			QueueEvent.Wait(50);
+		}
+		
+		return false;
+	}
 
-			DeleteArray(Doc);
+	void StartWorkers()
+	{
+		Queue.Length(0);
+		QueuePos = 0;
+		WalkDone = false;
+
+		int Cpus = LgiApp ? LgiApp->GetCpuCount() : 1;
+		int Count = limit(Cpus, 1, FIF_MAX_WORKERS);
+		for (int i=0; i<Count; i++)
+			Workers.Add(new FindInFilesWorker(this));
+	}
+
+	void EndWorkers()
+	{
+		if (QueueLock.Lock(_FL))
+		{
+			WalkDone = true;
+			QueueLock.Unlock();
 		}
-		else if (LgiFileSize(File) > 0)
+		for (unsigned i=0; i<Workers.Length(); i++)
+			QueueEvent.Signal();
+
+		for (unsigned i=0; i<Workers.Length(); i++)
+		{
+			while (!Workers[i]->IsExited())
+				LgiSleep(1);
+		}
+		Workers.DeleteObjects();
+		Queue.Length(0);
+	}
+
+	void AddResult(const char *Str, ssize_t Len)
+	{
+		if (ResultLock.Lock(_FL))
+		{
+			Pipe.Push(Str, Len);
+
+			int64 Now = LgiCurrentTime();
+			if (Now > Last + FIF_FLUSH_MS)
+			{
+				GEventSinkMap::Dispatch.PostEvent(AppHnd, M_APPEND_TEXT, (GMessage::Param)Pipe.NewStr(), 2);
+				Last = Now;
+			}
+			ResultLock.Unlock();
+		}
+	}
+
+	void FlushResults()
+	{
+		if (ResultLock.Lock(_FL))
 		{
-			LgiTrace("%s:%i - Couldn't Read file '%s'\n", _FL, File);
+			char *Str = Pipe.NewStr();
+			if (Str)
+				GEventSinkMap::Dispatch.PostEvent(AppHnd, M_APPEND_TEXT, (GMessage::Param)Str, 2);
+			ResultLock.Unlock();
 		}
 	}
+
+	void SearchFile(const char *File, GArray<char> &Buf)
+	{
+		FifFileView View;
+		if (!View.Open(File, Buf))
+		{
+			if (LgiFileSize(File) > 0)
+				LgiTrace("%s:%i - Couldn't Read file '%s'\n", _FL, File);
+			return;
+		}
+
+		const char *Doc = View.Start;
+		const char *End = Doc + View.Len;
+		const char *Counted = Doc;
+		const char *LineStart = Doc;
+		size_t Len = Matcher->Length();
+		int Line = 0;
+		
+		for (const char *s = Doc; Loop && (s = Matcher->Find(s, End)); )
+		{
+			// Count lines up to the match, noting where its line starts so
+			// there's no scanning backwards per match.
+			for (const char *n = Counted; (n = (const char*) memchr(n, '\n', s - n)); n++)
+			{
+				Line++;
+				LineStart = n + 1;
+			}
+			Counted = s;
+
+			bool StartOk = true;
+			bool EndOk = true;
+			if (Params->MatchWord)
+			{
+				if (s > Doc)
+					StartOk = IsWordBoundry(s[-1]);
+				if (s + Len < End)
+					EndOk = IsWordBoundry(s[Len]);
+			}
+
+			if (StartOk && EndOk)
+			{
+				const char *Eol = (const char*) memchr(s + Len, '\n', End - s - Len);
+				if (!Eol)
+					Eol = End;
+
+				char Buf[1024];
+				int LineLen = (int) (Eol - LineStart);
+				if (LineLen > 0 && LineStart[LineLen-1] == '\r')
+					LineLen--;
+				int Chars = snprintf(Buf, sizeof(Buf), "%s:%i:%.*s\n", File, Line + 1, LineLen, LineStart);
+				if (Chars > 0)
+					AddResult(Buf, Chars < (int)sizeof(Buf) ? Chars : (int)sizeof(Buf) - 1);
+
+				// One result per line is enough
+				s = Eol;
+			}
+			else s++;
+		}
+	}
+};
+
+int FindInFilesWorker::Main()
+{
+	GString File;
+	GArray<char> Buf;
+	while (d->NextFile(File))
+		d->SearchFile(File, Buf);
+	return 0;
+}
+
+FindInFilesThread::FindInFilesThread(int AppHnd, FindIndex *Index) : GEventTargetThread("FindInFiles")
+{
+	d = new FindInFilesThreadPrivate;
+	d->AppHnd = AppHnd;
+	d->Index = Index;
+}
+
+FindInFilesThread::~FindInFilesThread()
+{
+	DeleteObj(d);
 }
 
-bool FindInFilesCallback(void *UserData, char *Path, GDirectory *Dir)
+bool FindInFilesCallback(void *UserData, LFileWalker::Entry &e)
 {
-	if (Dir->IsDir())
+	FindInFilesThreadPrivate *d = (FindInFilesThreadPrivate*)UserData;
+	if (!d->Loop)
+		return false;
+
+	const char *p = e.Leaf;
+	if (e.IsDir)
 	{
-		char *p = Dir->GetName();
 		if
 		(
-			p
-			&&
-			(
-				stricmp(p, ".svn") == 0
-				||
-				stricmp(p, ".git") == 0
-			)
+			stricmp(p, ".svn") == 0
+			||
+			stricmp(p, ".git") == 0
 		)
 			return false;
+
+		return true;
 	}
+
+	// The walker has already matched the extensions, hand the file
+	// straight to the worker pool so searching overlaps the walk.
+	if (p[0] != '.')
+		d->AddFile(e.Path);
 	
 	return true;
 }
@@ -359,81 +639,69 @@ GMessage::Result FindInFilesThread::OnEvent(GMessage *Msg)
 
 				d->Loop = true;
 				d->Busy = true;
+				d->Last = LgiCurrentTime();
 				snprintf(Msg, sizeof(Msg), "Searching for '%s'...\n", d->Params->Text.Get());
 				GEventSinkMap::Dispatch.PostEvent(d->AppHnd, M_APPEND_TEXT, 0, 2);
 				GEventSinkMap::Dispatch.PostEvent(d->AppHnd, M_APPEND_TEXT, (GMessage::Param)NewStr(Msg), 2);
 
-				GArray<const char*> Ext;
+				d->Matcher.Reset(new FifMatcher(d->Params->Text, d->Params->MatchCase));
+				
+				d->Ext.Length(0);
 				GToken e(d->Params->Ext, ";, ");
 				for (int i=0; i<e.Length(); i++)
 				{
-					Ext.Add(e[i]);
+					d->Ext.Add(e[i]);
 				}
+
+				d->StartWorkers();
 		
-				GArray<char*> Files;
 				if (d->Params->Type == FifSearchSolution)
 				{
 					// Do the extension filtering...
+					GArray<GString> Files;
 					for (unsigned i=0; i<d->Params->ProjectFiles.Length(); i++)
 					{
 						GString p = d->Params->ProjectFiles[i];
 						if (p)
 						{
 							const char *Leaf = LgiGetLeaf(p);
-							for (unsigned n=0; n<Ext.Length(); n++)
+							for (unsigned n=0; n<d->Ext.Length(); n++)
 							{
-								if (MatchStr(Ext[n], Leaf))
+								if (MatchStr(d->Ext[n], Leaf))
 								{
-									char *np = NewStr(p);
-									if (np)
-										Files.Add(np);
-									else
-										LgiTrace("%s:%i - Can't dup '%s'\n", _FL, p.Get());
+									Files.New() = p;
+									break;
 								}
 							}
 						}
 						else LgiTrace("%s:%i - Null string in project files array.\n", _FL);
 					}
+
+					// Let the trigram index rule out files that can't match...
+					if (d->Index)
+						d->Index->Filter(d->Params->Text, Files);
+
+					for (unsigned i=0; i<Files.Length() && d->Loop; i++)
+						d->AddFile(Files[i]);
 				}
 				else
 				{
-					// Find the files recursively...
-					LgiRecursiveFileSearch(d->Params->Dir, &Ext, &Files, 0, 0, FindInFilesCallback);
+					// Walk the folders, the callback queues the files. With
+					// no extensions every file is searched.
+					LFileWalker Walker(LFileWalker::WalkParallel | LFileWalker::WalkDirs);
+					for (unsigned i=0; i<d->Ext.Length(); i++)
+						Walker.AddPattern(d->Ext[i]);
+					Walker.Walk(d->Params->Dir, FindInFilesCallback, d);
 				}
 
-				if (Files.Length() > 0)
+				size_t Files = d->Queue.Length();
+				d->EndWorkers();
+				d->FlushResults();
+
+				if (Files > 0)
 				{			
-					sprintf(Msg, "in %i files...\n", (int)Files.Length());
+					sprintf(Msg, "Done (%i files).\n", (int)Files);
 					GEventSinkMap::Dispatch.PostEvent(d->AppHnd, M_APPEND_TEXT, (GMessage::Param)NewStr(Msg), 2);
-
-					for (int i=0; i<Files.Length() && d->Loop; i++)
-					{
-						char *f = Files[i];
-						if (f)
-						{
-							char *Dir = strrchr(f, DIR_CHAR);
-							if (!Dir || Dir[1] != '.')
-							{
-								/*
-								sprintf(Msg, "%s\n", f);
-								GEventSinkMap::Dispatch.PostEvent(d->AppHnd, M_APPEND_TEXT, (GMessage::Param)NewStr(Msg), 2);
-								*/
-
-								SearchFile(f);
-							}
-						}
-						else LgiTrace("%s:%i - NULL Ptr in list????", _FL);
-					}
-			
-					char *Str = d->Pipe.NewStr();
-					if (Str)
-					{
-						GEventSinkMap::Dispatch.PostEvent(d->AppHnd, M_APPEND_TEXT, (GMessage::Param)Str, 2);
-					}
-			
-					Files.DeleteArrays();
-
-					GEventSinkMap::Dispatch.PostEvent(d->AppHnd, M_APPEND_TEXT, (GMessage::Param)NewStr("Done.\n"), 2);
 				}
 				else
 				{
@@ -82,15 +82,13 @@ class FindInFilesThread : public GEventTargetThread
 {
 	class FindInFilesThreadPrivate *d;
 
-	void SearchFile(char *File);
-
 public:
 	enum Msgs
 	{
 		M_START_SEARCH = M_USER + 100, // A=(FindParams*)
 	};
 
-	FindInFilesThread(int AppHnd);
+	FindInFilesThread(int AppHnd, class FindIndex *Index = NULL);
 	~FindInFilesThread();
 	
 	void Stop();
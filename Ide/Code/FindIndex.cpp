@@ -0,0 +1,629 @@
+#include <stdio.h>
+#include <ctype.h>
+
+#include "Lgi.h"
+#include "LgiIde.h"
+#include "FindIndex.h"
+#include "GEventTargetThread.h"
+#include "CacheIo.h"
+
+#define FIDX_MAGIC				"LgiFidx1"
+#define FIDX_FILE				"FindIndex.bin"
+#define FIDX_SAVE_MS			(30 * 1000)
+#define FIDX_MAX_FILE_SIZE		(32 << 20)
+#define FIDX_BINARY_CHECK		8192
+#define FIDX_TRIGRAMS			(1 << 24)
+
+#define DEBUG_FIND_INDEX		0
+
+typedef uint32 Trigram;
+
+static inline uchar FidxFold(uchar c)
+{
+	// Same folding as FifMatcher in the C locale, so the index works for
+	// both case sensitive and insensitive searches.
+	return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+struct FindIndexFile
+{
+	GString Path;
+	int64 Size;
+	uint64 Modified;
+	bool Deleted;
+};
+
+struct FindIndexPriv : public GEventTargetThread
+{
+	int hApp;
+	bool Loaded;
+	bool Dirty;
+	GString IndexPath;
+
+	// A file id is an index into 'Files'. A changed file gets a new id, so
+	// posting lists stay sorted by only ever appending to them.
+	GArray<FindIndexFile> Files;
+	LHashTbl<StrKey<char>, int> FileMap;
+	LHashTbl<TrigramKey, GArray<uint32>*> Postings;
+	size_t DeadFiles;
+
+	// Scratch space for indexing one file
+	GArray<uint8> Seen;
+	GArray<Trigram> FileGrams;
+
+	// Progress
+	uint64 WorkStart;
+	int Indexed;
+	int Posted, Handled;
+
+	FindIndexPriv(int appHnd, const char *indexFile) :
+		GEventTargetThread("FindIndexPriv"),
+		FileMap(0, -1)
+	{
+		hApp = appHnd;
+		Loaded = false;
+		Dirty = false;
+		DeadFiles = 0;
+		WorkStart = 0;
+		Indexed = 0;
+		Posted = Handled = 0;
+		FileMap.SetMaxSize(0x7fffffff);
+		Postings.SetMaxSize(0x7fffffff);
+
+		if (indexFile)
+			IndexPath = indexFile;
+		else
+		{
+			GFile::Path p(LSP_APP_ROOT);
+			p += FIDX_FILE;
+			IndexPath = p.GetFull();
+		}
+
+		SetPulse(FIDX_SAVE_MS);
+	}
+
+	~FindIndexPriv()
+	{
+		EndThread();
+
+		if (Dirty)
+			Save();
+
+		Postings.DeleteObjects();
+	}
+
+	void Log(const char *Fmt, ...)
+	{
+		va_list Arg;
+		va_start(Arg, Fmt);
+		GString s;
+		s.Printf(Arg, Fmt);
+		va_end(Arg);
+		
+		char *Str = s.Length() ? NewStr(s) : NULL;
+		if (Str && !GEventSinkMap::Dispatch.PostEvent(hApp, M_APPEND_TEXT, (GMessage::Param)Str, AppWnd::BuildTab))
+			DeleteArray(Str);
+	}
+
+	bool Load()
+	{
+		Loaded = true;
+
+		GFile f;
+		if (!f.Open(IndexPath, O_READ))
+			return false;
+
+		uint64 Start = LgiCurrentTime();
+		GString Data = f.Read();
+		f.Close();
+
+		CacheReader r(Data.Get(), Data.Length());
+		char Magic[8];
+		uint32 FileCount = 0, GramCount = 0;
+		if (!r.Bytes(Magic, sizeof(Magic)) ||
+			memcmp(Magic, FIDX_MAGIC, sizeof(Magic)) ||
+			!r.Int(FileCount))
+		{
+			LgiTrace("%s:%i - '%s' is not a valid index.\n", _FL, IndexPath.Get());
+			return false;
+		}
+
+		LMutex::Auto Lck(this, _FL);
+		for (uint32 i=0; r.Ok && i<FileCount; i++)
+		{
+			FindIndexFile &File = Files.New();
+			if (r.Str(File.Path) &&
+				r.Int(File.Size) &&
+				r.Int(File.Modified))
+			{
+				FileMap.Add(File.Path, (int)i);
+			}
+		}
+
+		r.Int(GramCount);
+		for (uint32 i=0; r.Ok && i<GramCount; i++)
+		{
+			Trigram t;
+			uint32 Count = 0, Id = 0, Delta;
+			if (!r.Int(t) || !r.Int(Count))
+				break;
+
+			GArray<uint32> *p = new GArray<uint32>(Count);
+			for (uint32 n=0; n<Count && r.VarInt(Delta); n++)
+			{
+				Id += Delta;
+				(*p)[n] = Id;
+			}
+			Postings.Add(t, p);
+		}
+
+		if (!r.Ok)
+		{
+			LgiTrace("%s:%i - '%s' is truncated, rebuilding.\n", _FL, IndexPath.Get());
+			Files.Length(0);
+			FileMap.Empty();
+			Postings.DeleteObjects();
+			return false;
+		}
+
+		Log("FindIndex: loaded %i files, %i trigrams in %i ms\n",
+			(int)Files.Length(), (int)Postings.Length(), (int)(LgiCurrentTime() - Start));
+		return true;
+	}
+
+	bool Save()
+	{
+		LMutex::Auto Lck(this, _FL);
+		uint64 Start = LgiCurrentTime();
+		CacheWriter w;
+
+		// Write out only the live files, renumbering them on the way.
+		GArray<int> Remap;
+		Remap.Length(Files.Length());
+		uint32 Live = 0;
+		for (unsigned i=0; i<Files.Length(); i++)
+			Remap[i] = Files[i].Deleted ? -1 : Live++;
+
+		w.Bytes(FIDX_MAGIC, 8);
+		w.Int(Live);
+		for (unsigned i=0; i<Files.Length(); i++)
+		{
+			FindIndexFile &f = Files[i];
+			if (!f.Deleted)
+			{
+				w.Str(f.Path);
+				w.Int(f.Size);
+				w.Int(f.Modified);
+			}
+		}
+
+		size_t CountPos = w.Length();
+		uint32 Grams = 0;
+		w.Int(Grams);
+		for (auto p : Postings)
+		{
+			GArray<uint32> &a = *p.value;
+			uint32 Count = 0;
+			for (unsigned i=0; i<a.Length(); i++)
+				if (Remap[a[i]] >= 0)
+					Count++;
+			if (!Count)
+				continue;
+
+			w.Int(p.key);
+			w.Int(Count);
+			uint32 Prev = 0;
+			for (unsigned i=0; i<a.Length(); i++)
+			{
+				int Id = Remap[a[i]];
+				if (Id >= 0)
+				{
+					w.VarInt(Id - Prev);
+					Prev = Id;
+				}
+			}
+			Grams++;
+		}
+		memcpy(w.At(CountPos), &Grams, sizeof(Grams));
+
+		bool Status = w.Save(IndexPath);
+		if (!Status)
+			LgiTrace("%s:%i - Can't write '%s'.\n", _FL, IndexPath.Get());
+		Dirty = !Status;
+
+		#if DEBUG_FIND_INDEX
+		LgiTrace("%s:%i - Saved index: %i files, %i trigrams, %i KB in %i ms\n",
+			_FL, Live, Grams, (int)(w.Length() >> 10), (int)(LgiCurrentTime() - Start));
+		#endif
+		return Status;
+	}
+
+	/// Drop dead files from memory, renumbering the rest.
+	void Compact()
+	{
+		LMutex::Auto Lck(this, _FL);
+
+		GArray<int> Remap;
+		GArray<FindIndexFile> Live;
+		Remap.Length(Files.Length());
+		for (unsigned i=0; i<Files.Length(); i++)
+		{
+			if (Files[i].Deleted)
+				Remap[i] = -1;
+			else
+			{
+				Remap[i] = (int)Live.Length();
+				Live.New() = Files[i];
+				FileMap.Add(Files[i].Path, Remap[i]);
+			}
+		}
+
+		GArray<Trigram> Empty;
+		for (auto p : Postings)
+		{
+			GArray<uint32> &a = *p.value;
+			size_t Out = 0;
+			for (unsigned i=0; i<a.Length(); i++)
+			{
+				int Id = Remap[a[i]];
+				if (Id >= 0)
+					a[Out++] = Id;
+			}
+			a.Length(Out);
+			if (!Out)
+				Empty.Add(p.key);
+		}
+		for (unsigned i=0; i<Empty.Length(); i++)
+		{
+			delete Postings.Find(Empty[i]);
+			Postings.Delete(Empty[i]);
+		}
+
+		Files = Live;
+		DeadFiles = 0;
+	}
+
+	void RemoveFile(const char *Path)
+	{
+		LMutex::Auto Lck(this, _FL);
+		int Id = FileMap.Find((char*)Path);
+		if (Id >= 0)
+		{
+			Files[Id].Deleted = true;
+			DeadFiles++;
+			FileMap.Delete((char*)Path);
+			Dirty = true;
+		}
+	}
+
+	void RemoveAll()
+	{
+		LMutex::Auto Lck(this, _FL);
+		Files.Length(0);
+		FileMap.Empty();
+		Postings.DeleteObjects();
+		DeadFiles = 0;
+		Dirty = true;
+	}
+
+	bool IndexFile(GString Path)
+	{
+		int64 Size = 0;
+		uint64 Modified = 0;
+		if (!CacheStat(Path, Size, Modified))
+		{
+			RemoveFile(Path);
+			return false;
+		}
+
+		int Id = FileMap.Find(Path);
+		if (Id >= 0 &&
+			Files[Id].Size == Size &&
+			Files[Id].Modified == Modified)
+			return true; // Up to date.
+
+		GString Data;
+		if (Size <= FIDX_MAX_FILE_SIZE)
+		{
+			GFile f;
+			if (f.Open(Path, O_READ))
+				Data = f.Read();
+		}
+
+		const uchar *s = (const uchar*)Data.Get();
+		size_t Len = Data.Length();
+		if (Len < Size ||
+			(Len > 0 && memchr(s, 0, MIN(Len, FIDX_BINARY_CHECK))))
+		{
+			// Too big, unreadable or binary. Leave it out of the index so 
+			// that searches always look at it.
+			RemoveFile(Path);
+			return false;
+		}
+
+		// Collect the distinct trigrams in the file
+		if (!Seen.Length())
+			Seen.Length(FIDX_TRIGRAMS >> 3);
+		uint8 *Bits = Seen.AddressOf();
+		FileGrams.Length(0);
+		if (Len >= 3)
+		{
+			Trigram t = (FidxFold(s[0]) << 8) | FidxFold(s[1]);
+			for (size_t i=2; i<Len; i++)
+			{
+				t = ((t << 8) | FidxFold(s[i])) & (FIDX_TRIGRAMS - 1);
+				uint8 Bit = 1 << (t & 7);
+				if (!(Bits[t >> 3] & Bit))
+				{
+					Bits[t >> 3] |= Bit;
+					FileGrams.Add(t);
+				}
+			}
+		}
+		for (unsigned i=0; i<FileGrams.Length(); i++)
+			Bits[FileGrams[i] >> 3] = 0;
+
+		// Commit them to the index
+		LMutex::Auto Lck(this, _FL);
+		if (Id >= 0)
+		{
+			Files[Id].Deleted = true;
+			DeadFiles++;
+		}
+		
+		uint32 NewId = (uint32)Files.Length();
+		FindIndexFile &f = Files.New();
+		f.Path = Path;
+		f.Size = Size;
+		f.Modified = Modified;
+		f.Deleted = false;
+		FileMap.Add(Path, NewId);
+
+		for (unsigned i=0; i<FileGrams.Length(); i++)
+		{
+			GArray<uint32> *p = Postings.Find(FileGrams[i]);
+			if (!p)
+				Postings.Add(FileGrams[i], p = new GArray<uint32>);
+			p->Add(NewId);
+		}
+
+		Dirty = true;
+		Indexed++;
+		return true;
+	}
+
+	void OnPulse()
+	{
+		if (DeadFiles > 1024 &&
+			DeadFiles > Files.Length() / 2)
+			Compact();
+		if (Dirty)
+			Save();
+	}
+
+	bool Post(GAutoPtr<FindSymbolSystem::SymFileParams> &Params)
+	{
+		LMutex::Auto Lck(this, _FL);
+		bool Status = Params ?
+			PostObject(GetHandle(), M_FIND_INDEX_FILE, Params) :
+			PostEvent(M_FIND_INDEX_FILE);
+		if (Status)
+			Posted++;
+		return Status;
+	}
+
+	GMessage::Result OnEvent(GMessage *Msg)
+	{
+		switch (Msg->Msg())
+		{
+			case M_FIND_INDEX_FILE:
+			{
+				GAutoPtr<FindSymbolSystem::SymFileParams> Params((FindSymbolSystem::SymFileParams*)Msg->A());
+				if (!Loaded)
+					Load();
+				if (!Params)
+					break;
+
+				if (!WorkStart)
+				{
+					WorkStart = LgiCurrentTime();
+					Indexed = 0;
+				}
+
+				switch (Params->Action)
+				{
+					case FindSymbolSystem::FileAdd:
+					case FindSymbolSystem::FileReparse:
+						IndexFile(Params->File);
+						break;
+					case FindSymbolSystem::FileRemove:
+						RemoveFile(Params->File);
+						break;
+					case FindSymbolSystem::FileRemoveAll:
+						RemoveAll();
+						break;
+				}
+
+				if (GetQueueSize() == 0)
+				{
+					if (Indexed > 1)
+						Log("FindIndex: indexed %i files in %i ms (%i files, %i trigrams)\n",
+							Indexed,
+							(int)(LgiCurrentTime() - WorkStart),
+							(int)(Files.Length() - DeadFiles),
+							(int)Postings.Length());
+					WorkStart = 0;
+				}
+				break;
+			}
+			default:
+			{
+				LgiAssert(!"Implement handler for message.");
+				break;
+			}
+		}
+
+		if (Msg->Msg() == M_FIND_INDEX_FILE)
+		{
+			LMutex::Auto Lck(this, _FL);
+			Handled++;
+		}
+
+		return 0;
+	}
+};
+
+int FidxListCmp(GArray<uint32> **a, GArray<uint32> **b)
+{
+	return (int)(*a)->Length() - (int)(*b)->Length();
+}
+
+///////////////////////////////////////////////////////////////////////////
+FindIndex::FindIndex(int AppHnd, const char *IndexFile)
+{
+	d = new FindIndexPriv(AppHnd, IndexFile);
+	GAutoPtr<FindSymbolSystem::SymFileParams> Load;
+	d->Post(Load);
+}
+
+FindIndex::~FindIndex()
+{
+	delete d;
+}
+
+bool FindIndex::OnFile(const char *Path, FindSymbolSystem::SymAction Action)
+{
+	GAutoPtr<FindSymbolSystem::SymFileParams> Params(new FindSymbolSystem::SymFileParams);
+	Params->File = Path;
+	Params->Action = Action;
+	Params->Platforms = 0;
+	return d->Post(Params);
+}
+
+bool FindIndex::WaitIdle(int TimeoutMs)
+{
+	uint64 Start = LgiCurrentTime();
+	while (true)
+	{
+		{
+			LMutex::Auto Lck(d, _FL);
+			if (d->Handled >= d->Posted)
+				return true;
+		}
+		if (TimeoutMs >= 0 && LgiCurrentTime() - Start >= (uint64)TimeoutMs)
+			return false;
+		LgiSleep(1);
+	}
+}
+
+bool FindIndex::Save()
+{
+	return d->Save();
+}
+
+bool FindIndex::Filter(const char *Text, GArray<GString> &Files)
+{
+	size_t Len = Text ? strlen(Text) : 0;
+	if (Len < 3)
+		return false;
+
+	uint64 Start = LgiCurrentTime();
+	const uchar *s = (const uchar*)Text;
+	GArray<Trigram> Grams;
+	for (size_t i=2; i<Len; i++)
+		Grams.Add((FidxFold(s[i-2]) << 16) | (FidxFold(s[i-1]) << 8) | FidxFold(s[i]));
+
+	struct Unmatched
+	{
+		GString Path;
+		int64 Size;
+		uint64 Modified;
+	};
+	GArray<GString> Out;
+	GArray<Unmatched> Check;
+
+	{
+		LMutex::Auto Lck(d, _FL);
+		if (!Lck.GetLocked() || !d->Loaded)
+			return false;
+
+		// Intersect the posting lists, shortest first.
+		GArray<GArray<uint32>*> Lists;
+		for (unsigned i=0; i<Grams.Length(); i++)
+		{
+			GArray<uint32> *p = d->Postings.Find(Grams[i]);
+			if (!p)
+			{
+				// No indexed file has this trigram.
+				Lists.Length(0);
+				break;
+			}
+			if (!Lists.HasItem(p))
+				Lists.Add(p);
+		}
+		
+		GArray<bool> Match;
+		Match.Length(d->Files.Length());
+		if (Lists.Length())
+		{
+			Lists.Sort(FidxListCmp);
+
+			GArray<uint32> Cur = *Lists[0];
+			for (unsigned i=1; i<Lists.Length() && Cur.Length(); i++)
+			{
+				GArray<uint32> &b = *Lists[i];
+				size_t Out = 0, bi = 0;
+				for (size_t ai=0; ai<Cur.Length() && bi<b.Length(); )
+				{
+					if (Cur[ai] < b[bi])
+						ai++;
+					else if (Cur[ai] > b[bi])
+						bi++;
+					else
+					{
+						Cur[Out++] = Cur[ai++];
+						bi++;
+					}
+				}
+				Cur.Length(Out);
+			}
+
+			for (unsigned i=0; i<Cur.Length(); i++)
+				Match[Cur[i]] = true;
+		}
+
+		for (unsigned i=0; i<Files.Length(); i++)
+		{
+			int Id = d->FileMap.Find(Files[i]);
+			if (Id < 0 || Match[Id])
+				Out.New() = Files[i];
+			else
+			{
+				// The index says no, but only if the file hasn't changed
+				// since it was indexed.
+				Unmatched &u = Check.New();
+				u.Path = Files[i];
+				u.Size = d->Files[Id].Size;
+				u.Modified = d->Files[Id].Modified;
+			}
+		}
+	}
+
+	for (unsigned i=0; i<Check.Length(); i++)
+	{
+		Unmatched &u = Check[i];
+		int64 Size;
+		uint64 Modified;
+		if (CacheStat(u.Path, Size, Modified) &&
+			(Size != u.Size || Modified != u.Modified))
+			Out.New() = u.Path;
+	}
+
+	#if DEBUG_FIND_INDEX
+	LgiTrace("%s:%i - Index filtered %i files to %i in %i ms\n",
+		_FL, (int)Files.Length(), (int)Out.Length(), (int)(LgiCurrentTime() - Start));
+	#endif
+
+	Files = Out;
+	return true;
+}
@@ -0,0 +1,40 @@
+#ifndef _FIND_INDEX_H_
+#define _FIND_INDEX_H_
+
+#include "FindSymbol.h"
+
+/// An on disk trigram index of the solution's files. The index is built and
+/// kept up to date by a background thread as project files are added, removed
+/// or saved. FindInFilesThread uses it to skip files that can't contain the
+/// search text before running the exact matcher over the rest.
+class FindIndex
+{
+	struct FindIndexPriv *d;
+
+public:
+	/// 'IndexFile' is where the index is kept, by default FindIndex.bin in the
+	/// app's folder.
+	FindIndex(int AppHnd, const char *IndexFile = NULL);
+	~FindIndex();
+
+	/// Queue a file change for the index thread.
+	bool OnFile(const char *Path, FindSymbolSystem::SymAction Action);
+
+	/// Waits for the index thread to finish the queued changes.
+	/// \returns false if it's still busy after 'TimeoutMs'.
+	bool WaitIdle(int TimeoutMs = -1);
+
+	/// Writes the index to disk now rather than on the next save pulse.
+	bool Save();
+
+	/// Narrows 'Files' down to the ones that may contain 'Text'. Files the index
+	/// doesn't know about, or that have changed since they were indexed, are
+	/// always kept.
+	///
+	/// \returns false if the index can't help with this search (text shorter
+	/// than a trigram or the index isn't loaded yet), in which case 'Files' is
+	/// left alone.
+	bool Filter(const char *Text, GArray<GString> &Files);
+};
+
+#endif
@@ -10,6 +10,7 @@
 #include "GEventTargetThread.h"
 #include "GTextFile.h"
 #include "SimpleCppParser.h"
+#include "CacheIo.h"
 
 #if 1
 #include "GParseCpp.h"
@@ -20,7 +21,6 @@
 #define MSG_TIME_MS				1000
 
 #define DEBUG_FIND_SYMBOL		0
-#define DEBUG_NO_THREAD			1
 // #define DEBUG_FILE				"dante_config_common.h"
 
 int SYM_FILE_SENT = 0;
@@ -49,7 +49,65 @@ int ScoreCmp(FindSymResult **a, FindSymResult **b)
 	return (*b)->Score - (*a)->Score;
 }
 
-#define USE_HASH	1
+#define SYM_CACHE_FILE			"FindSymbol.cache"
+#define SYM_CACHE_MAGIC			"LgiSym01"
+#define SYM_SAVE_MS				(30 * 1000)
+#define SYM_MAX_PARSERS			8
+#define SYM_COMPACT_MIN			10000
+
+typedef uint32 SymTrigram;
+
+int SymListCmp(GArray<uint32> **a, GArray<uint32> **b)
+{
+	return (int)(*a)->Length() - (int)(*b)->Length();
+}
+
+static inline uchar SymFold(uchar c)
+{
+	return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+static inline SymTrigram SymGram(const char *s)
+{
+	return (SymFold(s[0]) << 16) | (SymFold(s[1]) << 8) | SymFold(s[2]);
+}
+
+/// Parsed definitions of a file, as saved in the symbol cache.
+struct SymCacheEntry
+{
+	int64 Size;
+	uint64 Modified;
+	uint32 Hash;
+	GString::Array Headers;
+	GArray<DefnInfo> Defs;
+};
+
+/// A file waiting to be parsed by one of the parser threads.
+struct SymParseJob
+{
+	GString Path;
+	uint32 Gen;
+	int64 Size;
+	uint64 Modified;
+	uint32 Hash;
+	GString::Array Headers;
+	GAutoWString Source;
+	GArray<DefnInfo> Defs;
+};
+
+class FindSymParser : public LThread
+{
+	struct FindSymbolSystemPriv *d;
+
+public:
+	FindSymParser(FindSymbolSystemPriv *priv) : LThread("FindSymParser")
+	{
+		d = priv;
+		Run();
+	}
+
+	int Main();
+};
 
 struct FindSymbolSystemPriv : public GEventTargetThread
 {
@@ -58,19 +116,24 @@ struct FindSymbolSystemPriv : public GEventTargetThread
 		GString Path;
 		int Platforms;
 		GString::Array *Inc;
-		GAutoWString Source;
 		GArray<DefnInfo> Defs;
 		bool IsSource;
 		bool IsHeader;
+		uint32 Gen;			// Matches the outstanding parse job
+		ssize_t FirstSym;	// Index of Defs[0] in 'Syms' or -1
 		
-		bool Parse()
+		FileSyms()
 		{
+			Platforms = 0;
+			Inc = NULL;
 			IsSource = false;
 			IsHeader = false;
-			Defs.Length(0);
-			
-			bool Status = false;
-			// GString Src = (wchar_t*)Source.Get();
+			Gen = 0;
+			FirstSym = -1;
+		}
+
+		bool SetType()
+		{
 			char *Ext = LgiGetExtension(Path);
 			if (Ext)
 			{
@@ -84,24 +147,41 @@ struct FindSymbolSystemPriv : public GEventTargetThread
 							!_stricmp(Ext, "hpp")
 							||
 							!_stricmp(Ext, "hxx");
-				if (IsSource || IsHeader)
-				{
-					Status = BuildDefnList(Path, Source, Defs, DefnNone);
-				}
 			}
 
-			return Status;
+			return IsSource || IsHeader;
 		}
 	};
 
+	/// Reference to one definition, the index into 'Syms' is it's id.
+	struct SymRef
+	{
+		FileSyms *File; // NULL once the file is removed or reparsed
+		uint32 Def;
+	};
+
 	int hApp;
 	GArray<GString::Array*> IncPaths;
-	
-	#if USE_HASH
 	LHashTbl<ConstStrKey<char,false>, FileSyms*> Files;
-	#else
-	GArray<FileSyms*> Files;
-	#endif	
+	
+	// Symbol name trigram index
+	GArray<SymRef> Syms;
+	LHashTbl<TrigramKey, GArray<uint32>*> SymGrams;
+	size_t DeadSyms;
+	uint32 NextGen;
+
+	// Cache of parsed files
+	GString CachePath;
+	LHashTbl<StrKey<char>, SymCacheEntry*> Cache;
+	bool CacheLoaded;
+	bool CacheDirty;
+
+	// Parser pool
+	LMutex JobLock;
+	GArray<SymParseJob*> Jobs;
+	LThreadEvent JobEvent;
+	GArray<FindSymParser*> Parsers;
+	bool ParserLoop;
 	
 	uint32 Tasks;
 	uint64 MsgTs;
@@ -109,15 +189,45 @@ struct FindSymbolSystemPriv : public GEventTargetThread
 	
 	FindSymbolSystemPriv(int appSinkHnd) :
 		hApp(appSinkHnd),
-		GEventTargetThread("FindSymbolSystemPriv")
+		GEventTargetThread("FindSymbolSystemPriv"),
+		JobLock("FindSymbolSystemPriv.Jobs")
 	{
 		Tasks = 0;
 		MsgTs = 0;
 		DoingProgress = false;
+		DeadSyms = 0;
+		NextGen = 0;
+		CacheLoaded = false;
+		CacheDirty = false;
+		ParserLoop = true;
+		SymGrams.SetMaxSize(0x7fffffff);
+
+		GFile::Path p(LSP_APP_ROOT);
+		p += SYM_CACHE_FILE;
+		CachePath = p.GetFull();
+
+		int Cpus = LgiApp ? LgiApp->GetCpuCount() : 1;
+		int Count = limit(Cpus - 1, 1, SYM_MAX_PARSERS);
+		for (int i=0; i<Count; i++)
+			Parsers.Add(new FindSymParser(this));
+
+		SetPulse(SYM_SAVE_MS);
 	}
 
 	~FindSymbolSystemPriv()
 	{
+		// Stop the parsers, dropping any files they haven't got to yet...
+		ParserLoop = false;
+		for (unsigned i=0; i<Parsers.Length(); i++)
+			JobEvent.Signal();
+		for (unsigned i=0; i<Parsers.Length(); i++)
+		{
+			while (!Parsers[i]->IsExited())
+				LgiSleep(1);
+		}
+		Parsers.DeleteObjects();
+		Jobs.DeleteObjects();
+
 		// Wait for the queue of messages to complete...
 		while (GetQueueSize())
 			LgiSleep(1);
@@ -125,8 +235,13 @@ struct FindSymbolSystemPriv : public GEventTargetThread
 		// End the thread...
 		EndThread();
 
+		if (CacheDirty)
+			SaveCache();
+
 		// Clean up mem
 		Files.DeleteObjects();
+		SymGrams.DeleteObjects();
+		Cache.DeleteObjects();
 	}
 
 	void Log(const char *Fmt, ...)
@@ -140,23 +255,208 @@ struct FindSymbolSystemPriv : public GEventTargetThread
 		if (s.Length())
 			GEventSinkMap::Dispatch.PostEvent(hApp, M_APPEND_TEXT, (GMessage::Param)NewStr(s), AppWnd::BuildTab);
 	}
-	
-	#if !USE_HASH
-	int GetFileIndex(GString &Path)
+
+	SymParseJob *NextJob()
 	{
-		for (unsigned i=0; i<Files.Length(); i++)
+		while (ParserLoop)
 		{
-			if (Path == Files[i]->Path)
-				return i;
+			if (JobLock.Lock(_FL))
+			{
+				SymParseJob *j = NULL;
+				if (Jobs.Length())
+				{
+					j = Jobs.Last();
+					Jobs.PopLast();
+				}
+				JobLock.Unlock();
+				if (j)
+					return j;
+			}
+			JobEvent.Wait(100);
 		}
-		return -1;
+		return NULL;
+	}
+
+	void AddJob(SymParseJob *j)
+	{
+		if (JobLock.Lock(_FL))
+		{
+			Jobs.Add(j);
+			JobLock.Unlock();
+			JobEvent.Signal();
+		}
+		else delete j;
+	}
+
+	bool LoadCache()
+	{
+		CacheLoaded = true;
+
+		GFile f;
+		if (!f.Open(CachePath, O_READ))
+			return false;
+		GString Data = f.Read();
+		f.Close();
+
+		CacheReader r(Data.Get(), Data.Length());
+		char Magic[8];
+		uint32 Count = 0;
+		if (!r.Bytes(Magic, sizeof(Magic)) ||
+			memcmp(Magic, SYM_CACHE_MAGIC, sizeof(Magic)) ||
+			!r.Int(Count))
+			return false;
+
+		for (uint32 i=0; r.Ok && i<Count; i++)
+		{
+			GString Path;
+			uint32 Headers = 0, Defs = 0;
+			GAutoPtr<SymCacheEntry> e(new SymCacheEntry);
+			if (!r.Str(Path) ||
+				!r.Int(e->Size) ||
+				!r.Int(e->Modified) ||
+				!r.Int(e->Hash) ||
+				!r.Int(Headers))
+				break;
+
+			e->Headers.SetFixedLength(false);
+			for (uint32 n=0; n<Headers && r.Ok; n++)
+				r.Str(e->Headers.New());
+
+			r.Int(Defs);
+			for (uint32 n=0; n<Defs && r.Ok; n++)
+			{
+				DefnInfo &Def = e->Defs.New();
+				uint32 Type = 0;
+				int32 Line = 0, FnStart = 0, FnLen = 0;
+				r.Int(Type);
+				r.Int(Line);
+				r.Int(FnStart);
+				r.Int(FnLen);
+				r.Str(Def.Name);
+				Def.Type = (DefnType)Type;
+				Def.File = Path;
+				Def.Line = Line;
+				Def.FnName.Start = FnStart;
+				Def.FnName.Len = FnLen;
+			}
+
+			if (r.Ok)
+				Cache.Add(Path, e.Release());
+		}
+
+		return r.Ok;
+	}
+
+	bool SaveCache()
+	{
+		CacheWriter w;
+		uint32 Count = 0;
+
+		w.Bytes(SYM_CACHE_MAGIC, 8);
+		w.Int(Count);
+		for (auto it : Cache)
+		{
+			// Only keep files that are still part of the solution.
+			SymCacheEntry *e = it.value;
+			if (!Files.Find(it.key))
+				continue;
+
+			w.Str(it.key);
+			w.Int(e->Size);
+			w.Int(e->Modified);
+			w.Int(e->Hash);
+			w.Int((uint32)e->Headers.Length());
+			for (unsigned i=0; i<e->Headers.Length(); i++)
+				w.Str(e->Headers[i]);
+			w.Int((uint32)e->Defs.Length());
+			for (unsigned i=0; i<e->Defs.Length(); i++)
+			{
+				DefnInfo &Def = e->Defs[i];
+				w.Int((uint32)Def.Type);
+				w.Int((int32)Def.Line);
+				w.Int((int32)Def.FnName.Start);
+				w.Int((int32)Def.FnName.Len);
+				w.Str(Def.Name);
+			}
+			Count++;
+		}
+		memcpy(w.At(8), &Count, sizeof(Count));
+
+		CacheDirty = !w.Save(CachePath);
+		return !CacheDirty;
+	}
+
+	/// The part of the definition that searches match against.
+	GString SearchName(DefnInfo &Def)
+	{
+		if (Def.Type == DefnFunc && Def.FnName.Len > 0)
+			return Def.Name(Def.FnName.Start, Def.FnName.End());
+		return Def.Name;
+	}
+
+	void IndexSyms(FileSyms *f)
+	{
+		f->FirstSym = Syms.Length();
+		GArray<SymTrigram> Grams;
+		for (unsigned i=0; i<f->Defs.Length(); i++)
+		{
+			uint32 Id = (uint32)Syms.Length();
+			SymRef &r = Syms.New();
+			r.File = f;
+			r.Def = i;
+
+			GString Name = SearchName(f->Defs[i]);
+			Grams.Length(0);
+			for (size_t n=2; n<Name.Length(); n++)
+			{
+				SymTrigram t = SymGram(Name.Get() + n - 2);
+				if (!Grams.HasItem(t))
+					Grams.Add(t);
+			}
+			for (unsigned n=0; n<Grams.Length(); n++)
+			{
+				GArray<uint32> *p = SymGrams.Find(Grams[n]);
+				if (!p)
+					SymGrams.Add(Grams[n], p = new GArray<uint32>);
+				p->Add(Id);
+			}
+		}
+	}
+
+	void UnindexSyms(FileSyms *f)
+	{
+		if (f->FirstSym < 0)
+			return;
+		for (unsigned i=0; i<f->Defs.Length(); i++)
+			Syms[f->FirstSym + i].File = NULL;
+		DeadSyms += f->Defs.Length();
+		f->FirstSym = -1;
+
+		if (DeadSyms > SYM_COMPACT_MIN &&
+			DeadSyms > Syms.Length() / 2)
+		{
+			// Rebuild the index from the live files
+			Syms.Length(0);
+			SymGrams.DeleteObjects();
+			DeadSyms = 0;
+			for (auto it : Files)
+			{
+				if (it.value->FirstSym >= 0)
+					IndexSyms(it.value);
+			}
+		}
+	}
+
+	void SetDefs(FileSyms *f, GArray<DefnInfo> &Defs)
+	{
+		UnindexSyms(f);
+		f->Defs = Defs;
+		IndexSyms(f);
 	}
-	#endif
 	
 	bool AddFile(GString Path, int Platforms)
 	{
 		// Already added?
-		#if USE_HASH
 		FileSyms *f = Files.Find(Path);
 		if (f)
 		{
@@ -164,24 +464,6 @@ struct FindSymbolSystemPriv : public GEventTargetThread
 				f->Platforms = Platforms;
 			return true;
 		}
-		#else
-		int Idx = GetFileIndex(Path);
-
-		#ifdef DEBUG_FILE
-		bool Debug = false;
-		if ((Debug = Path.Find(DEBUG_FILE) >= 0))
-			printf("%s:%i - AddFile(%s) = %i\n", _FL, Path.Get(), Idx);
-		#endif
-
-		if (Idx >= 0)
-		{
-			if (Platforms && Files[Idx]->Platforms == 0)
-				Files[Idx]->Platforms = Platforms;
-			return true;
-		}
-
-		FileSyms *f;
-		#endif
 
 		if (!FileExists(Path))
 			return false;
@@ -194,12 +476,23 @@ struct FindSymbolSystemPriv : public GEventTargetThread
 		f->Path = Path;
 		f->Platforms = Platforms;
 		f->Inc = IncPaths.Length() ? IncPaths.Last() : NULL;
+		f->SetType();
+		Files.Add(f->Path, f);
 
-		#if USE_HASH
-		Files.Add(Path, f);
-		#else
-		Files.Add(f);
-		#endif
+		// Is the cached copy still current?
+		int64 Size = 0;
+		uint64 Modified = 0;
+		CacheStat(Path, Size, Modified);
+		SymCacheEntry *e = Cache.Find(Path);
+		if (e &&
+			e->Size == Size &&
+			e->Modified == Modified)
+		{
+			for (unsigned i=0; i<e->Headers.Length(); i++)
+				AddFile(e->Headers[i], 0);
+			SetDefs(f, e->Defs);
+			return true;
+		}
 		
 		// Parse for headers...
 		GTextFile Tf;
@@ -211,37 +504,78 @@ struct FindSymbolSystemPriv : public GEventTargetThread
 		}
 
 		GAutoString Source = Tf.Read();
+		if (!Source)
+			return false;
+		
+		GAutoPtr<SymParseJob> Job(new SymParseJob);
+		Job->Path = Path;
+		Job->Size = Size;
+		Job->Modified = Modified;
+		Job->Hash = LHash<uint32,char>(Source, strlen(Source), true);
+		Job->Headers.SetFixedLength(false);
+
 		GArray<char*> Headers;
 		GArray<GString> EmptyInc;
 		if (BuildHeaderList(Source, Headers, f->Inc ? *f->Inc : EmptyInc, false))
 		{
 			for (unsigned i=0; i<Headers.Length(); i++)
 			{
+				Job->Headers.New() = Headers[i];
 				AddFile(Headers[i], 0);
 			}
 		}
 		Headers.DeleteArrays();
+
+		if (e &&
+			e->Size == Size &&
+			e->Hash == Job->Hash)
+		{
+			// Same contents, only the time stamp changed.
+			e->Modified = Modified;
+			CacheDirty = true;
+			SetDefs(f, e->Defs);
+			return true;
+		}
+
+		if (!f->IsSource && !f->IsHeader)
+			return false;
 		
-		// Parse for symbols...
-		f->Source.Reset(Utf8ToWide(Source));
+		// Parse for symbols on the parser threads...
+		f->Gen = Job->Gen = ++NextGen;
+		Job->Source.Reset(Utf8ToWide(Source));
 
 		#ifdef DEBUG_FILE
-		if (Debug)
-			printf("%s:%i - About to parse '%s' containing %i chars.\n", _FL, f->Path.Get(), StrlenW(f->Source));
+		if (Path.Find(DEBUG_FILE) >= 0)
+			printf("%s:%i - About to parse '%s' containing %i chars.\n", _FL, f->Path.Get(), StrlenW(Job->Source));
 		#endif
 
-		return f->Parse();
+		AddJob(Job.Release());
+		return true;
+	}
+
+	void OnParsed(SymParseJob *Job)
+	{
+		FileSyms *f = Files.Find(Job->Path);
+		if (!f || f->Gen != Job->Gen)
+			return; // Removed or reparsed since.
+
+		SetDefs(f, Job->Defs);
+
+		SymCacheEntry *e = Cache.Find(Job->Path);
+		if (!e)
+			Cache.Add(Job->Path, e = new SymCacheEntry);
+		e->Size = Job->Size;
+		e->Modified = Job->Modified;
+		e->Hash = Job->Hash;
+		e->Headers = Job->Headers;
+		e->Defs = Job->Defs;
+		CacheDirty = true;
 	}
 	
 	bool ReparseFile(GString Path)
 	{
-		#if USE_HASH
 		FileSyms *f = Files.Find(Path);
 		int Platform = f ? f->Platforms : 0;
-		#else
-		int Idx = GetFileIndex(Path);
-		int Platform = Idx >= 0 ? Files[Idx]->Platforms : 0;
-		#endif
 		
 		if (!RemoveFile(Path))
 			return false;
@@ -251,23 +585,130 @@ struct FindSymbolSystemPriv : public GEventTargetThread
 	
 	bool RemoveFile(GString Path)
 	{
-		#if USE_HASH
 		FileSyms *f = Files.Find(Path);
 		if (!f) return false;
+		UnindexSyms(f);
 		Files.Delete(Path);
 		delete f;
-		#else
-		int Idx = GetFileIndex(Path);
-		if (Idx < 0) return false;
-		delete Files[Idx];
-		Files.DeleteAt(Idx);
-		#endif
 
 		return true;
 	}
 
+	/// Finds the ids of the symbols that contain all the positive search terms
+	/// of at least a trigram in length.
+	///
+	/// \returns false if there are no such terms and all symbols have to be checked.
+	bool Candidates(GString::Array &Terms, GArray<uint32> &Out)
+	{
+		GArray<GArray<uint32>*> Lists;
+		bool HasTerm = false;
+		for (unsigned i=0; i<Terms.Length(); i++)
+		{
+			const char *t = Terms[i];
+			if (*t == '-' || Terms[i].Length() < 3)
+				continue;
+
+			HasTerm = true;
+			for (size_t n=2; t[n]; n++)
+			{
+				GArray<uint32> *p = SymGrams.Find(SymGram(t + n - 2));
+				if (!p)
+				{
+					// No symbol has this trigram
+					Out.Length(0);
+					return true;
+				}
+				if (!Lists.HasItem(p))
+					Lists.Add(p);
+			}
+		}
+		if (!HasTerm)
+			return false;
+
+		// Intersect shortest first
+		Lists.Sort(SymListCmp);
+		Out = *Lists[0];
+		for (unsigned i=1; i<Lists.Length() && Out.Length(); i++)
+		{
+			GArray<uint32> &b = *Lists[i];
+			size_t o = 0, bi = 0;
+			for (size_t ai=0; ai<Out.Length() && bi<b.Length(); )
+			{
+				if (Out[ai] < b[bi])
+					ai++;
+				else if (Out[ai] > b[bi])
+					bi++;
+				else
+				{
+					Out[o++] = Out[ai++];
+					bi++;
+				}
+			}
+			Out.Length(o);
+		}
+
+		return true;
+	}
+
+	struct SymMatches
+	{
+		GArray<FindSymResult*> Class, Hdr, Src;
+	};
+
+	void MatchDef(FileSyms *fs, DefnInfo &Def, GString::Array &p, SymMatches &m)
+	{
+		// For each search term...
+		int ScoreSum = 0;
+		for (unsigned n=0; n<p.Length(); n++)
+		{
+			const char *Part = p[n];
+			bool Not = *Part == '-';
+			if (Not)
+				Part++;
+
+			int Score = Def.Find(Part);
+			if
+			(
+				(Not && Score != 0)
+				||
+				(!Not && Score == 0)
+			)
+			{
+				return;
+			}
+
+			ScoreSum += Score;
+		}
+
+		// Create a result for this match...
+		FindSymResult *r = new FindSymResult();
+		if (r)
+		{
+			r->Score = ScoreSum;
+			r->File = Def.File.Get();
+			r->Symbol = Def.Name.Get();
+			r->Line = Def.Line;
+
+			if (Def.Type == DefnClass)
+				m.Class.Add(r);
+			else if (fs->IsHeader)
+				m.Hdr.Add(r);
+			else
+				m.Src.Add(r);
+		}
+	}
+
+	void OnPulse()
+	{
+		if (CacheDirty)
+			SaveCache();
+	}
+
 	GMessage::Result OnEvent(GMessage *Msg)
 	{
+		if (!CacheLoaded)
+			LoadCache();
+
 		switch (Msg->Msg())
 		{
 			case M_FIND_SYM_REQUEST:
@@ -280,28 +721,31 @@ struct FindSymbolSystemPriv : public GEventTargetThread
 					if (p.Length() == 0)
 						break;
 					
-					GArray<FindSymResult*> ClassMatches;
-					GArray<FindSymResult*> HdrMatches;
-					GArray<FindSymResult*> SrcMatches;
-
-					// For each file...
-					#if USE_HASH
-					for (auto it : Files)
+					#if DEBUG_FIND_SYMBOL
+					uint64 Start = LgiCurrentTime();
+					#endif
+					SymMatches m;
+					GArray<uint32> Ids;
+					if (Candidates(p, Ids))
 					{
-						FileSyms *fs = it.value;
-					#else
-					for (unsigned f=0; f<Files.Length(); f++)
+						// Only check the symbols the index says could match
+						for (unsigned i=0; i<Ids.Length(); i++)
+						{
+							SymRef &r = Syms[Ids[i]];
+							if (!r.File)
+								continue;
+							if (!AllPlatforms &&
+								(r.File->Platforms & PLATFORM_CURRENT) == 0)
+								continue;
+							MatchDef(r.File, r.File->Defs[r.Def], p, m);
+						}
+					}
+					else
 					{
-						FileSyms *fs = Files[f];
-					#endif
-						if (fs)
+						// For each file...
+						for (auto it : Files)
 						{
-							#ifdef DEBUG_FILE
-							bool Debug = false;
-							Debug = fs->Path.Find(DEBUG_FILE) >= 0;
-							if (Debug)
-								printf("%s:%i - Searching '%s' with %i syms...\n", _FL, fs->Path.Get(), fs->Defs.Length());
-							#endif
+							FileSyms *fs = it.value;
 
 							// Check platforms...
 							if (!AllPlatforms &&
@@ -310,72 +754,35 @@ struct FindSymbolSystemPriv : public GEventTargetThread
 
 							// For each symbol...
 							for (unsigned i=0; i<fs->Defs.Length(); i++)
-							{
-								DefnInfo &Def = fs->Defs[i];
-								
-								// For each search term...
-								bool Match = true;
-								int ScoreSum = 0;
-								for (unsigned n=0; n<p.Length(); n++)
-								{
-									const char *Part = p[n];
-									bool Not = *Part == '-';
-									if (Not)
-										Part++;
-
-									int Score = Def.Find(Part);
-									if
-									(
-										(Not && Score != 0)
-										||
-										(!Not && Score == 0)
-									)
-									{
-										Match = false;
-										break;
-									}
-
-									ScoreSum += Score;
-								}
-
-								#ifdef DEBUG_FILE
-								if (Debug)
-									printf("%s:%i - '%s' = %i\n", _FL, Def.Name.Get(), Match);
-								#endif
-								
-								if (Match)
-								{
-									// Create a result for this match...
-									FindSymResult *r = new FindSymResult();
-									if (r)
-									{
-										r->Score = ScoreSum;
-										r->File = Def.File.Get();
-										r->Symbol = Def.Name.Get();
-										r->Line = Def.Line;
-
-										if (Def.Type == DefnClass)
-											ClassMatches.Add(r);
-										else if (fs->IsHeader)
-											HdrMatches.Add(r);
-										else
-											SrcMatches.Add(r);
-									}
-								}
-							}
+								MatchDef(fs, fs->Defs[i], p, m);
 						}
 					}
 
-					ClassMatches.Sort(ScoreCmp);
-					Req->Results.Add(ClassMatches);
-					Req->Results.Add(HdrMatches);
-					Req->Results.Add(SrcMatches);
+					#if DEBUG_FIND_SYMBOL
+					LgiTrace("%s:%i - '%s' matched %i of %i candidates in %i ms\n",
+						_FL, Req->Str.Get(),
+						(int)(m.Class.Length() + m.Hdr.Length() + m.Src.Length()),
+						(int)Ids.Length(),
+						(int)(LgiCurrentTime() - Start));
+					#endif
+
+					m.Class.Sort(ScoreCmp);
+					Req->Results.Add(m.Class);
+					Req->Results.Add(m.Hdr);
+					Req->Results.Add(m.Src);
 					
 					int Hnd = Req->SinkHnd;
 					PostObject(Hnd, M_FIND_SYM_REQUEST, Req);
 				}
 				break;
 			}
+			case M_FIND_SYM_PARSED:
+			{
+				GAutoPtr<SymParseJob> Job((SymParseJob*)Msg->A());
+				if (Job)
+					OnParsed(Job);
+				break;
+			}
 			case M_FIND_SYM_FILE:
 			{
 				uint64 Now = LgiCurrentTime();
@@ -434,6 +841,19 @@ struct FindSymbolSystemPriv : public GEventTargetThread
 	}	
 };
 
+int FindSymParser::Main()
+{
+	SymParseJob *j;
+	while ((j = d->NextJob()))
+	{
+		BuildDefnList(j->Path, j->Source, j->Defs, DefnNone);
+		j->Source.Reset();
+		if (!d->PostEvent(M_FIND_SYM_PARSED, (GMessage::Param)j))
+			delete j;
+	}
+	return 0;
+}
+
 int AlphaCmp(LListItem *a, LListItem *b, NativeInt d)
 {
 	return stricmp(a->GetText(0), b->GetText(0));
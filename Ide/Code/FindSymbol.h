@@ -3,6 +3,14 @@
 
 #include "GEventTargetThread.h"
 
+/// Trigrams of text are clustered in a few bits of each byte, so mix them
+/// before they're used as a hash.
+class TrigramKey : public IntKey<uint32>
+{
+public:
+	uint32 Hash(uint32 k) { return k * 2654435761U; }
+};
+
 struct FindSymResult
 {
 	GString Symbol, File;
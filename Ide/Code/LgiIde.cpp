@@ -14,6 +14,7 @@
 #include "FtpThread.h"
 #include "GClipBoard.h"
 #include "FindSymbol.h"
+#include "FindIndex.h"
 #include "GBox.h"
 #include "GTextLog.h"
 #include "GEdit.h"
@@ -1012,6 +1013,7 @@ public:
 	GSubMenu *WindowsMenu;
 	GSubMenu *CreateMakefileMenu;
 	GAutoPtr<FindSymbolSystem> FindSym;
+	GAutoPtr<FindIndex> FindIdx;
 	GArray<GAutoString> SystemIncludePaths;
 	GArray<GDebugger::BreakPoint> BreakPoints;
 	
@@ -1056,6 +1058,7 @@ public:
 		Options(GOptionsFile::DesktopMode, AppName)
 	{
 		FindSym.Reset(new FindSymbolSystem(AppHnd));
+		FindIdx.Reset(new FindIndex(AppHnd));
 		HistoryLoc = 0;
 		InHistorySeek = false;
 		WindowsMenu = 0;
@@ -1082,6 +1085,7 @@ public:
 	{
 		FindSym.Reset();
 		Finder.Reset();
+		FindIdx.Reset();
 		Output->Save();
 		App->SerializeState(&Options, "WndPos", false);
 		SerializeStringList("RecentFiles", &RecentFiles, true);
@@ -2384,6 +2388,7 @@ bool AppWnd::OnNode(const char *Path, ProjectNode *Node, FindSymbolSystem::SymAc
 		return false;
 
 	d->FindSym->OnFile(Path, Action, Node->GetPlatforms());
+	d->FindIdx->OnFile(Path, Action);
 	return true;
 }
 
@@ -2922,7 +2927,7 @@ int AppWnd::OnCommand(int Cmd, int Event, OsView Wnd)
 		{
 			if (!d->Finder)
 			{
-				d->Finder.Reset(new FindInFilesThread(d->AppHnd));
+				d->Finder.Reset(new FindInFilesThread(d->AppHnd, d->FindIdx));
 			}
 			if (d->Finder)
 			{
@@ -3053,7 +3058,7 @@ int AppWnd::OnCommand(int Cmd, int Event, OsView Wnd)
 			GString Word(s, e - s);
 
 			if (!d->Finder)
-				d->Finder.Reset(new FindInFilesThread(d->AppHnd));
+				d->Finder.Reset(new FindInFilesThread(d->AppHnd, d->FindIdx));
 			if (!d->Finder)
 				break;
 
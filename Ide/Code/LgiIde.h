@@ -45,6 +45,15 @@ enum IdeMessages
 	/// Send a file to the worker thread...
 	/// GAutoPtr<GString::Array> Paths((GString::Array*)Msg->A());
 	M_FIND_SYM_INC_PATHS,
+
+	/// A parser thread finished a file...
+	/// GAutoPtr<SymParseJob> Job((SymParseJob*)Msg->A());
+	M_FIND_SYM_PARSED,
+
+	/// Adds, removes or re-indexes a file in FindIndex's trigram index. A NULL
+	/// parameter just loads the index from disk. The handler owns the params:
+	/// GAutoPtr<FindSymbolSystem::SymFileParams> Params((FindSymbolSystem::SymFileParams*)Msg->A());
+	M_FIND_INDEX_FILE,
 };
 
 #define ICON_PROJECT			0
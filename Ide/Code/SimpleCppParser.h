@@ -45,6 +45,7 @@ public:
 		Name = d.Name;
 		File = d.File;
 		Line = d.Line;
+		FnName = d.FnName;
 	}
 	
 	void Set(DefnType type, char *file, GString s, int line)
@@ -147,6 +147,77 @@ bool VcCommit::SvnParse(GString s)
 	return Author && Rev && Ts.IsValid();
 }
 
+static void CacheWriteInt(GArray<char> &Out, uint64 i)
+{
+	// Variable length, 7 bits per byte
+	do
+	{
+		char b = (char) (i & 0x7f);
+		i >>= 7;
+		if (i) b |= 0x80;
+		Out.Add(b);
+	}
+	while (i);
+}
+
+static bool CacheReadInt(const char *&Ptr, const char *End, uint64 &i)
+{
+	i = 0;
+	for (int Shift = 0; Ptr < End && Shift < 64; Shift += 7)
+	{
+		uint8 b = (uint8) *Ptr++;
+		i |= (uint64)(b & 0x7f) << Shift;
+		if (!(b & 0x80))
+			return true;
+	}
+	return false;
+}
+
+static void CacheWriteStr(GArray<char> &Out, GString &s)
+{
+	CacheWriteInt(Out, s.Length());
+	if (s.Length())
+		Out.Add(s.Get(), s.Length());
+}
+
+static bool CacheReadStr(const char *&Ptr, const char *End, GString &s)
+{
+	uint64 Len;
+	if (!CacheReadInt(Ptr, End, Len) ||
+		Len > (uint64)(End - Ptr))
+		return false;
+	s.Set(Ptr, (ssize_t)Len);
+	Ptr += Len;
+	return true;
+}
+
+void VcCommit::CacheWrite(GArray<char> &Out)
+{
+	uint64 t = 0;
+	Ts.Get(t);
+
+	CacheWriteStr(Out, Rev);
+	CacheWriteStr(Out, Author);
+	CacheWriteInt(Out, t);
+	CacheWriteInt(Out, (uint64)(Ts.GetTimeZone() + 24 * 60));
+	CacheWriteStr(Out, Msg);
+}
+
+bool VcCommit::CacheRead(const char *&Ptr, const char *End)
+{
+	uint64 t, Tz;
+	if (!CacheReadStr(Ptr, End, Rev) ||
+		!CacheReadStr(Ptr, End, Author) ||
+		!CacheReadInt(Ptr, End, t) ||
+		!CacheReadInt(Ptr, End, Tz) ||
+		!CacheReadStr(Ptr, End, Msg))
+		return false;
+
+	Ts.Set(t);
+	Ts.SetTimeZone((int)Tz - 24 * 60, false);
+	return Rev.Get() != NULL;
+}
+
 VcFolder *VcCommit::GetFolder()
 {
 	for (GTreeItem *i = d->Tree->Selection(); i;
@@ -31,6 +31,10 @@ public:
 	bool CvsParse(LDateTime &Dt, GString Auth, GString Msg);
 	VcFolder *GetFolder();
 
+	// Log cache
+	void CacheWrite(GArray<char> &Out);
+	bool CacheRead(const char *&Ptr, const char *End);
+
 	// Events
 	void OnMouseClick(GMouse &m);
 	void Select(bool b);
@@ -5,6 +5,8 @@
 #define CALL_MEMBER_FN(object,ptrToMember)  ((object).*(ptrToMember))
 #endif
 
+#define LOG_CACHE_MAGIC		"LvcLog01"
+
 ReaderThread::ReaderThread(GSubProcess *p, GStream *out) : LThread("ReaderThread")
 {
 	Process = p;
@@ -57,6 +59,94 @@ int ReaderThread::Main()
 	return (int) Process->GetExitValue();
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////////
+LogSplitter::LogSplitter(VersionCtrl Type) : Lock("LogSplitter")
+{
+	Records.SetFixedLength(false);
+	Skip = Scan = 0;
+
+	switch (Type)
+	{
+		case VcGit:
+			// Each record starts with the "commit <hash>" line
+			Delim = "\ncommit ";
+			Skip = 1;
+			break;
+		case VcSvn:
+			Delim = "------------------------------------------------------------------------";
+			Skip = Delim.Length();
+			break;
+		case VcHg:
+			Delim = "\n\n";
+			Skip = Delim.Length();
+			break;
+		default:
+			LgiAssert(!"Impl me.");
+			break;
+	}
+}
+
+void LogSplitter::Emit(const char *s, size_t len)
+{
+	if (len > 0)
+		Records.New().Set(s, len);
+}
+
+void LogSplitter::Write(const char *Ptr, ssize_t Size)
+{
+	if (!Delim || Size <= 0)
+		return;
+
+	LMutex::Auto Lck(&Lock, _FL);
+	Partial.Add((char*)Ptr, Size);
+
+	char *s = Partial.AddressOf();
+	size_t Len = Partial.Length(), DLen = Delim.Length(), Start = 0;
+	char *d = Delim.Get();
+
+	for (size_t i = Scan; i + DLen <= Len; )
+	{
+		char *m = (char*)memchr(s + i, *d, Len - DLen + 1 - i);
+		if (!m)
+			break;
+
+		i = m - s;
+		if (!memcmp(m, d, DLen))
+		{
+			Emit(s + Start, i - Start);
+			Start = i + Skip;
+			i += DLen;
+		}
+		else i++;
+	}
+
+	if (Start > 0)
+	{
+		memmove(s, s + Start, Len - Start);
+		Partial.Length(Len - Start);
+	}
+	Scan = Partial.Length() >= DLen ? Partial.Length() - DLen + 1 : 0;
+}
+
+void LogSplitter::Flush()
+{
+	LMutex::Auto Lck(&Lock, _FL);
+	Emit(Partial.AddressOf(), Partial.Length());
+	Partial.Length(0);
+	Scan = 0;
+}
+
+bool LogSplitter::Take(GString::Array &Out)
+{
+	LMutex::Auto Lck(&Lock, _FL);
+	if (Records.Length() == 0)
+		return false;
+
+	Out = Records;
+	Records.Length(0);
+	return true;
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////
 void VcFolder::Init(AppPriv *priv)
 {
@@ -70,14 +160,15 @@ void VcFolder::Init(AppPriv *priv)
 	IsWorkingFld = false;
 	CommitListDirty = false;
 	IsUpdatingCounts = false;
+	LogCacheLoaded = false;
 
 	Unpushed = Unpulled = -1;
 	Type = VcNone;
 	CmdErrors = 0;
+	LogMap.SetMaxSize(0x7fffffff); // Big repositories have 100k's of commits
 
 	Expanded(false);
-	Insert(Tmp = new GTreeItem);
-	Tmp->SetText("Loading...");
+	SetLazyChildren();
 
 	LgiAssert(d != NULL);
 }
@@ -180,8 +271,9 @@ const char *VcFolder::GetVcName()
 	return VcCmd;
 }
 
-bool VcFolder::StartCmd(const char *Args, ParseFn Parser, ParseParams *Params, bool LogCmd)
+bool VcFolder::StartCmd(const char *Args, ParseFn Parser, ParseParams *Params, bool LogCmd, LogSplitter *Split)
 {
+	GAutoPtr<LogSplitter> Splitter(Split);
 	const char *Exe = GetVcName();
 	if (!Exe)
 		return false;
@@ -203,6 +295,7 @@ bool VcFolder::StartCmd(const char *Args, ParseFn Parser, ParseParams *Params, b
 
 	c->PostOp = Parser;
 	c->Params.Reset(Params);
+	c->Split = Splitter;
 	c->Rd.Reset(new ReaderThread(Process.Release(), c));
 	Cmds.Add(c.Release());
 
@@ -288,6 +381,26 @@ void VcFolder::OnBranchesChange()
 	}
 }
 
+static bool CommitMatches(VcCommit *c, const char *Filter)
+{
+	if (!Filter)
+		return true;
+
+	const char *s = c->GetRev();
+	if (s && strstr(s, Filter) != NULL)
+		return true;
+
+	s = c->GetAuthor();
+	if (s && stristr(s, Filter) != NULL)
+		return true;
+	
+	s = c->GetMsg();
+	if (s && stristr(s, Filter) != NULL)
+		return true;
+
+	return false;
+}
+
 void VcFolder::Select(bool b)
 {
 	GTreeItem::Select(b);
@@ -300,7 +413,7 @@ void VcFolder::Select(bool b)
 		if ((Log.Length() == 0 || CommitListDirty) && !IsLogging)
 		{
 			CommitListDirty = false;
-			IsLogging = StartCmd("log", &VcFolder::ParseLog);
+			IsLogging = StartLog();
 		}
 
 		if (Branches.Length() == 0)
@@ -385,23 +498,7 @@ void VcFolder::Select(bool b)
 				}
 			}
 
-			bool Add = !Filter;
-			if (Filter)
-			{
-				const char *s = Log[i]->GetRev();
-				if (s && strstr(s, Filter) != NULL)
-					Add = true;
-
-				s = Log[i]->GetAuthor();
-				if (s && stristr(s, Filter) != NULL)
-					Add = true;
-				
-				s = Log[i]->GetMsg();
-				if (s && stristr(s, Filter) != NULL)
-					Add = true;
-				
-			}
-
+			bool Add = CommitMatches(Log[i], Filter);
 			LList *CurOwner = Log[i]->GetList();
 			if (Add ^ (CurOwner != NULL))
 			{
@@ -468,92 +565,245 @@ int CommitDateCmp(VcCommit **a, VcCommit **b)
 	return (diff > 0) ? 1 : 0;
 }
 
-bool VcFolder::ParseLog(int Result, GString s, ParseParams *Params)
+bool VcFolder::StartLog()
 {
-	GHashTbl<char*, VcCommit*> Map;
-	for (VcCommit **pc = NULL; Log.Iterate(pc); )
-		Map.Add((*pc)->GetRev(), *pc);
+	if (!LogCacheLoaded)
+	{
+		LogCacheLoaded = true;
+		LoadLogCache();
+	}
 
-	int Skipped = 0, Errors = 0;
-	switch (GetType())
+	if (LogHead && GetType() == VcGit)
 	{
-		case VcGit:
+		// The cached head has to still be in the history, a rebase or reset
+		// can drop it while it's still reachable by hash.
+		GString Args;
+		Args.Printf("merge-base --is-ancestor %s HEAD", LogHead.Get());
+		return StartCmd(Args, &VcFolder::ParseLogHead);
+	}
+
+	return StartLogCmd();
+}
+
+bool VcFolder::ParseLogHead(int Result, GString s, ParseParams *Params)
+{
+	if (Result)
+	{
+		LgiTrace("%s:%i - Cached log head '%s' isn't in the history, dropping the cache.\n", _FL, LogHead.Get());
+		DropLogCache();
+	}
+
+	IsLogging = StartLogCmd();
+	return false;
+}
+
+bool VcFolder::StartLogCmd()
+{
+	GString Args = "log";
+	if (LogHead)
+	{
+		// Only fetch the revisions newer than those in the cache
+		switch (GetType())
 		{
-			GString::Array c;
-			c.SetFixedLength(false);
-			char *prev = s.Get();
+			case VcGit:
+				Args.Printf("log %s..HEAD", LogHead.Get());
+				break;
+			case VcSvn:
+				Args.Printf("log -r HEAD:%s", LogHead.Get());
+				break;
+			case VcHg:
+				Args.Printf("log -r tip:%s", LogHead.Split(":").Last().Get());
+				break;
+			default:
+				break;
+		}
+	}
 
-			for (char *i = s.Get(); *i; )
-			{
-				if (!strnicmp(i, "commit ", 7))
-				{
-					if (i > prev)
-					{
-						c.New().Set(prev, i - prev);
-						// LgiTrace("commit=%i\n", (int)(i - prev));
-					}
-					prev = i;
-				}
+	LogSplitter *Split = GetType() != VcCvs ? new LogSplitter(GetType()) : NULL;
+	return StartCmd(Args, &VcFolder::ParseLog, LogHead ? new ParseParams(LogHead) : NULL, false, Split);
+}
 
-				while (*i)
-				{
-					if (*i++ == '\n')
-						break;
-				}
-			}
+GString VcFolder::LogCacheFile(bool Create)
+{
+	char Hex[16];
+	sprintf_s(Hex, sizeof(Hex), "%8.8x", LHash<uint32, char>(Path, Path.Length(), true));
 
-			for (unsigned i=0; i<c.Length(); i++)
-			{
-				GAutoPtr<VcCommit> Rev(new VcCommit(d));
-				if (Rev->GitParse(c[i]))
-				{
-					if (!Map.Find(Rev->GetRev()))
-						Log.Add(Rev.Release());
-					else
-						Skipped++;
-				}
-				else
-				{
-					LgiTrace("%s:%i - Failed:\n%s\n\n", _FL, c[i].Get());
-					Errors++;
-				}
-			}
-			Log.Sort(CommitDateCmp);
+	GFile::Path p(LSP_APP_ROOT);
+	p += "LogCache";
+	if (Create && !DirExists(p.GetFull()))
+		FileDev->CreateFolder(p.GetFull(), true);
+	GString Leaf;
+	Leaf.Printf("log-%s.cache", Hex);
+	p += Leaf;
+	return p.GetFull();
+}
+
+bool VcFolder::LoadLogCache()
+{
+	if (GetType() == VcCvs)
+		return false;
+
+	GFile f;
+	if (!f.Open(LogCacheFile(), O_READ))
+		return false;
+	GString Data = f.Read();
+	f.Close();
+
+	const char *Ptr = Data.Get(), *End = Ptr + Data.Length();
+	size_t MagicLen = strlen(LOG_CACHE_MAGIC);
+	if (Data.Length() < MagicLen + 1 ||
+		memcmp(Ptr, LOG_CACHE_MAGIC, MagicLen))
+		return false;
+	Ptr += MagicLen;
+	if (*Ptr++ != (char)GetType())
+		return false;
+
+	// The head revision follows the header
+	const char *Head = Ptr;
+	while (Ptr < End && *Ptr)
+		Ptr++;
+	if (Ptr++ >= End)
+		return false;
+	GString HeadRev(Head, Ptr - Head - 1);
+
+	while (Ptr < End)
+	{
+		GAutoPtr<VcCommit> c(new VcCommit(d));
+		if (!c->CacheRead(Ptr, End))
+		{
+			LgiTrace("%s:%i - Log cache '%s' is corrupt.\n", _FL, LogCacheFile().Get());
 			break;
 		}
-		case VcSvn:
+		if (!LogMap.Find(c->GetRev()))
 		{
-			GString::Array c = s.Split("------------------------------------------------------------------------");
-			for (unsigned i=0; i<c.Length(); i++)
-			{
-				GAutoPtr<VcCommit> Rev(new VcCommit(d));
-				GString Raw = c[i].Strip();
-				if (Rev->SvnParse(Raw))
-				{
-					if (!Map.Find(Rev->GetRev()))
-						Log.Add(Rev.Release());
-				}
-				else if (Raw)
-				{
-					LgiTrace("%s:%i - Failed:\n%s\n\n", _FL, Raw.Get());
-					Errors++;
-				}
-			}
-			Log.Sort(CommitRevCmp);
-			break;
+			LogMap.Add(c->GetRev(), c);
+			Log.Add(c.Release());
 		}
+	}
+
+	LogHead = HeadRev;
+	return true;
+}
+
+bool VcFolder::SaveLogCache()
+{
+	if (GetType() == VcCvs || !LogHead)
+		return false;
+
+	GArray<char> Out;
+	Out.Add((char*)LOG_CACHE_MAGIC, strlen(LOG_CACHE_MAGIC));
+	Out.Add((char)GetType());
+	Out.Add(LogHead.Get(), LogHead.Length() + 1);
+	for (unsigned i=0; i<Log.Length(); i++)
+		Log[i]->CacheWrite(Out);
+
+	GFile f;
+	GString File = LogCacheFile(true);
+	if (!f.Open(File, O_WRITE))
+		return false;
+	f.SetSize(0);
+	return f.Write(Out.AddressOf(), Out.Length()) == (ssize_t)Out.Length();
+}
+
+void VcFolder::DropLogCache()
+{
+	LogMap.Empty();
+	Log.DeleteObjects();
+	LogHead.Empty();
+	NewLogHead.Empty();
+
+	GString File = LogCacheFile();
+	if (FileExists(File))
+		FileDev->Delete(File, false);
+}
+
+void VcFolder::ParseLogRecords(GString::Array &Records)
+{
+	GString Filter;
+	if (d->CurFolder == this)
+	{
+		char *Ctrl = d->Lst->GetWindow()->GetCtrlName(IDC_FILTER);
+		if (ValidStr(Ctrl))
+			Filter = Ctrl;
+	}
+
+	List<LListItem> Ls;
+	for (unsigned i=0; i<Records.Length(); i++)
+	{
+		GString Raw = Records[i].Strip();
+		if (!Raw)
+			continue;
+
+		GAutoPtr<VcCommit> Rev(new VcCommit(d));
+		bool Ok = false;
+		switch (GetType())
+		{
+			case VcGit:
+				Ok = Rev->GitParse(Raw);
+				break;
+			case VcSvn:
+				Ok = Rev->SvnParse(Raw);
+				break;
+			case VcHg:
+				Ok = Rev->HgParse(Raw);
+				break;
+			default:
+				LgiAssert(!"Impl me.");
+				break;
+		}
+		if (!Ok)
+		{
+			LgiTrace("%s:%i - Failed:\n%s\n\n", _FL, Raw.Get());
+			continue;
+		}
+
+		// The log is output newest first
+		if (!NewLogHead)
+			NewLogHead = Rev->GetRev();
+		if (LogMap.Find(Rev->GetRev()))
+			continue;
+
+		VcCommit *c = Rev.Release();
+		Log.Add(c);
+		LogMap.Add(c->GetRev(), c);
+		if (d->CurFolder == this && CommitMatches(c, Filter))
+			Ls.Insert(c);
+	}
+
+	// Show the commits as they arrive, ParseLog sorts the list at the end
+	if (Ls.Length())
+		d->Lst->Insert(Ls);
+}
+
+bool VcFolder::ParseLog(int Result, GString s, ParseParams *Params)
+{
+	switch (GetType())
+	{
+		case VcGit:
+		case VcSvn:
 		case VcHg:
 		{
-			GString::Array c = s.Split("\n\n");
-			for (GString *Commit = NULL; c.Iterate(Commit); )
+			// The commits were parsed by ParseLogRecords as the output arrived.
+			if (Result && Params && Params->Str)
 			{
-				GAutoPtr<VcCommit> Rev(new VcCommit(d));
-				if (Rev->HgParse(*Commit))
-				{
-					if (!Map.Find(Rev->GetRev()))
-						Log.Add(Rev.Release());
-				}
+				// Fetching just the new revisions failed, the cached head
+				// may have been rewritten. Fall back to the full log.
+				DropLogCache();
+				IsLogging = StartLog();
+				return false;
 			}
+
+			if (GetType() == VcGit)
+				Log.Sort(CommitDateCmp);
+			else if (GetType() == VcSvn)
+				Log.Sort(CommitRevCmp);
+
+			if (!Result && NewLogHead && !NewLogHead.Equals(LogHead))
+			{
+				LogHead = NewLogHead;
+				SaveLogCache();
+			}
+			NewLogHead.Empty();
 			break;
 		}
 		case VcCvs:
@@ -636,7 +886,6 @@ bool VcFolder::ParseLog(int Result, GString s, ParseParams *Params)
 			break;
 	}
 
-	// LgiTrace("%s:%i - ParseLog: Skip=%i, Error=%i\n", _FL, Skipped, Errors);
 	IsLogging = false;
 
 	return true;
@@ -951,7 +1200,21 @@ void VcFolder::OnPulse()
 	for (unsigned i=0; i<Cmds.Length(); i++)
 	{
 		Cmd *c = Cmds[i];
-		if (c && c->Rd->IsExited())
+		if (!c)
+			continue;
+
+		bool Exited = c->Rd->IsExited();
+		if (c->Split)
+		{
+			// Parse whatever complete commits have arrived so far
+			GString::Array Records;
+			if (Exited)
+				c->Split->Flush();
+			if (c->Split->Take(Records))
+				ParseLogRecords(Records);
+		}
+
+		if (Exited)
 		{
 			GString s = c->Buf.NewGStr();
 			int Result = c->Rd->ExitCode();
@@ -1084,14 +1347,9 @@ void VcFolder::ReadDir(GTreeItem *Parent, const char *Path)
 	Parent->SortChildren(FolderCompare);
 }
 
-void VcFolder::OnExpand(bool b)
+void VcFolder::OnPopulate()
 {
-	if (Tmp && b)
-	{
-		Tmp->Remove();
-		DeleteObj(Tmp);
-		ReadDir(this, Path);
-	}
+	ReadDir(this, Path);
 }
 
 void VcFolder::OnPaint(ItemPaintCtx &Ctx)
@@ -1704,14 +1962,10 @@ VcLeaf::VcLeaf(VcFolder *parent, GTreeItem *Item, GString path, GString leaf, bo
 	Path = path;
 	Leaf = leaf;
 	Folder = folder;
-	Tmp = NULL;
 	Item->Insert(this);
 
 	if (Folder)
-	{
-		Insert(Tmp = new GTreeItem);
-		Tmp->SetText("Loading...");
-	}
+		SetLazyChildren();
 }
 
 GString VcLeaf::Full()
@@ -1747,17 +2001,11 @@ void VcLeaf::AfterBrowse()
 	Files->ResizeColumnsToContent();
 }
 
-void VcLeaf::OnExpand(bool b)
+void VcLeaf::OnPopulate()
 {
-	if (Tmp && b)
-	{
-		Tmp->Remove();
-		DeleteObj(Tmp);
-			
-		GFile::Path p(Path);
-		p += Leaf;
-		Parent->ReadDir(this, p);
-	}
+	GFile::Path p(Path);
+	p += Leaf;
+	Parent->ReadDir(this, p);
 }
 
 char *VcLeaf::GetText(int Col)
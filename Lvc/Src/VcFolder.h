@@ -23,6 +23,31 @@ public:
 	int Main();
 };
 
+/// Splits the output of a 'log' command into separate commit records as it
+/// arrives from the ReaderThread, so they can be parsed and listed before
+/// the command finishes.
+class LogSplitter
+{
+	LMutex Lock;
+	GArray<char> Partial;
+	GString::Array Records;
+	GString Delim;
+	size_t Skip;	// Offset into the delimiter where the next record starts
+	size_t Scan;	// Where to resume searching 'Partial'
+
+	void Emit(const char *s, size_t len);
+
+public:
+	LogSplitter(VersionCtrl Type);
+
+	// Called by the reader thread
+	void Write(const char *Ptr, ssize_t Size);
+	void Flush();
+
+	// Called by the GUI thread
+	bool Take(GString::Array &Out);
+};
+
 class VcFolder : public GTreeItem
 {
 	struct ParseParams
@@ -46,6 +71,7 @@ class VcFolder : public GTreeItem
 	{
 		GStringPipe Buf;
 		GStream *Log;
+		GAutoPtr<LogSplitter> Split;
 		GAutoPtr<LThread> Rd;
 		ParseFn PostOp;
 		GAutoPtr<ParseParams> Params;
@@ -59,7 +85,11 @@ class VcFolder : public GTreeItem
 
 		ssize_t Write(const void *Ptr, ssize_t Size, int Flags = 0)
 		{
-			ssize_t Wr = Buf.Write(Ptr, Size, Flags);
+			ssize_t Wr = Size;
+			if (Split && !Flags)
+				Split->Write((const char*)Ptr, Size);
+			else
+				Wr = Buf.Write(Ptr, Size, Flags);
 			if (Log) Log->Write(Ptr, Size, Flags);
 			if (Flags) Err = (LvcError) Flags;
 			return Wr;
@@ -84,6 +114,9 @@ class VcFolder : public GTreeItem
 	VersionCtrl Type;
 	GString Path, CurrentCommit, RepoUrl, VcCmd;
 	GArray<VcCommit*> Log;
+	LHashTbl<ConstStrKey<char>, VcCommit*> LogMap;
+	GString LogHead, NewLogHead;
+	bool LogCacheLoaded;
 	GString CurrentBranch;
 	GString::Array Branches;
 	GAutoPtr<UncommitedItem> Uncommit;
@@ -91,7 +124,6 @@ class VcFolder : public GTreeItem
 	bool CommitListDirty;
 	int Unpushed, Unpulled;
 	GString CountCache;
-	GTreeItem *Tmp;
 	int CmdErrors;
 	
 	GArray<Cmd*> Cmds;
@@ -99,12 +131,20 @@ class VcFolder : public GTreeItem
 
 	void Init(AppPriv *priv);
 	const char *GetVcName();
-	bool StartCmd(const char *Args, ParseFn Parser, ParseParams *Params = NULL, bool LogCmd = false);
+	bool StartCmd(const char *Args, ParseFn Parser, ParseParams *Params = NULL, bool LogCmd = false, LogSplitter *Split = NULL);
+	bool StartLog();
+	bool StartLogCmd();
+	GString LogCacheFile(bool Create = false);
+	bool LoadLogCache();
+	bool SaveLogCache();
+	void DropLogCache();
+	void ParseLogRecords(GString::Array &Records);
 	void OnBranchesChange();
 	void OnCmdError();
 
 	bool ParseDiffs(GString s, GString Rev, bool IsWorking);
 	bool ParseLog(int Result, GString s, ParseParams *Params);
+	bool ParseLogHead(int Result, GString s, ParseParams *Params);
 	bool ParseInfo(int Result, GString s, ParseParams *Params);
 	bool ParseFiles(int Result, GString s, ParseParams *Params);
 	bool ParseWorking(int Result, GString s, ParseParams *Params);
@@ -148,7 +188,7 @@ public:
 	void OnUpdate(const char *Rev);
 	void OnMouseClick(GMouse &m);
 	void OnRemove();
-	void OnExpand(bool b);
+	void OnPopulate();
 	void OnPaint(ItemPaintCtx &Ctx);
 };
 
@@ -158,7 +198,6 @@ class VcLeaf : public GTreeItem
 	VcFolder *Parent;
 	bool Folder;
 	GString Path, Leaf;
-	GTreeItem *Tmp;
 
 public:
 	VcLeaf(VcFolder *parent, GTreeItem *Item, GString path, GString leaf, bool folder);
@@ -166,7 +205,7 @@ public:
 	GString Full();
 	void OnBrowse();
 	void AfterBrowse();
-	void OnExpand(bool b);
+	void OnPopulate();
 	char *GetText(int Col);
 	int GetImage(int Flags);
 	int Compare(VcLeaf *b);
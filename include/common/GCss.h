@@ -686,11 +686,13 @@ public:
 			GAutoString Value;
 			GAutoString Param;
 			int Media;
+			uint32 Hash; // Store::AtomHash of type, class and id values
 			
 			Part()
 			{
 				Type = SelNull;
 				Media = MediaNull;
+				Hash = 0;
 			}
 			
 			bool IsSel()
@@ -710,6 +712,7 @@ public:
 				Type = s.Type;
 				Value.Reset(NewStr(s.Value));
 				Param.Reset(NewStr(s.Param));
+				Hash = s.Hash;
 				return *this;
 			}
 		};
@@ -717,6 +720,12 @@ public:
 		GArray<Part> Parts;
 		GArray<ssize_t> Combs;
 		char *Style;
+		/// The parsed form of 'Style', owned by the Store. NULL if the
+		/// declarations have to be parsed onto each element's style.
+		GCss *Decl;
+		/// Hashes of the types, classes and ids that the element's
+		/// ancestors must have for the selector to match.
+		GArray<uint32> AncestorAtoms;
 		int SourceIndex;
 		GAutoString Raw;
 		GAutoPtr<class Store> Children;
@@ -724,6 +733,7 @@ public:
 		Selector()
 		{
 			Style = NULL;
+			Decl = NULL;
 			SourceIndex = 0;
 		}
 		bool TokString(GAutoString &a, const char *&s);
@@ -786,6 +796,101 @@ public:
 	/// This class parses and stores the CSS selectors and styles.
 	class LgiClass Store
 	{
+	public:
+		/// Case insensitive hash of a type ('t'), class ('.') or id ('#') name.
+		static uint32 AtomHash(char Kind, const char *s)
+		{
+			uint32 h = 2166136261U ^ (uint8)Kind;
+			h *= 16777619U;
+			for (; s && *s; s++)
+			{
+				h ^= (uint8)ToLower(*s);
+				h *= 16777619U;
+			}
+			return h;
+		}
+
+		/// The names of an element, fetched once per match.
+		struct ElementInfo
+		{
+			const char *Element;
+			uint32 ElementHash;
+			GString Id;
+			uint32 IdHash;
+			GString::Array Classes;
+			GArray<uint32> ClassHashes;
+
+			template<typename T>
+			void Get(ElementCallback<T> *Context, T *Obj)
+			{
+				Element = Context->GetElement(Obj);
+				ElementHash = AtomHash('t', Element);
+				Id = Context->GetAttr(Obj, "id");
+				IdHash = AtomHash('#', Id);
+				if (Context->GetClasses(Classes, Obj))
+				{
+					for (unsigned i=0; i<Classes.Length(); i++)
+						ClassHashes.Add(AtomHash('.', Classes[i]));
+				}
+			}
+		};
+
+		/// A Bloom filter of the types, classes and ids of an element's
+		/// ancestors. Selectors needing an ancestor that isn't in the filter
+		/// are skipped without walking up the tree. When styling a whole
+		/// tree pass each child the parent's filter plus the parent.
+		struct AtomFilter
+		{
+			uint32 Bits[8];
+
+			AtomFilter()
+			{
+				ZeroObj(Bits);
+			}
+
+			void Add(uint32 h)
+			{
+				Bits[(h >> 5) & 7] |= 1 << (h & 31);
+				Bits[(h >> 13) & 7] |= 1 << ((h >> 8) & 31);
+			}
+
+			bool MayHave(uint32 h)
+			{
+				return	(Bits[(h >> 5) & 7] & (1 << (h & 31))) &&
+						(Bits[(h >> 13) & 7] & (1 << ((h >> 8) & 31)));
+			}
+
+			bool MayMatch(GCss::Selector *Sel)
+			{
+				for (unsigned i=0; i<Sel->AncestorAtoms.Length(); i++)
+				{
+					if (!MayHave(Sel->AncestorAtoms[i]))
+						return false;
+				}
+				return true;
+			}
+
+			template<typename T>
+			void AddElement(ElementCallback<T> *Context, T *Obj)
+			{
+				ElementInfo i;
+				i.Get(Context, Obj);
+				if (i.Element)
+					Add(i.ElementHash);
+				if (i.Id)
+					Add(i.IdHash);
+				for (unsigned n=0; n<i.ClassHashes.Length(); n++)
+					Add(i.ClassHashes[n]);
+			}
+
+			template<typename T>
+			void AddAncestors(ElementCallback<T> *Context, T *Obj)
+			{
+				for (T *p = Context->GetParent(Obj); p; p = Context->GetParent(p))
+					AddElement(Context, p);
+			}
+		};
+
 	protected:
 		/// This code matches a simple part of a selector, i.e. no combinatorial operators involved.
 		template<typename T>
@@ -798,10 +903,18 @@ public:
 			/// Our context callback to get properties of the object
 			ElementCallback<T> *Context,
 			/// The object to match
-			T *Obj
+			T *Obj,
+			/// The names of 'Obj' if already known
+			ElementInfo *Info = NULL
 		)
 		{
-			const char *Element = Context->GetElement(Obj);
+			ElementInfo Local;
+			if (!Info)
+			{
+				Local.Get(Context, Obj);
+				Info = &Local;
+			}
+			const char *Element = Info->Element;
 			
 			for (ssize_t n = PartIdx; n<Sel->Parts.Length(); n++)
 			{
@@ -810,8 +923,9 @@ public:
 				{
 					case GCss::Selector::SelType:
 					{
-						const char *Tag = Context->GetElement(Obj);
-						if (!Tag || _stricmp(Tag, p.Value))
+						if (!Element ||
+							Info->ElementHash != p.Hash ||
+							_stricmp(Element, p.Value))
 							return false;
 						break;
 					}
@@ -842,17 +956,11 @@ public:
 					case GCss::Selector::SelClass:
 					{
 						// Check the class matches
-						GString::Array Class;
-						if (!Context->GetClasses(Class, Obj))
-							return false;
-
-						if (Class.Length() == 0)
-							return false;
-
 						bool Match = false;
-						for (unsigned i=0; i<Class.Length(); i++)
+						for (unsigned i=0; i<Info->Classes.Length(); i++)
 						{
-							if (!_stricmp(Class[i], p.Value))
+							if (Info->ClassHashes[i] == p.Hash &&
+								!_stricmp(Info->Classes[i], p.Value))
 							{
 								Match = true;
 								break;
@@ -875,8 +983,9 @@ public:
 					}
 					case GCss::Selector::SelID:
 					{
-						const char *Id = Context->GetAttr(Obj, "id");
-						if (!Id || _stricmp(Id, p.Value))
+						if (!Info->Id ||
+							Info->IdHash != p.Hash ||
+							_stricmp(Info->Id, p.Value))
 							return false;
 						break;
 					}
@@ -919,13 +1028,13 @@ public:
 		
 		/// This code matches a all the parts of a selector.
 		template<typename T>
-		bool MatchFullSelector(GCss::Selector *Sel, ElementCallback<T> *Context, T *Obj)
+		bool MatchFullSelector(GCss::Selector *Sel, ElementCallback<T> *Context, T *Obj, ElementInfo *Info = NULL)
 		{
 			bool Complex = Sel->Combs.Length() > 0;
 			ssize_t CombIdx = Complex ? (ssize_t)Sel->Combs.Length() - 1 : 0;
 			ssize_t StartIdx = (Complex) ? Sel->Combs[CombIdx] + 1 : 0;
 			
-			bool Match = MatchSimpleSelector(Sel, StartIdx, Context, Obj);
+			bool Match = MatchSimpleSelector(Sel, StartIdx, Context, Obj, Info);
 			if (!Match)
 				return false;
 
@@ -992,6 +1101,8 @@ public:
 		// This stores the unparsed style strings. More than one selector
 		// may reference this memory.
 		GArray<char*> Styles;
+		// And the parsed declarations, see Selector::Decl
+		GArray<GCss*> Decls;
 		
 		// Sort the styles into less specific to more specific order
 		void SortStyles(GCss::SelArray &Styles);
@@ -1016,6 +1127,7 @@ public:
 			Error.Empty();
 
 			Styles.DeleteArrays();
+			Decls.DeleteObjects();
 		}
 
 		/// Parse general CSS into selectors.		
@@ -1024,52 +1136,76 @@ public:
 		/// Converts store back into string form
 		bool ToString(GStream &p);
 
+		/// Applies the declarations of a matching selector to 'Css'.
+		void Apply(GCss &Css, GCss::Selector *Sel);
+
 		/// Use to finding matching selectors for an element.
 		template<typename T>
-		bool Match(GCss::SelArray &Styles, ElementCallback<T> *Context, T *Obj)
+		bool Match
+		(
+			/// The matching selectors are added to this
+			GCss::SelArray &Styles,
+			/// Callbacks to get the properties of the element
+			ElementCallback<T> *Context,
+			/// The element
+			T *Obj,
+			/// Optional filter of the element's ancestors, see AtomFilter
+			AtomFilter *Ancestors = NULL
+		)
 		{
 			SelArray *s;
 
 			if (!Context || !Obj)
 				return false;
 			
-			// An array of potential selector matches...
+			ElementInfo Info;
+			Info.Get(Context, Obj);
+
+			// An array of potential selector matches. Each selector is
+			// only in one map, so there is no need to check for duplicates.
 			GArray<SelArray*> Maps;
 
 			// Check element type
-			const char *Type = Context->GetElement(Obj);
-			if (Type && (s = TypeMap.Find(Type)))
+			if (Info.Element && (s = TypeMap.Find(Info.Element)))
 				Maps.Add(s);
 			
 			// Check the ID
-			const char *Id = Context->GetAttr(Obj, "id");
-			if (Id && (s = IdMap.Find(Id)))
+			if (Info.Id && (s = IdMap.Find(Info.Id)))
 				Maps.Add(s);
 			
 			// Check all the classes
-			GString::Array Classes;
-			if (Context->GetClasses(Classes, Obj))
+			for (unsigned i=0; i<Info.Classes.Length(); i++)
 			{
-				for (unsigned i=0; i<Classes.Length(); i++)
-				{
-					if ((s = ClassMap.Find(Classes[i])))
-						Maps.Add(s);
-				}
+				if ((s = ClassMap.Find(Info.Classes[i])) && !Maps.HasItem(s))
+					Maps.Add(s);
 			}
 			
 			// Add in any other ones
 			Maps.Add(&Other);
 
 			// Now from the list of possibles, do the actual checking of selectors...
+			AtomFilter Local;
+			size_t Existing = Styles.Length();
 			for (unsigned i=0; i<Maps.Length(); i++)
 			{
 				GCss::SelArray *s = Maps[i];
 				for (unsigned i=0; i<s->Length(); i++)
 				{
 					GCss::Selector *Sel = (*s)[i];
+
+					if (Sel->AncestorAtoms.Length())
+					{
+						if (!Ancestors)
+						{
+							Local.AddAncestors(Context, Obj);
+							Ancestors = &Local;
+						}
+						if (!Ancestors->MayMatch(Sel))
+							continue;
+					}
 					
-					if (!Styles.HasItem(Sel) &&
-						MatchFullSelector(Sel, Context, Obj))
+					if ((!Existing || !Styles.HasItem(Sel)) &&
+						MatchFullSelector(Sel, Context, Obj, &Info))
 					{
 						// Output the matching selector
 						Styles.Add(Sel);
@@ -1087,15 +1223,30 @@ public:
 		bool Dump(GStream &out);
 	};
 
+	/// Keeps one copy of each distinct style so that objects with the same
+	/// properties can share their values instead of each having a copy.
+	class LgiClass StylePool
+	{
+		LHashTbl<IntKey<uint32>, GCss*> Styles;
+
+	public:
+		~StylePool() { Empty(); }
+		void Empty() { Styles.DeleteObjects(); }
+
+		/// Makes 'c' share the values of an identical style seen before.
+		/// \returns true if 'c' now shares its values.
+		bool Share(GCss &c);
+	};
+
 	//////////////////////////////////////////////////////////////////////////////////////////////////////////
 	GCss();
 	GCss(const GCss &c);
 	virtual ~GCss();
 
 	#define Accessor(PropName, Type, Default, BaseProp) \
-		Type PropName() { Type *Member = (Type*)Props.Find(Prop##PropName); \
+		Type PropName() { Type *Member = (Type*)Props.Get(Prop##PropName); \
 							if (Member) return *Member; \
-							else if ((Member = (Type*)Props.Find(BaseProp))) return *Member; \
+							else if ((Member = (Type*)Props.Get(BaseProp))) return *Member; \
 							return Default; } \
 		void PropName(Type t) { Type *Member = (Type*)Props.Find(Prop##PropName); \
 								if (Member) *Member = t; \
@@ -1178,10 +1329,10 @@ public:
 	bool CopyStyle(const GCss &c);
 	bool operator ==(GCss &c);
 	bool operator !=(GCss &c) { return !(*this == c); }
-	GCss &operator =(const GCss &c) { Empty(); CopyStyle(c); return *this; }
+	GCss &operator =(const GCss &c) { Props = c.Props; return *this; }
 	GCss &operator +=(const GCss &c) { CopyStyle(c); return *this; }
 	GCss &operator -=(const GCss &c);
-	void *PropAddress(PropType p) { return Props.Find(p); }
+	const void *PropAddress(PropType p) { return Props.Get(p); }
 	GAutoString ToString();
 	const char *ToString(DisplayType dt);
 
@@ -1230,8 +1381,51 @@ public:
 	*/
 
 protected:
-	inline void DeleteProp(PropType p, void *Ptr);
-	LHashTbl<IntKey<PropType,PropNull>, void*> Props;
+	/// The property values. Copies of a style share one set of values by
+	/// reference, which is copied the first time one of them is changed.
+	/// So use Get() to read a value, Find() may have to copy the set.
+	class LgiClass PropStore
+	{
+	public:
+		typedef LHashTbl<IntKey<PropType,PropNull>, void*> Map;
+
+	protected:
+		struct Values
+		{
+			int Refs;
+			Map Props;
+
+			Values() : Props(32) { Refs = 1; }
+		};
+
+		Values *v;
+		static Map Nil;
+
+		static Values *Copy(Values *From);
+		Map &Write();
+		void Release();
+
+	public:
+		PropStore() { v = NULL; }
+		PropStore(const PropStore &p) { v = NULL; *this = p; }
+		~PropStore() { Release(); }
+
+		PropStore &operator =(const PropStore &p);
+
+		bool SameValues(const PropStore &p) const { return v == p.v; }
+		size_t Length() const { return v ? v->Props.Length() : 0; }
+		void *Get(PropType p) const { return v ? v->Props.Find(p) : NULL; }
+		void *Find(PropType p) { return v ? Write().Find(p) : NULL; }
+		bool Add(PropType p, void *Value) { return Write().Add(p, Value); }
+		bool Delete(PropType p) { return v ? Write().Delete(p) : false; }
+		void Empty() { Release(); }
+
+		Map::PairIterator begin() const { return (v ? v->Props : Nil).begin(); }
+		Map::PairIterator end() const { return (v ? v->Props : Nil).end(); }
+	};
+
+	static void DeleteProp(PropType p, void *Ptr);
+	PropStore Props;
 
 	static LHashTbl<ConstStrKey<char,false>, PropType> Lut;
 	static LHashTbl<IntKey<int>, PropType> ParentProp;
@@ -11,6 +11,7 @@
 #endif
 
 #define LGI_DSP_STR_CACHE		1
+#define LGI_DSP_RUN_CACHE		1 // Share laid out strings between instances (GTK)
 
 /// \brief Cache for text measuring, glyph substitution and painting
 ///
@@ -41,6 +42,7 @@ protected:
 	uint8 LaidOut : 1;
 	uint8 AppendDots : 1;
 	uint8 VisibleTab : 1;
+	uint8 SharedHnd : 1; // 'Hnd' belongs to the run cache, copy before changing it
 
 	#if LGI_DSP_STR_CACHE
 	// Wide char cache
@@ -140,6 +142,28 @@ public:
 		LgiAssert(0);
 		return *this;
 	}
+
+	/// Counters for the process wide cache of laid out strings. Strings with
+	/// the same text, font and tab settings share one layout from the cache.
+	/// On SDL the cache holds rendered glyphs rather than whole strings.
+	struct RunCacheStats
+	{
+		int64 Hits;
+		int64 Misses;
+		int64 Evictions;
+		size_t Entries;
+		size_t Bytes; // Estimated
+	};
+	/// Gets the run cache counters. All zero where there is no cache.
+	static void GetRunCacheStats(RunCacheStats &s);
+	/// Sets the limits of the run cache, least recently used runs are freed first.
+	static void SetRunCacheLimits(size_t MaxEntries, size_t MaxBytes);
+	/// Frees all the cached runs.
+	static void EmptyRunCache();
+	#if defined(LGI_SDL)
+	/// Frees the cached glyphs of a font, called as the font is destroyed.
+	static void EmptyGlyphCache(OsFont Fnt);
+	#endif
 	
 	/// \returns the draw offset used to calculate tab spacing (in Px)
 	int GetDrawOffset();
@@ -307,10 +307,13 @@ public:
 		if (!Lock(_FL))
 			return false;
 		
+		// Main takes all the messages each time it wakes, so the event
+		// only needs signalling when the queue was empty.
+		bool Wake = Msgs.Length() == 0;
 		Msgs.Add(new GMessage(Cmd, a, b));
 		Unlock();
 		
-		return Event.Signal();
+		return Wake ? Event.Signal() : true;
 	}
 	
 	int Main()
@@ -331,7 +334,7 @@ public:
 					if (TimerMs)
 					{
 						TimerTs = Now + TimerMs;
-						WaitLength = (int) TimerTs;
+						WaitLength = (int) TimerMs;
 					}
 					else WaitLength = -1;
 				}
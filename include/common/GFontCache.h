@@ -5,7 +5,15 @@ class GFontCache
 {
 	GFont *DefaultFont;
 	GArray<GFont*> Fonts;
+	LHashTbl<StrKey<char,false>, GFont*> Index; // 'Fonts' by FontKey
 	GHashTbl<const char*, GString> FontName;
+
+	/// The key of a font in 'Index'. The face can't be confused with
+	/// the numbers because they always make the last 2 fields.
+	static void FontKey(char *Key, size_t Size, const char *Face, int PtSize, bool Bold, bool Italic, bool Underline)
+	{
+		sprintf_s(Key, Size, "%s,%i,%i", Face, PtSize, (Bold ? 1 : 0) | (Italic ? 2 : 0) | (Underline ? 4 : 0));
+	}
 	
 public:
 	/// Constructor for font cache
@@ -50,20 +58,17 @@ public:
 					GCss::FontStyleType Style,
 					GCss::TextDecorType Decor)
 	{
+		bool Bold = Weight == GCss::FontWeightBold;
+		bool Italic = Style == GCss::FontStyleItalic;
+		bool Underline = Decor == GCss::TextDecorUnderline;
+
 		// Matching existing fonts...
-		for (unsigned i=0; i<Fonts.Length(); i++)
+		char Key[256];
+		if (Face)
 		{
-			GFont *f = Fonts[i];
-			if
-			(
-				f->Face() &&
-				Face &&
-				!_stricmp(f->Face(), Face) &&
-				f->PointSize() == PtSize &&
-				f->Bold() == (Weight == GCss::FontWeightBold) &&
-				f->Italic() == (Style == GCss::FontStyleItalic) &&
-				f->Underline() == (Decor == GCss::TextDecorUnderline)
-			)
+			FontKey(Key, sizeof(Key), Face, PtSize, Bold, Italic, Underline);
+			GFont *f = Index.Find(Key);
+			if (f)
 				return f;
 		}
 		
@@ -71,9 +76,9 @@ public:
 		GFont *f = new GFont;
 		if (f)
 		{
-			f->Bold(Weight == GCss::FontWeightBold);
-			f->Italic(Style == GCss::FontStyleItalic);
-			f->Underline(Decor == GCss::TextDecorUnderline);
+			f->Bold(Bold);
+			f->Italic(Italic);
+			f->Underline(Underline);
 			
 			if (!f->Create(Face, PtSize))
 			{
@@ -83,6 +88,8 @@ public:
 			}
 			
 			Fonts.Add(f);
+			if (Face)
+				Index.Add(Key, f);
 		}
 		
 		return f;
@@ -67,8 +67,10 @@ protected:
 	GFont *DefFont();
 	void CloseTag(GTag *t);
 	void ParseDocument(const char *Doc);
+	void FixupDocument();
 	void OnAddStyle(const char *MimeType, const char *Styles);
 	int ScrollY();
+	bool PaintTiles(GSurface *pDC, GColour &Back);
 	void SetCursorVis(bool b);
 	bool GetCursorVis();
 	GRect *GetCursorPos();
@@ -129,8 +131,20 @@ public:
 	/// Returns the HTML content
 	char16 *NameW();
 
+	/// Starts loading a document that arrives in pieces, e.g. from the network.
+	/// The parts added with AppendHtml are laid out and painted as they arrive.
+	bool BeginHtml();
+	/// Adds the next piece of the document started with BeginHtml.
+	bool AppendHtml(const char *Data, ssize_t Len = -1);
+	/// Finishes the document started with BeginHtml.
+	bool EndHtml();
+
 	// Impl
 	void OnPaint(GSurface *pDC);
+	/// Drops the cached paint tiles under 'r' (or all of them) and repaints.
+	/// Changes that only scroll the view call GDocView::Invalidate directly.
+	bool Invalidate(GRect *r = NULL, bool Repaint = false, bool NonClient = false);
+	using GDocView::Invalidate;
 	void OnMouseClick(GMouse &m);
 	void OnMouseMove(GMouse &m);
 	LgiCursor GetCursor(int x, int y);
@@ -9,6 +9,72 @@ class GHtmlParser
 	GStringPipe SourceData;
 	const char *CurrentSrc;
 
+	/// State of an incremental parse (see ParseBegin). Incoming data is run through
+	/// a resumable scanner that tracks how much of it is complete markup, only that
+	/// part is handed to ParseHtml. The rest waits in 'Buf' for more data.
+	struct GHtmlStream
+	{
+		enum ScanState
+		{
+			ScanText,		// Content between tags
+			ScanLt,			// Seen a '<'
+			ScanTagName,	// Name of a start tag
+			ScanTag,		// Attributes of a start tag
+			ScanQuote,		// Quoted attribute value
+			ScanEndTag,		// Inside an end tag
+			ScanBang,		// Seen "<!"
+			ScanBangDash,	// Seen "<!-"
+			ScanComment,	// Inside "<!-- -->"
+			ScanDecl,		// "<!DOCTYPE>", "<![if]>" etc
+			ScanDynamic,	// Inside a "<? ?>" section
+			ScanRawText,	// Script or style content
+		};
+
+		GHtmlElement *Root;		// Element the document is parsed into
+		GHtmlElement *Resume;	// Innermost element left open by the last segment
+		GArray<char> Buf;		// Unparsed input, NULL terminated
+		size_t Scanned;			// Bytes of 'Buf' the scanner has seen
+		size_t Safe;			// Bytes of 'Buf' that are complete markup
+		size_t Lt;				// Offset of the last '<'
+		bool Partial;			// Parsing a segment with more data to come
+		bool SkipSpace;			// The last segment ended skipping non-display content
+
+		ScanState State;
+		char Quote;				// Open quote in ScanQuote/ScanDynamic
+		char Prev;				// Last non white space char of a start tag
+		int Match;				// Chars of the current terminator matched
+		char Name[16];			// Start of the tag name (lower case)
+		int NameLen;
+		bool XmlNs;				// "<?xml:namespace ... />" section
+		const char *RawEnd;		// Terminator of ScanRawText
+
+		GHtmlStream()
+		{
+			Root = NULL;
+			Reset();
+		}
+
+		void Reset()
+		{
+			Resume = NULL;
+			Buf.Length(1);
+			Buf[0] = 0;
+			Scanned = Safe = Lt = 0;
+			Partial = SkipSpace = false;
+			State = ScanText;
+			Quote = Prev = 0;
+			Match = NameLen = 0;
+			Name[0] = 0;
+			XmlNs = false;
+			RawEnd = NULL;
+		}
+	}	Stream;
+
+	GArray<char16> EntityBuf;	// Shared output of DecodeEntities
+
+	void ScanStream();
+	void ParseSegment(char *s);
+
 protected:
 	GDocView *View;
 	GAutoString Source;
@@ -26,8 +92,10 @@ protected:
 
 	GHtmlElement *GetOpenTag(const char *Tag);
 	void _TraceOpenTags();
-	char *ParseHtml(GHtmlElement *Elem, char *Doc, int Depth, bool InPreTag = false, bool *BackOut = NULL);	
+	char *ParseHtml(GHtmlElement *Elem, char *Doc, int Depth, bool InPreTag = false, bool *BackOut = NULL, bool Resume = false);
 	char16 *DecodeEntities(const char *s, ssize_t len);
+	/// Decodes into 'Out', which is reused between calls. Returns 'Out's memory.
+	const char16 *DecodeEntities(GArray<char16> &Out, const char *s, ssize_t len);
 
 public:
 	GHtmlParser(GDocView *view)
@@ -41,6 +109,27 @@ public:
 
 	// Main entry point
 	bool Parse(GHtmlElement *Root, const char *Doc);
+
+	// Incremental parsing, for documents that arrive in pieces
+
+	/// Starts parsing a document into 'Root'.
+	bool ParseBegin(GHtmlElement *Root);
+	/// Adds the next piece of the document. Elements are created for all the
+	/// complete markup so far, the open ones are carried on by the next call.
+	bool ParseChunk(const char *Data, ssize_t Len = -1);
+	/// Parses whatever is left and closes the document.
+	bool ParseEnd();
+	/// True between ParseBegin and ParseEnd.
+	bool IsParsingStream() { return Stream.Root != NULL; }
+	/// The innermost element left open by the incremental parse so far. Only it
+	/// and its parents can gain children from the next ParseChunk.
+	GHtmlElement *GetOpenElement() { return Stream.Resume; }
+	/// Drops an incremental parse without finishing it.
+	void ParseCancel()
+	{
+		Stream.Root = NULL;
+		Stream.Reset();
+	}
 	
 	// Tool methods
 	GHtmlElemInfo *GetTagInfo(const char *Tag);
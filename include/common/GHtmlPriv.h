@@ -107,6 +107,14 @@ public:
 	bool OverlapY(GFlowRect *b) { return !(b->y2 < y1 || b->y1 > y2); }
 };
 
+/// The insertion state of a GFlowRegion, saved by the layout cache.
+struct GFlowState
+{
+	int x1, x2, y1, y2, cx, my;
+	int InBody;
+	GdcPt2 Max;
+};
+
 class GArea : public GArray<GFlowRect*>
 {
 public:
@@ -136,6 +144,13 @@ struct GHtmlTableLayout
 	GArray<int> MinCol, MaxCol, MaxRow;
 	GArray<GCss::Len> SizeCol;
 
+	// The column measurements from the last layout, reused while
+	// nothing in the table changes and the width is the same.
+	int MeasuredX;
+	GArray<int> MeasuredMin, MeasuredMax;
+	GArray<GCss::Len> MeasuredSize;
+	GArray<uint16> MeasuredContent; // Min and max content of each cell
+
 	GHtmlTableLayout(GTag *table);
 
 	void GetSize(int &x, int &y);
@@ -294,6 +309,8 @@ protected:
 	GTag *PrevTag();
 	GRect ChildBounds();
 	bool GetWidthMetrics(GTag *Table, uint16 &Min, uint16 &Max);
+	bool CalcWidthMetrics(GTag *Table, uint16 &Min, uint16 &Max);
+	bool ReuseFlow(GFlowRegion *Flow);
 	void LayoutTable(GFlowRegion *f, uint16 Depth);
 	void BoundParents();
 	bool PeekTag(char *s, char *tag);
@@ -312,6 +329,7 @@ public:
 	// Object
 	GString::Array Class;
 	const char *HtmlId;
+	uint32 StyleShareId; // Style sharing entry from the last Restyle, 0 if none
 
 	GAutoString Condition;
 	int TipId;
@@ -328,6 +346,32 @@ public:
 	GFont *Font;
 	int LineHeightCache;
 	GRect PadPx;
+
+	// Layout caching
+	bool LayoutDirty; // This tag or one below it changed since it was last flowed
+	struct LayoutCacheInfo
+	{
+		// The last flow of a block: the region before and after,
+		// and where the block ended up.
+		bool FlowValid;
+		GFlowState FlowIn, FlowOut;
+		int ViewY;
+		GdcPt2 Pos, Size;
+
+		// The last GetWidthMetrics call
+		bool MetricsValid;
+		bool MetricsStatus;
+		GTag *MetricsTable;
+		uint16 InMin, InMax, OutMin, OutMax;
+	}	LayoutCache;
+	/// Marks this tag and its parents as needing layout, and optionally all the children.
+	void SetLayoutDirty(bool Children = false);
+
+	// Painting
+	GRect PaintBounds; // What this tag and its children paint, relative to the tag
+	bool PaintAlways; // Paint even when out of view, for side effects or unknown bounds
+	/// Works out the paint bounds after a layout.
+	void UpdatePaintBounds();
 	
 	// Images
 	bool ImageResized;
@@ -400,10 +444,14 @@ public:
 	
 	/// Configures the tag's styles.
 	void SetStyle();
+	/// The style sharing key, empty if the tag's styles can't be shared.
+	GString StyleShareKey();
+	/// Shares the property values of an identical style from an earlier tag.
+	void ShareStyle();
 	/// Called to apply CSS selectors on initialization and also when properties change at runtime.
-	void Restyle();
+	void Restyle(GCss::Store::AtomFilter *Ancestors = NULL);
 	/// Recursively call restyle on all nodes in the doc tree
-	void RestyleAll();
+	void RestyleAll(GCss::Store::AtomFilter *Ancestors = NULL);
 	
 	/// Takes the CSS styles, parses and stores them in the current object,
 	//// overwriting any duplicate properties.
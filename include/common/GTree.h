@@ -94,7 +94,9 @@ protected:
 
 	// Private methods
 	void _RePour();
-	void _Pour(GdcPt2 *Limit, int ColumnPx, int Depth, bool Visible);
+	void _Pour(GdcPt2 *Limit, int ColumnPx, int Depth, bool Visible, GArray<GTreeItem*> &Rows);
+	void _ShowChildren(bool Show);
+	bool _HasExpander();
 	void _Remove();
 	void _MouseClick(GMouse &m);
 	void _SetTreePtr(GTree *t);
@@ -155,6 +157,25 @@ public:
 	/// True if the node is the drop target
 	bool IsDropTarget();
 
+	/// \brief Creates the children when the node is first opened.
+	///
+	/// A lazy node shows an expander before it has any children. The first
+	/// time it's expanded OnPopulate is called to insert them. Use this
+	/// instead of a placeholder child for large or slow to read hierarchies.
+	void SetLazyChildren
+	(
+		/// True to populate on demand
+		bool Lazy = true,
+		/// Delete the children when the node is collapsed, so they're
+		/// created again by the next OnPopulate
+		bool ReleaseOnCollapse = false
+	);
+	/// True if the node is lazy and OnPopulate hasn't been called since
+	/// it was made lazy or last released.
+	bool IsUnpopulated();
+
+	/// Called to insert the children of a lazy node, see SetLazyChildren.
+	virtual void OnPopulate() {}
 	/// Called when the node expands/contracts to show or hide it's children.
 	virtual void OnExpand(bool b);
 
@@ -176,6 +197,7 @@ class LgiClass GTree :
 
 	// Private methods
 	void _Pour();
+	ssize_t _RowFromY(int y);
 	void _OnSelect(GTreeItem *Item);
 	void _Update(GRect *r = 0, bool Now = false);
 	void _UpdateBelow(int y, bool Now = false);
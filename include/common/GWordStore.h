@@ -2,6 +2,35 @@
 #ifndef _GWORDSTORE_H_
 #define _GWORDSTORE_H_
 
+/// The unique words of some text, lower cased and sorted, ready for a batched
+/// lookup with GWordStore::GetWordCounts.
+class GWordTokens
+{
+	friend class GWordStore;
+
+	GArray<char> Text;			// Words separated by NULLs
+	GArray<const char*> Words;	// Sorted and unique, pointing into 'Text'
+
+public:
+	/// Splits 'Str' into words. Letters, digits, '-', '\'', '$' and any non-ASCII
+	/// (UTF-8) bytes are part of a word. Words shorter than 3 or longer than 40
+	/// bytes are skipped.
+	/// \returns the number of unique words.
+	size_t Tokenise(const char *Str, ssize_t Len = -1, bool Append = false);
+
+	size_t Length() { return Words.Length(); }
+	const char *operator [](size_t i) { return Words[i]; }
+	void Empty() { Text.Length(0); Words.Length(0); }
+};
+
+/// Word frequency store for the Bayesian filter.
+///
+/// The words are kept in a sorted, front-coded binary file that is memory mapped
+/// read-only for lookups. Changes go into an in-memory overlay and an append-only
+/// log beside the file ("<file>.log"), so saving only writes what changed. Once the
+/// overlay gets large it is merged back into the sorted file on the thread pool.
+///
+/// Words are case insensitive (ASCII). Words longer than 255 bytes are ignored.
 class GWordStore
 {
 	class GWordStorePriv *d;
@@ -9,25 +38,40 @@ class GWordStore
 public:
 	GWordStore(const char *file = 0);
 	~GWordStore();
-	
+
 	// Serialization
+
+	/// Load maps 'file' and replays its log. Old text stores are converted,
+	/// the original is kept beside it as "<file>.v1". Saving to the current
+	/// file only flushes the log, saving to any other file writes a complete
+	/// sorted copy.
 	bool Serialize(const char *file, bool Load);
-	
+	/// Merge the overlay into the sorted file, optionally on the thread pool.
+	bool Compact(bool Background = false);
+
 	// Container
 	long GetItems();
 	bool SetItems(int s);
 	bool Insert(const char *Word);
 	long GetWordCount(const char *Word);
 	int SetWordCount(const char *Word, ssize_t Count);
+	/// Looks up all the words in 't' in one pass over the file.
+	/// Counts[i] is set to the count for t[i].
+	bool GetWordCounts(GWordTokens &t, GArray<int64> &Counts);
 	void Empty();
 	char *GetFile();
 	void SetFile(const char *file);
 
-	// Iterate
+	// Iterate, in sorted order. Compacts first if there are pending changes.
 	const char *First();
 	const char *Next();
 	unsigned long Length();
 
+	/// The probability (0 to 1) that 'Body' is spam, given stores of words seen
+	/// in spam and in ham. The store's item counts are the number of messages
+	/// each was trained on. Pass 'Buf' to reuse its memory between messages.
+	static double Classify(GWordStore *Spam, GWordStore *Ham, const char *Body, ssize_t Len = -1, GWordTokens *Buf = NULL);
+
 	#ifdef _DEBUG
 	int64 Sizeof();
 	#endif
@@ -1374,6 +1374,27 @@ LgiFunc bool LgiRopRgb
 /// Universal bit blt method
 LgiFunc bool LgiRopUniversal(GBmpMem *Dst, GBmpMem *Src, bool Composite);
 
+/// Blends a solid colour into a row of pixels, weighted by an 8 bit coverage
+/// value per pixel (e.g. an anti-aliased glyph mask). Handles 16, 24 and 32 bit
+/// RGB colour spaces, 32 bit rows use SSE2 where available. On a 32 bit surface
+/// with an alpha channel, pixels that get all of 'c' are made opaque and the
+/// partly covered ones keep their alpha.
+/// \returns false if the colour space isn't supported
+LgiFunc bool LgiBlendCoverage
+(
+	/// Pointer to the first destination pixel
+	uint8 *Dst,
+	/// Destination colour space
+	GColourSpace DstCs,
+	/// One coverage value per pixel: 0 leaves the pixel, 255 sets it to 'c'.
+	/// NULL fills all the pixels with 'c'.
+	const uint8 *Coverage,
+	/// Number of pixels
+	int Px,
+	/// The colour to blend in
+	GColour c
+);
+
 /// Gets the screens DPI
 LgiFunc int LgiScreenDpi();
 
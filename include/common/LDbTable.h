@@ -28,12 +28,18 @@ class LDbRow : public GDataPropI
 {
 	friend class LDbTable;
 	friend struct DbTablePriv;
+	friend class DbTreeIndex;
+	friend struct DbTreePriv;
 
 	// Global table specific data
 	DbTablePriv *d;
 
 	// The doubly linked list of rows.
 	LDbRow *Next, *Prev;
+
+	// Increases along the list of rows, orders rows with equal
+	// values in an index. Renumbered when the table is saved.
+	uint32 Seq;
 	
 	// This is the position in the tables read-only data
 	// for this row.
@@ -105,6 +111,8 @@ public:
 	virtual ~DbIndex();
 	virtual bool OnNew(LDbRow *r) = 0;
 	virtual bool OnDelete(LDbRow *r) = 0;
+	/// Called before (Before = true) and after field 'Id' of 'r' changes.
+	virtual bool OnChange(LDbRow *r, int Id, bool Before) { return true; }
 };
 
 class DbArrayIndex : public DbIndex, public GArray<LDbRow*>
@@ -122,6 +130,65 @@ public:
 	bool OnDelete(LDbRow *r);
 	bool Resort();
 };
+
+/// A sorted index on one int, string or date field, kept up to date as
+/// rows are added, edited and deleted. It's a B+tree in memory, and is
+/// saved with the table (in "<table>.idx") so that loading doesn't need
+/// to sort. Strings are compared case insensitively.
+///
+/// Cursors are invalidated by any change to the table.
+class DbTreeIndex : public DbIndex
+{
+	friend class LDbTable;
+	friend struct DbTablePriv;
+	struct DbTreePriv *t;
+
+	DbTreeIndex(DbTablePriv *priv, LDbField &fld);
+	bool Build(GArray<LDbRow*> *Sorted = NULL);
+
+public:
+	struct Cursor
+	{
+		void *Node;
+		int Idx;
+
+		Cursor() { Node = NULL; Idx = 0; }
+		operator bool() { return Node != NULL; }
+	};
+
+	~DbTreeIndex();
+
+	bool OnNew(LDbRow *r);
+	bool OnDelete(LDbRow *r);
+	bool OnChange(LDbRow *r, int Id, bool Before);
+
+	LDbField &GetField();
+	size_t Length();
+
+	// Ordered iteration, each returns false when there are no more rows
+	bool First(Cursor &c);
+	bool Last(Cursor &c);
+	bool Next(Cursor &c);
+	bool Prev(Cursor &c);
+	/// The row at 'c', or NULL if 'c' is past the end.
+	LDbRow *Row(Cursor &c);
+
+	/// Moves 'c' to the first row with a value >= 'Value'.
+	bool Seek(Cursor &c, int64 Value);
+	bool Seek(Cursor &c, LDateTime &Value);
+	bool Seek(Cursor &c, const char *Value);
+
+	/// Adds the rows with Min <= value <= Max to 'Rows', in order.
+	/// \returns the number of rows added.
+	size_t Range(GArray<LDbRow*> &Rows, int64 Min, int64 Max);
+	size_t Range(GArray<LDbRow*> &Rows, LDateTime &Min, LDateTime &Max);
+	size_t Range(GArray<LDbRow*> &Rows, const char *Min, const char *Max);
+	/// Adds the rows whose string value starts with 'Prefix' to 'Rows', in order.
+	size_t Prefix(GArray<LDbRow*> &Rows, const char *Prefix);
+	/// Adds all the rows to 'Rows' in ascending or descending order.
+	size_t Get(GArray<LDbRow*> &Rows, bool Ascending = true);
+};
+
 class LDbTable
 {
 	struct DbTablePriv *d;
@@ -148,6 +215,13 @@ public:
 	/// table. When done just free the index object.
 	DbArrayIndex *Sort(int Id, bool Ascending = true);
 
+	/// Creates an index on field 'Id', or returns the existing one. The
+	/// index belongs to the table and is saved with it.
+	DbTreeIndex *AddIndex(int Id);
+	/// \returns the index on field 'Id' or NULL.
+	DbTreeIndex *GetIndex(int Id);
+	bool DeleteIndex(int Id);
+
 	// IO
 	bool Serialize(const char *Path, bool Write);
 
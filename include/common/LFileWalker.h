@@ -0,0 +1,74 @@
+/*
+	Recursive folder walker.
+
+	On POSIX systems entries are typed from readdir's d_type, so an entry is only
+	stat'd when the file system doesn't report a type or the size was asked for.
+	Sub-folders are opened relative to the parent folder's descriptor. Paths are
+	built in a reused buffer, there is no heap allocation per entry.
+
+	With WalkParallel each sub-folder is scanned as a separate LThreadPool task,
+	so the callback can be called from several threads at once.
+*/
+#ifndef _LFILEWALKER_H_
+#define _LFILEWALKER_H_
+
+#include "LCancel.h"
+
+class LgiClass LFileWalker : public LCancel
+{
+	struct LFileWalkerPriv *d;
+
+public:
+	/// Details of one entry, only valid for the duration of the callback.
+	struct Entry
+	{
+		/// Full path of the entry
+		const char *Path;
+		/// Length of 'Path'
+		size_t PathLen;
+		/// The leaf name, points into 'Path'
+		const char *Leaf;
+		/// True for folders
+		bool IsDir;
+		/// Size in bytes if WalkSize was set, otherwise -1
+		int64 Size;
+		/// Folder depth below the root (0 = in the root)
+		int Depth;
+	};
+
+	/// Called for each matching file (and folder, with WalkDirs). Return false for a
+	/// folder to skip it. Call Cancel() on the walker to stop altogether.
+	typedef bool (*EntryCallback)(void *UserData, Entry &e);
+
+	enum WalkFlags
+	{
+		/// Scan sub-folders on the thread pool
+		WalkParallel = 0x1,
+		/// Fill in Entry::Size for files
+		WalkSize = 0x2,
+		/// Call back for folders as well as files
+		WalkDirs = 0x4,
+		/// Skip entries whose name starts with '.'
+		WalkSkipHidden = 0x8,
+	};
+
+	LFileWalker(int Flags = 0);
+	~LFileWalker();
+
+	/// Only report files matching one of the added patterns (see MatchStr).
+	/// With no patterns every file is reported.
+	void AddPattern(const char *Pattern);
+
+	/// Walk the tree under 'Root'.
+	/// \returns false if 'Root' couldn't be read or the walk was cancelled.
+	bool Walk(const char *Root, EntryCallback Callback, void *UserData = NULL);
+
+	/// Matching files seen by the last walk
+	uint64 GetFiles();
+	/// Folders seen by the last walk
+	uint64 GetDirs();
+	/// Total size of matching files, needs WalkSize
+	uint64 GetSize();
+};
+
+#endif
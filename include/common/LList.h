@@ -151,6 +151,26 @@ public:
 
 // typedef int (*LListCompareFunc)(LListItem *a, LListItem *b, NativeInt Data);
 
+/// \brief Supplies the rows of a LList in virtual mode.
+///
+/// The list asks for an item only when its row is about to be shown, and
+/// deletes it again once the row is well out of view. So the source should
+/// hold the data and create light weight items (typically overriding
+/// LListItem::GetText) on demand.
+class LgiClass LListDataSource
+{
+public:
+	virtual ~LListDataSource() {}
+
+	/// \returns the number of rows
+	virtual size_t GetRows() = 0;
+	/// Creates the item for 'Row'. The list owns the item.
+	virtual LListItem *NewItem(size_t Row) = 0;
+	/// Compares two rows for LList::Sort, returning < 0 if 'a' comes before 'b'.
+	/// The default keeps the source's order.
+	virtual int CompareRows(size_t a, size_t b, int Column) { return a < b ? -1 : a > b; }
+};
+
 class LListItems
 {
 protected:
@@ -282,6 +302,12 @@ protected:
 	void KeyScroll(int iTo, int iFrom, bool SelectItems);
 	void ClearDs(int Col);
 
+	// Virtual mode
+	void PourRows();
+	void FreeRow(LListItem *i);
+	bool SelectRows(int From, int To, bool Others);
+	int ViewIndexOf(LListItem *i);
+
 public:
 	/// Constructor
 	LList
@@ -401,11 +427,31 @@ public:
 	void ScrollToSelection();
 	/// Clears the text cache for all the items and repaints the screen.
 	void UpdateAllItems();
-	/// Gets the number of items.
-	size_t Length() { return Items.Length(); }
+	/// Gets the number of items (rows in virtual mode).
+	size_t Length();
 
 	/// Returns true if the list is empty
-	bool IsEmpty() { return Items.Length() == 0; }
+	bool IsEmpty() { return Length() == 0; }
+
+	/// \brief Puts the list in virtual mode, or back to normal if 'Src' is NULL.
+	///
+	/// In virtual mode the rows come from 'Src' and only the visible rows plus a
+	/// margin have items, so the list can show millions of rows. Indexes (Value,
+	/// ItemAt etc) are positions in the view and items returned are only valid
+	/// until the list is next laid out. All rows are assumed to be the height
+	/// of the first row and the list is always shown in LListDetails mode.
+	/// Any existing items are deleted. The caller keeps ownership of 'Src', pass
+	/// NULL to go back to normal items.
+	void SetDataSource(LListDataSource *Src);
+	/// The data source in virtual mode, otherwise NULL.
+	LListDataSource *GetDataSource();
+	/// Call when the data source's rows have changed. Drops the cached items,
+	/// the sort order and the selection.
+	void ReloadRows();
+	/// The source row shown at view position 'Index' (virtual mode).
+	int RowAt(int Index);
+	/// Gets the source rows of the selected items in view order (virtual mode).
+	bool GetSelectedRows(GArray<int> &Rows);
 	/// Deletes the current item
 	bool Delete();
 	/// Deletes the item at index 'Index'
@@ -464,7 +510,7 @@ public:
 		User Data = 0
 	)
 	{
-		if (!Compare || !Lock(_FL))
+		if (!Compare || GetDataSource() || !Lock(_FL))
 			return;
 
 		LListItem *Kb = Items[Keyboard];
@@ -476,6 +522,12 @@ public:
 
 	void Sort(int Column)
 	{
+		if (GetDataSource())
+		{
+			SortRows(Column);
+			return;
+		}
+
 		if (!Lock(_FL))
 			return;
 
@@ -495,7 +547,12 @@ public:
 		Invalidate(&ItemsPos);
 	}
 
-	/// Removes all items from list and delete the objects.
+	/// Sorts the rows in virtual mode with LListDataSource::CompareRows. The
+	/// source is not changed, the view keeps an index of its rows.
+	void SortRows(int Column, bool Ascending = true);
+
+	/// Removes all items from list and delete the objects. In virtual mode the
+	/// data source is kept, ReloadRows shows its rows again.
 	virtual void Empty();
 	/// Removes all references to externally owned items. Doesn't delete objects.
 	virtual void RemoveAll();
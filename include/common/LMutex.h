@@ -7,14 +7,31 @@ class LgiClass LMutex
 {
 	OsThreadId _Thread;
 	OsSemaphore _Sem;
+	#if defined POSIX
+	pthread_cond_t _Cond;	// Signalled on unlock when there are waiters
+	int _Waiters;
+	int _Spin;				// Adaptive spin count before blocking
+	#endif
+	#ifdef _DEBUG
 	const char *File;
 	int Line;
-	#ifdef _DEBUG
 	bool _DebugSem;
 	#endif
+
+	// LMutexProfile state for the current outermost lock
+	uint64 _ProfStart;
+	uint64 _ProfWait;
+	const char *_ProfFile;
+	int _ProfLine;
 	
 	bool _Lock();
 	void _Unlock();
+	void _ProfAcquire(uint64 WaitStart, const char *file, int line);
+	bool _ProfRelease(struct LMutexSample &s);
+	#if defined POSIX
+	bool _TryAcquire(OsThreadId Me);
+	bool _Wait(OsThreadId Me, int Timeout, bool NoTrace);
+	#endif
 	char *_Name;
 
 protected:
@@ -0,0 +1,39 @@
+/// \file
+#ifndef _LMUTEX_PROFILE_H_
+#define _LMUTEX_PROFILE_H_
+
+#include "GVariant.h"
+
+/// Opt-in lock contention profiler for LMutex.
+///
+/// While enabled each LMutex records how long callers waited to acquire it
+/// and how long it was held, as log2 microsecond histograms per mutex name
+/// and per locking call site (file:line), plus the longest single holds.
+/// When disabled the only cost to LMutex is testing a flag. When enabled each
+/// thread buffers its samples after unlocking, and they're merged into the
+/// statistics when read.
+///
+/// The statistics are available as a text report or through the GDom
+/// interface:
+///		"Enabled"	bool, read/write
+///		"Report"	string
+///		"Names"		list of stats hashes, one per mutex name
+///		"Sites"		list of stats hashes, one per call site
+///		"Longest"	list of the longest holds
+class LgiClass LMutexProfile : public GDom
+{
+public:
+	/// Turns collection on or off, it's off by default
+	static void Enable(bool b = true);
+	/// \returns true if collecting
+	static bool IsEnabled();
+	/// Clears all the collected statistics
+	static void Reset();
+	/// \returns a plain text report of the statistics
+	static GString Report();
+
+	bool GetVariant(const char *Name, GVariant &Value, char *Array = 0);
+	bool SetVariant(const char *Name, GVariant &Value, char *Array = 0);
+};
+
+#endif
@@ -4,6 +4,7 @@
 //////////////////////////////////////////////////////////////////////////
 // Thread types are defined in LMutex.h
 #include "LMutex.h"
+#include "LThreadEvent.h"
 
 class LgiClass LThread
 {
@@ -123,7 +124,8 @@ public:
 class LgiClass LThreadWorker : public LThread, public LMutex
 {
 	GArray<LThreadTarget*> Owners;
-	GArray<LThreadJob*> Jobs;
+	GArray<LThreadJob*> Jobs;	// Queued jobs, Main takes them in batches
+	LThreadEvent Event;			// Signalled when Jobs stops being empty
 	bool Loop;
 
 public:
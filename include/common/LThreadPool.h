@@ -0,0 +1,177 @@
+/*
+	A process wide pool of worker threads, sized to the number of CPU cores.
+
+	Each worker owns a queue of tasks. Workers run their own tasks newest first
+	and when idle steal the oldest tasks from the other workers. A thread waiting
+	on a LThreadTaskGroup helps run tasks rather than blocking, so groups can be
+	nested (a task can itself start and wait on a group).
+
+	Typical usage:
+
+		struct RowFn
+		{
+			GSurface *pDC;
+			void operator()(ssize_t From, ssize_t To)
+			{
+				for (ssize_t y=From; y<To; y++)
+					ProcessRow(pDC, y);
+			}
+		}	Fn = { pDC };
+		LThreadPool::ParallelFor(0, pDC->Y(), Fn);
+*/
+#ifndef _LTHREADPOOL_H_
+#define _LTHREADPOOL_H_
+
+#include "LThread.h"
+#include "LCancel.h"
+
+class LThreadPool;
+class LThreadTaskGroup;
+
+/// A unit of work to run on the thread pool.
+class LgiClass LThreadTask
+{
+	friend class LThreadPool;
+	friend class LThreadTaskGroup;
+
+protected:
+	/// The group this task belongs to (or NULL).
+	LThreadTaskGroup *Group;
+
+public:
+	LThreadTask() { Group = NULL; }
+	virtual ~LThreadTask() {}
+
+	/// Override to do the work. Not called if the group is cancelled before the task starts.
+	virtual void Do() = 0;
+};
+
+/// A set of tasks that can be waited on and cancelled together. Optionally
+/// posts an event to a GEventSinkI when the last task finishes.
+class LgiClass LThreadTaskGroup : public LCancel
+{
+	friend class LThreadPool;
+
+	LCancel *Parent;
+	int Pending;
+	LThreadEvent Done;
+	GEventSinkI *Sink;
+	int SinkCmd;
+	GMessage::Param SinkParam;
+
+public:
+	/// Create a group, optionally cancelled along with 'parent'.
+	LThreadTaskGroup(LCancel *parent = NULL);
+	/// Waits for any outstanding tasks.
+	~LThreadTaskGroup();
+
+	/// True if this group or its parent has been cancelled.
+	bool IsCancelled();
+
+	/// Post 'Cmd' to 'sink' when the pending count drops to zero.
+	/// The event has a = 'Param' and b = true if the group was cancelled.
+	void SetSink(GEventSinkI *sink, int Cmd, GMessage::Param Param = 0);
+
+	/// Queue a task on the pool. The pool owns the task and deletes it once run.
+	void Add(LThreadTask *t);
+
+	/// The number of tasks not yet finished.
+	int GetPending();
+
+	/// Wait for all the tasks to finish, running queued tasks on this
+	/// thread in the meantime.
+	/// \returns false if the group was cancelled.
+	bool Wait();
+};
+
+/// The shared pool of worker threads.
+class LgiClass LThreadPool
+{
+	friend class LThreadTaskGroup;
+	friend class LThreadPoolWorker;
+	struct LThreadPoolPriv *d;
+
+	LThreadPool();
+	void Execute(LThreadTask *t);
+
+public:
+	~LThreadPool();
+
+	/// The process wide pool.
+	static LThreadPool *Inst();
+
+	/// The number of worker threads.
+	int GetThreads();
+
+	/// Queue a task without a group. The pool owns the task.
+	void Add(LThreadTask *t);
+
+	/// Run one queued task on the calling thread.
+	/// \returns false if there was nothing to run.
+	bool RunOne();
+
+	/// Runs Fn(From, To) over sub-ranges of [Start, End) on the pool
+	/// and waits for them all to finish.
+	/// \returns false if cancelled.
+	template<typename Fn>
+	static bool ParallelFor
+	(
+		/// The first index
+		ssize_t Start,
+		/// One past the last index
+		ssize_t End,
+		/// A function or functor taking (ssize_t From, ssize_t To)
+		Fn &f,
+		/// The number of indexes per task, or 0 to pick one from the thread count
+		ssize_t Grain = 0,
+		/// Optional cancel object, checked before each sub-range starts
+		LCancel *Cancel = NULL
+	)
+	{
+		if (End <= Start)
+			return true;
+
+		if (Grain <= 0)
+		{
+			// Aim for a few tasks per thread so the load evens out.
+			ssize_t Tasks = Inst()->GetThreads() * 4;
+			Grain = MAX(1, (End - Start + Tasks - 1) / Tasks);
+		}
+
+		if (End - Start <= Grain)
+		{
+			if (Cancel && Cancel->IsCancelled())
+				return false;
+			f(Start, End);
+			return true;
+		}
+
+		LThreadTaskGroup Group(Cancel);
+		for (ssize_t i=Start; i<End; i+=Grain)
+			Group.Add(new RangeTask<Fn>(f, i, MIN(i + Grain, End)));
+		return Group.Wait();
+	}
+
+protected:
+	template<typename Fn>
+	class RangeTask : public LThreadTask
+	{
+		Fn *f;
+		ssize_t From, To;
+
+	public:
+		RangeTask(Fn &fn, ssize_t from, ssize_t to)
+		{
+			f = &fn;
+			From = from;
+			To = to;
+		}
+
+		void Do()
+		{
+			(*f)(From, To);
+		}
+	};
+};
+
+#endif
@@ -22,11 +22,24 @@ class GSubFilePtr;
 namespace Storage2
 {
 	#define STORAGE2_ITEM_MAGIC		0x123400AB
-	#define STORAGE2_MAGIC			0x123400FE
+	#define STORAGE2_MAGIC			0x123400FE	// v2 files
+	#define STORAGE2_MAGIC_V3		0x123400FA	// v3 files, so older builds won't open them
+	#define STORAGE2_FREEMAP_MAGIC	0x123400FB	// StorageHeader::FreeMapMagic when the saved free map is current
+	#define STORAGE2_FREEMAP_MAGIC32 0x123400FC	// Same, for a map with 32-bit entries (v2 files)
+	#define STORAGE2_JOURNAL_MAGIC	0x123400FD
+	#define STORAGE2_COMPACT_STEP	16			// Default number of items CompactStep looks at
+
+	// File versions, StorageHeader::Version
+	#define STORAGE2_VERSION2		0			// 32-bit locations, limited to 4GB
+	#define STORAGE2_VERSION3		3			// 64-bit locations
+	#define STORAGE2_HEADER_V2		32			// Bytes per item header on disk
+	#define STORAGE2_HEADER_V3		48
+	#define STORAGE2_UPGRADE_SIZE	(3LL << 30)	// v2 files bigger than this are upgraded when opened or idle
 
 	class StorageKitImpl;
 	class StorageItemImpl;
 	class StorageKitImplPrivate;
+	class StorageKitFile;
 
 	struct StorageItemHeader
 	{
@@ -34,19 +47,24 @@ namespace Storage2
 
 		// object descriptor
 		uint32 Type;			// application defined object type
-		uint32 DataLoc;			// location in file of this objects data segment
+		uint64 DataLoc;			// location in file of this objects data segment
 		uint32 DataSize;		// size of this objects data segment
 		
 		// heirarchy descriptor
-		uint32 ParentLoc;		// file location of objects parent
-		uint32 DirLoc;			// file location of the child directory
+		uint64 ParentLoc;		// file location of objects parent
+		uint64 DirLoc;			// file location of the child directory
 		uint32 DirCount;		// number of elements in the child directory array
 		uint32 DirAlloc;		// numder of allocated elements in child directory
 
 		// file io
 		StorageItemHeader();
-		bool Serialize(GFile &f, bool Write);
-		void SwapBytes();
+		bool Serialize(GFile &f, bool Write, int Version);
+
+		/// The on disk layout is little endian. v2 files store 32 bit locations
+		/// in STORAGE2_HEADER_V2 bytes, v3 files 64 bit locations in STORAGE2_HEADER_V3.
+		static int DiskSize(int Version) { return Version >= STORAGE2_VERSION3 ? STORAGE2_HEADER_V3 : STORAGE2_HEADER_V2; }
+		void Encode(uint8 *p, int Version);
+		void Decode(const uint8 *p, int Version);
 	};
 
 	class StorageItemImpl : public StorageItem
@@ -58,7 +76,7 @@ namespace Storage2
 		friend class WriterItem;
 
 	private:
-		uint32 StoreLoc;
+		uint64 StoreLoc;
 		bool HeaderDirty;
 		StorageItemHeader *Header;		// pointer to our block in the parents Dir array
 		StorageItemHeader *Dir;			// an array of children
@@ -110,8 +128,13 @@ namespace Storage2
 		bool EndOfObj(GFile &f);
 		bool Save();
 		
+		/// Points 'Ptr' at the object's data in a read only mapping of the file,
+		/// without copying it. The view is valid until the object is written,
+		/// moved or deleted, or the store is compacted with Compact or closed.
+		bool GetView(const uint8 *&Ptr, int &Len);
+
 		// Debug
-		int GetStoreLoc() { return StoreLoc; }
+		int64 GetStoreLoc() { return StoreLoc; }
 		void Dump(int d)
 		{
 			char s[256];
@@ -128,12 +151,15 @@ namespace Storage2
 
 	struct StorageHeader {
 
-		int Magic;				// always STORAGE2_MAGIC
-		int Version;			// 0x0
-		int Reserved1;			// 0x0
-		int Reserved2;			// 0x0
+		int Magic;				// STORAGE2_MAGIC or STORAGE2_MAGIC_V3
+		int Version;			// STORAGE2_VERSION2 or STORAGE2_VERSION3
+		int FreeMapLoc;			// location of the saved free extent map, or 0x0
+		int FreeMapSize;		// bytes allocated to the saved free extent map
 		char Password[32];		// obsured password
-		int Reserved3[4];		// 0x0
+		int FreeMapMagic;		// STORAGE2_FREEMAP_MAGIC if the saved free map is current
+		int FreeMapFileSize;	// the file size when the free map was saved
+		int FreeMapLocHi;		// high 32 bits of FreeMapLoc
+		int FreeMapFileSizeHi;	// high 32 bits of FreeMapFileSize
 	};
 
 	class StorageKitImpl :
@@ -143,6 +169,7 @@ namespace Storage2
 	{
 		friend class StorageItemImpl;
 		friend class StorageKitImplPrivate;
+		friend class StorageKitFile;
 
 	protected:
 		StorageKitImplPrivate *d;
@@ -164,6 +191,17 @@ namespace Storage2
 
 		bool _ValidLoc(int64 Loc);
 		bool _Serialize(GFile &f, bool Write);
+		void _EncodeHeader(uint8 *p);
+		int _HeaderSize() { return StorageItemHeader::DiskSize(Version); }
+		const uint8 *_Map(uint64 Loc, uint64 Len);
+		const uint8 *_Get(uint64 Loc, uint64 Len, GArray<uint8> &Buf);
+
+		// Free space
+		uint64 _Alloc(uint64 Size);
+		void _Free(uint64 Loc, uint64 Size);
+		bool _LoadFreeMap();
+		bool _SaveFreeMap();
+		void _OnDelete(StorageItemImpl *Item);
 		
 	public:
 		StorageKitImpl(char *FileName);
@@ -183,6 +221,15 @@ namespace Storage2
 		StorageItem *CreateRoot(StorageObj *Obj);
 
 		bool Compact(Progress *p, bool Interactive, StorageValidator *Validator = 0);
+		bool CompactStep(int MaxItems = STORAGE2_COMPACT_STEP);
+		/// Upgrades a v2 file that is nearing 4GB, then does a CompactStep.
+		bool OnIdle();
+		/// Converts a v2 file to v3 (64-bit locations). Only the directories are
+		/// rewritten, object data stays where it is. New files are v2 until they
+		/// need to be upgraded.
+		bool Upgrade();
+		/// The number of bytes in holes left by deleted, moved or resized objects.
+		uint64 GetFreeSpace();
 		bool DeleteItem(StorageItem *Item);
 		bool SeparateItem(StorageItem *Item);
 		bool AttachItem(StorageItem *Item, StorageItem *To, NodeRelation Relationship = NodeChild);
@@ -44,6 +44,10 @@ public:
 	void Detach(GSubFilePtr *Ptr);
 	SubLock Lock(const char *file, int line);
 
+	/// Points to 'Len' bytes at 'Loc' in a mapping of the file, if there is
+	/// one. GSubFilePtr reads from this instead of seeking. Call with the lock.
+	virtual const uint8 *GetView(int64 Loc, int64 Len) { return NULL; }
+
 	#if GSUBFILE_NOBUFFERING
 	int Open(char *Str = 0, int Int = 0);
 	int Read(void *Buffer, int Size, int Flags = 0);
@@ -147,6 +151,8 @@ public:
 	virtual bool Save() = 0;
 	virtual GFile *GotoObject(const char *file, int line) = 0;
 	virtual bool EndOfObj(GFile &f) = 0;
+	/// Zero copy read access to the object's data, if the store supports it.
+	virtual bool GetView(const uint8 *&Ptr, int &Len) { return false; }
 };
 
 class StorageObj
@@ -218,6 +224,16 @@ public:
 
 	// Methods
 	virtual bool Compact(Progress *p, bool Interactive, StorageValidator *Validator = 0) = 0;
+
+	/// Moves a few objects down into free space, call this while idle. The
+	/// file shrinks as space at the end is freed.
+	/// \returns true if there is more to do.
+	virtual bool CompactStep(int MaxItems = 16) { return false; }
+
+	/// Called when the application is not receiving messages, does a little
+	/// background work such as CompactStep.
+	/// \returns false to wait for more messages.
+	virtual bool OnIdle() { return CompactStep(); }
 };
 
 #endif
@@ -40,6 +40,9 @@
 	LgiAssert(Sizeof() == *Sz); \
 	return true;
 
+#define DB_TREE_FANOUT		64			// Max entries in a B+tree node
+#define DB_INDEX_EXT		".idx"		// Index file, beside the table file
+
 #define DB_DATE_SZ \
 	( \
 		2 + /* Year  */ \
@@ -63,6 +66,7 @@ enum DbMagic
 	TableMagic = MAGIC('tbl\0'),
 	FieldMagic = MAGIC('fld\0'),
 	RowMagic = MAGIC('row\0'),
+	IndexMagic = MAGIC('idx\0'),
 };
 
 ///////////////////////////////////////////////////////////////////
@@ -106,15 +110,18 @@ struct DbTablePriv
 	LDbRow *First, *Last;
 	GArray<char> Data;
 	bool Dirty;
+	uint32 NextSeq;
 
 	// Indexes
 	GArray<DbIndex*> Indexes;
+	GArray<DbTreeIndex*> Trees; // Also in 'Indexes'
 
 	// Methods
 	DbTablePriv() : Map(0, false, -1, Info())
 	{
 		First = Last = NULL;
 		Rows = 0;
+		NextSeq = 0;
 		Fixed = 0;
 		Variable = 0;
 		FixedSz = 0;
@@ -141,6 +148,120 @@ struct DbTablePriv
 		return NULL;
 	}
 
+	GString IndexFile(const char *Path)
+	{
+		GString s = Path;
+		return s + DB_INDEX_EXT;
+	}
+
+	/// Writes the row order of each tree index. Must be called after the
+	/// rows are renumbered so that a row's Seq is its position in the file.
+	bool WriteIndexes(const char *Path)
+	{
+		GString File = IndexFile(Path);
+		if (!Trees.Length())
+		{
+			if (FileExists(File))
+				FileDev->Delete(File, false);
+			return true;
+		}
+
+		GArray<uint32> Out;
+		Out.Add(IndexMagic);
+		Out.Add(Rows);
+		uint64 TableSize = LgiFileSize(Path);
+		Out.Add((uint32)TableSize);
+		Out.Add((uint32)(TableSize >> 32));
+		Out.Add((uint32)Trees.Length());
+		for (unsigned i=0; i<Trees.Length(); i++)
+		{
+			DbTreeIndex *t = Trees[i];
+			Out.Add(t->GetField().Id);
+			Out.Add((uint32)t->Length());
+
+			DbTreeIndex::Cursor c;
+			for (bool b = t->First(c); b; b = t->Next(c))
+				Out.Add(t->Row(c)->Seq);
+		}
+
+		GFile f;
+		if (!f.Open(File, O_WRITE))
+			return false;
+		f.SetSize(0);
+		ssize_t Bytes = Out.Length() * sizeof(uint32);
+		return f.Write(Out.AddressOf(), Bytes) == Bytes;
+	}
+
+	/// Reloads the saved indexes. Any index that doesn't match the
+	/// table is rebuilt by sorting the rows.
+	void ReadIndexes(const char *Path)
+	{
+		GFile f;
+		GString File = IndexFile(Path);
+		if (!FileExists(File) || !f.Open(File, O_READ))
+			return;
+
+		GArray<uint32> In;
+		int64 Sz = f.GetSize();
+		if (Sz < 20 || Sz % sizeof(uint32) != 0 ||
+			!In.Length((size_t)(Sz / sizeof(uint32))) ||
+			f.Read(In.AddressOf(), (ssize_t)Sz) != Sz)
+			return;
+		f.Close();
+
+		uint64 TableSize = ((uint64)In[3] << 32) | In[2];
+		bool Valid = In[0] == IndexMagic &&
+					In[1] == (uint32)Rows &&
+					TableSize == (uint64)LgiFileSize(Path);
+
+		GArray<LDbRow*> ByPos, Sorted;
+		if (Valid)
+		{
+			ByPos.Length(Rows);
+			int n = 0;
+			for (LDbRow *r = First; r; r = r->Next)
+				ByPos[n++] = r;
+		}
+
+		GArray<bool> Seen;
+		size_t Pos = 5;
+		for (uint32 Idx = 0; Idx < In[4] && Pos + 2 <= In.Length(); Idx++)
+		{
+			int Id = (int)In[Pos++];
+			uint32 Count = In[Pos++];
+			LDbField *Fld = FindField(Id);
+			if (!Fld || Pos + Count > In.Length())
+				break;
+
+			DbTreeIndex *t = new DbTreeIndex(this, *Fld);
+			Indexes.Add(t);
+			Trees.Add(t);
+
+			bool Ok = Valid && Count == (uint32)Rows;
+			if (Ok)
+			{
+				Seen.Length(0);
+				Seen.Length(Rows);
+				Sorted.Length(Count);
+				for (uint32 i=0; Ok && i<Count; i++)
+				{
+					uint32 s = In[Pos + i];
+					if (s >= (uint32)Rows || Seen[s])
+						Ok = false;
+					else
+					{
+						Seen[s] = true;
+						Sorted[i] = ByPos[s];
+					}
+				}
+			}
+			Pos += Count;
+
+			if (!t->Build(Ok ? &Sorted : NULL))
+				LgiTrace("%s:%i - Failed to build index %i.\n", _FL, Id);
+		}
+	}
+
 	// This is called when the fields change
 	bool OffsetFields()
 	{
@@ -193,6 +314,17 @@ struct DbTablePriv
 
 	bool DeleteField(int Id)
 	{
+		// An index can't outlive its field. Deleting it takes it
+		// out of 'Trees' and 'Indexes'.
+		for (int i=(int)Trees.Length()-1; i>=0; i--)
+		{
+			if (Trees[i]->GetField().Id == Id)
+			{
+				delete Trees[i];
+				SetDirty();
+			}
+		}
+
 		for (unsigned i=0; i<Fields.Length(); i++)
 		{
 			LDbField &f = Fields[i];
@@ -215,8 +347,17 @@ struct DbTablePriv
 		return OffsetFields();
 	}
 
+	void OnChange(LDbRow *r, int Id, bool Before)
+	{
+		for (unsigned i=0; i<Indexes.Length(); i++)
+			Indexes[i]->OnChange(r, Id, Before);
+	}
+
 	bool DeleteRow(LDbRow *r)
 	{
+		for (unsigned i=0; i<Indexes.Length(); i++)
+			Indexes[i]->OnDelete(r);
+
 		if (r->Prev)
 		{
 			r->Prev->Next = r->Next;
@@ -266,13 +407,14 @@ DbArrayIndex::DbArrayIndex(DbTablePriv *priv) : DbIndex(priv)
 
 bool DbArrayIndex::OnNew(LDbRow *r)
 {
-	return Delete(r);
+	// New rows have no values yet, Resort() places them.
+	Add(r);
+	return true;
 }
 
 bool DbArrayIndex::OnDelete(LDbRow *r)
 {
-	Add(r);
-	return true;
+	return Delete(r, true);
 }
 
 struct CompareParams
@@ -365,6 +507,613 @@ bool DbArrayIndex::Resort()
 	return Sort(&Fld, Ascend);
 }
 
+///////////////////////////////////////////////////////////////////////////////////
+struct DbTreeEntry
+{
+	union
+	{
+		int64 Key;			// Int fields, and date fields as UTC
+		const char *Str;	// String value of a search (Row == NULL)
+	};
+	LDbRow *Row;			// NULL when searching, sorts before rows with the same value
+};
+
+struct DbTreeNode
+{
+	bool Leaf;
+	int Count;
+	// Leaves: the entries in order.
+	// Internal nodes: the lowest entry under each child.
+	DbTreeEntry Items[DB_TREE_FANOUT];
+	DbTreeNode **Child;		// Internal nodes only
+	DbTreeNode *Prev, *Next; // Leaves only, the neighbouring leaves
+
+	DbTreeNode(bool leaf)
+	{
+		Leaf = leaf;
+		Count = 0;
+		Child = leaf ? NULL : new DbTreeNode*[DB_TREE_FANOUT];
+		Prev = Next = NULL;
+	}
+
+	~DbTreeNode()
+	{
+		if (Child)
+		{
+			for (int i=0; i<Count; i++)
+				delete Child[i];
+			delete [] Child;
+		}
+	}
+};
+
+struct DbTreePriv
+{
+	DbTablePriv *d;
+	LDbField Fld;
+	DbTreeNode *Root;
+	size_t Items;
+
+	DbTreePriv(DbTablePriv *priv, LDbField &fld)
+	{
+		d = priv;
+		Fld = fld;
+		Root = new DbTreeNode(true);
+		Items = 0;
+	}
+
+	~DbTreePriv()
+	{
+		delete Root;
+	}
+
+	const char *Str(const DbTreeEntry &e)
+	{
+		const char *s = e.Row ? e.Row->GetStr(Fld.Id) : e.Str;
+		return s ? s : "";
+	}
+
+	/// Compares values only
+	int CompareValue(const DbTreeEntry &a, const DbTreeEntry &b)
+	{
+		if (Fld.Type == GV_STRING)
+			return stricmp(Str(a), Str(b));
+		return a.Key < b.Key ? -1 : a.Key > b.Key;
+	}
+
+	/// Compares values and then row order, so no two rows are equal.
+	int Compare(const DbTreeEntry &a, const DbTreeEntry &b)
+	{
+		int c = CompareValue(a, b);
+		if (c)
+			return c;
+		if (!a.Row || !b.Row)
+			return (a.Row != NULL) - (b.Row != NULL);
+		return a.Row->Seq < b.Row->Seq ? -1 : a.Row->Seq > b.Row->Seq;
+	}
+
+	DbTreeEntry Make(LDbRow *r)
+	{
+		DbTreeEntry e;
+		e.Key = 0;
+		e.Row = r;
+		if (r->Base.c)
+		{
+			// A row with no data reads as zeros, same as after StartEdit().
+			if (Fld.Type == GV_INT32 || Fld.Type == GV_INT64)
+			{
+				e.Key = r->GetInt(Fld.Id);
+			}
+			else if (Fld.Type == GV_DATETIME)
+			{
+				LDateTime *dt = r->GetDate(Fld.Id);
+				uint64 t;
+				if (dt && dt->IsValid() && dt->Get(t))
+					e.Key = t;
+			}
+		}
+		return e;
+	}
+
+	/// The child of internal node 'n' that 'e' belongs under: the last
+	/// one whose lowest entry is <= 'e'.
+	int ChildFor(DbTreeNode *n, const DbTreeEntry &e)
+	{
+		int Lo = 1, Hi = n->Count;
+		while (Lo < Hi)
+		{
+			int Mid = (Lo + Hi) >> 1;
+			if (Compare(n->Items[Mid], e) <= 0)
+				Lo = Mid + 1;
+			else
+				Hi = Mid;
+		}
+		return Lo - 1;
+	}
+
+	/// The first entry in leaf 'n' >= 'e'
+	int LowerBound(DbTreeNode *n, const DbTreeEntry &e)
+	{
+		int Lo = 0, Hi = n->Count;
+		while (Lo < Hi)
+		{
+			int Mid = (Lo + Hi) >> 1;
+			if (Compare(n->Items[Mid], e) < 0)
+				Lo = Mid + 1;
+			else
+				Hi = Mid;
+		}
+		return Lo;
+	}
+
+	void InsertAt(DbTreeNode *n, int i, const DbTreeEntry &e, DbTreeNode *c = NULL)
+	{
+		memmove(n->Items + i + 1, n->Items + i, (n->Count - i) * sizeof(*n->Items));
+		n->Items[i] = e;
+		if (n->Child)
+		{
+			memmove(n->Child + i + 1, n->Child + i, (n->Count - i) * sizeof(*n->Child));
+			n->Child[i] = c;
+		}
+		n->Count++;
+	}
+
+	void RemoveAt(DbTreeNode *n, int i)
+	{
+		n->Count--;
+		memmove(n->Items + i, n->Items + i + 1, (n->Count - i) * sizeof(*n->Items));
+		if (n->Child)
+			memmove(n->Child + i, n->Child + i + 1, (n->Count - i) * sizeof(*n->Child));
+	}
+
+	/// Moves the top half of 'n' into a new node on its right
+	DbTreeNode *Split(DbTreeNode *n)
+	{
+		DbTreeNode *r = new DbTreeNode(n->Leaf);
+		int Half = n->Count >> 1;
+		r->Count = n->Count - Half;
+		memcpy(r->Items, n->Items + Half, r->Count * sizeof(*r->Items));
+		if (n->Leaf)
+		{
+			r->Prev = n;
+			r->Next = n->Next;
+			if (n->Next)
+				n->Next->Prev = r;
+			n->Next = r;
+		}
+		else
+		{
+			memcpy(r->Child, n->Child + Half, r->Count * sizeof(*r->Child));
+		}
+		n->Count = Half;
+		return r;
+	}
+
+	/// \returns the new right hand node if 'n' had to split.
+	DbTreeNode *Insert(DbTreeNode *n, const DbTreeEntry &e)
+	{
+		if (n->Leaf)
+		{
+			InsertAt(n, LowerBound(n, e), e);
+		}
+		else
+		{
+			int i = ChildFor(n, e);
+			if (Compare(e, n->Items[i]) < 0)
+				n->Items[i] = e; // New lowest entry
+			DbTreeNode *r = Insert(n->Child[i], e);
+			if (r)
+				InsertAt(n, i + 1, r->Items[0], r);
+		}
+
+		return n->Count >= DB_TREE_FANOUT ? Split(n) : NULL;
+	}
+
+	/// Removes 'e', and empty nodes below 'n'. The lowest entry of each
+	/// child is updated so that no node refers to the row afterwards.
+	bool Delete(DbTreeNode *n, const DbTreeEntry &e)
+	{
+		if (n->Leaf)
+		{
+			int i = LowerBound(n, e);
+			if (i >= n->Count || n->Items[i].Row != e.Row)
+				return false;
+			RemoveAt(n, i);
+			return true;
+		}
+
+		int i = ChildFor(n, e);
+		DbTreeNode *c = n->Child[i];
+		if (!Delete(c, e))
+			return false;
+
+		if (c->Count == 0)
+		{
+			if (c->Leaf)
+			{
+				if (c->Prev)
+					c->Prev->Next = c->Next;
+				if (c->Next)
+					c->Next->Prev = c->Prev;
+			}
+			delete c;
+			RemoveAt(n, i);
+		}
+		else if (n->Items[i].Row == e.Row)
+		{
+			n->Items[i] = c->Items[0];
+		}
+
+		return true;
+	}
+
+	void Add(LDbRow *r)
+	{
+		DbTreeNode *Right = Insert(Root, Make(r));
+		if (Right)
+		{
+			DbTreeNode *n = new DbTreeNode(false);
+			n->Items[0] = Root->Items[0];
+			n->Child[0] = Root;
+			n->Items[1] = Right->Items[0];
+			n->Child[1] = Right;
+			n->Count = 2;
+			Root = n;
+		}
+		Items++;
+	}
+
+	bool Remove(LDbRow *r)
+	{
+		if (!Delete(Root, Make(r)))
+		{
+			LgiAssert(!"Row not in index.");
+			return false;
+		}
+
+		Items--;
+		while (!Root->Leaf && Root->Count <= 1)
+		{
+			// Drop a level
+			DbTreeNode *n = Root;
+			Root = n->Count ? n->Child[0] : new DbTreeNode(true);
+			n->Count = 0;
+			delete n;
+		}
+		return true;
+	}
+
+	/// Builds the tree bottom up from entries that are already sorted.
+	void Build(GArray<DbTreeEntry> &e)
+	{
+		delete Root;
+
+		int Per = DB_TREE_FANOUT * 3 / 4; // Leave room to insert
+		GArray<DbTreeNode*> Level;
+		DbTreeNode *Prev = NULL;
+		for (size_t i=0; i<e.Length(); i+=Per)
+		{
+			DbTreeNode *n = new DbTreeNode(true);
+			n->Count = (int)MIN((size_t)Per, e.Length() - i);
+			memcpy(n->Items, e.AddressOf(i), n->Count * sizeof(*n->Items));
+			n->Prev = Prev;
+			if (Prev)
+				Prev->Next = n;
+			Level.Add(Prev = n);
+		}
+		if (!Level.Length())
+			Level.Add(new DbTreeNode(true));
+
+		while (Level.Length() > 1)
+		{
+			GArray<DbTreeNode*> Up;
+			for (size_t i=0; i<Level.Length(); i+=Per)
+			{
+				DbTreeNode *n = new DbTreeNode(false);
+				for (size_t j=i; j<Level.Length() && j<i+Per; j++)
+				{
+					n->Items[n->Count] = Level[j]->Items[0];
+					n->Child[n->Count++] = Level[j];
+				}
+				Up.Add(n);
+			}
+			Level = Up;
+		}
+
+		Root = Level[0];
+		Items = e.Length();
+	}
+
+	/// Positions 'c' at the first entry >= 'e'
+	bool Seek(DbTreeIndex::Cursor &c, const DbTreeEntry &e)
+	{
+		DbTreeNode *n = Root;
+		while (!n->Leaf)
+			n = n->Child[ChildFor(n, e)];
+
+		c.Idx = LowerBound(n, e);
+		if (c.Idx >= n->Count)
+		{
+			n = n->Next;
+			c.Idx = 0;
+		}
+		c.Node = n;
+		return n != NULL;
+	}
+
+	DbTreeEntry *At(DbTreeIndex::Cursor &c)
+	{
+		DbTreeNode *n = (DbTreeNode*)c.Node;
+		return n && c.Idx < n->Count ? n->Items + c.Idx : NULL;
+	}
+
+	/// Adds rows from 'c' on while their value is <= 'Max'
+	size_t Collect(GArray<LDbRow*> &Rows, DbTreeIndex::Cursor &c, DbTreeEntry *Max)
+	{
+		size_t Start = Rows.Length();
+		for (DbTreeEntry *e; (e = At(c)); )
+		{
+			if (Max && CompareValue(*e, *Max) > 0)
+				break;
+			Rows.Add(e->Row);
+
+			DbTreeNode *n = (DbTreeNode*)c.Node;
+			if (++c.Idx >= n->Count)
+			{
+				c.Node = n->Next;
+				c.Idx = 0;
+			}
+		}
+		return Rows.Length() - Start;
+	}
+
+	bool Probe(DbTreeEntry &e, int64 i)
+	{
+		if (Fld.Type != GV_INT32 && Fld.Type != GV_INT64)
+		{
+			LgiAssert(!"Not an int index.");
+			return false;
+		}
+		e.Key = i;
+		e.Row = NULL;
+		return true;
+	}
+
+	bool Probe(DbTreeEntry &e, LDateTime &dt)
+	{
+		uint64 t;
+		if (Fld.Type != GV_DATETIME)
+		{
+			LgiAssert(!"Not a date index.");
+			return false;
+		}
+		e.Key = dt.IsValid() && dt.Get(t) ? t : 0;
+		e.Row = NULL;
+		return true;
+	}
+
+	bool Probe(DbTreeEntry &e, const char *s)
+	{
+		if (Fld.Type != GV_STRING)
+		{
+			LgiAssert(!"Not a string index.");
+			return false;
+		}
+		e.Str = s;
+		e.Row = NULL;
+		return true;
+	}
+
+	template<typename T>
+	size_t Range(GArray<LDbRow*> &Rows, T Min, T Max)
+	{
+		DbTreeEntry Lo, Hi;
+		DbTreeIndex::Cursor c;
+		if (!Probe(Lo, Min) ||
+			!Probe(Hi, Max) ||
+			!Seek(c, Lo))
+			return 0;
+
+		return Collect(Rows, c, &Hi);
+	}
+};
+
+DeclGArrayCompare(DbTreeCompare, DbTreeEntry, DbTreePriv)
+{
+	return param->Compare(*a, *b);
+}
+
+DbTreeIndex::DbTreeIndex(DbTablePriv *priv, LDbField &fld) : DbIndex(priv)
+{
+	t = new DbTreePriv(priv, fld);
+}
+
+DbTreeIndex::~DbTreeIndex()
+{
+	t->d->Trees.Delete(this);
+	DeleteObj(t);
+}
+
+bool DbTreeIndex::Build(GArray<LDbRow*> *Sorted)
+{
+	GArray<DbTreeEntry> e;
+	if (!e.Length(t->d->Rows))
+		return t->d->Rows == 0;
+
+	if (Sorted)
+	{
+		// Check the saved order is still right
+		for (size_t i=0; i<Sorted->Length(); i++)
+		{
+			e[i] = t->Make((*Sorted)[i]);
+			if (i && t->Compare(e[i-1], e[i]) >= 0)
+			{
+				Sorted = NULL;
+				break;
+			}
+		}
+	}
+
+	if (!Sorted)
+	{
+		int i = 0;
+		for (LDbRow *r = t->d->First; r; r = r->Next)
+			e[i++] = t->Make(r);
+		e.Sort(DbTreeCompare, t);
+	}
+
+	t->Build(e);
+	return true;
+}
+
+bool DbTreeIndex::OnNew(LDbRow *r)
+{
+	t->Add(r);
+	return true;
+}
+
+bool DbTreeIndex::OnDelete(LDbRow *r)
+{
+	return t->Remove(r);
+}
+
+bool DbTreeIndex::OnChange(LDbRow *r, int Id, bool Before)
+{
+	if (Id != t->Fld.Id)
+		return true;
+	if (Before)
+		return t->Remove(r);
+	t->Add(r);
+	return true;
+}
+
+LDbField &DbTreeIndex::GetField()
+{
+	return t->Fld;
+}
+
+size_t DbTreeIndex::Length()
+{
+	return t->Items;
+}
+
+bool DbTreeIndex::First(Cursor &c)
+{
+	DbTreeNode *n = t->Root;
+	while (!n->Leaf)
+		n = n->Child[0];
+	c.Node = n->Count ? n : NULL;
+	c.Idx = 0;
+	return c.Node != NULL;
+}
+
+bool DbTreeIndex::Last(Cursor &c)
+{
+	DbTreeNode *n = t->Root;
+	while (!n->Leaf)
+		n = n->Child[n->Count - 1];
+	c.Node = n->Count ? n : NULL;
+	c.Idx = n->Count - 1;
+	return c.Node != NULL;
+}
+
+bool DbTreeIndex::Next(Cursor &c)
+{
+	DbTreeNode *n = (DbTreeNode*)c.Node;
+	if (!n)
+		return false;
+	if (++c.Idx >= n->Count)
+	{
+		c.Node = n->Next;
+		c.Idx = 0;
+	}
+	return c.Node != NULL;
+}
+
+bool DbTreeIndex::Prev(Cursor &c)
+{
+	DbTreeNode *n = (DbTreeNode*)c.Node;
+	if (!n)
+		return false;
+	if (--c.Idx < 0)
+	{
+		c.Node = n = n->Prev;
+		c.Idx = n ? n->Count - 1 : 0;
+	}
+	return c.Node != NULL;
+}
+
+LDbRow *DbTreeIndex::Row(Cursor &c)
+{
+	DbTreeEntry *e = t->At(c);
+	return e ? e->Row : NULL;
+}
+
+bool DbTreeIndex::Seek(Cursor &c, int64 Value)
+{
+	DbTreeEntry e;
+	return t->Probe(e, Value) && t->Seek(c, e);
+}
+
+bool DbTreeIndex::Seek(Cursor &c, LDateTime &Value)
+{
+	DbTreeEntry e;
+	return t->Probe(e, Value) && t->Seek(c, e);
+}
+
+bool DbTreeIndex::Seek(Cursor &c, const char *Value)
+{
+	DbTreeEntry e;
+	return t->Probe(e, Value) && t->Seek(c, e);
+}
+
+size_t DbTreeIndex::Range(GArray<LDbRow*> &Rows, int64 Min, int64 Max)
+{
+	return t->Range(Rows, Min, Max);
+}
+
+size_t DbTreeIndex::Range(GArray<LDbRow*> &Rows, LDateTime &Min, LDateTime &Max)
+{
+	return t->Range<LDateTime&>(Rows, Min, Max);
+}
+
+size_t DbTreeIndex::Range(GArray<LDbRow*> &Rows, const char *Min, const char *Max)
+{
+	return t->Range(Rows, Min, Max);
+}
+
+size_t DbTreeIndex::Prefix(GArray<LDbRow*> &Rows, const char *Prefix)
+{
+	DbTreeEntry e;
+	Cursor c;
+	if (!Prefix ||
+		!t->Probe(e, Prefix) ||
+		!t->Seek(c, e))
+		return 0;
+
+	size_t Start = Rows.Length(), Len = strlen(Prefix);
+	for (DbTreeEntry *i; (i = t->At(c)) && !strnicmp(t->Str(*i), Prefix, Len); Next(c))
+		Rows.Add(i->Row);
+	return Rows.Length() - Start;
+}
+
+size_t DbTreeIndex::Get(GArray<LDbRow*> &Rows, bool Ascending)
+{
+	size_t Start = Rows.Length();
+	Cursor c;
+	if (Ascending)
+	{
+		if (First(c))
+			t->Collect(Rows, c, NULL);
+	}
+	else
+	{
+		for (bool b = Last(c); b; b = Prev(c))
+			Rows.Add(Row(c));
+	}
+	return Rows.Length() - Start;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////
 size_t LDbDate::Sizeof()
 {
@@ -443,6 +1192,7 @@ LDbRow::LDbRow(DbTablePriv *priv)
 	Next = NULL;
 	Prev = NULL;
 	Pos = -1;
+	Seq = 0;
 	Base.c = NULL;
 	Offsets[FixedOff] = d->FixedOffsets.AddressOf();
 	Offsets[VariableOff] = NULL;
@@ -504,7 +1254,7 @@ bool LDbRow::Compact()
 			if (b.Start > Pos)
 			{
 				// Move block down
-				memcpy(Base.c + Pos, Base.c + b.Start, b.Len);
+				memmove(Base.c + Pos, Base.c + b.Start, b.Len);
 				Offsets[VariableOff][b.Index] = Pos;
 				b.Start = Pos;
 			}
@@ -602,7 +1352,8 @@ char *LDbRow::GetStr(int id)
 	if (i.Index < 0 || i.Type != GV_STRING || !Base.c)
 		return NULL;
 	LgiAssert((unsigned)i.Index < d->Variable);
-	return Base.c + Offsets[VariableOff][i.Index];
+	int32 Off = Offsets[VariableOff][i.Index];
+	return Off < 0 ? NULL : Base.c + Off; // Not set yet
 }
 
 bool LDbRow::StartEdit()
@@ -631,7 +1382,7 @@ bool LDbRow::StartEdit()
 			if (d->Variable > 0)
 			{
 				// And the variable offset table to -1
-				memset(Base.c + 8 + d->FixedSz, 0xff, InitialSize - d->FixedSz);
+				memset(Base.c + 8 + d->FixedSz, 0xff, d->Variable * sizeof(uint32));
 			}
 		}
 
@@ -660,6 +1411,7 @@ Store3Status LDbRow::SetStr(int id, const char *str)
 	if (!StartEdit())
 		return Store3Error;
 
+	d->OnChange(this, id, true);
 	size_t len = str ? strlen(str) + 1 : 1;
 	Offsets[VariableOff][i.Index] = Edit.Length();
 	if (str)
@@ -668,6 +1420,7 @@ Store3Status LDbRow::SetStr(int id, const char *str)
 		Edit.Add((char*)"", 1);
 
 	PostEdit();
+	d->OnChange(this, id, false);
 	d->SetDirty();
 
 	return Store3Success;
@@ -689,24 +1442,19 @@ int64 LDbRow::GetInt(int id)
 Store3Status LDbRow::SetInt(int id, int64 val)
 {
 	Info i = d->Map.Find(id);
-	if (i.Index < 0)
+	if (i.Index < 0 || (i.Type != GV_INT32 && i.Type != GV_INT64))
 		return Store3Error;
 	if (!Base.c)
 		StartEdit();
 	GPointer p = { Base.s8 + Offsets[FixedOff][i.Index] };
+	d->OnChange(this, id, true);
 	if (i.Type == GV_INT32)
-	{
 		*p.s32 = (int32)val;
-		d->SetDirty();
-		return Store3Success;
-	}
-	if (i.Type == GV_INT64)
-	{
+	else
 		*p.s64 = val;
-		d->SetDirty();
-		return Store3Success;
-	}
-	return Store3Error;
+	d->OnChange(this, id, false);
+	d->SetDirty();
+	return Store3Success;
 }
 
 LDateTime *LDbRow::GetDate(int id)
@@ -735,7 +1483,9 @@ Store3Status LDbRow::SetDate(int id, LDateTime *dt)
 		return Store3Error;
 
 	LDbDate dd;
+	d->OnChange(this, id, true);
 	dd.Serialize(p, *dt, true);
+	d->OnChange(this, id, false);
 	d->SetDirty();
 	
 	return Store3Success;
@@ -852,6 +1602,7 @@ LDbRow *LDbTable::NewRow()
 		d->First = d->Last = r;
 		d->Rows = 1;
 	}
+	r->Seq = d->NextSeq++;
 
 	for (unsigned i=0; i<d->Indexes.Length(); i++)
 		d->Indexes[i]->OnNew(r);
@@ -872,6 +1623,7 @@ bool LDbTable::Empty()
 
 	d->First = d->Last = NULL;
 	d->Rows = 0;
+	d->NextSeq = 0;
 	d->Fixed = 0;
 	d->FixedSz = 0;
 	d->Variable = 0;
@@ -888,9 +1640,6 @@ bool LDbTable::DeleteRow(LDbRow *r)
 	if (!r || r->d != d)
 		return false;
 
-	for (unsigned i=0; i<d->Indexes.Length(); i++)
-		d->Indexes[i]->OnDelete(r);
-
 	return d->DeleteRow(r);
 }
 
@@ -924,6 +1673,54 @@ DbArrayIndex *LDbTable::Sort(int Id, bool Ascending)
 	return i;
 }
 
+DbTreeIndex *LDbTable::AddIndex(int Id)
+{
+	DbTreeIndex *i = GetIndex(Id);
+	if (i)
+		return i;
+
+	LDbField *f = d->FindField(Id);
+	if (!f ||
+		(f->Type != GV_INT32 &&
+		f->Type != GV_INT64 &&
+		f->Type != GV_STRING &&
+		f->Type != GV_DATETIME))
+		return NULL;
+
+	i = new DbTreeIndex(d, *f);
+	d->Indexes.Add(i);
+	d->Trees.Add(i);
+	if (!i->Build())
+	{
+		delete i;
+		return NULL;
+	}
+
+	d->SetDirty();
+	return i;
+}
+
+DbTreeIndex *LDbTable::GetIndex(int Id)
+{
+	for (unsigned i=0; i<d->Trees.Length(); i++)
+	{
+		if (d->Trees[i]->GetField().Id == Id)
+			return d->Trees[i];
+	}
+	return NULL;
+}
+
+bool LDbTable::DeleteIndex(int Id)
+{
+	DbTreeIndex *i = GetIndex(Id);
+	if (!i)
+		return false;
+
+	delete i;
+	d->SetDirty();
+	return true;
+}
+
 bool LDbTable::Serialize(const char *Path, bool Write)
 {
 	GFile f;
@@ -953,6 +1750,8 @@ bool LDbTable::Serialize(const char *Path, bool Write)
 				return false;
 		}
 
+		// Renumber the rows, this keeps their order in the indexes
+		d->NextSeq = 0;
 		for (LDbRow *r = d->First; r; r = r->Next)
 		{
 			// Fix the size before we write
@@ -961,7 +1760,12 @@ bool LDbTable::Serialize(const char *Path, bool Write)
 				r->Compact();
 			if (f.Write(r->Base.c, r->Size()) != r->Size())
 				return false;
+			r->Seq = d->NextSeq++;
 		}
+
+		f.Close();
+		if (!d->WriteIndexes(Path))
+			return false;
 	}
 	else
 	{
@@ -1023,8 +1827,11 @@ bool LDbTable::Serialize(const char *Path, bool Write)
 				d->First = d->Last = r;
 				d->Rows = 1;
 			}
+			r->Seq = d->NextSeq++;
 			p.c += p.u32[1];
 		}
+
+		d->ReadIndexes(Path);
 	}
 
 	return true;
@@ -1093,6 +1900,10 @@ bool LDbTable::UnitTests()
 		LgiTrace("\t%i: %i, %s, %s\n", (int)Id, (int)Int, s, s2);
 	}
 
+	// Saved with the table, and updated by the edits below
+	if (!t.AddIndex(TestInt32))
+		return false;
+
 	const char *File = "test.db";
 	t.Serialize(File, true);
 
@@ -1150,5 +1961,20 @@ bool LDbTable::UnitTests()
 		LgiTrace("\t%i: %i, %s, %s\n", (int)Id, (int)Int, s, s2);
 	}
 
+	DbTreeIndex *Idx = t.GetIndex(TestInt32);
+	if (!Idx || Idx->Length() != (size_t)t.GetRows())
+		return false;
+	GArray<LDbRow*> Rows;
+	Idx->Get(Rows);
+	for (unsigned i=1; i<Rows.Length(); i++)
+	{
+		if (Rows[i-1]->GetInt(TestInt32) > Rows[i]->GetInt(TestInt32))
+			return false;
+	}
+	Rows.Length(0);
+	if (Idx->Range(Rows, 3, 15) != 3 ||	// 3, 12, 15
+		Rows[0]->GetInt(TestInt32) != 3)
+		return false;
+
 	return true;
 }
\ No newline at end of file
@@ -15,6 +15,13 @@
 #include "GPixelRops.h"
 #include "GPalette.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ALPHA_SSE2		1
+#include <emmintrin.h>
+#else
+#define ALPHA_SSE2		0
+#endif
+
 // #define Div255(a)	DivLut[a]
 #define Div255(a)	((a)/255)
 
@@ -1818,3 +1825,237 @@ bool GdcApp8Alpha::Blt(GBmpMem *Src, GPalette *SPal, GBmpMem *SrcAlpha)
 	return false;
 }
 
+
+//////////////////////////////////////////////////////////////////////////////
+template<typename Pixel>
+void BlendCoverage16(uint8 *Dst, const uint8 *Coverage, int Px, GColour c)
+{
+	uchar *Lut = Div255Lut;
+	Pixel *d = (Pixel*)Dst;
+	Pixel *e = d + Px;
+	Pixel px;
+	px.r = c.r() >> 3;
+	px.g = c.g() >> 2;
+	px.b = c.b() >> 3;
+
+	if (!Coverage)
+	{
+		while (d < e)
+			*d++ = px;
+		return;
+	}
+
+	int r = c.r(), g = c.g(), b = c.b();
+	while (d < e)
+	{
+		REG uint8 a = *Coverage++;
+		if (a == 255)
+			*d = px;
+		else if (a)
+		{
+			REG uint8 oma = 255 - a;
+			d->r = Lut[(G5bitTo8bit(d->r) * oma) + (r * a)] >> 3;
+			d->g = Lut[(G6bitTo8bit(d->g) * oma) + (g * a)] >> 2;
+			d->b = Lut[(G5bitTo8bit(d->b) * oma) + (b * a)] >> 3;
+		}
+		d++;
+	}
+}
+
+template<typename Pixel>
+void BlendCoverage24(uint8 *Dst, const uint8 *Coverage, int Px, GColour c)
+{
+	uchar *Lut = Div255Lut;
+	Pixel *d = (Pixel*)Dst;
+	Pixel *e = d + Px;
+	REG uint8 r = c.r(), g = c.g(), b = c.b();
+
+	if (!Coverage)
+	{
+		while (d < e)
+		{
+			d->r = r;
+			d->g = g;
+			d->b = b;
+			d++;
+		}
+		return;
+	}
+
+	while (d < e)
+	{
+		REG uint8 a = *Coverage++;
+		if (a == 255)
+		{
+			d->r = r;
+			d->g = g;
+			d->b = b;
+		}
+		else if (a)
+		{
+			REG uint8 oma = 255 - a;
+			d->r = Lut[(d->r * oma) + (r * a)];
+			d->g = Lut[(d->g * oma) + (g * a)];
+			d->b = Lut[(d->b * oma) + (b * a)];
+		}
+		d++;
+	}
+}
+
+/// All four bytes of a 32 bit pixel are blended the same way, so 'Packed'
+/// is the colour laid out in the destination's byte order with the alpha
+/// (or pad) byte at 255. Fully covered pixels are set to 'Packed'. For the
+/// partly covered ones the bits set in 'Keep' (the alpha byte of an alpha
+/// surface) are left as they were in the destination.
+static void BlendCoverage32(uint8 *Dst, const uint8 *Coverage, int Px, uint32 Packed, uint32 Keep)
+{
+	uint32 *d = (uint32*)Dst;
+	uint32 *e = d + Px;
+
+	if (!Coverage)
+	{
+		while (d < e)
+			*d++ = Packed;
+		return;
+	}
+
+	#if ALPHA_SSE2
+	// 4 pixels at a time: d = (d * (255 - a) + c * a) / 255, rounded.
+	__m128i Zero = _mm_setzero_si128();
+	__m128i Max = _mm_set1_epi16(255);
+	__m128i Half = _mm_set1_epi16(128);
+	__m128i Col = _mm_unpacklo_epi8(_mm_set1_epi32((int)Packed), Zero);
+	__m128i Solid = _mm_set1_epi32((int)Packed);
+	__m128i KeepMask = _mm_set1_epi32((int)Keep);
+	__m128i Full = _mm_set1_epi32(-1);
+	while (e - d >= 4)
+	{
+		uint32 Cov4;
+		memcpy(&Cov4, Coverage, 4);
+		if (Cov4 == 0xffffffff)
+		{
+			_mm_storeu_si128((__m128i*)d, Solid);
+		}
+		else if (Cov4)
+		{
+			// Spread each coverage byte over its pixel's 4 bytes
+			__m128i a = _mm_cvtsi32_si128((int)Cov4);
+			a = _mm_unpacklo_epi8(a, a);
+			a = _mm_unpacklo_epi16(a, a);
+			__m128i aLo = _mm_unpacklo_epi8(a, Zero);
+			__m128i aHi = _mm_unpackhi_epi8(a, Zero);
+
+			__m128i Px4 = _mm_loadu_si128((__m128i*)d);
+			__m128i dLo = _mm_unpacklo_epi8(Px4, Zero);
+			__m128i dHi = _mm_unpackhi_epi8(Px4, Zero);
+
+			#define BlendHalf(dv, av) \
+				dv = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(dv, _mm_sub_epi16(Max, av)), \
+												 _mm_mullo_epi16(Col, av)), Half); \
+				dv = _mm_srli_epi16(_mm_add_epi16(dv, _mm_srli_epi16(dv, 8)), 8)
+			BlendHalf(dLo, aLo);
+			BlendHalf(dHi, aHi);
+			#undef BlendHalf
+
+			__m128i Out = _mm_packus_epi16(dLo, dHi);
+			if (Keep)
+			{
+				// Fully covered pixels take the colour's alpha as well
+				__m128i k = _mm_andnot_si128(_mm_cmpeq_epi32(a, Full), KeepMask);
+				Out = _mm_or_si128(_mm_and_si128(Px4, k), _mm_andnot_si128(k, Out));
+			}
+			_mm_storeu_si128((__m128i*)d, Out);
+		}
+
+		d += 4;
+		Coverage += 4;
+	}
+	#endif
+
+	uchar *Lut = Div255Lut;
+	uint8 *c = (uint8*)&Packed;
+	while (d < e)
+	{
+		REG uint8 a = *Coverage++;
+		if (a == 255)
+			*d = Packed;
+		else if (a)
+		{
+			REG uint8 oma = 255 - a;
+			uint32 Old = *d;
+			uint8 *p = (uint8*)d;
+			p[0] = Lut[(p[0] * oma) + (c[0] * a)];
+			p[1] = Lut[(p[1] * oma) + (c[1] * a)];
+			p[2] = Lut[(p[2] * oma) + (c[2] * a)];
+			p[3] = Lut[(p[3] * oma) + (c[3] * a)];
+			*d = (*d & ~Keep) | (Old & Keep);
+		}
+		d++;
+	}
+}
+
+template<typename Pixel>
+uint32 PackColour32(GColour c)
+{
+	uint32 Packed = 0xffffffff;
+	Pixel *p = (Pixel*)&Packed;
+	p->r = c.r();
+	p->g = c.g();
+	p->b = c.b();
+	return Packed;
+}
+
+template<typename Pixel>
+uint32 AlphaMask32()
+{
+	uint32 Mask = 0;
+	((Pixel*)&Mask)->a = 0xff;
+	return Mask;
+}
+
+bool LgiBlendCoverage(uint8 *Dst, GColourSpace DstCs, const uint8 *Coverage, int Px, GColour c)
+{
+	if (!Dst || Px <= 0)
+		return Dst != NULL;
+
+	switch (DstCs)
+	{
+		#define Case(name, sz) \
+			case Cs##name: \
+				BlendCoverage##sz<G##name>(Dst, Coverage, Px, c); \
+				break
+
+		Case(Rgb16, 16);
+		Case(Bgr16, 16);
+		Case(Rgb24, 24);
+		Case(Bgr24, 24);
+		#undef Case
+
+		#define Case(name) \
+			case Cs##name: \
+				BlendCoverage32(Dst, Coverage, Px, PackColour32<G##name>(c), 0); \
+				break
+
+		Case(Rgbx32);
+		Case(Bgrx32);
+		Case(Xrgb32);
+		Case(Xbgr32);
+		#undef Case
+
+		#define Case(name) \
+			case Cs##name: \
+				BlendCoverage32(Dst, Coverage, Px, PackColour32<G##name>(c), AlphaMask32<G##name>()); \
+				break
+
+		Case(Rgba32);
+		Case(Bgra32);
+		Case(Argb32);
+		Case(Abgr32);
+		#undef Case
+
+		default:
+			return false;
+	}
+
+	return true;
+}
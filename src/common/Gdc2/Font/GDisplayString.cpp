@@ -19,6 +19,7 @@
 
 #ifdef LGI_SDL
 #include "ftsynth.h"
+#include "ftoutln.h"
 #endif
 
 #if WINNATIVE
@@ -127,6 +128,7 @@ GDisplayString::GDisplayString(GFont *f, const char *s, ssize_t l, GSurface *pdc
 	LaidOut = 0;
 	AppendDots = 0;
 	VisibleTab = 0;
+	SharedHnd = 0;
 	
 	#if defined MAC && !defined COCOA && !defined(LGI_SDL)
 	
@@ -149,6 +151,7 @@ GDisplayString::GDisplayString(GFont *f, const char *s, ssize_t l, GSurface *pdc
 	
 	#elif defined __GTK_H__
 	
+		// Screen layouts are made in Layout, where they may come from the run cache
 		Hnd = 0;
 		LastTabOffset = -1;
 		if (Font && Str)
@@ -159,8 +162,6 @@ GDisplayString::GDisplayString(GFont *f, const char *s, ssize_t l, GSurface *pdc
 				Gtk::GtkPrintContext *PrintCtx = pDC ? pDC->GetPrintContext() : NULL;
 				if (PrintCtx)
 					Hnd = Gtk::gtk_print_context_create_pango_layout(PrintCtx);
-				else
-					Hnd = Gtk::pango_layout_new(GFontSystem::Inst()->GetContext());
 			}
 		}
 	
@@ -196,6 +197,7 @@ GDisplayString::GDisplayString(GFont *f, const char16 *s, ssize_t l, GSurface *p
 	LaidOut = 0;
 	AppendDots = 0;
 	VisibleTab = 0;
+	SharedHnd = 0;
 
 	#if defined MAC && !defined COCOA && !defined(LGI_SDL)
 	
@@ -216,13 +218,12 @@ GDisplayString::GDisplayString(GFont *f, const char16 *s, ssize_t l, GSurface *p
 	#elif defined __GTK_H__
 	
 		Hnd = 0;
+		LastTabOffset = -1;
 		if (Font && Str && len > 0)
 		{
 			Gtk::GtkPrintContext *PrintCtx = pDC ? pDC->GetPrintContext() : NULL;
 			if (PrintCtx)
 				Hnd = Gtk::gtk_print_context_create_pango_layout(PrintCtx);
-			else
-				Hnd = Gtk::pango_layout_new(GFontSystem::Inst()->GetContext());
 		}
 	
 	#endif
@@ -259,6 +260,7 @@ GDisplayString::GDisplayString(GFont *f, const uint32 *s, ssize_t l, GSurface *p
 	LaidOut = 0;
 	AppendDots = 0;
 	VisibleTab = 0;
+	SharedHnd = 0;
 }
 #endif
 
@@ -331,8 +333,533 @@ void GDisplayString::UpdateTabs(int Offset, int Size, bool Debug)
 		}
 	}
 }
+
+#if LGI_DSP_RUN_CACHE
+
+#define RUN_CACHE_MAX_ENTRIES		4096
+#define RUN_CACHE_MAX_BYTES			(8 << 20)
+#define RUN_CACHE_MAX_FONTS			64
+
+/// What a laid out string depends on
+struct GRunKey
+{
+	const char *Str;
+	ssize_t Len;
+	Gtk::PangoFontDescription *Desc;
+	bool Underline;
+	int TabSize, TabOffset; // Zero if there are no tabs
+	int64 Hash;
+
+	GRunKey(const char *s, ssize_t l, GFont *f, int Offset)
+	{
+		Str = s;
+		Len = l;
+		Desc = f->Handle();
+		Underline = f->Underline();
+		bool Tabs = memchr(s, '\t', l) != NULL;
+		TabSize = Tabs ? f->TabSize() : 0;
+		TabOffset = Tabs ? Offset : 0;
+
+		uint64 h = LHash<uint64, char>(s, l, true);
+		h = h * 31 + Gtk::pango_font_description_hash(Desc);
+		h = h * 31 + ((TabSize << 1) | Underline);
+		h = h * 31 + TabOffset;
+		Hash = (int64)h;
+		if (Hash == -1) // The hash table's null key
+			Hash = 0;
+	}
+};
+
+/// A layout shared by all the strings with the same key
+struct GShapedRun
+{
+	int64 Hash;
+	GAutoString Str;
+	ssize_t Len;
+	Gtk::PangoFontDescription *Desc; // Owned by the font's GRunFont
+	bool Underline;
+	int TabSize, TabOffset;
+
+	Gtk::PangoLayout *Hnd;
+	int X, XF, YF;
+	size_t Bytes;
+
+	// Least recently used list, the head is the most recent.
+	GShapedRun *Prev, *Next;
+
+	bool Is(GRunKey &k)
+	{
+		return	Len == k.Len &&
+				Underline == k.Underline &&
+				TabSize == k.TabSize &&
+				TabOffset == k.TabOffset &&
+				!memcmp(Str, k.Str, Len) &&
+				Gtk::pango_font_description_equal(Desc, k.Desc);
+	}
+};
+
+/// Each font gets a context of its own. A layout is laid out again whenever its
+/// context changes, and the shared context changes font for every string drawn.
+/// On a private context a cached layout is shaped once.
+struct GRunFont
+{
+	Gtk::PangoFontDescription *Desc;
+	Gtk::PangoContext *Ctx;
+	guint Hash;
+};
+
+class GShapedRunCache : public LMutex
+{
+	LHashTbl<IntKey<int64>, GShapedRun*> Map;
+	GArray<GRunFont*> Fonts;
+	GShapedRun *Head, *Tail;
+
+	void Unlink(GShapedRun *r)
+	{
+		if (r->Prev) r->Prev->Next = r->Next;
+		else Head = r->Next;
+		if (r->Next) r->Next->Prev = r->Prev;
+		else Tail = r->Prev;
+		r->Prev = r->Next = NULL;
+	}
+
+	void PushFront(GShapedRun *r)
+	{
+		r->Prev = NULL;
+		r->Next = Head;
+		if (Head) Head->Prev = r;
+		else Tail = r;
+		Head = r;
+	}
+
+	void Free(GShapedRun *r)
+	{
+		Unlink(r);
+		Map.Delete(r->Hash);
+		Stats.Entries--;
+		Stats.Bytes -= r->Bytes;
+		g_object_unref(r->Hnd);
+		delete r;
+	}
+
+	void Trim()
+	{
+		while (Tail && (Stats.Entries > MaxEntries || Stats.Bytes > MaxBytes))
+		{
+			Free(Tail);
+			Stats.Evictions++;
+		}
+	}
+
+public:
+	GDisplayString::RunCacheStats Stats;
+	size_t MaxEntries, MaxBytes;
+
+	GShapedRunCache() : LMutex("GShapedRunCache")
+	{
+		Head = Tail = NULL;
+		ZeroObj(Stats);
+		MaxEntries = RUN_CACHE_MAX_ENTRIES;
+		MaxBytes = RUN_CACHE_MAX_BYTES;
+	}
+
+	~GShapedRunCache()
+	{
+		Empty();
+		for (unsigned i=0; i<Fonts.Length(); i++)
+		{
+			GRunFont *f = Fonts[i];
+			g_object_unref(f->Ctx);
+			Gtk::pango_font_description_free(f->Desc);
+			delete f;
+		}
+	}
+
+	static GShapedRunCache *Inst();
+
+	void Empty()
+	{
+		while (Head)
+			Free(Head);
+	}
+
+	void SetLimits(size_t Entries, size_t Bytes)
+	{
+		MaxEntries = Entries;
+		MaxBytes = Bytes;
+		Trim();
+	}
+
+	/// \returns a new reference to the cached layout, or NULL.
+	Gtk::PangoLayout *Find(GRunKey &k, int &X, int &XF, int &YF)
+	{
+		GShapedRun *r = Map.Find(k.Hash);
+		if (!r || !r->Is(k))
+		{
+			Stats.Misses++;
+			return NULL;
+		}
+
+		Stats.Hits++;
+		Unlink(r);
+		PushFront(r);
+		X = r->X;
+		XF = r->XF;
+		YF = r->YF;
+		return (Gtk::PangoLayout*)g_object_ref(r->Hnd);
+	}
+
+	/// Adds a layout made on the font's context from GetFont.
+	bool Add(GRunKey &k, Gtk::PangoLayout *Hnd, int X, int XF, int YF)
+	{
+		GRunFont *f = GetFont(k.Desc);
+		if (!f || !MaxEntries)
+			return false;
+
+		GShapedRun *Old = Map.Find(k.Hash);
+		if (Old)
+			Free(Old); // Same hash, different text
+
+		GShapedRun *r = new GShapedRun;
+		r->Hash = k.Hash;
+		r->Str.Reset(NewStr(k.Str, k.Len));
+		r->Len = k.Len;
+		r->Desc = f->Desc;
+		r->Underline = k.Underline;
+		r->TabSize = k.TabSize;
+		r->TabOffset = k.TabOffset;
+		r->Hnd = (Gtk::PangoLayout*)g_object_ref(Hnd);
+		r->X = X;
+		r->XF = XF;
+		r->YF = YF;
+		// Roughly the glyph and cluster arrays plus the line and item structures
+		r->Bytes = sizeof(*r) + k.Len * 40 + 512;
+		r->Prev = r->Next = NULL;
+
+		Map.Add(r->Hash, r);
+		PushFront(r);
+		Stats.Entries++;
+		Stats.Bytes += r->Bytes;
+		Trim();
+		return true;
+	}
+
+	/// The private context for a font, or NULL if there are already too many fonts.
+	GRunFont *GetFont(Gtk::PangoFontDescription *Desc)
+	{
+		guint Hash = Gtk::pango_font_description_hash(Desc);
+		for (unsigned i=0; i<Fonts.Length(); i++)
+		{
+			GRunFont *f = Fonts[i];
+			if (f->Hash == Hash &&
+				Gtk::pango_font_description_equal(f->Desc, Desc))
+				return f;
+		}
+
+		if (Fonts.Length() >= RUN_CACHE_MAX_FONTS)
+			return NULL;
+
+		GFontSystem *FSys = GFontSystem::Inst();
+		Gtk::PangoContext *Ctx = Gtk::pango_cairo_font_map_create_context((Gtk::PangoCairoFontMap*)FSys->GetFontMap());
+		if (!Ctx)
+			return NULL;
+
+		GRunFont *f = new GRunFont;
+		f->Desc = Gtk::pango_font_description_copy(Desc);
+		f->Ctx = Ctx;
+		f->Hash = Hash;
+		Gtk::pango_context_set_font_description(f->Ctx, f->Desc);
+		Fonts.Add(f);
+		return f;
+	}
+};
+
+static LMutex RunCacheLock("RunCacheLock");
+static GAutoPtr<GShapedRunCache> RunCacheInst;
+
+GShapedRunCache *GShapedRunCache::Inst()
+{
+	if (!RunCacheInst && RunCacheLock.Lock(_FL))
+	{
+		if (!RunCacheInst)
+			RunCacheInst.Reset(new GShapedRunCache);
+		RunCacheLock.Unlock();
+	}
+
+	return RunCacheInst;
+}
+
+#endif
+#endif
+
+#if defined(LGI_SDL)
+
+#define GLYPH_ATLAS_SIZE			512	// Width and height of an atlas page
+#define GLYPH_ATLAS_MAX_PAGES		8
+#define GLYPH_SUBPIXEL_BITS			2	// Glyphs are positioned to a quarter pixel
+
+/// A rendered glyph in the atlas
+struct GAtlasGlyph
+{
+	int Page;		// -1 if the glyph has no pixels
+	int Ax, Ay;		// Position of the mask in the page
+	int Cx, Cy;		// Size of the mask
+	int Left, Top;	// Offset of the mask from the pen position and the baseline
+	int AdvanceF;	// 26.6 fixed point
+};
+
+/// 8 bit coverage masks of rendered glyphs, shelf packed into pages shared by
+/// all the fonts. A glyph is rendered once per font and sub-pixel offset, after
+/// that strings are laid out by copying masks. When the pages are full the whole
+/// atlas is emptied and refilled.
+class GGlyphAtlas : public LMutex
+{
+	struct Page
+	{
+		GArray<uint8> Px;
+		int ShelfX, ShelfY, ShelfHt;
+	};
+
+	LHashTbl<IntKey<int64>, GAtlasGlyph*> Map;
+	GArray<Page*> Pages;
+	GArray<OsFont> Fonts; // A font's id is its index + 1
+
+	bool Alloc(GAtlasGlyph *g)
+	{
+		if (g->Cx > GLYPH_ATLAS_SIZE || g->Cy > GLYPH_ATLAS_SIZE)
+			return false;
+
+		Page *p = Pages.Length() ? Pages.Last() : NULL;
+		if (p && p->ShelfX + g->Cx > GLYPH_ATLAS_SIZE)
+		{
+			// Start a new shelf
+			p->ShelfY += p->ShelfHt;
+			p->ShelfX = p->ShelfHt = 0;
+		}
+		if (!p || p->ShelfY + g->Cy > GLYPH_ATLAS_SIZE)
+		{
+			if (Pages.Length() >= GLYPH_ATLAS_MAX_PAGES)
+				return false;
+
+			p = new Page;
+			p->Px.Length(GLYPH_ATLAS_SIZE * GLYPH_ATLAS_SIZE);
+			p->ShelfX = p->ShelfY = p->ShelfHt = 0;
+			Pages.Add(p);
+			Stats.Bytes += p->Px.Length();
+		}
+
+		g->Page = (int)Pages.Length() - 1;
+		g->Ax = p->ShelfX;
+		g->Ay = p->ShelfY;
+		p->ShelfX += g->Cx;
+		p->ShelfHt = MAX(p->ShelfHt, g->Cy);
+		return true;
+	}
+
+public:
+	GDisplayString::RunCacheStats Stats;
+	int64 Generation; // Incremented each time the atlas is emptied
+
+	GGlyphAtlas() : LMutex("GGlyphAtlas")
+	{
+		ZeroObj(Stats);
+		Generation = 0;
+	}
+
+	~GGlyphAtlas()
+	{
+		Empty();
+	}
+
+	static GGlyphAtlas *Inst();
+
+	void Empty()
+	{
+		Map.DeleteObjects();
+		Map.Empty();
+		Pages.DeleteObjects();
+		Stats.Entries = 0;
+		Stats.Bytes = 0;
+		Generation++;
+	}
+
+	/// Frees the glyphs of a font that is going away.
+	void EmptyFont(OsFont Fnt)
+	{
+		ssize_t Idx = Fonts.IndexOf(Fnt);
+		if (Idx < 0)
+			return;
+
+		int64 Id = Idx + 1;
+		GArray<int64> Keys;
+		for (auto p : Map)
+		{
+			if ((p.key >> 32) == Id)
+				Keys.Add(p.key);
+		}
+		for (unsigned i=0; i<Keys.Length(); i++)
+		{
+			delete Map.Find(Keys[i]);
+			Map.Delete(Keys[i]);
+		}
+		Stats.Entries -= Keys.Length();
+		Fonts[Idx] = NULL;
+	}
+
+	int GetFontId(OsFont Fnt)
+	{
+		ssize_t Idx = Fonts.IndexOf(Fnt);
+		if (Idx < 0 && (Idx = Fonts.IndexOf((OsFont)NULL)) >= 0)
+			Fonts[Idx] = Fnt;
+		else if (Idx < 0)
+		{
+			Idx = Fonts.Length();
+			Fonts.Add(Fnt);
+		}
+		return (int)Idx + 1;
+	}
+
+	/// Gets a glyph, rendering it on a miss. The glyph is only valid until the
+	/// next call as that may empty the atlas (check Generation).
+	GAtlasGlyph *Get(OsFont Fnt, int FontId, FT_UInt Index, int SubPx, bool Italic)
+	{
+		int64 Key = ((int64)FontId << 32) | ((int64)Italic << 30) | ((int64)SubPx << 24) | (Index & 0xffffff);
+		GAtlasGlyph *g = Map.Find(Key);
+		if (g)
+		{
+			Stats.Hits++;
+			return g;
+		}
+
+		Stats.Misses++;
+		if (FT_Load_Glyph(Fnt, Index, FT_LOAD_FORCE_AUTOHINT))
+			return NULL;
+
+		FT_GlyphSlot Slot = Fnt->glyph;
+		if (Italic)
+			FT_GlyphSlot_Oblique(Slot);
+		if (SubPx && Slot->format == FT_GLYPH_FORMAT_OUTLINE)
+			FT_Outline_Translate(&Slot->outline, SubPx << (6 - GLYPH_SUBPIXEL_BITS), 0);
+		if (FT_Render_Glyph(Slot, FT_RENDER_MODE_NORMAL))
+			return NULL;
+
+		FT_Bitmap &bmp = Slot->bitmap;
+		g = new GAtlasGlyph;
+		g->Page = -1;
+		g->Ax = g->Ay = 0;
+		g->Cx = bmp.buffer ? bmp.width : 0;
+		g->Cy = bmp.buffer ? bmp.rows : 0;
+		g->Left = Slot->bitmap_left;
+		g->Top = Slot->bitmap_top;
+		g->AdvanceF = (int)Slot->metrics.horiAdvance;
+
+		if (g->Cx > 0 && g->Cy > 0)
+		{
+			if (!Alloc(g))
+			{
+				Empty();
+				if (!Alloc(g))
+					g->Cx = g->Cy = 0; // Too big to cache, draw nothing
+			}
+
+			if (g->Page >= 0)
+			{
+				uint8 *Px = Pages[g->Page]->Px.AddressOf();
+				for (int y=0; y<g->Cy; y++)
+					memcpy(Px + ((g->Ay + y) * GLYPH_ATLAS_SIZE) + g->Ax, bmp.buffer + (y * bmp.pitch), g->Cx);
+			}
+		}
+
+		Map.Add(Key, g);
+		Stats.Entries++;
+		return g;
+	}
+
+	/// The mask pixels of row 'y' of the glyph
+	uint8 *GetRow(GAtlasGlyph *g, int y)
+	{
+		return Pages[g->Page]->Px.AddressOf() + ((g->Ay + y) * GLYPH_ATLAS_SIZE) + g->Ax;
+	}
+};
+
+static LMutex GlyphAtlasLock("GlyphAtlasLock");
+static GAutoPtr<GGlyphAtlas> GlyphAtlasInst;
+
+GGlyphAtlas *GGlyphAtlas::Inst()
+{
+	if (!GlyphAtlasInst && GlyphAtlasLock.Lock(_FL))
+	{
+		if (!GlyphAtlasInst)
+			GlyphAtlasInst.Reset(new GGlyphAtlas);
+		GlyphAtlasLock.Unlock();
+	}
+
+	return GlyphAtlasInst;
+}
+
+void GDisplayString::EmptyGlyphCache(OsFont Fnt)
+{
+	GGlyphAtlas *a = GlyphAtlasInst; // Don't create it just to empty it
+	if (a && a->Lock(_FL))
+	{
+		a->EmptyFont(Fnt);
+		a->Unlock();
+	}
+}
+
 #endif
 
+void GDisplayString::GetRunCacheStats(RunCacheStats &s)
+{
+	ZeroObj(s);
+	#if defined(__GTK_H__) && LGI_DSP_RUN_CACHE
+	GShapedRunCache *c = GShapedRunCache::Inst();
+	if (c && c->Lock(_FL))
+	{
+		s = c->Stats;
+		c->Unlock();
+	}
+	#elif defined(LGI_SDL)
+	GGlyphAtlas *a = GGlyphAtlas::Inst();
+	if (a && a->Lock(_FL))
+	{
+		s = a->Stats;
+		a->Unlock();
+	}
+	#endif
+}
+
+void GDisplayString::SetRunCacheLimits(size_t MaxEntries, size_t MaxBytes)
+{
+	#if defined(__GTK_H__) && LGI_DSP_RUN_CACHE
+	GShapedRunCache *c = GShapedRunCache::Inst();
+	if (c && c->Lock(_FL))
+	{
+		c->SetLimits(MaxEntries, MaxBytes);
+		c->Unlock();
+	}
+	#endif
+}
+
+void GDisplayString::EmptyRunCache()
+{
+	#if defined(__GTK_H__) && LGI_DSP_RUN_CACHE
+	GShapedRunCache *c = GShapedRunCache::Inst();
+	if (c && c->Lock(_FL))
+	{
+		c->Empty();
+		c->Unlock();
+	}
+	#elif defined(LGI_SDL)
+	GGlyphAtlas *a = GGlyphAtlas::Inst();
+	if (a && a->Lock(_FL))
+	{
+		a->Empty();
+		a->Unlock();
+	}
+	#endif
+}
+
 void GDisplayString::DrawWhiteSpace(GSurface *pDC, char Ch, GRect &r)
 {
 	if (Ch == '\t')
@@ -363,124 +890,119 @@ void GDisplayString::Layout(bool Debug)
 	#if defined(LGI_SDL)
     
 		FT_Face Fnt = Font->Handle();
-		FT_Error error;
-		
 		if (!Fnt || !Str)
 			return;
-		
-		// Create an array of glyph indexes
-		GArray<uint32> Glyphs;
-		for (OsChar *s = Str; *s; s++)
+
+		GGlyphAtlas *Atlas = GGlyphAtlas::Inst();
+		if (!Atlas || !Atlas->Lock(_FL))
+			return;
+
+		struct Placed
 		{
-			FT_UInt index = FT_Get_Char_Index(Fnt, *s);
-			if (index)
-				Glyphs.Add(index);
-		}
+			GAtlasGlyph g;
+			int Px, Py;
+		};
+		GArray<Placed> Glyphs;
+		int FontId = Atlas->GetFontId(Fnt);
+		int Ascent = (int) Font->Ascent();
+		bool IsItalic = Font->Italic();
+		bool Kerning = FT_HAS_KERNING(Fnt) != 0;
+		int CurX = 0;
+		bool Stable = false;
 		
-		// Measure the string...
-		GdcPt2 Sz;
-		int FontHt = Font->GetHeight();
-		int AscentF = (int) (Font->Ascent() * FScale);
-		int LoadMode = FT_LOAD_FORCE_AUTOHINT;
-		for (unsigned i=0; i<Glyphs.Length(); i++)
+		for (int Pass=0; Pass<2 && !Stable; Pass++)
 		{
-			error = FT_Load_Glyph(Fnt, Glyphs[i], LoadMode);
-			if (error == 0)
+			// Place the glyphs, the atlas may be emptied part way through
+			// (when it fills up) in which case go around again.
+			int64 Gen = Atlas->Generation;
+			FT_UInt Prev = 0;
+			Glyphs.Length(0);
+			CurX = 0;
+			for (OsChar *s = Str; *s; s++)
 			{
-				int PyF = AscentF - Fnt->glyph->metrics.horiBearingY;
+				FT_UInt Index = FT_Get_Char_Index(Fnt, *s);
+				if (!Index)
+					continue;
+
+				if (Prev && Kerning)
+				{
+					FT_Vector k;
+					if (!FT_Get_Kerning(Fnt, Prev, Index, FT_KERNING_DEFAULT, &k))
+						CurX += k.x;
+				}
+				Prev = Index;
 
-				Sz.x += Fnt->glyph->metrics.horiAdvance;
-				Sz.y = MAX(Sz.y, PyF + Fnt->glyph->metrics.height);
+				int SubPx = (CurX & (FScale - 1)) >> (FShift - GLYPH_SUBPIXEL_BITS);
+				GAtlasGlyph *g = Atlas->Get(Fnt, FontId, Index, SubPx, IsItalic);
+				if (!g)
+					continue;
+
+				if (g->Cx > 0)
+				{
+					Placed &p = Glyphs.New();
+					p.g = *g;
+					p.Px = (CurX >> FShift) + g->Left;
+					p.Py = Ascent - g->Top;
+				}
+				CurX += g->AdvanceF;
 			}
+
+			Stable = Gen == Atlas->Generation;
+		}
+
+		if (!Stable)
+		{
+			// The string's glyphs don't all fit in the atlas at once, the
+			// earlier ones point at pages that have been reused.
+			LgiTrace("%s:%i - Glyph atlas emptied twice laying out the string.\n", _FL);
+			Glyphs.Length(0);
 		}
 		
-		// Create the memory context to draw into
-		xf = Sz.x;
-		x = ((Sz.x + FScale - 1) >> FShift) + 1;
-		yf = FontHt << FShift;
-		y = FontHt; // ((Sz.y + FScale - 1) >> FShift) + 1;
-		
+		xf = CurX;
+		x = ((CurX + FScale - 1) >> FShift) + 1;
+		y = Font->GetHeight();
+		yf = y << FShift;
+
+		// Copy the glyph masks into the string's image
 		if (Img.Reset(new GMemDC(x, y, CsIndex8)))
 		{
-			// Clear the context to black
 			Img->Colour(0);
 			Img->Rectangle();
 
-			bool IsItalic = Font->Italic();
-			
-			int CurX = 0;
-			int FBaseline = Fnt->size->metrics.ascender;
+			GRect Bounds(0, 0, Img->X()-1, Img->Y()-1);
 			for (unsigned i=0; i<Glyphs.Length(); i++)
 			{
-				error = FT_Load_Glyph(Fnt, Glyphs[i], LoadMode);
-				if (error == 0)
+				Placed &p = Glyphs[i];
+				GRect Gr(p.Px, p.Py, p.Px + p.g.Cx - 1, p.Py + p.g.Cy - 1);
+				GRect Vis = Gr;
+				Vis.Bound(&Bounds);
+				if (!Vis.Valid())
+					continue;
+
+				for (int y=Vis.y1; y<=Vis.y2; y++)
 				{
-					if (IsItalic)
-						FT_GlyphSlot_Oblique(Fnt->glyph);
-
-					error = FT_Render_Glyph(Fnt->glyph, FT_RENDER_MODE_NORMAL);
-					if (error == 0)
+					uint8 *in = Atlas->GetRow(&p.g, y - Gr.y1) + (Vis.x1 - Gr.x1);
+					uint8 *out = (*Img)[y] + Vis.x1;
+					for (int n=Vis.X(); n>0; n--, in++, out++)
 					{
-						FT_Bitmap &bmp = Fnt->glyph->bitmap;
-						if (bmp.buffer)
-						{
-							// Copy rendered glyph into our image memory
-							int Px = (CurX + (FScale >> 1)) >> FShift;
-							int PyF = AscentF - Fnt->glyph->metrics.horiBearingY;
-							int Py = PyF >> FShift;
-							int Skip = 0;
-							
-							if (Fnt->glyph->format == FT_GLYPH_FORMAT_BITMAP)
-							{
-								Px += Fnt->glyph->bitmap_left;
-								Skip = Fnt->glyph->bitmap_left < 0 ? -Fnt->glyph->bitmap_left : 0;
-								Py = (AscentF >> FShift) - Fnt->glyph->bitmap_top;
-							}
-							
-							LgiAssert(Px + bmp.width <= Img->X());
-							for (int y=0; y<bmp.rows; y++)
-							{
-								uint8 *in = bmp.buffer + (y * bmp.pitch);
-								uint8 *out = (*Img)[Py+y];
-								if (out)
-								{
-									LgiAssert(Px+Skip >= 0);
-									out += Px+Skip;
-									memcpy(out, in+Skip, bmp.width-Skip);
-								}
-								/*
-								else
-								{
-									LgiAssert(!"No scanline?");
-									break;
-								}
-								*/
-							}
-						}
-						
-						if (i < Glyphs.Length() - 1)
-						{
-							FT_Vector kerning;
-							FT_Get_Kerning(Fnt, Glyphs[i], Glyphs[i+1], FT_KERNING_DEFAULT, &kerning);
-							CurX += Fnt->glyph->metrics.horiAdvance + kerning.x;
-						}
-						else
-						{
-							CurX += Fnt->glyph->metrics.horiAdvance;
-						}
+						// Glyphs can overlap, keep the most coverage
+						if (*in > *out)
+							*out = *in;
 					}
 				}
 			}
 		}
 		else LgiTrace("::Layout Create MemDC failed\n");
+
+		Atlas->Unlock();
     
 	#elif defined(__GTK_H__)
 	
 		y = Font->GetHeight();
 		yf = y * PANGO_SCALE;
-		if (!Hnd || !Font->Handle())
+		if (!Str || len <= 0 || !Font->Handle())
 		{
-			// LgiTrace("%s:%i - Missing handle: %p,%p\n", _FL, Hnd, Font->Handle());
+			// LgiTrace("%s:%i - Missing handle: %p,%p\n", _FL, Str, Font->Handle());
 			return;
 		}
 
@@ -491,12 +1013,48 @@ void GDisplayString::Layout(bool Debug)
 		}
 
 		GFontSystem *FSys = GFontSystem::Inst();
-		Gtk::pango_context_set_font_description(FSys->GetContext(), Font->Handle());
 
 		int TabSizePx = Font->TabSize();
 		int TabSizeF = TabSizePx * FScale;
 		int TabOffsetF = DrawOffsetF % TabSizeF;
 		int OffsetF = TabOffsetF ? TabSizeF - TabOffsetF : 0;
+
+		#if LGI_DSP_RUN_CACHE
+		// Print layouts are made up front, everything else can come from the cache.
+		GShapedRunCache *Cache = Hnd ? NULL : GShapedRunCache::Inst();
+		GRunKey Key(Str, len, Font, OffsetF / FScale);
+		Gtk::PangoContext *RunCtx = NULL;
+		if (Cache && Cache->Lock(_FL))
+		{
+			int Cx = 0;
+			Hnd = Cache->Find(Key, Cx, xf, yf);
+			if (Hnd)
+			{
+				x = Cx;
+				SharedHnd = 1;
+			}
+			else
+			{
+				GRunFont *f = Cache->GetFont(Key.Desc);
+				if (f)
+					RunCtx = f->Ctx;
+			}
+			Cache->Unlock();
+
+			if (Hnd)
+				return;
+		}
+
+		if (!Hnd)
+			Hnd = Gtk::pango_layout_new(RunCtx ? RunCtx : FSys->GetContext());
+		#else
+		if (!Hnd)
+			Hnd = Gtk::pango_layout_new(FSys->GetContext());
+		#endif
+		if (!Hnd)
+			return;
+
+		Gtk::pango_context_set_font_description(FSys->GetContext(), Font->Handle());
 		/*
 		if (Debug)
 		{
@@ -523,6 +1081,14 @@ void GDisplayString::Layout(bool Debug)
 		Gtk::pango_layout_set_text(Hnd, Str, len);
 		Gtk::pango_layout_get_size(Hnd, &xf, &yf);
 		x = (xf + PANGO_SCALE - 1) / PANGO_SCALE;
+
+		#if LGI_DSP_RUN_CACHE
+		if (RunCtx && Cache->Lock(_FL))
+		{
+			SharedHnd = Cache->Add(Key, Hnd, x, xf, yf);
+			Cache->Unlock();
+		}
+		#endif
 		#if 1
 		y = Font->GetHeight();
 		#else
@@ -857,6 +1423,17 @@ void GDisplayString::TruncateWithDots(int Width)
 	    
 	if (Hnd)
 	{
+		if (SharedHnd)
+		{
+			// Don't change the cached layout
+			Gtk::PangoLayout *Own = Gtk::pango_layout_copy(Hnd);
+			g_object_unref(Hnd);
+			Hnd = Own;
+			SharedHnd = 0;
+			if (!Hnd)
+				return;
+		}
+
 		Gtk::pango_layout_set_ellipsize(Hnd, Gtk::PANGO_ELLIPSIZE_END);
 		Gtk::pango_layout_set_width(Hnd, Width * PANGO_SCALE);
 	}
@@ -1246,336 +1823,32 @@ GdcPt2 GDisplayString::Size()
 
 #if defined LGI_SDL
 
-template<typename OutPx>
-bool CompositeText8Alpha(GSurface *Out, GSurface *In, GFont *Font, int px, int py, GBlitRegions &Clip)
-{
-	OutPx map[256];
-
-	if (!Out || !In || !Font)
-		return false;
-
-	// FIXME, do blt clipping here...
-
-	// Create colour map of the foreground/background colours		
-	uint8 *Div255 = Div255Lut;
-	GColour fore = Font->Fore();
-	GRgb24 fore_px;
-	fore_px.r = fore.r();
-	fore_px.g = fore.g();
-	fore_px.b = fore.b();
-	if (Font->Transparent())
-	{
-		for (int a=0; a<256; a++)
-		{
-			map[a].r = Div255[a * fore_px.r];
-			map[a].g = Div255[a * fore_px.g];
-			map[a].b = Div255[a * fore_px.b];
-			map[a].a = a;
-		}
-	}
-	else
-	{
-		GColour back = Font->Back();
-		GRgb24 back_px;
-		back_px.r = back.r();
-		back_px.g = back.g();
-		back_px.b = back.b();
-
-		for (int a=0; a<256; a++)
-		{
-			int oma = 255 - a;
-			map[a].r = (oma * back_px.r) + (a * fore_px.r) / 255;
-			map[a].g = (oma * back_px.g) + (a * fore_px.g) / 255;
-			map[a].b = (oma * back_px.b) + (a * fore_px.b) / 255;
-			map[a].a = 255;
-		}
-	}
-
-	uint8 *StartOfBuffer = (*Out)[0];
-	uint8 *EndOfBuffer = StartOfBuffer + (Out->GetRowStep() * Out->Y());
-
-	for (unsigned y=Clip.SrcClip.y1; y<=Clip.SrcClip.y2; y++)
-	{
-		OutPx *d = ((OutPx*) (*Out)[py + y]) + Clip.DstClip.x1;
-		uint8 *i = (*In)[y];
-		if (!i) return false;
-		uint8 *e = i + Clip.DstClip.X();
-
-		LgiAssert((uint8*)d >= StartOfBuffer);
-		
-		if (Font->Transparent())
-		{
-			uint8 a, o;
-			OutPx *s;
-			
-			while (i < e)
-			{
-				// Alpha blend map and output pixel
-				a = *i++;
-				switch (a)
-				{
-					case 0:
-						break;
-					case 255:
-						// Copy
-						*d = map[a];
-						break;
-					default:
-						// Blend
-						o = 255 - a;
-						s = map + a;
-						#define NonPreMulOver32NoAlpha(c)		d->c = ((s->c * a) + (Div255[d->c * 255] * o)) / 255
-						NonPreMulOver32NoAlpha(r);
-						NonPreMulOver32NoAlpha(g);
-						NonPreMulOver32NoAlpha(b);
-						break;
-				}
-				d++;
-			}
-		}
-		else
-		{
-			while (i < e)
-			{
-				// Copy rop
-				*d++ = map[*i++];
-			}
-		}
-
-		LgiAssert((uint8*)d <= EndOfBuffer);
-	}
-	
-	return true;
-}
-
-template<typename OutPx>
-bool CompositeText8NoAlpha(GSurface *Out, GSurface *In, GFont *Font, int px, int py, GBlitRegions &Clip)
+/// Blends the string's coverage image into 'Out' in the font's colours
+bool CompositeText(GSurface *Out, GSurface *In, GFont *Font, GBlitRegions &Clip)
 {
-	GRgba32 map[256];
-
 	if (!Out || !In || !Font)
 		return false;
 
-	// FIXME, do blt clipping here...
-
-	// Create colour map of the foreground/background colours		
-	uint8 *DivLut = Div255Lut;
-	GColour fore = Font->Fore();
-	GRgb24 fore_px;
-	fore_px.r = fore.r();
-	fore_px.g = fore.g();
-	fore_px.b = fore.b();
-	if (Font->Transparent())
-	{
-		for (int a=0; a<256; a++)
-		{
-			map[a].r = DivLut[a * fore_px.r];
-			map[a].g = DivLut[a * fore_px.g];
-			map[a].b = DivLut[a * fore_px.b];
-			map[a].a = a;
-		}
-	}
-	else
-	{
-		GColour back = Font->Back();
-		GRgb24 back_px;
-		back_px.r = back.r();
-		back_px.g = back.g();
-		back_px.b = back.b();
-
-		for (int a=0; a<256; a++)
-		{
-			int oma = 255 - a;
-			map[a].r = DivLut[(oma * back_px.r) + (a * fore_px.r)];
-			map[a].g = DivLut[(oma * back_px.g) + (a * fore_px.g)];
-			map[a].b = DivLut[(oma * back_px.b) + (a * fore_px.b)];
-			map[a].a = 255;
-		}
-	}
-
-	uint8 *StartOfBuffer = (*Out)[0];
-	uint8 *EndOfBuffer = StartOfBuffer + (Out->GetRowStep() * Out->Y());
+	GColourSpace Cs = Out->GetColourSpace();
+	int Bytes = GColourSpaceToBits(Cs) >> 3;
+	int Px = Clip.DstClip.X();
+	GColour Fore = Font->Fore();
+	GColour Back = Font->Back();
+	bool Opaque = !Font->Transparent();
 
-	for (int y=Clip.SrcClip.y1; y<=Clip.SrcClip.y2; y++)
+	for (int y=0; y<Clip.DstClip.Y(); y++)
 	{
-		OutPx *dst = (OutPx*) (*Out)[py + y];
-		if (!dst)
-			continue;
-		dst += Clip.DstClip.x1;
-		if ((uint8*)dst < StartOfBuffer)
+		uint8 *d = (*Out)[Clip.DstClip.y1 + y];
+		uint8 *s = (*In)[Clip.SrcClip.y1 + y];
+		if (!d || !s)
 			continue;
-		
-		uint8 *i = (*In)[y];
-		if (!i) return false;
-		uint8 *e = i + Clip.DstClip.X();
-		GRgba32 *src;
+		d += Clip.DstClip.x1 * Bytes;
+		s += Clip.SrcClip.x1;
 
-		LgiAssert((uint8*)dst >= StartOfBuffer);
-		
-		if (Font->Transparent())
-		{
-			uint8 a, oma;
-			
-			while (i < e)
-			{
-				// Alpha blend map and output pixel
-				a = *i++;
-				src = map + a;
-				switch (a)
-				{
-					case 0:
-						break;
-					case 255:
-						// Copy
-						dst->r = src->r;
-						dst->g = src->g;
-						dst->b = src->b;
-						break;
-					default:
-						// Blend
-						OverPm32toPm24(src, dst);
-						break;
-				}
-				dst++;
-			}
-		}
-		else
-		{
-			while (i < e)
-			{
-				// Copy rop
-				src = map + *i++;
-				dst->r = src->r;
-				dst->g = src->g;
-				dst->b = src->b;
-				dst++;
-			}
-		}
-
-		LgiAssert((uint8*)dst <= EndOfBuffer);
-	}
-	
-	return true;
-}
-
-template<typename OutPx>
-bool CompositeText5NoAlpha(GSurface *Out, GSurface *In, GFont *Font, int px, int py, GBlitRegions &Clip)
-{
-	OutPx map[256];
-
-	if (!Out || !In || !Font)
-		return false;
-
-	// FIXME, do blt clipping here...
-	#define MASK_5BIT 0x1f
-	#define MASK_6BIT 0x3f
-
-	// Create colour map of the foreground/background colours		
-	uint8 *Div255 = Div255Lut;
-	GColour fore = Font->Fore();
-	GRgb24 fore_px;
-	fore_px.r = fore.r();
-	fore_px.g = fore.g();
-	fore_px.b = fore.b();
-	if (Font->Transparent())
-	{
-		for (int a=0; a<256; a++)
-		{
-			map[a].r = (int)Div255[a * fore_px.r] >> 3;
-			map[a].g = (int)Div255[a * fore_px.g] >> 2;
-			map[a].b = (int)Div255[a * fore_px.b] >> 3;
-		}
-	}
-	else
-	{
-		GColour back = Font->Back();
-		GRgb24 back_px;
-		back_px.r = back.r();
-		back_px.g = back.g();
-		back_px.b = back.b();
-
-		for (int a=0; a<256; a++)
-		{
-			int oma = 255 - a;
-			map[a].r = Div255[(oma * back_px.r) + (a * fore_px.r)] >> 3;
-			map[a].g = Div255[(oma * back_px.g) + (a * fore_px.g)] >> 2;
-			map[a].b = Div255[(oma * back_px.b) + (a * fore_px.b)] >> 3;
-		}
-	}
-
-	uint8 *StartOfBuffer = (*Out)[0];
-	uint8 *EndOfBuffer = StartOfBuffer + (Out->GetRowStep() * Out->Y());
-
-	for (unsigned y=Clip.SrcClip.y1; y<=Clip.SrcClip.y2; y++)
-	{
-		OutPx *dst = ((OutPx*) (*Out)[py + y]);
-		if (!dst)
-			continue;
-		dst += Clip.DstClip.x1;
-		uint8 *i = (*In)[y];
-		if (!i) return false;
-		uint8 *e = i + Clip.DstClip.X();
-
-		LgiAssert((uint8*)dst >= StartOfBuffer);
-		
-		if (Font->Transparent())
-		{
-			uint8 a;
-			OutPx *src;
-			
-			while (i < e)
-			{
-				// Alpha blend map and output pixel
-				a = *i++;
-				switch (a)
-				{
-					case 0:
-						break;
-					case 255:
-						// Copy
-						*dst = map[a];
-						break;
-					default:
-					{
-						// Blend
-						#if 0
-						uint8 oma = 255 - a;
-						src = map + a;
-						GRgb24 d = { G5bitTo8bit(dst->r),
-									 G6bitTo8bit(dst->g),
-									 G5bitTo8bit(dst->b)};
-						GRgb24 s = { G5bitTo8bit(src->r),
-									 G6bitTo8bit(src->g),
-									 G5bitTo8bit(src->b)};
-						dst->r = Div255[(oma * d.r) + (a * s.r)] >> 3;
-						dst->g = Div255[(oma * d.g) + (a * s.g)] >> 2;
-						dst->b = Div255[(oma * d.b) + (a * s.b)] >> 3;
-						#else
-						uint8 a5 = a >> 3;
-						uint8 a6 = a >> 2;
-						uint8 oma5 = MASK_5BIT - a5;
-						uint8 oma6 = MASK_6BIT - a6;
-						src = map + a;
-						dst->r = ((oma5 * (uint8)dst->r) + (a5 * (uint8)src->r)) / MASK_5BIT;
-						dst->g = ((oma6 * (uint8)dst->g) + (a6 * (uint8)src->g)) / MASK_6BIT;
-						dst->b = ((oma5 * (uint8)dst->b) + (a5 * (uint8)src->b)) / MASK_5BIT;
-						#endif
-						break;
-					}
-				}
-				dst++;
-			}
-		}
-		else
-		{
-			while (i < e)
-			{
-				// Copy rop
-				*dst++ = map[*i++];
-			}
-		}
-		
-		LgiAssert((uint8*)dst <= EndOfBuffer);
+		if (Opaque && !LgiBlendCoverage(d, Cs, NULL, Px, Back))
+			return false;
+		if (!LgiBlendCoverage(d, Cs, s, Px, Fore))
+			return false;
 	}
 	
 	return true;
@@ -1614,33 +1887,10 @@ void GDisplayString::Draw(GSurface *pDC, int px, int py, GRect *r, bool Debug)
 		int Ox = 0, Oy = 0;
 		pDC->GetOrigin(Ox, Oy);
 		GBlitRegions Clip(pDC, px-Ox, py-Oy, Img, r);
-		GColourSpace DstCs = pDC->GetColourSpace();
-		switch (DstCs)
+		if (Clip.Valid() && !CompositeText(pDC, Img, Font, Clip))
 		{
-			#define DspStrCase(px_fmt, comp)											\
-				case Cs##px_fmt:														\
-					CompositeText##comp<G##px_fmt>(pDC, Img, Font, px-Ox, py-Oy, Clip);	\
-					break;
-			
-			DspStrCase(Rgb16, 5NoAlpha)
-			DspStrCase(Bgr16, 5NoAlpha)
-
-			DspStrCase(Rgb24, 8NoAlpha)
-			DspStrCase(Bgr24, 8NoAlpha)
-			DspStrCase(Rgbx32, 8NoAlpha)
-			DspStrCase(Bgrx32, 8NoAlpha)
-			DspStrCase(Xrgb32, 8NoAlpha)
-			DspStrCase(Xbgr32, 8NoAlpha)
-			DspStrCase(Rgba32, 8Alpha)
-			DspStrCase(Bgra32, 8Alpha)
-			DspStrCase(Argb32, 8Alpha)
-			DspStrCase(Abgr32, 8Alpha)
-			default:
-				LgiTrace("%s:%i - GDisplayString::Draw Unsupported colour space.\n", _FL);
-				// LgiAssert(!"Unsupported colour space.");
-				break;
-			
-			#undef DspStrCase
+			LgiTrace("%s:%i - GDisplayString::Draw Unsupported colour space.\n", _FL);
+			// LgiAssert(!"Unsupported colour space.");
 		}
 	}
 	else
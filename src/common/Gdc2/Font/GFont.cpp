@@ -579,6 +579,7 @@ bool GFont::Destroy()
 	if (d->hFont)
 	{
 		#if LGI_SDL
+			GDisplayString::EmptyGlyphCache(d->hFont);
 			FT_Done_Face(d->hFont);
 		#elif defined(WIN32)
 			DeleteObject(d->hFont);
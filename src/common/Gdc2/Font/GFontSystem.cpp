@@ -551,6 +551,25 @@ GFont *GFontSystem::GetBestFont(char *Str)
 	return MatchingFont;
 }
 
+// Points the code points in 'Map' that no font has yet at font 'Index'.
+// Glyph maps are mostly empty, so whole bytes are skipped at a time.
+static void AddGlyphsToLut(uchar *Lut, uchar *Map, uchar Index)
+{
+	for (int b=0; b<(MAX_UNICODE + 1) >> 3; b++)
+	{
+		uchar Bits = Map[b];
+		if (!Bits)
+			continue;
+
+		uchar *l = Lut + (b << 3);
+		for (int i=0; Bits; i++, Bits >>= 1)
+		{
+			if ((Bits & 1) && !l[i])
+				l[i] = Index;
+		}
+	}
+}
+
 GFont *GFontSystem::GetGlyph(int u, GFont *UserFont)
 {
 	if (u > MAX_UNICODE || !UserFont)
@@ -726,14 +745,7 @@ GFont *GFontSystem::GetGlyph(int u, GFont *UserFont)
 					{
 						// Insert all the characters of this font into the LUT
 						// so that we can map from a character back to the font
-						for (int k=0; k<=MAX_UNICODE; k++)
-						{
-							if (!Lut[k] &&
-								_HasUnicodeGlyph(n->GetGlyphMap(), k))
-							{
-								Lut[k] = LutIndex;
-							}
-						}
+						AddGlyphsToLut(Lut, n->GetGlyphMap(), LutIndex);
 
 						if (_HasUnicodeGlyph(n->GetGlyphMap(), u))
 						{
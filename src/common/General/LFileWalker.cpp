@@ -0,0 +1,326 @@
+#include "Lgi.h"
+#include "LFileWalker.h"
+#include "LThreadPool.h"
+
+#ifdef POSIX
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#ifndef O_CLOEXEC
+#define O_CLOEXEC			0
+#endif
+#define WALK_OPEN_FLAGS		(O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)
+#endif
+
+struct LFileWalkerCounts
+{
+	uint64 Files, Dirs, Size;
+
+	LFileWalkerCounts()
+	{
+		Files = Dirs = Size = 0;
+	}
+};
+
+struct LFileWalkerPriv : public LMutex
+{
+	LFileWalker *Walker;
+	int Flags;
+	GString::Array Patterns;
+	LFileWalker::EntryCallback Callback;
+	void *UserData;
+	LThreadTaskGroup *Group;
+	LFileWalkerCounts Total;
+
+	LFileWalkerPriv(LFileWalker *w, int flags) : LMutex("LFileWalkerPriv")
+	{
+		Walker = w;
+		Flags = flags;
+		Callback = NULL;
+		UserData = NULL;
+		Group = NULL;
+	}
+
+	bool Match(const char *Leaf)
+	{
+		if (!Patterns.Length())
+			return true;
+		for (unsigned i=0; i<Patterns.Length(); i++)
+		{
+			if (MatchStr(Patterns[i], Leaf))
+				return true;
+		}
+		return false;
+	}
+
+	/// Puts 'Name' after the folder path in 'Path', which is 'Base' chars long.
+	/// \returns the offset of the leaf.
+	size_t SetLeaf(GArray<char> &Path, size_t Base, const char *Name, size_t Len)
+	{
+		size_t Leaf = Base;
+		if (Base > 0 && Path[Base-1] != DIR_CHAR)
+			Leaf++;
+		Path.Length(Leaf + Len + 1);
+		if (Leaf > Base)
+			Path[Base] = DIR_CHAR;
+		memcpy(&Path[Leaf], Name, Len + 1);
+		return Leaf;
+	}
+
+	void Merge(LFileWalkerCounts &c)
+	{
+		LMutex::Auto Lck(this, _FL);
+		Total.Files += c.Files;
+		Total.Dirs += c.Dirs;
+		Total.Size += c.Size;
+	}
+
+	bool OnFolder(LFileWalker::Entry &e, LFileWalkerCounts &c);
+	bool OnFile(LFileWalker::Entry &e, LFileWalkerCounts &c);
+	bool ScanPath(const char *Path, int Depth);
+	#ifdef POSIX
+	void Scan(int Fd, GArray<char> &Path, int Depth, LFileWalkerCounts &c);
+	#else
+	void Scan(GArray<char> &Path, int Depth, LFileWalkerCounts &c);
+	#endif
+};
+
+class LFileWalkerTask : public LThreadTask
+{
+	LFileWalkerPriv *d;
+	GString Path;
+	int Depth;
+
+public:
+	LFileWalkerTask(LFileWalkerPriv *priv, const char *path, size_t len, int depth)
+	{
+		d = priv;
+		Path.Set(path, len);
+		Depth = depth;
+	}
+
+	void Do()
+	{
+		d->ScanPath(Path, Depth);
+	}
+};
+
+/// \returns true if the walker should descend into the folder on this thread.
+bool LFileWalkerPriv::OnFolder(LFileWalker::Entry &e, LFileWalkerCounts &c)
+{
+	c.Dirs++;
+	if ((Flags & LFileWalker::WalkDirs) && Callback && !Callback(UserData, e))
+		return false;
+
+	if (Group)
+	{
+		// Hand the folder to the pool, the path is the only allocation.
+		Group->Add(new LFileWalkerTask(this, e.Path, e.PathLen, e.Depth + 1));
+		return false;
+	}
+
+	return true;
+}
+
+bool LFileWalkerPriv::OnFile(LFileWalker::Entry &e, LFileWalkerCounts &c)
+{
+	if (!Match(e.Leaf))
+		return false;
+
+	c.Files++;
+	if (e.Size > 0)
+		c.Size += e.Size;
+	if (Callback)
+		Callback(UserData, e);
+	return true;
+}
+
+bool LFileWalkerPriv::ScanPath(const char *Path, int Depth)
+{
+	GArray<char> Buf;
+	size_t Len = strlen(Path);
+	Buf.Length(Len + 1);
+	memcpy(&Buf[0], Path, Len + 1);
+	Buf.Length(Len);
+
+	LFileWalkerCounts c;
+
+	#ifdef POSIX
+	int Fd = open(Path, WALK_OPEN_FLAGS);
+	if (Fd < 0)
+		return false;
+	Scan(Fd, Buf, Depth, c);
+	#else
+	Scan(Buf, Depth, c);
+	#endif
+
+	Merge(c);
+	return true;
+}
+
+#ifdef POSIX
+
+void LFileWalkerPriv::Scan(int Fd, GArray<char> &Path, int Depth, LFileWalkerCounts &c)
+{
+	DIR *Dir = fdopendir(Fd);
+	if (!Dir)
+	{
+		close(Fd);
+		return;
+	}
+
+	size_t Base = Path.Length();
+	struct dirent *De;
+	while (!Walker->IsCancelled() && (De = readdir(Dir)))
+	{
+		const char *Name = De->d_name;
+		if (Name[0] == '.')
+		{
+			if (!Name[1] || (Name[1] == '.' && !Name[2]))
+				continue;
+			if (Flags & LFileWalker::WalkSkipHidden)
+				continue;
+		}
+
+		int Type = De->d_type;
+		int64 Size = -1;
+		if (Type == DT_UNKNOWN ||
+			(Type != DT_DIR && (Flags & LFileWalker::WalkSize)))
+		{
+			// Only stat when readdir can't tell us what we need.
+			struct stat s;
+			if (fstatat(Fd, Name, &s, AT_SYMLINK_NOFOLLOW))
+				continue;
+			Type = S_ISDIR(s.st_mode) ? DT_DIR : DT_REG;
+			Size = s.st_size;
+		}
+
+		size_t Len = strlen(Name);
+		size_t Leaf = SetLeaf(Path, Base, Name, Len);
+
+		LFileWalker::Entry e;
+		e.Path = &Path[0];
+		e.PathLen = Leaf + Len;
+		e.Leaf = e.Path + Leaf;
+		e.IsDir = Type == DT_DIR;
+		e.Size = Size;
+		e.Depth = Depth;
+
+		if (e.IsDir)
+		{
+			if (OnFolder(e, c))
+			{
+				int Sub = openat(Fd, Name, WALK_OPEN_FLAGS);
+				if (Sub >= 0)
+				{
+					Path.Length(e.PathLen);
+					Scan(Sub, Path, Depth + 1, c);
+				}
+			}
+		}
+		else OnFile(e, c);
+	}
+
+	closedir(Dir);
+	Path.Length(Base);
+}
+
+#else
+
+void LFileWalkerPriv::Scan(GArray<char> &Path, int Depth, LFileWalkerCounts &c)
+{
+	size_t Base = Path.Length();
+	Path.Add(0);
+
+	GDirectory Dir;
+	for (int Found = Dir.First(&Path[0]); Found && !Walker->IsCancelled(); Found = Dir.Next())
+	{
+		const char *Name = Dir.GetName();
+		if (!Name ||
+			(Name[0] == '.' && (!Name[1] || (Name[1] == '.' && !Name[2]))))
+			continue;
+		if ((Flags & LFileWalker::WalkSkipHidden) && (Name[0] == '.' || Dir.IsHidden()))
+			continue;
+
+		size_t Len = strlen(Name);
+		size_t Leaf = SetLeaf(Path, Base, Name, Len);
+
+		LFileWalker::Entry e;
+		e.Path = &Path[0];
+		e.PathLen = Leaf + Len;
+		e.Leaf = e.Path + Leaf;
+		e.IsDir = Dir.IsDir();
+		e.Size = e.IsDir ? -1 : (int64)Dir.GetSize();
+		e.Depth = Depth;
+
+		if (e.IsDir)
+		{
+			if (OnFolder(e, c))
+			{
+				Path.Length(e.PathLen);
+				Scan(Path, Depth + 1, c);
+			}
+		}
+		else OnFile(e, c);
+	}
+
+	Path.Length(Base);
+}
+
+#endif
+
+//////////////////////////////////////////////////////////////////////////////
+LFileWalker::LFileWalker(int Flags)
+{
+	d = new LFileWalkerPriv(this, Flags);
+}
+
+LFileWalker::~LFileWalker()
+{
+	DeleteObj(d);
+}
+
+void LFileWalker::AddPattern(const char *Pattern)
+{
+	if (Pattern)
+		d->Patterns.New() = Pattern;
+}
+
+bool LFileWalker::Walk(const char *Root, EntryCallback Callback, void *UserData)
+{
+	if (!Root)
+		return false;
+
+	d->Callback = Callback;
+	d->UserData = UserData;
+	d->Total = LFileWalkerCounts();
+
+	if (d->Flags & WalkParallel)
+	{
+		LThreadTaskGroup Group(this);
+		d->Group = &Group;
+		bool Status = d->ScanPath(Root, 0);
+		Group.Wait();
+		d->Group = NULL;
+		return Status && !IsCancelled();
+	}
+
+	return d->ScanPath(Root, 0) && !IsCancelled();
+}
+
+uint64 LFileWalker::GetFiles()
+{
+	return d->Total.Files;
+}
+
+uint64 LFileWalker::GetDirs()
+{
+	return d->Total.Dirs;
+}
+
+uint64 LFileWalker::GetSize()
+{
+	return d->Total.Size;
+}
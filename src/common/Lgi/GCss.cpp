@@ -173,7 +173,7 @@ static char *ParseString(const char *&s)
 }
 
 /////////////////////////////////////////////////////////////////////////////
-GCss::GCss() : Props(32)
+GCss::GCss()
 {
 	if (Lut.Length() == 0)
 	{
@@ -752,7 +752,7 @@ bool GCss::InheritCollect(GCss &c, PropMap &Contrib)
 					type *Mine = (type*)Props.Find(a.key); \
 					if (!Mine || *Mine == inherit) \
 					{									\
-						type *Theirs = (type*)c.Props.Find(a.key); \
+						type *Theirs = (type*)c.Props.Get(a.key); \
 						if (Theirs) \
 						{ \
 							if (!Mine) Props.Add(a.key, Mine = new type); \
@@ -769,7 +769,7 @@ bool GCss::InheritCollect(GCss &c, PropMap &Contrib)
 					type *Mine = (type*)Props.Find(a.key); \
 					if (!Mine || Mine->Type == inherit) \
 					{									\
-						type *Theirs = (type*)c.Props.Find(a.key); \
+						type *Theirs = (type*)c.Props.Get(a.key); \
 						if (Theirs) \
 						{ \
 							if (!Mine) Props.Add(a.key, Mine = new type); \
@@ -803,7 +803,7 @@ bool GCss::InheritCollect(GCss &c, PropMap &Contrib)
 				Len *Mine = (Len*)Props.Find(a.key);
 				if (!Mine || Mine->IsDynamic())
 				{
-					Len *Cur = (Len*)c.Props.Find(a.key);
+					Len *Cur = (Len*)c.Props.Get(a.key);
 					if (Cur && Cur->Type != LenInherit)
 					{
 						if (!Mine) Props.Add(a.key, Mine = new Len);
@@ -819,7 +819,7 @@ bool GCss::InheritCollect(GCss &c, PropMap &Contrib)
 				GRect *Mine = (GRect*)Props.Find(a.key);
 				if (!Mine || !Mine->Valid())
 				{
-					GRect *Theirs = (GRect*)c.Props.Find(a.key);
+					GRect *Theirs = (GRect*)c.Props.Get(a.key);
 					if (Theirs)
 					{
 						if (!Mine) Props.Add(a.key, Mine = new GRect);
@@ -834,7 +834,7 @@ bool GCss::InheritCollect(GCss &c, PropMap &Contrib)
 				StringsDef *Mine = (StringsDef*)Props.Find(a.key);
 				if (!Mine || Mine->Length() == 0)
 				{
-					StringsDef *Theirs = (StringsDef*)c.Props.Find(a.key);
+					StringsDef *Theirs = (StringsDef*)c.Props.Get(a.key);
 					if (Theirs)
 					{
 						if (!Mine) Props.Add(a.key, Mine = new StringsDef);
@@ -1083,6 +1083,13 @@ GCss &GCss::operator -=(const GCss &c)
 
 bool GCss::CopyStyle(const GCss &c)
 {
+	if (!Props.Length())
+	{
+		// Nothing to merge with, so share the values
+		Props = c.Props;
+		return true;
+	}
+
 	GCss &cc = (GCss&)c;
 	// int Prop;
 	// for (void *p=cc.Props.First(&Prop); p; p=cc.Props.Next(&Prop))
@@ -1102,7 +1109,8 @@ bool GCss::CopyStyle(const GCss &c)
 
 			case TypeEnum:
 			{
-				void *n = new DisplayType;
+				void *n = Props.Find(p.key);
+				if (!n) n = new DisplayType;
 				*(uint32*)n = *(uint32*)p.value;
 				Props.Add(p.key, n);
 				break;
@@ -1135,7 +1143,7 @@ bool GCss::operator ==(GCss &c)
 	// for (void *Local=Props.First((int*)&Prop); Local && Eq; Local=Props.Next((int*)&Prop))
 	for (auto p : Props)
 	{
-		void *Other = c.Props.Find(p.key);
+		void *Other = c.Props.Get(p.key);
 		if (!Other)
 			return false;
 
@@ -1165,6 +1173,159 @@ bool GCss::operator ==(GCss &c)
 	return Eq;
 }
 
+static uint32 CssHash(const void *Ptr, size_t Len)
+{
+	return Ptr ? LHash<uint32,char>((const char*)Ptr, Len, true) : 0;
+}
+
+static uint32 CssHash(const GCss::Len &l)
+{
+	return l.Type ^ CssHash(&l.Value, sizeof(l.Value));
+}
+
+/// Hashes a property value, returns false if it can't be shared.
+static bool CssHashValue(GCss::PropType p, void *Ptr, uint32 &Hash)
+{
+	switch (p >> 8)
+	{
+		case GCss::TypeEnum:
+			Hash = *(uint32*)Ptr;
+			break;
+		case GCss::TypeLen:
+			Hash = CssHash(*(GCss::Len*)Ptr);
+			break;
+		case GCss::TypeGRect:
+		{
+			GRect *r = (GRect*)Ptr;
+			Hash = r->x1 ^ (r->y1 << 8) ^ (r->x2 << 16) ^ (r->y2 << 24);
+			break;
+		}
+		case GCss::TypeColor:
+		{
+			GCss::ColorDef *c = (GCss::ColorDef*)Ptr;
+			Hash = c->Type ^ c->Rgb32;
+			break;
+		}
+		case GCss::TypeImage:
+		{
+			GCss::ImageDef *i = (GCss::ImageDef*)Ptr;
+			if (i->Img)
+				return false;
+			Hash = i->Type ^ CssHash(i->Uri.Get(), i->Uri.Length());
+			break;
+		}
+		case GCss::TypeBorder:
+		{
+			GCss::BorderDef *b = (GCss::BorderDef*)Ptr;
+			Hash = CssHash(*b) ^ (b->Color.Type << 8) ^ b->Color.Rgb32 ^ (b->Style << 16);
+			break;
+		}
+		case GCss::TypeStrings:
+		{
+			GCss::StringsDef *s = (GCss::StringsDef*)Ptr;
+			Hash = 0;
+			for (unsigned i=0; i<s->Length(); i++)
+				Hash = (Hash * 31) ^ CssHash((*s)[i], Strlen((*s)[i]));
+			break;
+		}
+		default:
+			return false;
+	}
+
+	return true;
+}
+
+/// Unlike the value's operator ==, every field counts.
+static bool CssSameValue(GCss::PropType p, void *a, void *b)
+{
+	switch (p >> 8)
+	{
+		case GCss::TypeEnum:
+			return *(uint32*)a == *(uint32*)b;
+		case GCss::TypeLen:
+		{
+			GCss::Len *x = (GCss::Len*)a, *y = (GCss::Len*)b;
+			return x->Type == y->Type && x->Value == y->Value;
+		}
+		case GCss::TypeGRect:
+			return *(GRect*)a == *(GRect*)b;
+		case GCss::TypeColor:
+			return *(GCss::ColorDef*)a == *(GCss::ColorDef*)b;
+		case GCss::TypeImage:
+		{
+			GCss::ImageDef *x = (GCss::ImageDef*)a, *y = (GCss::ImageDef*)b;
+			return x->Type == y->Type && x->Img == y->Img && x->Uri.Equals(y->Uri);
+		}
+		case GCss::TypeBorder:
+		{
+			GCss::BorderDef *x = (GCss::BorderDef*)a, *y = (GCss::BorderDef*)b;
+			return	x->Type == y->Type &&
+					x->Value == y->Value &&
+					x->Color == y->Color &&
+					x->Style == y->Style &&
+					x->Important == y->Important;
+		}
+		case GCss::TypeStrings:
+		{
+			GCss::StringsDef *x = (GCss::StringsDef*)a, *y = (GCss::StringsDef*)b;
+			if (x->Length() != y->Length())
+				return false;
+			for (unsigned i=0; i<x->Length(); i++)
+			{
+				if (Strcmp((*x)[i], (*y)[i]))
+					return false;
+			}
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool GCss::StylePool::Share(GCss &c)
+{
+	if (!c.Props.Length())
+		return false;
+
+	// Added up so the order of the properties doesn't matter
+	uint32 Hash = 0;
+	for (auto p : c.Props)
+	{
+		uint32 h;
+		if (!CssHashValue(p.key, p.value, h))
+			return false;
+		Hash += (p.key * 0x9E3779B1) ^ h;
+	}
+	if (Hash == Styles.GetNullKey())
+		Hash++;
+
+	GCss *s = Styles.Find(Hash);
+	if (!s)
+	{
+		// The first of its kind
+		if ((s = new GCss))
+		{
+			s->Props = c.Props;
+			Styles.Add(Hash, s);
+		}
+		return false;
+	}
+
+	if (s->Props.SameValues(c.Props))
+		return true;
+	if (s->Props.Length() != c.Props.Length())
+		return false;
+	for (auto p : c.Props)
+	{
+		void *Theirs = s->Props.Get(p.key);
+		if (!Theirs || !CssSameValue(p.key, p.value, Theirs))
+			return false;
+	}
+
+	c.Props = s->Props;
+	return true;
+}
+
 void GCss::DeleteProp(PropType p)
 {
 	void *Data = Props.Find(p);
@@ -1212,13 +1373,86 @@ void GCss::DeleteProp(PropType Prop, void *Data)
 
 void GCss::Empty()
 {
-	// int Prop;
-	// for (void *Data=Props.First(&Prop); Data; Data=Props.Next(&Prop))
-	for (auto p : Props)
+	Props.Empty();
+}
+
+GCss::PropStore::Map GCss::PropStore::Nil;
+
+GCss::PropStore::Values *GCss::PropStore::Copy(Values *From)
+{
+	Values *n = new Values;
+	if (From)
+	{
+		for (auto p : From->Props)
+		{
+			void *c = NULL;
+			switch (p.key >> 8)
+			{
+				#define CopyValue(TypeId, Type) \
+					case TypeId: c = new Type(*(Type*)p.value); break;
+
+				CopyValue(TypeEnum, PropType);
+				CopyValue(TypeLen, Len);
+				CopyValue(TypeGRect, GRect);
+				CopyValue(TypeColor, ColorDef);
+				CopyValue(TypeImage, ImageDef);
+				CopyValue(TypeBorder, BorderDef);
+				CopyValue(TypeStrings, StringsDef);
+				default:
+					LgiAssert(!"Unknown property type.");
+					break;
+			}
+			if (c)
+				n->Props.Add(p.key, c);
+		}
+	}
+	return n;
+}
+
+GCss::PropStore &GCss::PropStore::operator =(const PropStore &p)
+{
+	if (p.v == v)
+		return *this;
+
+	Release();
+
+	// An image the values own can't be shared, whoever let go of
+	// the values last would delete it from under the others.
+	ImageDef *Img = (ImageDef*)p.Get(PropBackgroundImage);
+	if (Img && Img->Type == ImageOwn)
+		v = Copy(p.v);
+	else if ((v = p.v))
+		v->Refs++;
+
+	return *this;
+}
+
+GCss::PropStore::Map &GCss::PropStore::Write()
+{
+	if (!v)
 	{
-		DeleteProp((PropType)p.key, p.value);
+		v = new Values;
 	}
-	Props.Empty();
+	else if (v->Refs > 1)
+	{
+		// Someone else is using these values, so change a copy
+		Values *n = Copy(v);
+		v->Refs--;
+		v = n;
+	}
+
+	return v->Props;
+}
+
+void GCss::PropStore::Release()
+{
+	if (v && --v->Refs == 0)
+	{
+		for (auto p : v->Props)
+			DeleteProp(p.key, p.value);
+		delete v;
+	}
+	v = NULL;
 }
 
 void GCss::OnChange(PropType Prop)
@@ -1291,16 +1525,17 @@ bool GCss::ParseFontWeight(PropType PropId, const char *&s)
 
 bool GCss::ParseBackgroundRepeat(const char *&s)
 {
+	RepeatType r;
+	     if (ParseWord(s, "inherit")) r = RepeatInherit;
+	else if (ParseWord(s, "repeat-x")) r = RepeatX;
+	else if (ParseWord(s, "repeat-y")) r = RepeatY;
+	else if (ParseWord(s, "no-repeat")) r = RepeatNone;
+	else if (ParseWord(s, "repeat")) r = RepeatBoth;
+	else return false; // Don't leave an unset value behind
+	
 	RepeatType *w = (RepeatType*)Props.Find(PropBackgroundRepeat);
 	if (!w) Props.Add(PropBackgroundRepeat, w = new RepeatType);
-
-	     if (ParseWord(s, "inherit")) *w = RepeatInherit;
-	else if (ParseWord(s, "repeat-x")) *w = RepeatX;
-	else if (ParseWord(s, "repeat-y")) *w = RepeatY;
-	else if (ParseWord(s, "no-repeat")) *w = RepeatNone;
-	else if (ParseWord(s, "repeat")) *w = RepeatBoth;
-	else return false;
-	
+	*w = r;
 	return true;
 }
 
@@ -2292,6 +2527,7 @@ GCss::Selector &GCss::Selector::operator =(const GCss::Selector &s)
 		Part &n = Parts.New();
 		n = ((GCss::Selector&)s).Parts[i];
 	}
+	AncestorAtoms = s.AncestorAtoms;
 	return *this;
 }
 
@@ -2678,6 +2914,34 @@ bool GCss::Selector::Parse(const char *&s)
 
 	Raw.Reset(NewStr(Start, s - Start));
 
+	// Hash the names for matching
+	bool Sibling = false;
+	for (unsigned i=0; i<Parts.Length(); i++)
+	{
+		Part &p = Parts[i];
+		switch (p.Type)
+		{
+			case SelType:	p.Hash = Store::AtomHash('t', p.Value); break;
+			case SelClass:	p.Hash = Store::AtomHash('.', p.Value); break;
+			case SelID:		p.Hash = Store::AtomHash('#', p.Value); break;
+			case CombAdjacent: Sibling = true; break;
+			default: break;
+		}
+	}
+
+	// Everything left of the last combinator has to be on an ancestor,
+	// unless a sibling is involved.
+	AncestorAtoms.Length(0);
+	if (!Sibling && Combs.Length())
+	{
+		for (ssize_t i=0; i<Combs.Last(); i++)
+		{
+			Part &p = Parts[i];
+			if (p.Type == SelType || p.Type == SelClass || p.Type == SelID)
+				AncestorAtoms.Add(p.Hash);
+		}
+	}
+
 	return Parts.Length() > 0;
 }
 
@@ -2698,6 +2962,80 @@ static const char *SkipComment(const char *c)
 	return c;
 }
 
+/// Parses a declaration block once so it can be copied onto elements. Blocks
+/// that depend on the style they're parsed onto are left as text: border
+/// sub-properties that modify an existing border, and colours only the
+/// element class can resolve (OnUnhandledColor).
+class GCssDecl : public GCss
+{
+	bool Unresolved;
+
+	bool OnUnhandledColor(ColorDef *def, const char *&s)
+	{
+		Unresolved = true;
+		return false;
+	}
+
+public:
+	GCssDecl()
+	{
+		Unresolved = false;
+	}
+
+	static bool IsPartial(PropType p)
+	{
+		return	ParentProp.Find(p) != PropNull ||
+				p == PropBorderStyle ||
+				p == PropBorderColor;
+	}
+
+	bool Parse(const char *Style)
+	{
+		// Check the property names first
+		for (const char *s = Style; *s; )
+		{
+			while (*s && strchr(" \t\r\n;", *s))
+				s++;
+			const char *Name = s;
+			while (*s && (IsAlpha(*s) || strchr("-_", *s)))
+				s++;
+
+			char Prop[64];
+			ssize_t Len = s - Name;
+			if (Len > 0 && Len < (ssize_t)sizeof(Prop))
+			{
+				memcpy(Prop, Name, Len);
+				Prop[Len] = 0;
+				if (IsPartial(Lut.Find(Prop)))
+					return false;
+			}
+
+			while (*s && *s != ';')
+				s++;
+		}
+
+		const char *s = Style;
+		GCss::Parse(s, ParseRelaxed);
+		return !Unresolved;
+	}
+};
+
+void GCss::Store::Apply(GCss &Css, GCss::Selector *Sel)
+{
+	if (!Sel)
+		return;
+
+	if (Sel->Decl)
+	{
+		Css.CopyStyle(*Sel->Decl);
+	}
+	else if (Sel->Style)
+	{
+		const char *s = Sel->Style;
+		Css.Parse(s, ParseRelaxed);
+	}
+}
+
 bool GCss::Store::Dump(GStream &out)
 {
 	const char *MapNames[] = {"TypeMap", "ClassMap", "IdMap", NULL};
@@ -2868,11 +3206,28 @@ bool GCss::Store::Parse(const char *&c, int Depth)
 				char *Style = NewStr(Start, c - Start);
 				Styles.Add(Style);
 				c++;
+
+				// Blank out any comments, once
+				for (char *Cmt = Style; (Cmt = strstr(Cmt, "/*")); )
+				{
+					char *End = strstr(Cmt + 2, "*/");
+					if (!End)
+						break;
+					memset(Cmt, ' ', End + 2 - Cmt);
+				}
+
+				// Parse the declarations, once
+				GCssDecl *Decl = new GCssDecl;
+				if (Decl->Parse(Style))
+					Decls.Add(Decl);
+				else
+					DeleteObj(Decl);
 				
 				for (int i=0; i<Selectors.Length(); i++)
 				{
 					GCss::Selector *s = Selectors[i];
 					s->Style = Style;
+					s->Decl = Decl;
 					
 					ssize_t n = s->GetSimpleIndex();
 					if (n >= s->Parts.Length())
@@ -2881,7 +3236,21 @@ bool GCss::Store::Parse(const char *&c, int Depth)
 						LgiAssert(!"Part index too high.");
 						return false;
 					}
-					GCss::Selector::Part &p = s->Parts[n];
+
+					// Index by the most specific part of the element's
+					// own selector: id, then class, then type.
+					GCss::Selector::Part *Key = &s->Parts[n];
+					for (ssize_t k=n; k<s->Parts.Length() && s->Parts[k].IsSel(); k++)
+					{
+						GCss::Selector::Part &p = s->Parts[k];
+						if (!p.Value)
+							continue;
+						if (p.Type == GCss::Selector::SelID ||
+							(p.Type == GCss::Selector::SelClass && Key->Type != GCss::Selector::SelID) ||
+							(p.Type == GCss::Selector::SelType && Key->Type != GCss::Selector::SelID && Key->Type != GCss::Selector::SelClass))
+							Key = &p;
+					}
+					GCss::Selector::Part &p = *Key;
 					
 					switch (p.Type)
 					{
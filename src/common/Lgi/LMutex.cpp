@@ -2,6 +2,7 @@
 #include <errno.h>
 
 #include "Lgi.h"
+#include "LMutexProfile.h"
 
 //////////////////////////////////////////////////////////////////////////////
 char *SemPrint(OsSemaphore *s)
@@ -17,14 +18,468 @@ char *SemPrint(OsSemaphore *s)
 	return Buf;
 }
 
+//////////////////////////////////////////////////////////////////////////////
+#define LMUTEX_BUCKETS			24		// Log2 microsecond buckets, the last is 4s+
+#define LMUTEX_LONGEST			16		// Number of longest holds to keep
+#define LMUTEX_RING				512		// Samples buffered per thread before merging
+
+#ifdef _MSC_VER
+#define LMUTEX_TLS				__declspec(thread)
+static inline uint32 ProfLoad(volatile uint32 *p) { uint32 v = *p; _ReadWriteBarrier(); return v; }
+static inline void ProfStore(volatile uint32 *p, uint32 v) { _ReadWriteBarrier(); *p = v; }
+#else
+#define LMUTEX_TLS				__thread
+static inline uint32 ProfLoad(volatile uint32 *p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+static inline void ProfStore(volatile uint32 *p, uint32 v) { __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+#endif
+
+static bool ProfileOn = false;
+
+static int ProfileBucket(uint64 Us)
+{
+	int b = 0;
+	while (Us && b < LMUTEX_BUCKETS - 1)
+	{
+		Us >>= 1;
+		b++;
+	}
+	return b;
+}
+
+struct LMutexStats
+{
+	GString Key;
+	uint64 Count, Contended;
+	uint64 WaitTotal, WaitMax;
+	uint64 HoldTotal, HoldMax;
+	uint32 Wait[LMUTEX_BUCKETS];
+	uint32 Hold[LMUTEX_BUCKETS];
+
+	LMutexStats(const char *key)
+	{
+		Key = key;
+		Count = Contended = 0;
+		WaitTotal = WaitMax = 0;
+		HoldTotal = HoldMax = 0;
+		ZeroObj(Wait);
+		ZeroObj(Hold);
+	}
+
+	void Add(uint64 WaitUs, uint64 HoldUs)
+	{
+		Count++;
+		if (WaitUs)
+			Contended++;
+		WaitTotal += WaitUs;
+		WaitMax = MAX(WaitMax, WaitUs);
+		HoldTotal += HoldUs;
+		HoldMax = MAX(HoldMax, HoldUs);
+		Wait[ProfileBucket(WaitUs)]++;
+		Hold[ProfileBucket(HoldUs)]++;
+	}
+};
+
+/// One outermost lock/unlock, captured while the lock is held and recorded
+/// once it's released.
+struct LMutexSample
+{
+	char Name[48]; // Copied, the mutex may be gone by the time it's merged
+	const char *File;
+	int Line;
+	OsThreadId Thread;
+	uint64 WaitUs, HoldUs;
+};
+
+/// Each thread records its samples here without taking any lock. 'Head' is
+/// only written by the owning thread, 'Tail' only under LMutexProfileData's
+/// lock, when the samples are merged into the totals.
+struct LMutexRing
+{
+	LMutexSample Samples[LMUTEX_RING];
+	volatile uint32 Head, Tail;
+	LMutexRing *Next;
+
+	LMutexRing()
+	{
+		Head = Tail = 0;
+		Next = NULL;
+	}
+};
+
+static LMUTEX_TLS LMutexRing *ThreadRing = NULL;
+
+struct LMutexHold
+{
+	GString Name, Site;
+	uint64 Us;
+	OsThreadId Thread;
+};
+
+struct LMutexProfileData
+{
+	// This lock is never profiled itself
+	LMutex Lock;
+	LHashTbl<StrKey<char>, LMutexStats*> Names, Sites;
+	GArray<LMutexHold> Longest; // Sorted longest first
+	LMutexRing *Rings; // One per thread that has recorded a sample, never freed
+
+	// The stats the last sample went to, hot locks tend to repeat
+	LMutexStats *LastName, *LastSite;
+	const char *LastFile;
+	int LastLine;
+
+	LMutexProfileData() : Lock("LMutexProfile")
+	{
+		Rings = NULL;
+		LastName = LastSite = NULL;
+		LastFile = NULL;
+		LastLine = 0;
+	}
+
+	LMutexRing *NewRing()
+	{
+		LMutexRing *r = new LMutexRing;
+		LMutex::Auto Lck(&Lock, _FL);
+		r->Next = Rings;
+		Rings = r;
+		return r;
+	}
+
+	/// Moves the buffered samples into the totals. Call with 'Lock' held.
+	void Merge(LMutexRing *r, bool Discard = false)
+	{
+		uint32 Head = ProfLoad(&r->Head);
+		for (uint32 i = r->Tail; i != Head; i++)
+		{
+			if (!Discard)
+				Add(r->Samples[i % LMUTEX_RING]);
+		}
+		ProfStore(&r->Tail, Head);
+	}
+
+	void MergeAll(bool Discard = false)
+	{
+		for (LMutexRing *r = Rings; r; r = r->Next)
+			Merge(r, Discard);
+	}
+
+	void Empty()
+	{
+		Names.DeleteObjects();
+		Sites.DeleteObjects();
+		Longest.Length(0);
+		LastName = LastSite = NULL;
+	}
+
+	LMutexStats *Get(LHashTbl<StrKey<char>, LMutexStats*> &Tbl, const char *Key)
+	{
+		LMutexStats *s = Tbl.Find(Key);
+		if (!s)
+			Tbl.Add(Key, s = new LMutexStats(Key));
+		return s;
+	}
+
+	/// Call with 'Lock' held.
+	void Add(LMutexSample &s)
+	{
+		if (!LastSite || s.File != LastFile || s.Line != LastLine)
+		{
+			GString Site;
+			if (s.File)
+			{
+				const char *Leaf = strrchr(s.File, DIR_CHAR);
+				Site.Printf("%s:%i", Leaf ? Leaf + 1 : s.File, s.Line);
+			}
+			else Site = "(unknown)";
+			LastSite = Get(Sites, Site);
+			LastFile = s.File;
+			LastLine = s.Line;
+		}
+		if (!LastName || strcmp(LastName->Key, s.Name))
+			LastName = Get(Names, s.Name);
+
+		uint64 HoldUs = s.HoldUs;
+		LastName->Add(s.WaitUs, HoldUs);
+		LastSite->Add(s.WaitUs, HoldUs);
+
+		if (Longest.Length() < LMUTEX_LONGEST ||
+			HoldUs > Longest.Last().Us)
+		{
+			size_t i = 0;
+			while (i < Longest.Length() && Longest[i].Us >= HoldUs)
+				i++;
+			LMutexHold h;
+			h.Name = s.Name;
+			h.Site = LastSite->Key;
+			h.Us = HoldUs;
+			h.Thread = s.Thread;
+			Longest.AddAt(i, h);
+			if (Longest.Length() > LMUTEX_LONGEST)
+				Longest.Length(LMUTEX_LONGEST);
+		}
+	}
+};
+
+static LMutexProfileData *ProfileData = NULL;
+
+void LMutex::_ProfAcquire(uint64 WaitStart, const char *file, int line)
+{
+	_ProfStart = LgiMicroTime();
+	_ProfWait = _ProfStart - WaitStart;
+	_ProfFile = file;
+	_ProfLine = line;
+}
+
+bool LMutex::_ProfRelease(LMutexSample &s)
+{
+	s.HoldUs = LgiMicroTime() - _ProfStart;
+	_ProfStart = 0;
+	if (!ProfileData || this == &ProfileData->Lock)
+		return false;
+
+	// Long names are truncated
+	const char *n = _Name ? _Name : "(unnamed)";
+	size_t i;
+	for (i = 0; n[i] && i < sizeof(s.Name) - 1; i++)
+		s.Name[i] = n[i];
+	s.Name[i] = 0;
+	s.File = _ProfFile;
+	s.Line = _ProfLine;
+	s.Thread = _Thread;
+	s.WaitUs = _ProfWait;
+	return true;
+}
+
+static void LMutexProfileRecord(LMutexSample &s)
+{
+	LMutexRing *r = ThreadRing;
+	if (!r)
+		r = ThreadRing = ProfileData->NewRing();
+
+	uint32 Head = r->Head;
+	if (Head - ProfLoad(&r->Tail) >= LMUTEX_RING)
+	{
+		// Full, merge this thread's samples now
+		LMutex::Auto Lck(&ProfileData->Lock, _FL);
+		ProfileData->Merge(r);
+	}
+
+	r->Samples[Head % LMUTEX_RING] = s;
+	ProfStore(&r->Head, Head + 1);
+}
+
+void LMutexProfile::Enable(bool b)
+{
+	if (b && !ProfileData)
+		ProfileData = new LMutexProfileData; // Lives till exit, other threads may be using it
+	ProfileOn = b;
+}
+
+bool LMutexProfile::IsEnabled()
+{
+	return ProfileOn;
+}
+
+void LMutexProfile::Reset()
+{
+	if (ProfileData)
+	{
+		LMutex::Auto Lck(&ProfileData->Lock, _FL);
+		ProfileData->MergeAll(true);
+		ProfileData->Empty();
+	}
+}
+
+static int StatsWaitCmp(LMutexStats **a, LMutexStats **b)
+{
+	uint64 A = (*a)->WaitTotal, B = (*b)->WaitTotal;
+	if (A == B)
+	{
+		A = (*a)->HoldTotal;
+		B = (*b)->HoldTotal;
+	}
+	return A > B ? -1 : (A < B ? 1 : 0);
+}
+
+static void SortStats(LHashTbl<StrKey<char>, LMutexStats*> &Tbl, GArray<LMutexStats*> &Out)
+{
+	for (auto i : Tbl)
+		Out.Add(i.value);
+	Out.Sort(StatsWaitCmp);
+}
+
+static void PrintHistogram(GStringPipe &p, const char *Label, uint32 *Buckets)
+{
+	p.Print("      %s:", Label);
+	for (int i=0; i<LMUTEX_BUCKETS; i++)
+	{
+		if (Buckets[i])
+		{
+			if (i)
+				p.Print(" <" LGI_PrintfInt64 "us=%u", (uint64)1 << i, Buckets[i]);
+			else
+				p.Print(" 0us=%u", Buckets[i]);
+		}
+	}
+	p.Print("\n");
+}
+
+static void PrintStats(GStringPipe &p, const char *Title, LHashTbl<StrKey<char>, LMutexStats*> &Tbl)
+{
+	GArray<LMutexStats*> a;
+	SortStats(Tbl, a);
+
+	p.Print("%s:\n", Title);
+	for (unsigned i=0; i<a.Length(); i++)
+	{
+		LMutexStats *s = a[i];
+		p.Print("  %s\n"
+				"      locks=" LGI_PrintfInt64 " contended=" LGI_PrintfInt64
+				" wait(total=" LGI_PrintfInt64 "us max=" LGI_PrintfInt64 "us)"
+				" hold(total=" LGI_PrintfInt64 "us max=" LGI_PrintfInt64 "us)\n",
+				s->Key.Get(),
+				s->Count, s->Contended,
+				s->WaitTotal, s->WaitMax,
+				s->HoldTotal, s->HoldMax);
+		PrintHistogram(p, "wait", s->Wait);
+		PrintHistogram(p, "hold", s->Hold);
+	}
+	p.Print("\n");
+}
+
+GString LMutexProfile::Report()
+{
+	GStringPipe p;
+	if (!ProfileData)
+	{
+		p.Print("LMutexProfile: not enabled.\n");
+		return p.NewGStr();
+	}
+
+	LMutex::Auto Lck(&ProfileData->Lock, _FL);
+	ProfileData->MergeAll();
+	p.Print("LMutexProfile: %s\n\n", ProfileOn ? "enabled" : "disabled");
+	PrintStats(p, "By mutex", ProfileData->Names);
+	PrintStats(p, "By call site", ProfileData->Sites);
+
+	p.Print("Longest holds:\n");
+	for (auto &h : ProfileData->Longest)
+		p.Print("  " LGI_PrintfInt64 "us %s at %s (thread " LGI_PrintfInt64 ")\n", h.Us, h.Name.Get(), h.Site.Get(), (uint64)h.Thread);
+
+	return p.NewGStr();
+}
+
+static GVariant *HistogramVariant(uint32 *Buckets)
+{
+	GVariant *v = new GVariant;
+	v->SetList();
+	for (int i=0; i<LMUTEX_BUCKETS; i++)
+		v->Value.Lst->Insert(new GVariant(Buckets[i]));
+	return v;
+}
+
+static void StatsVariant(GVariant &Value, LHashTbl<StrKey<char>, LMutexStats*> &Tbl)
+{
+	GArray<LMutexStats*> a;
+	SortStats(Tbl, a);
+
+	Value.SetList();
+	for (unsigned i=0; i<a.Length(); i++)
+	{
+		LMutexStats *s = a[i];
+		GVariant::LHash *h = new GVariant::LHash;
+		h->Add("Name", new GVariant(s->Key.Get()));
+		h->Add("Count", new GVariant(s->Count));
+		h->Add("Contended", new GVariant(s->Contended));
+		h->Add("WaitTotal", new GVariant(s->WaitTotal));
+		h->Add("WaitMax", new GVariant(s->WaitMax));
+		h->Add("HoldTotal", new GVariant(s->HoldTotal));
+		h->Add("HoldMax", new GVariant(s->HoldMax));
+		h->Add("WaitHistogram", HistogramVariant(s->Wait));
+		h->Add("HoldHistogram", HistogramVariant(s->Hold));
+
+		GVariant *v = new GVariant;
+		v->SetHashTable(h, false);
+		Value.Value.Lst->Insert(v);
+	}
+}
+
+bool LMutexProfile::GetVariant(const char *Name, GVariant &Value, char *Array)
+{
+	if (!Name)
+		return false;
+
+	if (!_stricmp(Name, "Enabled"))
+	{
+		Value = ProfileOn;
+		return true;
+	}
+	if (!_stricmp(Name, "Report"))
+	{
+		Value = Report().Get();
+		return true;
+	}
+
+	if (!ProfileData)
+		return false;
+
+	LMutex::Auto Lck(&ProfileData->Lock, _FL);
+	ProfileData->MergeAll();
+	if (!_stricmp(Name, "Names"))
+	{
+		StatsVariant(Value, ProfileData->Names);
+	}
+	else if (!_stricmp(Name, "Sites"))
+	{
+		StatsVariant(Value, ProfileData->Sites);
+	}
+	else if (!_stricmp(Name, "Longest"))
+	{
+		Value.SetList();
+		for (auto &l : ProfileData->Longest)
+		{
+			GVariant::LHash *h = new GVariant::LHash;
+			h->Add("Name", new GVariant(l.Name.Get()));
+			h->Add("Site", new GVariant(l.Site.Get()));
+			h->Add("Hold", new GVariant(l.Us));
+			h->Add("Thread", new GVariant((uint64)l.Thread));
+
+			GVariant *v = new GVariant;
+			v->SetHashTable(h, false);
+			Value.Value.Lst->Insert(v);
+		}
+	}
+	else return false;
+
+	return true;
+}
+
+bool LMutexProfile::SetVariant(const char *Name, GVariant &Value, char *Array)
+{
+	if (!Name)
+		return false;
+
+	if (!_stricmp(Name, "Enabled"))
+	{
+		Enable(Value.CastInt32() != 0);
+		return true;
+	}
+
+	return false;
+}
+
+//////////////////////////////////////////////////////////////////////////////
 LMutex::LMutex(const char *name)
 {
 	_Thread = 0;
 	_Count = 0;
-	File = 0;
-	Line = 0;
+	_ProfStart = _ProfWait = 0;
+	_ProfFile = NULL;
+	_ProfLine = 0;
 	_Name = NewStr(name);
 	#ifdef _DEBUG
+	File = 0;
+	Line = 0;
 	_DebugSem = false;
 	#endif
 
@@ -44,6 +499,12 @@ LMutex::LMutex(const char *name)
 	{
 		LgiTrace("%s:%i - Couldn't create mutex for LMutex\n", __FILE__, __LINE__);
 	}
+	if (pthread_cond_init(&_Cond, 0))
+	{
+		LgiTrace("%s:%i - Couldn't create condition for LMutex\n", __FILE__, __LINE__);
+	}
+	_Waiters = 0;
+	_Spin = 0;
 
 	#endif
 }
@@ -66,6 +527,7 @@ LMutex::~LMutex()
 	
 	#elif defined POSIX
 
+	pthread_cond_destroy(&_Cond);
 	pthread_mutex_destroy(&_Sem);
 
 	#endif
@@ -99,13 +561,8 @@ bool LMutex::_Lock()
 	
 	#elif defined POSIX
 
-	if (pthread_mutex_trylock(&_Sem))
-	{
-		// printf("\t%s:%i - pthread_mutex_trylock errored: %s\n\t_Sem=%s\n", __FILE__, __LINE__, GetErrorName(errno), SemPrint(&_Sem));
-		return false;
-	}
-	
-	return true;
+	// Only guards the condition variable, ownership is in _Thread
+	return pthread_mutex_lock(&_Sem) == 0;
 
 	#endif
 }
@@ -131,9 +588,224 @@ void LMutex::_Unlock()
 	#endif
 }
 
+#if defined POSIX
+
+#define LMUTEX_MAX_SPIN			200
+#ifdef _DEBUG
+#define LMUTEX_WARN_MS			5000
+#define LMUTEX_DEADLOCK_MS		(2 * 60 * 1000)
+#endif
+
+static OsThreadId LMutexThreadId()
+{
+	// GetCurrentThreadId can be a system call, so cache it per thread
+	static __thread OsThreadId Id = 0;
+	if (!Id)
+		Id = GetCurrentThreadId();
+	return Id;
+}
+
+static inline void LMutexPause()
+{
+	#if defined(__i386__) || defined(__x86_64__)
+	__builtin_ia32_pause();
+	#elif defined(__aarch64__)
+	asm volatile("yield");
+	#endif
+}
+
+bool LMutex::_TryAcquire(OsThreadId Me)
+{
+	OsThreadId Free = 0;
+	return __atomic_compare_exchange_n(&_Thread, &Free, Me, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+bool LMutex::_Wait(OsThreadId Me, int Timeout, bool NoTrace)
+{
+	// Most locks are held briefly, so spin for a while before sleeping.
+	// The spin count adapts to how long it took to get the lock last time.
+	int MaxSpin = MIN(LMUTEX_MAX_SPIN, _Spin * 2 + 10);
+	for (int i=0; i<MaxSpin; i++)
+	{
+		if (__atomic_load_n(&_Thread, __ATOMIC_RELAXED) == 0 &&
+			_TryAcquire(Me))
+		{
+			_Spin += (i - _Spin) / 8;
+			return true;
+		}
+		LMutexPause();
+	}
+	_Spin += (MaxSpin - _Spin) / 8;
+
+	if (Timeout == 0)
+		return false;
+
+	uint64 Start = LgiCurrentTime();
+	#ifdef _DEBUG
+	uint64 Warn = Start + LMUTEX_WARN_MS;
+	#endif
+	bool Status = false;
+
+	if (!_Lock())
+		return false;
+
+	// Registering as a waiter before the final check means Unlock
+	// either sees us waiting or we see the lock as free.
+	__atomic_add_fetch(&_Waiters, 1, __ATOMIC_SEQ_CST);
+	while (!(Status = _TryAcquire(Me)))
+	{
+		int Ms = Timeout;
+		#ifdef _DEBUG
+		if (!NoTrace && (Ms < 0 || Ms > LMUTEX_WARN_MS))
+			Ms = LMUTEX_WARN_MS;
+		#endif
+
+		if (Ms < 0)
+		{
+			pthread_cond_wait(&_Cond, &_Sem);
+		}
+		else
+		{
+			struct timespec To;
+			clock_gettime(CLOCK_REALTIME, &To);
+			To.tv_sec += Ms / 1000;
+			To.tv_nsec += (Ms % 1000) * 1000000;
+			if (To.tv_nsec >= 1000000000)
+			{
+				To.tv_sec++;
+				To.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&_Cond, &_Sem, &To);
+		}
+
+		uint64 Now = LgiCurrentTime();
+		if (Timeout >= 0 && Now >= Start + Timeout)
+		{
+			Status = _TryAcquire(Me);
+			break;
+		}
+
+		#ifdef _DEBUG
+		if (!NoTrace && Timeout < 0 && Now >= Warn)
+		{
+			LgiTrace("LMutex=%p(%s): Can't lock after %ims... LockingThread=%i ThisThread=%x Count=%x Locker=%s:%i.\n",
+					this,
+					_Name,
+					(int)(Now - Start),
+					_Thread,
+					Me,
+					_Count,
+					File,
+					Line);
+			Warn = Now + LMUTEX_WARN_MS;
+
+			if (Now > Start + LMUTEX_DEADLOCK_MS)
+			{
+				// Obviously we've locked up and to un-deadlock things we'll fail the lock
+				LgiTrace("::Lock timeout ask_thread=%i hold_thread=%i count=%i\n", Me, _Thread, _Count);
+				break;
+			}
+		}
+		#endif
+	}
+	__atomic_sub_fetch(&_Waiters, 1, __ATOMIC_SEQ_CST);
+
+	_Unlock();
+	return Status;
+}
+
+bool LMutex::Lock(const char *file, int line, bool NoTrace)
+{
+	OsThreadId Me = LMutexThreadId();
+
+	// Only this thread can set _Thread to its own id, so a relaxed read is
+	// enough to detect recursion.
+	if (__atomic_load_n(&_Thread, __ATOMIC_RELAXED) == Me)
+	{
+		_Count++;
+	}
+	else
+	{
+		uint64 WaitStart = ProfileOn ? LgiMicroTime() : 0;
+		if (!_TryAcquire(Me) && !_Wait(Me, -1, NoTrace))
+			return false;
+		_Count = 1;
+		if (WaitStart)
+			_ProfAcquire(WaitStart, file, line);
+	}
+
+	#ifdef _DEBUG
+	File = file;
+	Line = line;
+	#endif
+	return true;
+}
+
+bool LMutex::LockWithTimeout(int Timeout, const char *file, int line)
+{
+	OsThreadId Me = LMutexThreadId();
+
+	if (__atomic_load_n(&_Thread, __ATOMIC_RELAXED) == Me)
+	{
+		_Count++;
+	}
+	else
+	{
+		uint64 WaitStart = ProfileOn ? LgiMicroTime() : 0;
+		if (!_TryAcquire(Me) && !_Wait(Me, MAX(Timeout, 0), true))
+			return false;
+		_Count = 1;
+		if (WaitStart)
+			_ProfAcquire(WaitStart, file, line);
+	}
+
+	#ifdef _DEBUG
+	File = file;
+	Line = line;
+	#endif
+	return true;
+}
+
+void LMutex::Unlock()
+{
+	if (_Count < 1)
+	{
+		printf("%s:%i - _Count=%i\n", __FILE__, __LINE__, _Count);
+		
+		// if this assert fails then you tryed to unlock an object that
+		// wasn't locked in the first place
+		LgiAssert(0);
+		return;
+	}
+
+	if (--_Count > 0)
+		return;
+
+	#ifdef _DEBUG
+	File = 0;
+	Line = 0;
+	#endif
+	LMutexSample Sample;
+	bool Profiled = _ProfStart && _ProfRelease(Sample);
+	__atomic_store_n(&_Thread, (OsThreadId)0, __ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&_Waiters, __ATOMIC_SEQ_CST) > 0 &&
+		_Lock())
+	{
+		pthread_cond_signal(&_Cond);
+		_Unlock();
+	}
+
+	if (Profiled)
+		LMutexProfileRecord(Sample);
+}
+
+#else
+
 bool LMutex::Lock(const char *file, int line, bool NoTrace)
 {
 	int64 Start = LgiCurrentTime();
+	uint64 WaitStart = ProfileOn ? LgiMicroTime() : 0;
 	bool Status = false;
 	OsThreadId CurrentThread = GetCurrentThreadId();
 	bool Warn = true;
@@ -147,8 +819,10 @@ bool LMutex::Lock(const char *file, int line, bool NoTrace)
 			{
 				_Thread = CurrentThread;
 				_Count++;
+				#ifdef _DEBUG
 				File = file;
 				Line = line;
+				#endif
 
 				/*
 				if (_Name && stricmp(_Name, "ScribeWnd") == 0)
@@ -169,7 +843,7 @@ bool LMutex::Lock(const char *file, int line, bool NoTrace)
 			LgiSleep(1);
 		}
 
-		#if 1 // _DEBUG
+		#ifdef _DEBUG
 		int64 Now = LgiCurrentTime();
 		if (Warn && Now > Start + 5000 && !NoTrace)
 		{
@@ -196,6 +870,9 @@ bool LMutex::Lock(const char *file, int line, bool NoTrace)
 		#endif
 	}
 
+	if (Status && WaitStart && _Count == 1)
+		_ProfAcquire(WaitStart, file, line);
+
 	#ifdef _DEBUG
     /*
 	if (_DebugSem)
@@ -208,6 +885,7 @@ bool LMutex::Lock(const char *file, int line, bool NoTrace)
 bool LMutex::LockWithTimeout(int Timeout, const char *file, int line)
 {
 	int64 Start = LgiCurrentTime();
+	uint64 WaitStart = ProfileOn ? LgiMicroTime() : 0;
 	bool Status = false;
 
 	while (!Status &&
@@ -221,8 +899,10 @@ bool LMutex::LockWithTimeout(int Timeout, const char *file, int line)
 			{
 				_Thread = CurrentThread;
 				_Count++;
+				#ifdef _DEBUG
 				File = file;
 				Line = line;
+				#endif
 				Status = true;
 			}
 			_Unlock();
@@ -234,6 +914,9 @@ bool LMutex::LockWithTimeout(int Timeout, const char *file, int line)
 		}
 	}
 
+	if (Status && WaitStart && _Count == 1)
+		_ProfAcquire(WaitStart, file, line);
+
 	#ifdef _DEBUG
     /*
 	if (_DebugSem)
@@ -276,13 +959,22 @@ void LMutex::Unlock()
 	{
 		_Count--;
 	}
+	LMutexSample Sample;
+	bool Profiled = false;
 	if (_Count < 1)
 	{
+		Profiled = _ProfStart && _ProfRelease(Sample);
 		_Thread = 0;
+		#ifdef _DEBUG
 		File = 0;
 		Line = 0;
+		#endif
 	}
 
 	_Unlock();
+
+	if (Profiled)
+		LMutexProfileRecord(Sample);
 }
 
+#endif
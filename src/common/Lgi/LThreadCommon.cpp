@@ -40,6 +40,7 @@ LThreadWorker::LThreadWorker(LThreadTarget *First, const char *ThreadName) :
 LThreadWorker::~LThreadWorker()
 {
 	Stop();
+	Jobs.DeleteObjects();
 }
 
 void LThreadWorker::Stop()
@@ -47,6 +48,7 @@ void LThreadWorker::Stop()
 	if (Loop)
 	{
 		Loop = false;
+		Event.Signal();
 		while (!IsExited())
 			LgiSleep(1);
 		if (Lock(_FL))
@@ -84,12 +86,18 @@ void LThreadWorker::AddJob(LThreadJob *j)
 {
 	if (Lock(_FL))
 	{
+		// Main drains the whole queue each time it wakes, so it only needs
+		// waking when the queue was empty.
+		bool Wake = Jobs.Length() == 0;
 		Jobs.Add(j);
 
 		if (!Owners.HasItem(j->Owner))
 			Attach(j->Owner);
 
 		Unlock();
+
+		if (Wake)
+			Event.Signal();
 	}
 }
 
@@ -100,18 +108,28 @@ void LThreadWorker::DoJob(LThreadJob *j)
 
 int LThreadWorker::Main()
 {
+	GArray<LThreadJob*> Batch;
+	size_t Next = 0;
+
 	while (Loop)
 	{
-		GAutoPtr<LThreadJob> j;
-		if (Lock(_FL))
+		if (Next >= Batch.Length())
 		{
-			if (Jobs.Length())
+			// Take all the queued jobs at once, so the lock is only held
+			// briefly and there is no shuffling of the queue per job.
+			Batch.Length(0);
+			Next = 0;
+			if (Lock(_FL))
 			{
-				j.Reset(Jobs[0]);
-				Jobs.DeleteAt(0, true);
+				Batch = Jobs;
+				Jobs.Length(0);
+				Unlock();
 			}
-			Unlock();
 		}
+
+		GAutoPtr<LThreadJob> j;
+		if (Next < Batch.Length())
+			j.Reset(Batch[Next++]);
 		if (j)
 		{
 			DoJob(j);
@@ -132,8 +150,13 @@ int LThreadWorker::Main()
 				Unlock();
 			}
 		}
-		else LgiSleep(50);
+		else Event.Wait();
 	}
+
+	// Drop any jobs that didn't get started
+	for (; Next < Batch.Length(); Next++)
+		delete Batch[Next];
+
 	return 0;
 }
 
@@ -0,0 +1,341 @@
+#include "Lgi.h"
+#include "LThreadPool.h"
+
+#define POOL_HELP_WAIT_MS		50	// Max time a waiting group sleeps before looking for tasks again
+
+class LThreadPoolWorker;
+
+struct LThreadPoolPriv : public LMutex
+{
+	GArray<LThreadPoolWorker*> Workers;
+	GArray<LThreadPoolWorker*> Sleepers; // Workers blocked on their event
+	int Next; // Round robin index for tasks added from outside the pool
+	bool Exiting;
+
+	LThreadPoolPriv() : LMutex("LThreadPoolPriv")
+	{
+		Next = 0;
+		Exiting = false;
+	}
+
+	int CurrentWorker();
+	void Push(int Idx, LThreadTask *t);
+	LThreadTask *Take(int Idx);
+};
+
+class LThreadPoolWorker : public LThread
+{
+	LThreadPool *Pool;
+	LThreadPoolPriv *d;
+	int Index;
+
+public:
+	LMutex QueueLock;
+	GArray<LThreadTask*> Queue;	// Tasks in [Head, Length), owner pops the end
+	size_t Head;				// Thieves take from here
+	LThreadEvent Event;
+
+	LThreadPoolWorker(LThreadPool *pool, LThreadPoolPriv *priv, int idx) :
+		LThread("LThreadPoolWorker"),
+		QueueLock("LThreadPoolWorker.Queue")
+	{
+		Pool = pool;
+		d = priv;
+		Index = idx;
+		Head = 0;
+	}
+
+	~LThreadPoolWorker()
+	{
+		for (size_t i=Head; i<Queue.Length(); i++)
+			DeleteObj(Queue[i]);
+	}
+
+	void Push(LThreadTask *t)
+	{
+		LMutex::Auto Lck(&QueueLock, _FL);
+		Queue.Add(t);
+	}
+
+	LThreadTask *Pop()
+	{
+		LMutex::Auto Lck(&QueueLock, _FL);
+		if (Queue.Length() <= Head)
+			return NULL;
+		LThreadTask *t = Queue.Last();
+		Queue.Length(Queue.Length() - 1);
+		if (Queue.Length() == Head)
+			Queue.Length(Head = 0);
+		return t;
+	}
+
+	LThreadTask *Steal()
+	{
+		LMutex::Auto Lck(&QueueLock, _FL);
+		if (Queue.Length() <= Head)
+			return NULL;
+		LThreadTask *t = Queue[Head++];
+		if (Queue.Length() == Head)
+			Queue.Length(Head = 0);
+		return t;
+	}
+
+	int Main()
+	{
+		while (!d->Exiting)
+		{
+			LThreadTask *t = d->Take(Index);
+			if (!t)
+			{
+				// Register as a sleeper before the final look so that a
+				// task pushed after this point will signal us.
+				if (d->Lock(_FL))
+				{
+					d->Sleepers.Add(this);
+					d->Unlock();
+				}
+
+				t = d->Take(Index);
+				if (!t)
+				{
+					Event.Wait();
+					continue;
+				}
+
+				if (d->Lock(_FL))
+				{
+					d->Sleepers.Delete(this);
+					d->Unlock();
+				}
+			}
+
+			Pool->Execute(t);
+		}
+
+		return 0;
+	}
+};
+
+int LThreadPoolPriv::CurrentWorker()
+{
+	OsThreadId Me = GetCurrentThreadId();
+	for (unsigned i=0; i<Workers.Length(); i++)
+	{
+		if (Workers[i]->GetId() == Me)
+			return i;
+	}
+	return -1;
+}
+
+void LThreadPoolPriv::Push(int Idx, LThreadTask *t)
+{
+	if (Idx < 0)
+	{
+		// Not a pool thread, spread the tasks over the workers.
+		if (Lock(_FL))
+		{
+			Idx = Next++ % Workers.Length();
+			Unlock();
+		}
+		else Idx = 0;
+	}
+
+	Workers[Idx]->Push(t);
+
+	LThreadPoolWorker *Wake = NULL;
+	if (Lock(_FL))
+	{
+		if (Sleepers.Length())
+		{
+			Wake = Sleepers.Last();
+			Sleepers.Length(Sleepers.Length() - 1);
+		}
+		Unlock();
+	}
+	if (Wake)
+		Wake->Event.Signal();
+}
+
+LThreadTask *LThreadPoolPriv::Take(int Idx)
+{
+	LThreadTask *t;
+	if (Idx >= 0 && (t = Workers[Idx]->Pop()))
+		return t;
+
+	int Len = (int)Workers.Length();
+	int Start = Idx >= 0 ? Idx + 1 : 0;
+	for (int i=0; i<Len; i++)
+	{
+		int n = (Start + i) % Len;
+		if (n != Idx && (t = Workers[n]->Steal()))
+			return t;
+	}
+
+	return NULL;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+static LMutex PoolLock("LThreadPool");
+static GAutoPtr<LThreadPool> PoolInst;
+
+LThreadPool *LThreadPool::Inst()
+{
+	if (!PoolInst && PoolLock.Lock(_FL))
+	{
+		if (!PoolInst)
+			PoolInst.Reset(new LThreadPool);
+		PoolLock.Unlock();
+	}
+
+	return PoolInst;
+}
+
+LThreadPool::LThreadPool()
+{
+	d = new LThreadPoolPriv;
+
+	int Cpus = LgiApp ? LgiApp->GetCpuCount() : -1;
+	if (Cpus < 1)
+		Cpus = 2;
+
+	for (int i=0; i<Cpus; i++)
+	{
+		LThreadPoolWorker *w = new LThreadPoolWorker(this, d, i);
+		d->Workers.Add(w);
+	}
+
+	// Start the threads once the worker array is complete
+	for (unsigned i=0; i<d->Workers.Length(); i++)
+		d->Workers[i]->Run();
+}
+
+LThreadPool::~LThreadPool()
+{
+	d->Exiting = true;
+	for (unsigned i=0; i<d->Workers.Length(); i++)
+		d->Workers[i]->Event.Signal();
+	for (unsigned i=0; i<d->Workers.Length(); i++)
+	{
+		while (!d->Workers[i]->IsExited())
+			LgiSleep(1);
+	}
+
+	d->Workers.DeleteObjects();
+	DeleteObj(d);
+}
+
+int LThreadPool::GetThreads()
+{
+	return (int)d->Workers.Length();
+}
+
+void LThreadPool::Add(LThreadTask *t)
+{
+	if (t)
+		d->Push(d->CurrentWorker(), t);
+}
+
+bool LThreadPool::RunOne()
+{
+	LThreadTask *t = d->Take(d->CurrentWorker());
+	if (!t)
+		return false;
+
+	Execute(t);
+	return true;
+}
+
+void LThreadPool::Execute(LThreadTask *t)
+{
+	LThreadTaskGroup *g = t->Group;
+	if (!g || !g->IsCancelled())
+		t->Do();
+	DeleteObj(t);
+	if (!g)
+		return;
+
+	GEventSinkI *Sink = NULL;
+	int Cmd = 0;
+	GMessage::Param Param = 0;
+	bool Cancelled = false;
+
+	// The group may be freed as soon as Pending is zero and the lock is
+	// released, so copy out anything needed afterwards.
+	if (d->Lock(_FL))
+	{
+		if (--g->Pending == 0)
+		{
+			Sink = g->Sink;
+			Cmd = g->SinkCmd;
+			Param = g->SinkParam;
+			Cancelled = g->IsCancelled();
+			g->Done.Signal();
+		}
+		d->Unlock();
+	}
+
+	if (Sink)
+		Sink->PostEvent(Cmd, Param, Cancelled);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+LThreadTaskGroup::LThreadTaskGroup(LCancel *parent)
+{
+	Parent = parent;
+	Pending = 0;
+	Sink = NULL;
+	SinkCmd = 0;
+	SinkParam = 0;
+}
+
+LThreadTaskGroup::~LThreadTaskGroup()
+{
+	Wait();
+}
+
+bool LThreadTaskGroup::IsCancelled()
+{
+	return LCancel::IsCancelled() || (Parent && Parent->IsCancelled());
+}
+
+void LThreadTaskGroup::SetSink(GEventSinkI *sink, int Cmd, GMessage::Param Param)
+{
+	Sink = sink;
+	SinkCmd = Cmd;
+	SinkParam = Param;
+}
+
+void LThreadTaskGroup::Add(LThreadTask *t)
+{
+	if (!t)
+		return;
+
+	LThreadPool *Pool = LThreadPool::Inst();
+	t->Group = this;
+	if (Pool->d->Lock(_FL))
+	{
+		Pending++;
+		Pool->d->Unlock();
+	}
+	Pool->Add(t);
+}
+
+int LThreadTaskGroup::GetPending()
+{
+	LThreadPool *Pool = LThreadPool::Inst();
+	LMutex::Auto Lck(Pool->d, _FL);
+	return Pending;
+}
+
+bool LThreadTaskGroup::Wait()
+{
+	LThreadPool *Pool = LThreadPool::Inst();
+	while (GetPending() > 0)
+	{
+		// Help out instead of blocking, any task will do.
+		if (!Pool->RunOne())
+			Done.Wait(POOL_HELP_WAIT_MS);
+	}
+
+	return !IsCancelled();
+}
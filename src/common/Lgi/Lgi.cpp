@@ -25,6 +25,7 @@
 #include "Lgi.h"
 #include "GToken.h"
 #include "GCapabilities.h"
+#include "LFileWalker.h"
 
 #if defined(LINUX) && !defined(LGI_SDL)
 	#include "LgiWinManGlue.h"
@@ -360,6 +361,29 @@ const char *LgiGetOsName()
 #define RecursiveFileSearch_Wildcard "*"
 #endif
 
+struct RecursiveFileSearch_Collect : public LMutex
+{
+	GArray<char*> *Files;
+
+	RecursiveFileSearch_Collect(GArray<char*> *files) : LMutex("RecursiveFileSearch_Collect")
+	{
+		Files = files;
+	}
+};
+
+static bool RecursiveFileSearch_Add(void *UserData, LFileWalker::Entry &e)
+{
+	RecursiveFileSearch_Collect *c = (RecursiveFileSearch_Collect*)UserData;
+	LMutex::Auto Lck(c, _FL);
+	c->Files->Add(NewStr(e.Path, e.PathLen));
+	return true;
+}
+
+static int RecursiveFileSearch_Cmp(const void *a, const void *b)
+{
+	return strcmp(*(char**)a, *(char**)b);
+}
+
 bool LgiRecursiveFileSearch(const char *Root,
 							GArray<const char*> *Ext,
 							GArray<char*> *Files,
@@ -373,6 +397,34 @@ bool LgiRecursiveFileSearch(const char *Root,
 	// validate args
 	if (!Root) return 0;
 
+	if (!Callback)
+	{
+		// Nothing needs the GDirectory, so use the parallel walker.
+		LFileWalker Walker(LFileWalker::WalkParallel | (Size ? LFileWalker::WalkSize : 0));
+		if (Ext)
+		{
+			for (unsigned i=0; i<Ext->Length(); i++)
+				Walker.AddPattern((*Ext)[i]);
+		}
+
+		RecursiveFileSearch_Collect Collect(Files);
+		size_t Start = Files ? Files->Length() : 0;
+		Walker.Walk(Root, Files ? RecursiveFileSearch_Add : NULL, &Collect);
+		if (Files && Files->Length() > Start + 1)
+		{
+			// The threads add files in any order, sort them so that callers
+			// see the same list each time.
+			qsort(Files->AddressOf(Start), Files->Length() - Start, sizeof(char*), RecursiveFileSearch_Cmp);
+		}
+		if (Size)
+			*Size += Walker.GetSize();
+		if (Count)
+			*Count += Walker.GetFiles();
+
+		// Like the GDirectory search, a root that can't be read isn't a failure.
+		return true;
+	}
+
 	// get directory enumerator
 	GDirectory Dir;
 	Status = true;
@@ -437,7 +489,7 @@ bool LgiRecursiveFileSearch(const char *Root,
 
 				if (Count)
 				{
-					Count++;
+					(*Count)++;
 				}
 
 				Status = true;
@@ -16,6 +16,11 @@
 #endif
 #include "GProgressDlg.h"
 #include "LgiRes.h"
+#ifdef POSIX
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #define STORE_DIR_ALLOC					8
 
@@ -73,75 +78,138 @@ StorageItemHeader::StorageItemHeader()
 	DirAlloc = 0;
 }
 
-bool StorageItemHeader::Serialize(GFile &f, bool Write)
+static uint32 Store2_Get32(const uint8 *p)
 {
-	bool Status = true;
-	int64 Here = f.GetPos();
+	return	(uint32)p[0] |
+			((uint32)p[1] << 8) |
+			((uint32)p[2] << 16) |
+			((uint32)p[3] << 24);
+}
 
-	if (Write)
+static void Store2_Put32(uint8 *p, uint32 i)
+{
+	p[0] = (uint8)i;
+	p[1] = (uint8)(i >> 8);
+	p[2] = (uint8)(i >> 16);
+	p[3] = (uint8)(i >> 24);
+}
+
+/// Waits for what's been written to 'f' to reach the disk, so that the
+/// writes after it can't get there first.
+static bool Store2_Flush(GFile &f)
+{
+	#if defined(WIN32)
+	return FlushFileBuffers(f.Handle()) != 0;
+	#elif defined(POSIX)
+	return fsync(f.Handle()) == 0;
+	#else
+	return true;
+	#endif
+}
+
+static uint64 Store2_Get64(const uint8 *p)
+{
+	return (uint64)Store2_Get32(p) | ((uint64)Store2_Get32(p + 4) << 32);
+}
+
+static void Store2_Put64(uint8 *p, uint64 i)
+{
+	Store2_Put32(p, (uint32)i);
+	Store2_Put32(p + 4, (uint32)(i >> 32));
+}
+
+void StorageItemHeader::Encode(uint8 *p, int Version)
+{
+	Magic = STORAGE2_ITEM_MAGIC;
+
+	if (Version >= STORAGE2_VERSION3)
+	{
+		Store2_Put32(p, Magic);
+		Store2_Put32(p + 4, Type);
+		Store2_Put64(p + 8, DataLoc);
+		Store2_Put32(p + 16, DataSize);
+		Store2_Put32(p + 20, DirCount);
+		Store2_Put64(p + 24, ParentLoc);
+		Store2_Put64(p + 32, DirLoc);
+		Store2_Put32(p + 40, DirAlloc);
+		Store2_Put32(p + 44, 0);
+	}
+	else
 	{
-		Magic = STORAGE2_ITEM_MAGIC;
+		LgiAssert(DataLoc <= 0xffffffff && ParentLoc <= 0xffffffff && DirLoc <= 0xffffffff);
+		Store2_Put32(p, Magic);
+		Store2_Put32(p + 4, Type);
+		Store2_Put32(p + 8, (uint32)DataLoc);
+		Store2_Put32(p + 12, DataSize);
+		Store2_Put32(p + 16, (uint32)ParentLoc);
+		Store2_Put32(p + 20, (uint32)DirLoc);
+		Store2_Put32(p + 24, DirCount);
+		Store2_Put32(p + 28, DirAlloc);
+	}
+}
 
-		f << Magic;
-		f << Type;
-		f << DataLoc;
-		f << DataSize;
-		f << ParentLoc;
-		f << DirLoc;
-		f << DirCount;
-		f << DirAlloc;
+void StorageItemHeader::Decode(const uint8 *p, int Version)
+{
+	Magic = Store2_Get32(p);
+	Type = Store2_Get32(p + 4);
+	if (Version >= STORAGE2_VERSION3)
+	{
+		DataLoc = Store2_Get64(p + 8);
+		DataSize = Store2_Get32(p + 16);
+		DirCount = Store2_Get32(p + 20);
+		ParentLoc = Store2_Get64(p + 24);
+		DirLoc = Store2_Get64(p + 32);
+		DirAlloc = Store2_Get32(p + 40);
 	}
 	else
 	{
-		f >> Magic;
-		f >> Type;
-		f >> DataLoc;
-		f >> DataSize;
-		f >> ParentLoc;
-		f >> DirLoc;
-		f >> DirCount;
-		f >> DirAlloc;
+		DataLoc = Store2_Get32(p + 8);
+		DataSize = Store2_Get32(p + 12);
+		ParentLoc = Store2_Get32(p + 16);
+		DirLoc = Store2_Get32(p + 20);
+		DirCount = Store2_Get32(p + 24);
+		DirAlloc = Store2_Get32(p + 28);
+	}
+}
+
+bool StorageItemHeader::Serialize(GFile &f, bool Write, int Version)
+{
+	uint8 Buf[STORAGE2_HEADER_V3];
+	int Size = DiskSize(Version);
 
-		Status = Magic == STORAGE2_ITEM_MAGIC;
-		if (!Status)
+	if (Write)
+	{
+		Encode(Buf, Version);
+		if (f.Write(Buf, Size) != Size)
 		{
-			printf("%s:%i - Magic wrong %x != %x\n",
-				_FL, Magic, STORAGE2_ITEM_MAGIC);
+			printf("%s:%i - Header write failed.\n", _FL);
 			return false;
 		}
 	}
-
-	if (Here + 32 != f.GetPos())
+	else
 	{
-		if (!Write)
+		int64 Here = f.GetPos();
+		ssize_t Rd = f.Read(Buf, Size);
+		if (Rd != Size)
 		{
-			int64 Diff = Here + 32 - f.GetPos();
-			printf("%s:%i - Wrong length, Here+32=" LGI_PrintfInt64 " != GetPos=" LGI_PrintfInt64
-				" Diff=" LGI_PrintfInt64
+			printf("%s:%i - Wrong length, read %i of %i bytes at " LGI_PrintfInt64
 				" FileSize=" LGI_PrintfInt64 "\n",
-				_FL, Here+32, f.GetPos(), Diff, f.GetSize());
+				_FL, (int)Rd, Size, Here, f.GetSize());
+			return false;
+		}
+
+		Decode(Buf, Version);
+		if (Magic != STORAGE2_ITEM_MAGIC)
+		{
+			printf("%s:%i - Magic wrong %x != %x\n",
+				_FL, Magic, STORAGE2_ITEM_MAGIC);
+			return false;
 		}
-			
-		return false;
 	}
 	
 	return true;
 }
 
-void StorageItemHeader::SwapBytes()
-{
-	#ifdef __BIG_ENDIAN__
-	Magic = LgiSwap32(Magic);
-	Type = LgiSwap32(Type);
-	DataLoc = LgiSwap32(DataLoc);
-	DataSize = LgiSwap32(DataSize);
-	ParentLoc = LgiSwap32(ParentLoc);
-	DirLoc = LgiSwap32(DirLoc);
-	DirCount = LgiSwap32(DirCount);
-	DirAlloc = LgiSwap32(DirAlloc);
-	#endif
-}
-
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 StorageItemImpl::StorageItemImpl(StorageItemHeader *header)
 {
@@ -164,6 +232,8 @@ StorageItemImpl::StorageItemImpl(StorageItemHeader *header)
 StorageItemImpl::~StorageItemImpl()
 {
 	// LgiTrace("%p::~StorageItemImpl obj=%p type=%x\n", this, Object, Object ? Object->Type()  : 0);
+	if (Tree)
+		Tree->_OnDelete(this);
 
 	StorageItemImpl *i, *n;
 	for (i = Child; i; i = n)
@@ -218,7 +288,8 @@ int StorageItemImpl::GetTotalSize()
 {
 	if (Header)
 	{
-		return	((1 + Header->DirAlloc - Header->DirCount) * sizeof(StorageItemHeader)) + 
+		int HeaderSize = Tree ? Tree->_HeaderSize() : STORAGE2_HEADER_V2;
+		return	((1 + Header->DirAlloc - Header->DirCount) * HeaderSize) + 
 				Header->DataSize;
 	}
 
@@ -277,7 +348,7 @@ GFile *StorageItemImpl::GotoObject(const char *file, int line)
 	}
 	else
 	{
-		printf("%s:%i - Bad Param or loc=%u (type=%x)\n", _FL, Header->DataLoc, Header->Type);
+		printf("%s:%i - Bad Param or loc=" LGI_PrintfInt64 " (type=%x)\n", _FL, (int64)Header->DataLoc, Header->Type);
 	}
 
 	return f;
@@ -337,14 +408,14 @@ bool StorageItemImpl::SerializeHeader(GFile &f, bool Write)
 				f.SetPos(StoreLoc);
 				if (f.GetPos() == StoreLoc)
 				{
-					Status = Header->Serialize(f, Write);
+					Status = Header->Serialize(f, Write, Tree->Version);
 					if (Status)
 					{
 						HeaderDirty = false;
 					}
 					else
 					{
-						printf("%s:%i - Header->Serialize failed at file offset 0x%x .\n", _FL, StoreLoc);
+						printf("%s:%i - Header->Serialize failed at file offset 0x" LGI_PrintfHex64 " .\n", _FL, StoreLoc);
 					}
 
 					#if defined(_DEBUG) && defined(WINDOWS)
@@ -392,7 +463,15 @@ bool StorageItemImpl::SerializeObject(GSubFilePtr &f, bool Write)
 					// change required
 					if (Size > Header->DataSize)
 					{
-						Header->DataLoc = (uint32)f.GetSize();
+						uint64 OldLoc = Header->DataLoc;
+						Header->DataLoc = Tree->_Alloc(Size);
+						if (OldLoc)
+							Tree->_Free(OldLoc, Header->DataSize);
+					}
+					else if (Header->DataLoc)
+					{
+						// give back the unused tail
+						Tree->_Free(Header->DataLoc + Size, Header->DataSize - Size);
 					}
 					Header->DataSize = Size;
 					HeaderDirty = true;
@@ -519,6 +598,23 @@ bool StorageItemImpl::Save()
 	return Status;
 }
 
+bool StorageItemImpl::GetView(const uint8 *&Ptr, int &Len)
+{
+	if (!Tree ||
+		!Header ||
+		!Tree->_ValidLoc(Header->DataLoc) ||
+		(Object && Object->GetDirty()))
+		return false;
+
+	LMutex::Auto Lck(Tree, _FL);
+	Ptr = Tree->_Map(Header->DataLoc, Header->DataSize);
+	if (!Ptr)
+		return false;
+
+	Len = Header->DataSize;
+	return true;
+}
+
 StorageItem *StorageItemImpl::GetNext()
 {
 	return Next;
@@ -557,112 +653,100 @@ StorageItem *StorageItemImpl::GetChild()
 			// Load in the children
 
 			// Allocate directory
-			uint32 Pos = Header->DirLoc;
+			uint64 Pos = Header->DirLoc;
+			int HeaderSize = Tree->_HeaderSize();
 			LgiAssert(Header->DirAlloc <= 40000); // this it arbitary, increase if needed
 
+			if (Header->DirCount > Header->DirAlloc)
+			{
+				// This should not be???
+				// Oh well, fix it up here by searching through the items
+				// on disk looking for the last valid looking entry and call
+				// that our 'length'.
+				StorageItemHeader Test;
+				Tree->File->SetPos(Header->DirLoc);
+				for (Header->DirCount = 0; true; Header->DirCount++)
+				{
+					if (!Test.Serialize(*Tree->File, false, Tree->Version))
+						break;
+				}
+
+				// We don't know the _actual_ alloc, but making it the same as the
+				// length is probably the safest thing to do.
+				Header->DirAlloc = Header->DirCount;
+			}
+
 			Dir = new StorageItemHeader[Header->DirAlloc];
 			if (Dir)
 			{
-				// Seek to directory
-				bool GotLoc = Tree->File->SetPos(Header->DirLoc) == Header->DirLoc;
-				LgiAssert(GotLoc);
-				if (GotLoc)
+				// Read directory in one big hit... the speed oh the SPEEEED!
+				// When the file is mapped this doesn't copy at all.
+				GArray<uint8> Buf;
+				const uint8 *Raw = Tree->_Get(Header->DirLoc, Header->DirCount * HeaderSize, Buf);
+				LgiAssert(Raw != NULL);
+				if (Raw)
 				{
-					// Read directory in one big hit... the speed oh the SPEEEED!
-					if (Header->DirCount > Header->DirAlloc)
+					// Decode them all first, a bad entry gets swapped with the last
+					for (unsigned i=0; i<Header->DirCount; i++)
+						Dir[i].Decode(Raw + (i * HeaderSize), Tree->Version);
+
+					// Now allocate a list of children items
+					StorageItemImpl *Last = 0;
+					bool ChildHeaderDirty = false; // default setting for Item->HeaderDirty
+					for (unsigned i=0; i<Header->DirCount; i++)
 					{
-						// This should not be???
-						// Oh well, fix it up here by searching through the items
-						// on disk looking for the last valid looking entry and call
-						// that our 'length'.
-						StorageItemHeader Test;
-						for (Header->DirCount = 0; true; Header->DirCount++)
+						// Check the pos is not one of our parent items...
+						// Because that would be bad... veeerry bad...
+						bool RecursiveLoop = false;
+						for (StorageItemImpl *p = this; p; p = p->Parent)
 						{
-							if (Tree->File->Read(&Test, sizeof(Test)) == sizeof(Test))
+							if (p->StoreLoc == Pos)
 							{
-								Test.SwapBytes();
-								if (Test.Magic != STORAGE2_ITEM_MAGIC)
-								{
-									break;
-								}
+								RecursiveLoop = true;
+								break;
 							}
-							else break;
 						}
 
-						// We don't know the _actual_ alloc, but making it the same as the
-						// length is probably the safest thing to do.
-						Header->DirAlloc = Header->DirCount;
-
-						// Reset the file point after ourselves
-						Tree->File->SetPos(Header->DirLoc);
-					}
-
-					int DirLength = Header->DirCount * sizeof(StorageItemHeader);
-					bool GotLength = Tree->File->Read(Dir, DirLength) == DirLength;
-					LgiAssert(GotLength);
-					if (GotLength)
-					{
-						// Now allocate a list of children items
-						StorageItemImpl *Last = 0;
-						bool ChildHeaderDirty = false; // default setting for Item->HeaderDirty
-						for (unsigned i=0; i<Header->DirCount; i++)
+						if (RecursiveLoop)
 						{
-							// Swap bytes
-							Dir[i].SwapBytes();
-
-							// Check the pos is not one of our parent items...
-							// Because that would be bad... veeerry bad...
-							bool RecursiveLoop = false;
-							for (StorageItemImpl *p = this; p; p = p->Parent)
+							// This node is really one of our parent nodes.
+							// Which is obviously invalid, swap it with the last one
+							// and reduce the size of the directory
+							if (i < Header->DirCount - 1)
 							{
-								if (p->StoreLoc == Pos)
-								{
-									RecursiveLoop = true;
-									break;
-								}
+								Dir[i] = Dir[Header->DirCount - 1];
 							}
-
-							if (RecursiveLoop)
+							Header->DirCount--;
+							ChildHeaderDirty = HeaderDirty = true;
+							i--;
+						}
+						else
+						{
+							StorageItemImpl *Item = new StorageItemImpl(Dir+i);
+							if (Item)
 							{
-								// This node is really one of our parent nodes.
-								// Which is obviously invalid, swap it with the last one
-								// and reduce the size of the directory
-								if (i < Header->DirCount - 1)
+								// Set the child item
+								Item->StoreLoc = Pos;
+								Item->Parent = this;
+								Item->Tree = Tree;
+								Item->HeaderDirty = ChildHeaderDirty;
+								if (i == 0)
 								{
-									Dir[i] = Dir[Header->DirCount - 1];
+									Child = Item;
 								}
-								Header->DirCount--;
-								ChildHeaderDirty = HeaderDirty = true;
-								i--;
-							}
-							else
-							{
-								StorageItemImpl *Item = new StorageItemImpl(Dir+i);
-								if (Item)
+								else
 								{
-									// Set the child item
-									Item->StoreLoc = Pos;
-									Item->Parent = this;
-									Item->Tree = Tree;
-									Item->HeaderDirty = ChildHeaderDirty;
-									if (i == 0)
-									{
-										Child = Item;
-									}
-									else
-									{
-										LgiAssert(Last != NULL);
-										Last->Next = Item;
-										Item->Prev = Last;
-									}
-
-									Last = Item;
+									LgiAssert(Last != NULL);
+									Last->Next = Item;
+									Item->Prev = Last;
 								}
-								else break; // mem alloc error
-							}
 
-							Pos += sizeof(StorageItemHeader); // 32 bytes
+								Last = Item;
+							}
+							else break; // mem alloc error
 						}
+
+						Pos += HeaderSize;
 					}
 				}
 			}
@@ -692,8 +776,19 @@ bool StorageItemImpl::IncDirSize()
 			if (Header->DirCount >= Header->DirAlloc)
 			{
 				// dir needs to grow
-				Header->DirLoc = (uint32) Tree->File->GetSize();
+				uint64 OldLoc = Header->DirLoc;
+				uint64 OldSize = Header->DirAlloc * Tree->_HeaderSize();
+				uint64 NewLoc = Tree->_Alloc((Header->DirAlloc + STORE_DIR_ALLOC) * Tree->_HeaderSize());
+				if (!NewLoc)
+				{
+					Tree->Unlock();
+					return false;
+				}
+
 				Header->DirAlloc += STORE_DIR_ALLOC;
+				Header->DirLoc = NewLoc;
+				if (OldLoc)
+					Tree->_Free(OldLoc, OldSize);
 
 				ReallocateDir = true;
 			}
@@ -742,13 +837,14 @@ bool StorageItemImpl::DirChange()
 		if (Dir)
 		{
 			// tell any children the address of their header and loc
+			int HeaderSize = Tree->_HeaderSize();
 			uint32 n = 0;
 			for (StorageItemImpl *i = Child; i; i = i->Next)
 			{
 				i->HeaderDirty = false;
 				i->Header = Dir + n;
 				i->Header->ParentLoc = StoreLoc;
-				i->StoreLoc = Header->DirLoc + (n * sizeof(StorageItemHeader));
+				i->StoreLoc = Header->DirLoc + (n * HeaderSize);
 
 				n++;
 			}
@@ -758,17 +854,12 @@ bool StorageItemImpl::DirChange()
 			LgiAssert(GotPos);
 			if (GotPos)
 			{
-				int DirLength = Header->DirAlloc * sizeof(StorageItemHeader);
-				#ifdef __BIG_ENDIAN__
-				int i;
-				for (i=0; i<Header->DirAlloc; i++)
-					Dir[i].SwapBytes();
-				#endif
-				int w = Tree->File->Write(Dir, DirLength);
-				#ifdef __BIG_ENDIAN__
-				for (i=0; i<Header->DirAlloc; i++)
-					Dir[i].SwapBytes();
-				#endif
+				int DirLength = Header->DirAlloc * HeaderSize;
+				GArray<uint8> Buf;
+				Buf.Length(DirLength);
+				for (unsigned i=0; i<Header->DirCount; i++)
+					Dir[i].Encode(Buf.AddressOf(i * HeaderSize), Tree->Version);
+				int w = Tree->File->Write(Buf.AddressOf(), DirLength);
 				LgiAssert(w == DirLength);
 				if (w == DirLength)
 				{
@@ -1037,29 +1128,34 @@ bool StorageItemImpl::DeleteAllChildren()
 	{
 		if (Tree->Lock(_FL))
 		{
+			// load the children so their space can be reclaimed
+			GetChild();
+
+			// clear grandchildren, and free the children's data while
+			// their headers are still intact
+			for (StorageItemImpl *Item = Child; Item; Item = Item->Next)
+			{
+				Item->DeleteAllChildren();
+				if (Item->Header->DataLoc)
+					Tree->_Free(Item->Header->DataLoc, Item->Header->DataSize);
+			}
+
 			// clear contents of dir on disk
 			if (Dir)
 			{
-				int DirLength = Header->DirAlloc * sizeof(StorageItemHeader);
+				int DirLength = Header->DirAlloc * Tree->_HeaderSize();
 
 				// zero out all the Headers..
-				memset(Dir, 0, DirLength);
+				memset(Dir, 0, Header->DirAlloc * sizeof(StorageItemHeader));
 
 				// write it
 				int64 NewLoc = Tree->File->SetPos(Header->DirLoc);
 				LgiAssert(NewLoc == Header->DirLoc);
 				if (NewLoc == Header->DirLoc)
 				{
-					#ifdef __BIG_ENDIAN__
-					int i;
-					for (i=0; i<Header->DirAlloc; i++)
-						Dir[i].SwapBytes();
-					#endif
-					bool WroteDir = Tree->File->Write(Dir, DirLength) == DirLength;
-					#ifdef __BIG_ENDIAN__
-					for (i=0; i<Header->DirAlloc; i++)
-						Dir[i].SwapBytes();
-					#endif
+					GArray<uint8> Zero;
+					Zero.Length(DirLength);
+					bool WroteDir = Tree->File->Write(Zero.AddressOf(), DirLength) == DirLength;
 					LgiAssert(WroteDir);
 				}
 				else
@@ -1071,17 +1167,13 @@ bool StorageItemImpl::DeleteAllChildren()
 				// this way a repair can't find the dir and do anything with it.
 			}
 
-			// clear grandchildren
-			for (StorageItemImpl *Item = Child; Item; Item = Item->Next)
-			{
-				Item->DeleteAllChildren();
-			}
-
 			// clear children
 			DeleteObj(Child);
 			DeleteArray(Dir);
 
-			// clear dir table (space won't be reclaimed until a compact)
+			// clear dir table
+			if (Header->DirLoc)
+				Tree->_Free(Header->DirLoc, Header->DirAlloc * Tree->_HeaderSize());
 			Header->DirCount = 0;
 			Header->DirAlloc = 0;
 			Header->DirLoc = 0;
@@ -1158,6 +1250,51 @@ namespace Storage2
 	public:
 		StorageItemImpl *Dir;
 		StorageItemImpl *Object;
+
+		Block() : GSegment(0, 0) {}
+	};
+
+	// A range of unused bytes in the file
+	struct Extent
+	{
+		uint64 Start;
+		uint64 Len;
+	};
+
+	// Written to "<file>.journal" while CompactStep moves an object. The
+	// object's bytes are copied before this is written, so after a crash the
+	// move can always be finished by writing 'Header' at 'HeaderLoc'.
+	//
+	//	uint32 Magic;					// STORAGE2_JOURNAL_MAGIC
+	//	uint32 HeaderSize;				// bytes used in 'Header'
+	//	uint64 HeaderLoc;
+	//	uint8 Header[STORAGE2_HEADER_V3]; // encoded
+	//
+	// All little endian.
+	#define STORAGE2_JOURNAL_SIZE		(16 + STORAGE2_HEADER_V3)
+
+	// A read only mapping of the file
+	struct Mapping
+	{
+		uint8 *Ptr;
+		uint64 Len;
+	};
+
+	// The kit's file, object reads come straight from the mapping when there is one.
+	class StorageKitFile : public GSubFile
+	{
+		StorageKitImpl *Kit;
+
+	public:
+		StorageKitFile(StorageKitImpl *kit) : GSubFile(kit, false)
+		{
+			Kit = kit;
+		}
+
+		const uint8 *GetView(int64 Loc, int64 Len)
+		{
+			return Loc >= 0 && Len >= 0 ? Kit->_Map(Loc, Len) : NULL;
+		}
 	};
 
 	class StorageKitImplPrivate
@@ -1172,6 +1309,23 @@ namespace Storage2
 		DoEvery _Timer;
 		int _CompactPos;
 		Block **Blocks;
+
+		// Free space
+		GArray<Extent> FreeMap;			// sorted by start, touching extents are merged
+		uint64 End;						// end of the last allocation, can be past the end
+										// of the file until the object is written
+		uint64 MapLoc, MapFileSize;		// saved map details for the file header
+		int MapSize, MapMagic;
+
+		// Mappings, the last is the current one. Older ones are kept so that
+		// views handed out stay valid, until Compact moves everything.
+		GArray<Mapping> Maps;
+		uint64 MapValid;				// bytes of the current mapping known to be in the file
+
+		// Incremental compact
+		StorageItemImpl *CompactNext;	// next item CompactStep looks at, 0 = start a pass at the root
+		bool CompactMoved;				// something moved in this pass
+		bool CompactIdle;				// a whole pass moved nothing, wait for more free space
 		
 		StorageKitImplPrivate(StorageKitImpl *kit)
 		{
@@ -1180,11 +1334,220 @@ namespace Storage2
 			UserData = 0;
 			_Ui = 0;
 			Blocks = 0;
+			End = 0;
+			MapLoc = MapFileSize = 0;
+			MapSize = MapMagic = 0;
+			MapValid = 0;
+			CompactNext = 0;
+			CompactMoved = false;
+			CompactIdle = false;
 		}
 
 		~StorageKitImplPrivate()
 		{
 			DeleteArray(Blocks);
+			Unmap();
+		}
+
+		void Unmap()
+		{
+			#ifdef POSIX
+			for (unsigned i=0; i<Maps.Length(); i++)
+				munmap(Maps[i].Ptr, (size_t)Maps[i].Len);
+			#endif
+			Maps.Length(0);
+			MapValid = 0;
+		}
+
+		/// The smallest free extent that 'Size' bytes fit in without going past 'Below'.
+		ssize_t FindFit(uint64 Size, uint64 Below)
+		{
+			ssize_t Best = -1;
+			for (unsigned i=0; i<FreeMap.Length(); i++)
+			{
+				Extent &e = FreeMap[i];
+				if (e.Start + Size > Below)
+					break;
+				if (e.Len >= Size &&
+					(Best < 0 || e.Len < FreeMap[Best].Len))
+				{
+					Best = i;
+					if (e.Len == Size)
+						break;
+				}
+			}
+			return Best;
+		}
+
+		/// Allocates 'Size' bytes from the start of extent 'Idx'.
+		void Take(ssize_t Idx, uint64 Size)
+		{
+			Extent &e = FreeMap[Idx];
+			e.Start += Size;
+			e.Len -= Size;
+			if (!e.Len)
+				FreeMap.DeleteAt(Idx, true);
+		}
+
+		void ResetFreeMap()
+		{
+			FreeMap.Length(0);
+			End = Kit->File->GetSize();
+			CompactNext = 0;
+			CompactIdle = false;
+		}
+
+		GString JournalFile()
+		{
+			GString s = Kit->FileName;
+			return s + ".journal";
+		}
+
+		bool WriteJournal(uint64 HeaderLoc, StorageItemHeader &h)
+		{
+			uint8 j[STORAGE2_JOURNAL_SIZE];
+			ZeroObj(j);
+			Store2_Put32(j, STORAGE2_JOURNAL_MAGIC);
+			Store2_Put32(j + 4, Kit->_HeaderSize());
+			Store2_Put64(j + 8, HeaderLoc);
+			h.Encode(j + 16, Kit->Version);
+
+			GFile f;
+			if (!f.Open(JournalFile(), O_WRITE))
+				return false;
+			f.SetSize(0);
+			return	f.Write(j, sizeof(j)) == sizeof(j) &&
+					Store2_Flush(f);
+		}
+
+		void ClearJournal()
+		{
+			FileDev->Delete(JournalFile(), false);
+		}
+
+		/// Finishes a move that was cut off by a crash.
+		void RecoverJournal()
+		{
+			GString Name = JournalFile();
+			if (!FileExists(Name))
+				return;
+
+			GFile f;
+			uint8 j[STORAGE2_JOURNAL_SIZE];
+			if (f.Open(Name, O_READ) &&
+				f.Read(j, sizeof(j)) == sizeof(j) &&
+				Store2_Get32(j) == STORAGE2_JOURNAL_MAGIC &&
+				Store2_Get32(j + 4) == Kit->_HeaderSize() &&
+				Kit->_ValidLoc(Store2_Get64(j + 8)))
+			{
+				int64 HeaderLoc = Store2_Get64(j + 8);
+				LgiTrace("%s:%i - Finishing the move of the item at " LGI_PrintfInt64 ".\n", _FL, HeaderLoc);
+				if (Kit->File->SetPos(HeaderLoc) == HeaderLoc &&
+					Kit->File->Write(j + 16, Kit->_HeaderSize()) == Kit->_HeaderSize())
+					Store2_Flush(*Kit->File);
+			}
+			f.Close();
+			ClearJournal();
+		}
+
+		bool CopyBytes(uint64 From, uint64 To, uint64 Size)
+		{
+			GArray<char> Buf;
+			int BufLen = (int)MIN(Size, (uint64)(1 << 20));
+			if (!Buf.Length(BufLen))
+				return false;
+
+			for (uint64 i=0; i<Size; )
+			{
+				int Chunk = (int)MIN((uint64)BufLen, Size - i);
+				if (Kit->File->SetPos(From + i) != From + i ||
+					Kit->File->Read(&Buf[0], Chunk) != Chunk ||
+					Kit->File->SetPos(To + i) != To + i ||
+					Kit->File->Write(&Buf[0], Chunk) != Chunk)
+					return false;
+				i += Chunk;
+			}
+
+			return true;
+		}
+
+		/// Moves an item's data (or directory) into the best fitting
+		/// free extent below where it is now.
+		/// \returns true if it moved.
+		bool Move(StorageItemImpl *Item, bool IsDir)
+		{
+			StorageItemHeader *h = Item->Header;
+			if (!h)
+				return false;
+
+			uint64 Loc = IsDir ? h->DirLoc : h->DataLoc;
+			uint64 Size = IsDir ? (uint64)h->DirAlloc * Kit->_HeaderSize() : h->DataSize;
+			if (!Loc || !Size)
+				return false;
+
+			ssize_t Idx = FindFit(Size, Loc);
+			if (Idx < 0)
+				return false;
+
+			uint64 NewLoc = FreeMap[Idx].Start;
+			StorageItemHeader New = *h;
+			if (IsDir)
+				New.DirLoc = NewLoc;
+			else
+				New.DataLoc = NewLoc;
+
+			// Each step has to be on the disk before the next one starts, the
+			// OS is free to reorder writes that aren't flushed.
+			if (!CopyBytes(Loc, NewLoc, Size) ||
+				!Store2_Flush(*Kit->File) ||
+				!WriteJournal(Item->StoreLoc, New))
+			{
+				// Nothing refers to the copy yet, so just give up.
+				CompactIdle = true;
+				return false;
+			}
+
+			Take(Idx, Size);
+			bool Status;
+			if (IsDir && Item->Dir && Kit->Lock(_FL))
+			{
+				// Rewrites the loaded directory and the children's locations,
+				// unlocks the kit.
+				h->DirLoc = NewLoc;
+				Status = Item->DirChange();
+			}
+			else
+			{
+				*h = New;
+				Item->HeaderDirty = true;
+				Status = Item->SerializeHeader(*Kit->File, true);
+			}
+
+			if (!Status || !Store2_Flush(*Kit->File))
+			{
+				// The header may or may not be on disk. Leave the journal so the
+				// next open finishes the move, and keep both copies.
+				LgiTrace("%s:%i - Failed to write the header at " LGI_PrintfInt64 ".\n", _FL, Item->StoreLoc);
+				CompactIdle = true;
+				return false;
+			}
+
+			ClearJournal();
+			Kit->_Free(Loc, Size);
+			return true;
+		}
+
+		/// The next item in a depth first walk of the tree.
+		StorageItemImpl *NextItem(StorageItemImpl *i)
+		{
+			if (i->GetChild())
+				return i->Child;
+			for (; i; i = i->Parent)
+			{
+				if (i->Next)
+					return i->Next;
+			}
+			return 0;
 		}
 
 		const char *DescribeType(int Type)
@@ -1257,10 +1620,10 @@ namespace Storage2
 				sprintf_s(Item1Desc, sizeof(Item1Desc),
 						"Item 1:\n"
 						"\tType: %s\n"
-						"\tStart: %u, Len: %u\n"
-						"\tData: %u, Len: %u\n",
+						"\tStart: " LGI_PrintfInt64 ", Len: %u\n"
+						"\tData: " LGI_PrintfInt64 ", Len: %u\n",
 						DescribeType(Item1->Header->Type),
-						Item1->StoreLoc, (unsigned)sizeof(*Item1->Header),
+						Item1->StoreLoc, (unsigned)Kit->_HeaderSize(),
 						Item1->Header->DataLoc, Item1->Header->DataSize);
 			}						
 
@@ -1270,11 +1633,11 @@ namespace Storage2
 				sprintf_s(Item2Desc, sizeof(Item2Desc),
 						"Item 2:\n"
 						"\tType: %s\n"
-						"\tStart: %u, Len: %lu\n"
-						"\tData: %u, Len: %u\n",
+						"\tStart: " LGI_PrintfInt64 ", Len: %u\n"
+						"\tData: " LGI_PrintfInt64 ", Len: %u\n",
 						DescribeType(Item2->Header->Type),
 						Item2->StoreLoc,
-						sizeof(*Item2->Header),
+						(unsigned)Kit->_HeaderSize(),
 						Item2->Header->DataLoc,
 						Item2->Header->DataSize);
 			}						
@@ -1357,7 +1720,7 @@ namespace Storage2
 								New->Object = 0;
 								New->Start = Item->Header->DirLoc;
 
-								New->Length = Item->Header->DirAlloc * sizeof(StorageItemHeader);
+								New->Length = (int64)Item->Header->DirAlloc * Kit->_HeaderSize();
 
 								GSegment *Conflict = 0;
 								if (!Segs.Insert(New, &Conflict))
@@ -1596,14 +1959,12 @@ namespace Storage2
 StorageKitImpl::StorageKitImpl(char *filename) : LMutex("StorageKitImpl2")
 {
 	d = new StorageKitImplPrivate(this);
-	File = new GSubFile(this, false);
+	File = new StorageKitFile(this);
 	Status = false;
 	ReadOnly = false;
 	StoreLoc = 0;
 	Root = 0;
-	Version = 0;
-
-	LgiAssert(sizeof(StorageItemHeader) == 32);
+	Version = STORAGE2_VERSION2; // for new files, replaced by the file's version
 
 	FileName = filename;
 	if (IsOk())
@@ -1623,6 +1984,17 @@ StorageKitImpl::StorageKitImpl(char *filename) : LMutex("StorageKitImpl2")
 			ReadOnly = true;
 			Status = _Serialize(*File, File->GetSize() == 0);
 		}
+
+		if (Status && !ReadOnly)
+		{
+			d->RecoverJournal();
+			_LoadFreeMap();
+
+			if (Version < STORAGE2_VERSION3 &&
+				(int64)File->GetSize() > STORAGE2_UPGRADE_SIZE &&
+				!Upgrade())
+				LgiTrace("%s:%i - Failed to upgrade '%s' to v3.\n", _FL, FileName);
+		}
 	}
 }
 
@@ -1631,6 +2003,8 @@ StorageKitImpl::~StorageKitImpl()
 	Lock(_FL);
 
 	DeleteObj(Root);
+	if (Status && !ReadOnly && File)
+		_SaveFreeMap();
 	DeleteObj(File);
 	DeleteObj(d);
 	Status = false;
@@ -1699,6 +2073,9 @@ StorageItem *Storage2::StorageKitImpl::CreateRoot(StorageObj *Obj)
 			if (Root)
 			{
 				File->SetSize(0);
+				d->Unmap();
+				d->ResetFreeMap();
+				Version = STORAGE2_VERSION2; // upgraded when it gets near 4GB
 				_Serialize(*File, true);
 
 				Root->Tree = this;
@@ -1734,7 +2111,7 @@ StorageItem *StorageKitImpl::GetRoot()
 				Root->StoreLoc = 64;
 				if (!Root->SerializeHeader(*File, false))
 				{
-					if (File->GetSize() < 64 + 32)
+					if (File->GetSize() < 64 + _HeaderSize())
 						Root->SerializeHeader(*File, true);
 					else
 						DeleteObj(Root);
@@ -1780,10 +2157,13 @@ bool StorageKitImpl::DeleteItem(StorageItem *Item)
 	{
 		if (Lock(_FL))
 		{
-			((StorageItemImpl*)Item)->DeleteAllChildren();
-			if (((StorageItemImpl*)Item)->Parent)
+			StorageItemImpl *i = (StorageItemImpl*)Item;
+			i->DeleteAllChildren();
+			if (i->Parent)
 			{
-				Status = ((StorageItemImpl*)Item)->Parent->DeleteChild(Item);
+				if (i->Header && i->Header->DataLoc)
+					_Free(i->Header->DataLoc, i->Header->DataSize);
+				Status = i->Parent->DeleteChild(Item);
 			}
 			else
 			{
@@ -1801,7 +2181,8 @@ bool StorageKitImpl::_ValidLoc(int64 Loc)
 {
 	if (File)
 	{
-		if (Loc >= 64 && Loc <= File->GetSize())
+		if (Loc >= 64 &&
+			((uint64)Loc <= d->MapValid || Loc <= File->GetSize()))
 		{
 			return true;
 		}
@@ -1892,7 +2273,7 @@ bool StorageKitImpl::Compact(Progress *p, bool Interactive, StorageValidator *va
 			b->Dir = 0;
 			b->Object = 0;
 			b->Start = 64;
-			b->Length = sizeof(StorageItemHeader); // 1 header only
+			b->Length = _HeaderSize(); // 1 header only
 			d->Segs.Insert(b);
 		}
 
@@ -1926,19 +2307,19 @@ bool StorageKitImpl::Compact(Progress *p, bool Interactive, StorageValidator *va
 						{
 							// some space exists between this object and the next,
 							// lets remove it eh?
-							uint32 NewPos = (uint32)(b->Start + b->Length);
+							uint64 NewPos = b->Start + b->Length;
 							
 							// Move all the data in the object in 1mb (or less) chunks.
 							uint32 i; // this holds the number of bytes moved
 							for (i=0; i<Next->Length; )
 							{
-								uint32 Chunk = min((uint32)BufLen, (uint32)Next->Length - i);
+								uint32 Chunk = MIN((uint32)BufLen, (uint32)Next->Length - i);
 								
 								File->SetPos((uint64)Next->Start + i);
 								if (File->Read(Buf, Chunk) == Chunk)
 								{
 									// read ok
-									uint32 At = NewPos + i;
+									uint64 At = NewPos + i;
 									File->SetPos(At);
 									if (File->Write(Buf, Chunk) == Chunk)
 									{
@@ -1948,7 +2329,7 @@ bool StorageKitImpl::Compact(Progress *p, bool Interactive, StorageValidator *va
 									else
 									{
 										// write failed
-										sprintf_s(Msg, sizeof(Msg), "Failed to write to file: %u bytes at position %u.", Chunk, At);
+										sprintf_s(Msg, sizeof(Msg), "Failed to write to file: %u bytes at position " LGI_PrintfInt64 ".", Chunk, At);
 										break;
 									}
 								}
@@ -2005,7 +2386,7 @@ bool StorageKitImpl::Compact(Progress *p, bool Interactive, StorageValidator *va
 						Status = true;
 						
 						char Size[64];
-						uint32 Change = (uint32)(OldSize - File->GetSize());
+						int64 Change = OldSize - File->GetSize();
 						LgiFormatSize(Size, sizeof(Size), Change);
 						sprintf_s(Msg, sizeof(Msg), "Compact complete, %s was recovered.", Size);
 					}
@@ -2037,6 +2418,9 @@ bool StorageKitImpl::Compact(Progress *p, bool Interactive, StorageValidator *va
 			Status = true;
 		}
 		d->_Ui = 0;
+		d->ResetFreeMap(); // objects have moved into the holes
+		d->Unmap(); // and any views of them are stale
+
 		DeleteArray(d->Blocks);
 		d->Segs.Empty();
 
@@ -2046,68 +2430,582 @@ bool StorageKitImpl::Compact(Progress *p, bool Interactive, StorageValidator *va
 	return Status;
 }
 
+bool StorageKitImpl::CompactStep(int MaxItems)
+{
+	bool More = false;
+
+	if (!ReadOnly &&
+		IsOk() &&
+		GetRoot() &&
+		Lock(_FL))
+	{
+		for (int n=0; n<MaxItems && !d->CompactIdle && d->FreeMap.Length(); n++)
+		{
+			if (!d->CompactNext)
+			{
+				// Start a new pass
+				d->CompactNext = Root;
+				d->CompactMoved = false;
+			}
+
+			StorageItemImpl *Item = d->CompactNext;
+			if (d->Move(Item, false))
+				d->CompactMoved = true;
+			if (d->Move(Item, true))
+				d->CompactMoved = true;
+
+			d->CompactNext = d->NextItem(Item);
+			if (!d->CompactNext && !d->CompactMoved)
+			{
+				// Nothing left that fits lower down
+				d->CompactIdle = true;
+			}
+		}
+
+		More = !d->CompactIdle && d->FreeMap.Length() > 0;
+		Unlock();
+	}
+
+	return More;
+}
+
+bool StorageKitImpl::OnIdle()
+{
+	// Upgrade while there is still room to do it in 32 bits.
+	if (!ReadOnly &&
+		IsOk() &&
+		Version < STORAGE2_VERSION3 &&
+		(int64)File->GetSize() > STORAGE2_UPGRADE_SIZE &&
+		!Upgrade())
+		LgiTrace("%s:%i - Failed to upgrade '%s' to v3.\n", _FL, FileName);
+
+	return CompactStep();
+}
+
+uint64 StorageKitImpl::GetFreeSpace()
+{
+	uint64 Bytes = 0;
+	if (Lock(_FL))
+	{
+		for (unsigned i=0; i<d->FreeMap.Length(); i++)
+			Bytes += d->FreeMap[i].Len;
+		Unlock();
+	}
+	return Bytes;
+}
+
+uint64 StorageKitImpl::_Alloc(uint64 Size)
+{
+	// v2 files can't address anything past 4GB
+	uint64 Limit = Version >= STORAGE2_VERSION3 ? (uint64)-1 : 0xffffffff;
+	ssize_t i = d->FindFit(Size, Limit);
+	if (i >= 0)
+	{
+		uint64 Loc = d->FreeMap[i].Start;
+		d->Take(i, Size);
+		return Loc;
+	}
+
+	// Append to the end of the file
+	uint64 Loc = MAX((uint64)File->GetSize(), d->End);
+	if (Loc + Size > Limit)
+	{
+		LgiTrace("%s:%i - '%s' is full, it needs upgrading to v3.\n", _FL, FileName);
+		return 0;
+	}
+
+	d->End = Loc + Size;
+	return Loc;
+}
+
+void StorageKitImpl::_Free(uint64 Loc, uint64 Size)
+{
+	if (ReadOnly || !Size)
+		return;
+	if (Loc < 64 + _HeaderSize())
+	{
+		// The header and root item never move
+		LgiAssert(!"Freeing the file header.");
+		return;
+	}
+
+	// Find the first extent after 'Loc'
+	GArray<Extent> &m = d->FreeMap;
+	size_t Lo = 0, Hi = m.Length();
+	while (Lo < Hi)
+	{
+		size_t Mid = (Lo + Hi) >> 1;
+		if (m[Mid].Start <= Loc)
+			Lo = Mid + 1;
+		else
+			Hi = Mid;
+	}
+
+	if ((Lo > 0 && m[Lo-1].Start + m[Lo-1].Len > Loc) ||
+		(Lo < m.Length() && Loc + Size > m[Lo].Start))
+	{
+		LgiTrace("%s:%i - Space at " LGI_PrintfInt64 " (" LGI_PrintfInt64 " bytes) is already free.\n", _FL, Loc, Size);
+		LgiAssert(0);
+		return;
+	}
+
+	bool JoinPrev = Lo > 0 && m[Lo-1].Start + m[Lo-1].Len == Loc;
+	bool JoinNext = Lo < m.Length() && Loc + Size == m[Lo].Start;
+	if (JoinPrev && JoinNext)
+	{
+		m[Lo-1].Len += Size + m[Lo].Len;
+		m.DeleteAt(Lo--, true);
+	}
+	else if (JoinPrev)
+	{
+		m[--Lo].Len += Size;
+	}
+	else if (JoinNext)
+	{
+		m[Lo].Start = Loc;
+		m[Lo].Len += Size;
+	}
+	else
+	{
+		Extent e = {Loc, Size};
+		m.AddAt(Lo, e);
+	}
+
+	// Give space at the end of the file back to the file system, unless
+	// something has been allocated after it and not written yet.
+	Extent &e = m[Lo];
+	uint64 ExtentEnd = e.Start + e.Len;
+	if (Lo == m.Length() - 1 &&
+		ExtentEnd == (uint64)File->GetSize() &&
+		d->End <= ExtentEnd)
+	{
+		File->SetSize(e.Start);
+		d->End = e.Start;
+		d->MapValid = MIN(d->MapValid, e.Start);
+		m.DeleteAt(Lo, true);
+	}
+
+	d->CompactIdle = false;
+}
+
+/// Loads the free map saved by the last clean close, and then marks it as
+/// used so that it's ignored if we crash before saving it again.
+bool StorageKitImpl::_LoadFreeMap()
+{
+	d->ResetFreeMap();
+
+	uint64 Size = File->GetSize();
+	int Word = d->MapMagic == STORAGE2_FREEMAP_MAGIC32 ? 4 : 8;
+	if ((d->MapMagic == STORAGE2_FREEMAP_MAGIC || d->MapMagic == STORAGE2_FREEMAP_MAGIC32) &&
+		d->MapFileSize == Size &&
+		d->MapLoc >= 64 + (uint64)_HeaderSize() &&
+		d->MapSize >= Word &&
+		d->MapLoc + d->MapSize <= Size)
+	{
+		// A count and then start/length pairs, little endian
+		GArray<uint8> Buf;
+		const uint8 *p = _Get(d->MapLoc, d->MapSize, Buf);
+		if (p)
+		{
+			#define MapWord(i)	(Word == 8 ? Store2_Get64(p + (i) * 8) : (uint64)Store2_Get32(p + (i) * 4))
+			uint64 Count = MapWord(0);
+			if (Count <= (uint64)(d->MapSize / Word - 1) / 2)
+			{
+				for (unsigned i=0; i<Count; i++)
+				{
+					Extent e = {MapWord(i*2+1), MapWord(i*2+2)};
+					Extent *Prev = d->FreeMap.Length() ? &d->FreeMap.Last() : NULL;
+					if (e.Start < 64 + (uint64)_HeaderSize() ||
+						e.Start + e.Len > Size ||
+						(Prev && Prev->Start + Prev->Len > e.Start))
+					{
+						LgiTrace("%s:%i - Invalid free map, ignoring it.\n", _FL);
+						d->FreeMap.Length(0);
+						break;
+					}
+					d->FreeMap.Add(e);
+				}
+			}
+			#undef MapWord
+		}
+
+		// The saved map's own space is free again
+		_Free(d->MapLoc, d->MapSize);
+	}
+
+	d->MapLoc = d->MapFileSize = 0;
+	d->MapSize = d->MapMagic = 0;
+	return _Serialize(*File, true);
+}
+
+bool StorageKitImpl::_SaveFreeMap()
+{
+	GArray<Extent> &m = d->FreeMap;
+	if (m.Length())
+	{
+		// v2 files are under 4GB so their map has 32-bit entries
+		int Word = Version >= STORAGE2_VERSION3 ? 8 : 4;
+
+		// The map's own space comes out of the map, which can only make it shorter
+		int Bytes = (int)(m.Length() * 2 + 1) * Word;
+		uint64 Loc = _Alloc(Bytes);
+
+		int Len = (int)(m.Length() * 2 + 1) * Word;
+		GArray<uint8> Buf;
+		Buf.Length(Len);
+		uint8 *p = Buf.AddressOf();
+		#define PutWord(i, v) \
+			if (Word == 8) Store2_Put64(p + (i) * 8, v); \
+			else Store2_Put32(p + (i) * 4, (uint32)(v))
+		PutWord(0, m.Length());
+		for (unsigned i=0; i<m.Length(); i++)
+		{
+			PutWord(i*2+1, m[i].Start);
+			PutWord(i*2+2, m[i].Len);
+		}
+		#undef PutWord
+
+		if (Loc &&
+			File->SetPos(Loc) == Loc &&
+			File->Write(p, Len) == Len)
+		{
+			d->MapLoc = Loc;
+			d->MapSize = Bytes;
+			d->MapMagic = Word == 8 ? STORAGE2_FREEMAP_MAGIC : STORAGE2_FREEMAP_MAGIC32;
+		}
+	}
+
+	d->MapFileSize = File->GetSize();
+	return _Serialize(*File, true);
+}
+
+void StorageKitImpl::_OnDelete(StorageItemImpl *Item)
+{
+	if (d && d->CompactNext == Item)
+		d->CompactNext = 0;
+}
+
+const uint8 *StorageKitImpl::_Map(uint64 Loc, uint64 Len)
+{
+	#ifdef POSIX
+	if (d->MapValid && Loc + Len <= d->MapValid)
+		return d->Maps.Last().Ptr + Loc;
+
+	uint64 Size = File ? File->GetSize() : 0;
+	if (Loc + Len > Size)
+		return NULL; // past the end is SIGBUS territory
+
+	Mapping *m = d->Maps.Length() ? &d->Maps.Last() : NULL;
+	if (!m || Size > m->Len)
+	{
+		// Map the file with room to double in size, so it's rarely mapped
+		// again. Address space is cheap on 64-bit, so reserve at least 1GB.
+		// The old mapping stays in case someone still has a view into it.
+		uint64 MapLen = Size << 1;
+		if (sizeof(size_t) > 4)
+			MapLen = MAX(MapLen, (uint64)1 << 30);
+		if (MapLen != (size_t)MapLen)
+			return NULL;
+
+		void *Ptr = mmap(NULL, (size_t)MapLen, PROT_READ, MAP_SHARED, File->Handle(), 0);
+		if (Ptr == MAP_FAILED)
+			return NULL;
+
+		m = &d->Maps.New();
+		m->Ptr = (uint8*)Ptr;
+		m->Len = MapLen;
+	}
+
+	d->MapValid = Size;
+	return m->Ptr + Loc;
+	#else
+	return NULL;
+	#endif
+}
+
+const uint8 *StorageKitImpl::_Get(uint64 Loc, uint64 Len, GArray<uint8> &Buf)
+{
+	const uint8 *p = _Map(Loc, Len);
+	if (p)
+		return p;
+
+	if (!Buf.Length((size_t)Len) ||
+		File->SetPos(Loc) != Loc ||
+		File->Read(Buf.AddressOf(), (ssize_t)Len) != Len)
+		return NULL;
+
+	return Buf.AddressOf();
+}
+
+bool StorageKitImpl::Upgrade()
+{
+	if (Version >= STORAGE2_VERSION3)
+		return true;
+	if (ReadOnly || !IsOk() || !GetRoot())
+		return false;
+
+	LMutex::Auto Lck(this, _FL);
+	
+	struct Plan
+	{
+		StorageItemImpl *Item;
+		uint64 DataLoc, DirLoc, StoreLoc;
+	};
+
+	// Load the whole tree, parents before children
+	GArray<Plan> Items;
+	LHashTbl<PtrKey<StorageItemImpl*>, int> Index;
+	for (StorageItemImpl *i = Root; i; i = d->NextItem(i))
+	{
+		Plan &p = Items.New();
+		p.Item = i;
+		p.DataLoc = i->Header->DataLoc;
+		p.DirLoc = 0;
+		p.StoreLoc = 64;
+		Index.Add(i, (int)Items.Length() - 1);
+	}
+
+	// The root header grows into [OldEnd, NewEnd), so nothing can be there.
+	uint64 OldEnd = 64 + STORAGE2_HEADER_V2, NewEnd = 64 + STORAGE2_HEADER_V3;
+	GArray<Extent> &m = d->FreeMap;
+	for (unsigned i=0; i<m.Length() && m[i].Start < NewEnd; i++)
+	{
+		uint64 End = m[i].Start + m[i].Len;
+		if (End <= OldEnd)
+			continue;
+		if (m[i].Start < OldEnd)
+		{
+			// Split around the hole
+			m[i].Len = OldEnd - m[i].Start;
+			if (End > NewEnd)
+			{
+				Extent e = {NewEnd, End - NewEnd};
+				m.AddAt(++i, e);
+			}
+		}
+		else if (End > NewEnd)
+		{
+			m[i].Start = NewEnd;
+			m[i].Len = End - NewEnd;
+		}
+		else
+		{
+			m.DeleteAt(i--, true);
+		}
+	}
+
+	// Work out the new locations. Data only moves out of the way of the
+	// root header, directories are all rewritten at the new size. Nothing
+	// on disk refers to the new locations until the root header is written,
+	// so a failure (or crash) before that leaves a good v2 file.
+	GArray<Extent> Release, Written;
+	bool Status = true;
+	int OldVersion = Version;
+	Version = STORAGE2_VERSION3; // allocations can go past 4GB from here on
+	for (unsigned n=0; Status && n<Items.Length(); n++)
+	{
+		Plan &p = Items[n];
+		StorageItemHeader *h = p.Item->Header;
+		if (p.DataLoc &&
+			p.DataLoc < NewEnd &&
+			p.DataLoc + h->DataSize > OldEnd)
+		{
+			uint64 Loc = _Alloc(h->DataSize);
+			if (!Loc || !d->CopyBytes(p.DataLoc, Loc, h->DataSize))
+			{
+				Status = false;
+				break;
+			}
+			Extent o = {p.DataLoc, h->DataSize}, w = {Loc, h->DataSize};
+			Release.Add(o);
+			Written.Add(w);
+			p.DataLoc = Loc;
+		}
+
+		if (h->DirLoc)
+		{
+			Extent o = {h->DirLoc, (uint64)h->DirAlloc * STORAGE2_HEADER_V2};
+			Release.Add(o);
+			if (p.Item->Dir && h->DirAlloc)
+			{
+				Extent w = {_Alloc((uint64)h->DirAlloc * STORAGE2_HEADER_V3), (uint64)h->DirAlloc * STORAGE2_HEADER_V3};
+				if (!w.Start)
+				{
+					Status = false;
+					break;
+				}
+				Written.Add(w);
+				p.DirLoc = w.Start;
+
+				uint32 c = 0;
+				for (StorageItemImpl *Child = p.Item->Child; Child; Child = Child->Next)
+					Items[Index.Find(Child)].StoreLoc = p.DirLoc + (c++ * STORAGE2_HEADER_V3);
+				if (c != h->DirCount)
+				{
+					// Some of the directory didn't load, don't lose it
+					Status = false;
+					break;
+				}
+			}
+			// else an empty directory is dropped
+		}
+	}
+
+	// Write the new directories
+	for (unsigned n=0; Status && n<Items.Length(); n++)
+	{
+		Plan &p = Items[n];
+		if (!p.DirLoc)
+			continue;
+
+		StorageItemHeader *h = p.Item->Header;
+		int Len = h->DirAlloc * STORAGE2_HEADER_V3;
+		GArray<uint8> Buf;
+		Buf.Length(Len);
+
+		int c = 0;
+		for (StorageItemImpl *Child = p.Item->Child; Child; Child = Child->Next)
+		{
+			Plan &cp = Items[Index.Find(Child)];
+			StorageItemHeader New = *Child->Header;
+			New.DataLoc = cp.DataLoc;
+			New.DirLoc = cp.DirLoc;
+			New.DirAlloc = cp.DirLoc ? New.DirAlloc : 0;
+			New.DirCount = cp.DirLoc ? New.DirCount : 0;
+			New.ParentLoc = p.StoreLoc;
+			New.Encode(Buf.AddressOf(c++ * STORAGE2_HEADER_V3), Version);
+		}
+
+		Status =	File->SetPos(p.DirLoc) == p.DirLoc &&
+					File->Write(Buf.AddressOf(), Len) == Len;
+	}
+
+	// Switch over with one write of the file header and the root header
+	if (Status)
+	{
+		uint8 Buf[64 + STORAGE2_HEADER_V3];
+		StorageItemHeader New = RootHeader;
+		New.DataLoc = Items[0].DataLoc;
+		New.DirLoc = Items[0].DirLoc;
+		New.DirAlloc = New.DirLoc ? New.DirAlloc : 0;
+		New.DirCount = New.DirLoc ? New.DirCount : 0;
+		_EncodeHeader(Buf);
+		New.Encode(Buf + 64, Version);
+
+		Status =	File->SetPos(0) == 0 &&
+					File->Write(Buf, sizeof(Buf)) == sizeof(Buf);
+	}
+
+	if (!Status)
+	{
+		LgiTrace("%s:%i - Upgrade of '%s' failed.\n", _FL, FileName);
+		Version = OldVersion;
+		for (unsigned i=0; i<Written.Length(); i++)
+		{
+			if (Written[i].Start)
+				_Free(Written[i].Start, Written[i].Len);
+		}
+		return false;
+	}
+
+	// Now update the loaded tree to match
+	for (unsigned n=0; n<Items.Length(); n++)
+	{
+		Plan &p = Items[n];
+		StorageItemHeader *h = p.Item->Header;
+		h->DataLoc = p.DataLoc;
+		h->DirLoc = p.DirLoc;
+		if (!p.DirLoc)
+			h->DirAlloc = h->DirCount = 0;
+		h->ParentLoc = p.Item->Parent ? p.Item->Parent->StoreLoc : 0;
+		p.Item->StoreLoc = p.StoreLoc;
+		p.Item->HeaderDirty = false;
+	}
+	d->CompactNext = 0;
+
+	// And give back the old space, apart from what the root header now uses
+	for (unsigned i=0; i<Release.Length(); i++)
+	{
+		Extent &e = Release[i];
+		uint64 End = e.Start + e.Len;
+		if (End > NewEnd)
+		{
+			uint64 Start = MAX(e.Start, NewEnd);
+			_Free(Start, End - Start);
+		}
+	}
+	LgiTrace("%s:%i - Upgraded '%s' to v3.\n", _FL, FileName);
+	return true;
+}
+
 /*
 	struct StorageHeader {
 
-		int Magic;				// always STORAGE2_MAGIC
-		int Version;			// 0x0
-		int Reserved1;			// 0x0
-		int Reserved2;			// 0x0
+		int Magic;				// STORAGE2_MAGIC, or STORAGE2_MAGIC_V3 for v3 files
+		int Version;			// STORAGE2_VERSION2 or STORAGE2_VERSION3
+		int FreeMapLoc;			// location of the saved free extent map, or 0x0
+		int FreeMapSize;		// bytes allocated to the saved free extent map
 		char Password[32];		// obsured password
-		int Reserved3[4];		// 0x0
+		int FreeMapMagic;		// STORAGE2_FREEMAP_MAGIC if the saved free map is current
+		int FreeMapFileSize;	// the file size when the free map was saved
+		int FreeMapLocHi;		// high 32 bits of FreeMapLoc
+		int FreeMapFileSizeHi;	// high 32 bits of FreeMapFileSize
 	};
+
+	All little endian.
 */
+void StorageKitImpl::_EncodeHeader(uint8 *p)
+{
+	StorageHeader Header;
+	ZeroObj(Header);
+	Password.Serialize(Header.Password, true);
+
+	Store2_Put32(p, Version >= STORAGE2_VERSION3 ? STORAGE2_MAGIC_V3 : STORAGE2_MAGIC);
+	Store2_Put32(p + 4, Version);
+	Store2_Put32(p + 8, (uint32)d->MapLoc);
+	Store2_Put32(p + 12, d->MapSize);
+	memcpy(p + 16, Header.Password, sizeof(Header.Password));
+	Store2_Put32(p + 48, d->MapMagic);
+	Store2_Put32(p + 52, (uint32)d->MapFileSize);
+	Store2_Put32(p + 56, (uint32)(d->MapLoc >> 32));
+	Store2_Put32(p + 60, (uint32)(d->MapFileSize >> 32));
+}
+
 bool StorageKitImpl::_Serialize(GFile &f, bool Write)
 {
 	bool Status = false;
-	StorageHeader Header;
+	uint8 Buf[sizeof(StorageHeader)];
 
 	if (IsOk() && Lock(_FL))
 	{
 		if (Write)
 		{
-			ZeroObj(Header);
-			Header.Magic = STORAGE2_MAGIC;
-			Header.Version = Version;
-			Password.Serialize(Header.Password, Write);
-
+			_EncodeHeader(Buf);
 			File->SetPos(0);
-
-			#ifdef __BIG_ENDIAN__
-			f.SetStatus();
-			f << Header.Magic;
-			f << Header.Version;
-			f << Header.Reserved1;
-			f << Header.Reserved2;
-			f.Write(Header.Password, sizeof(Header.Password));
-			f.Write(Header.Reserved3, sizeof(Header.Reserved3));
-			Status = f.GetStatus();
-			#else
-			Status = File->Write(&Header, sizeof(Header)) == sizeof(Header);
-			#endif
+			Status = File->Write(Buf, sizeof(Buf)) == sizeof(Buf);
 		}
 		else
 		{
 			f.SetPos(0);
-
-			#ifdef __BIG_ENDIAN__
-			f.SetStatus();
-			f >> Header.Magic;
-			f >> Header.Version;
-			f >> Header.Reserved1;
-			f >> Header.Reserved2;
-			f.Read(Header.Password, sizeof(Header.Password));
-			f.Read(Header.Reserved3, sizeof(Header.Reserved3));
-			Status = f.GetStatus();
-			#else
-			Status = f.Read(&Header, sizeof(Header)) == sizeof(Header);
-			#endif
-			if (Status && f.GetPos() == sizeof(Header))
+			Status = f.Read(Buf, sizeof(Buf)) == sizeof(Buf);
+			if (Status && f.GetPos() == sizeof(Buf))
 			{
-				Status = (Header.Magic == STORAGE2_MAGIC);
+				// v3 files have their own magic so that builds without 64-bit
+				// locations refuse them rather than corrupting them.
+				uint32 Magic = Store2_Get32(Buf);
+				int FileVersion = Store2_Get32(Buf + 4);
+				Status =	(Magic == STORAGE2_MAGIC && FileVersion < STORAGE2_VERSION3) ||
+							(Magic == STORAGE2_MAGIC_V3 && FileVersion == STORAGE2_VERSION3);
 				if (Status)
 				{
-					Version = Header.Version;
+					StorageHeader Header;
+					memcpy(Header.Password, Buf + 16, sizeof(Header.Password));
+
+					Version = FileVersion;
+					d->MapLoc = Store2_Get32(Buf + 8) | ((uint64)Store2_Get32(Buf + 56) << 32);
+					d->MapSize = Store2_Get32(Buf + 12);
+					d->MapMagic = Store2_Get32(Buf + 48);
+					d->MapFileSize = Store2_Get32(Buf + 52) | ((uint64)Store2_Get32(Buf + 60) << 32);
 					Password.Serialize(Header.Password, Write);
 				}
 			}
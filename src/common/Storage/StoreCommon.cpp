@@ -192,11 +192,18 @@ ssize_t GSubFilePtr::Read(void *Buffer, ssize_t Size, int Flags)
 	GSubFile::SubLock Lock = File->Lock(_FL);
 	if (!Sub || (Pos >= 0 && Pos <= Len))
 	{
-		if (SaveState())
+		const uint8 *View = NULL;
+		int64 RdSize = Sub ? MIN(Len - Pos, Size) : Size;
+		if (Sub && RdSize > 0 && (View = File->GetView(Start + Pos, RdSize)))
+		{
+			// Straight out of the mapping, no seeking
+			memcpy(Buffer, View, (size_t)RdSize);
+			Pos += RdSize;
+			Status = (int)RdSize;
+		}
+		else if (SaveState())
 		{
-			int64 Remaining = Len - Pos;
-			uint32 RdSize = (int) (Sub ? MIN(Remaining, Size) : Size);
-			Status = File->Read(Buffer, RdSize, Flags);
+			Status = File->Read(Buffer, (uint32)RdSize, Flags);
 			RestoreState();
 		}
 	}
@@ -27,6 +27,7 @@
 #define DEBUG_TABLE_LAYOUT			0
 #define DEBUG_DRAW_TD				0
 #define DEBUG_RESTYLE				0
+#define DEBUG_STYLE_SHARING			0
 #define DEBUG_TAG_BY_POS			0
 #define DEBUG_SELECTION				0
 #define DEBUG_TEXT_AREA				0
@@ -43,6 +44,8 @@
 #else
 #define GHTML_USE_DOUBLE_BUFFER		1
 #endif
+#define GHTML_TILE_SIZE				256	// Paint tiles are square, in px
+#define GHTML_MAX_TILES				64	// Tiles kept, unless more than that are visible
 #define GT_TRANSPARENT				0x00000000
 #ifndef IDC_HAND
 #define IDC_HAND					MAKEINTRESOURCE(32649)
@@ -130,6 +133,18 @@ using namespace Html1;
 namespace Html1
 {
 
+/// The selectors matching one kind of element. Elements with the same
+/// tag, id, classes and parent entry match the same selectors, so they
+/// share an entry rather than each matching the whole style sheet.
+struct GStyleShare
+{
+	uint32 Id;
+	GCss::SelArray Styles;
+	/// The declarations of 'Styles' merged in order, or NULL if
+	/// any of them has to be parsed onto the element.
+	GAutoPtr<GCss> Merged;
+};
+
 class GHtmlPrivate
 {
 public:
@@ -150,13 +165,30 @@ public:
 	bool IsParsing;
 	bool IsLoaded;
 	bool StyleDirty;
+
+	// Style sharing
+	LHashTbl<StrKey<char>, GStyleShare*> StyleShares;
+	uint32 NextStyleShare;
+	int CanShareStyles; // -1 = not checked yet
+	GCss::StylePool SharedStyles; // Computed styles the tags can share
+	#if DEBUG_STYLE_SHARING
+	int StyleHits, StyleMisses, StylesShared;
+	#endif
 	
+	// Paint tiles in document co-ordinates, keyed by (row << 8) | column
+	LHashTbl<IntKey<int>, GSurface*> Tiles;
+	bool TileFocus, TileEnabled;
+	bool HasCtrls; // Controls are moved as they paint, so can't be tiled
+	GArray<GTag*> PaintKeep; // The tags containing the cursor and selection
+
 	// Find settings
 	GAutoWString FindText;
 	bool MatchCase;
 	
 	GHtmlPrivate() : Loading(0, false)
 	{
+		TileFocus = TileEnabled = false;
+		HasCtrls = false;
 		IsLoaded = false;
 		StyleDirty = false;
 		IsParsing = false;
@@ -167,6 +199,11 @@ public:
 		CursorVis = false;
 		CursorPos.ZOff(-1, -1);
 		DeferredLoads = 0;
+		NextStyleShare = 1;
+		CanShareStyles = -1;
+		#if DEBUG_STYLE_SHARING
+		StyleHits = StyleMisses = StylesShared = 0;
+		#endif
 
 		char EmojiPng[MAX_PATH];
 		#ifdef MAC
@@ -187,6 +224,101 @@ public:
 
 	~GHtmlPrivate()
 	{
+		EmptyStyleShares();
+		EmptyTiles();
+	}
+
+	/// Drops the tiles overlapping 'Doc', or all of them.
+	void EmptyTiles(GRect *Doc = NULL)
+	{
+		if (!Doc)
+		{
+			Tiles.DeleteObjects();
+			return;
+		}
+
+		GArray<int> Drop;
+		for (auto t : Tiles)
+		{
+			GRect r;
+			r.ZOff(GHTML_TILE_SIZE-1, GHTML_TILE_SIZE-1);
+			r.Offset((t.key & 0xff) * GHTML_TILE_SIZE, (t.key >> 8) * GHTML_TILE_SIZE);
+			if (r.Overlap(Doc))
+				Drop.Add(t.key);
+		}
+		for (unsigned i=0; i<Drop.Length(); i++)
+		{
+			delete Tiles.Find(Drop[i]);
+			Tiles.Delete(Drop[i]);
+		}
+	}
+
+	/// Keeps the tile count down by dropping the rows furthest from the view.
+	void TrimTiles(int Row1, int Row2, int Visible)
+	{
+		size_t Max = MAX(GHTML_MAX_TILES, Visible * 3);
+		while (Tiles.Length() > Max)
+		{
+			int Far = -1, FarDist = -1;
+			for (auto t : Tiles)
+			{
+				int Row = t.key >> 8;
+				int Dist = Row < Row1 ? Row1 - Row : Row - Row2;
+				if (Dist > FarDist)
+				{
+					Far = t.key;
+					FarDist = Dist;
+				}
+			}
+			if (FarDist <= 0)
+				break;
+			delete Tiles.Find(Far);
+			Tiles.Delete(Far);
+		}
+	}
+
+	/// Call when the style sheet changes
+	void EmptyStyleShares()
+	{
+		StyleShares.DeleteObjects();
+		CanShareStyles = -1;
+	}
+
+	/// Attribute selectors can depend on anything about an element,
+	/// so style sharing is off for style sheets using them.
+	bool CanShare(GCss::Store &Store)
+	{
+		if (CanShareStyles < 0)
+		{
+			GArray<GCss::SelArray*> Arrays;
+			GCss::SelectorMap *Maps[] = {&Store.TypeMap, &Store.ClassMap, &Store.IdMap};
+			for (unsigned m=0; m<CountOf(Maps); m++)
+			{
+				for (auto a : *Maps[m])
+					Arrays.Add(a.value);
+			}
+			Arrays.Add(&Store.Other);
+
+			CanShareStyles = true;
+			for (unsigned i=0; CanShareStyles && i<Arrays.Length(); i++)
+			{
+				GCss::SelArray *a = Arrays[i];
+				for (unsigned n=0; CanShareStyles && n<a->Length(); n++)
+				{
+					GCss::Selector *s = (*a)[n];
+					for (unsigned k=0; k<s->Parts.Length(); k++)
+					{
+						if (s->Parts[k].Type == GCss::Selector::SelAttrib)
+						{
+							CanShareStyles = false;
+							break;
+						}
+					}
+				}
+			}
+		}
+
+		return CanShareStyles != 0;
 	}
 };
 
@@ -575,6 +707,44 @@ public:
 		x2 = x1 + newx - 1;
 	}
 
+	void Save(GFlowState &s)
+	{
+		s.x1 = x1;
+		s.x2 = x2;
+		s.y1 = y1;
+		s.y2 = y2;
+		s.cx = cx;
+		s.my = my;
+		s.InBody = InBody;
+		s.Max = MAX;
+	}
+
+	/// Moves to a saved state. The max dimensions only grow.
+	void Restore(GFlowState &s)
+	{
+		x1 = s.x1;
+		x2 = s.x2;
+		y1 = s.y1;
+		y2 = s.y2;
+		cx = s.cx;
+		my = s.my;
+		InBody = s.InBody;
+		MAX.x = MAX(MAX.x, s.Max.x);
+		MAX.y = MAX(MAX.y, s.Max.y);
+	}
+
+	/// True if a block starting here would be flowed the same as at 's',
+	/// apart from a vertical offset.
+	bool SameAs(GFlowState &s)
+	{
+		return	x1 == s.x1 &&
+				x2 == s.x2 &&
+				cx == s.cx &&
+				y2 - y1 == s.y2 - s.y1 &&
+				my == s.my &&
+				InBody == s.InBody;
+	}
+
 	GFlowRegion &operator +=(GRect r)
 	{
 		x1 += r.x1;
@@ -1324,6 +1494,10 @@ GTag::GTag(GHtml *h, GHtmlElement *p) :
 	Ctrl = 0;
 	CtrlType = CtrlNone;
 	TipId = 0;
+	LayoutDirty = true;
+	ZeroObj(LayoutCache);
+	PaintBounds.ZOff(-1, -1);
+	PaintAlways = false;
 	Display(DispInline);
 	Html = h;
 	
@@ -1333,6 +1507,7 @@ GTag::GTag(GHtml *h, GHtmlElement *p) :
 	Font = 0;
 	LineHeightCache = -1;
 	HtmlId = NULL;
+	StyleShareId = 0;
 	// TableBorder = 0;
 	Cell = NULL;
 	TagId = CONTENT;
@@ -1363,6 +1538,32 @@ GTag::~GTag()
 
 void GTag::OnChange(PropType Prop)
 {
+	SetLayoutDirty();
+}
+
+void GTag::SetLayoutDirty(bool Children)
+{
+	// Everything containing this tag has to be flowed again too.
+	for (GTag *t = this; t; t = ToTag(t->Parent))
+	{
+		t->LayoutDirty = true;
+		t->LayoutCache.MetricsValid = false;
+	}
+
+	if (Children)
+	{
+		GArray<GTag*> Stack;
+		Stack.Add(this);
+		while (Stack.Length())
+		{
+			GTag *t = Stack.Last();
+			Stack.Length(Stack.Length() - 1);
+			t->LayoutDirty = true;
+			t->LayoutCache.MetricsValid = false;
+			for (unsigned i=0; i<t->Children.Length(); i++)
+				Stack.Add(ToTag(t->Children[i]));
+		}
+	}
 }
 
 bool GTag::OnClick()
@@ -1433,6 +1634,7 @@ bool GTag::SetVariant(const char *Name, GVariant &Value, char *Array)
 			if (!Defs)
 				return false;
 				
+			SetLayoutDirty(true);
 			return Parse(Defs, ParseRelaxed);
 		}
 		case ObjTextContent:
@@ -1442,6 +1644,7 @@ bool GTag::SetVariant(const char *Name, GVariant &Value, char *Array)
 			{
 				GAutoWString w(CleanText(s, strlen(s), "utf-8", true, true));
 				Txt = w;
+				SetLayoutDirty();
 				return true;
 			}
 			break;
@@ -1480,6 +1683,7 @@ bool GTag::SetVariant(const char *Name, GVariant &Value, char *Array)
 		}
 	}
 
+	SetLayoutDirty(true);
 	Html->ViewWidth = -1;
 	return true;
 }
@@ -1589,7 +1793,7 @@ bool GTag::CreateSource(GStringPipe &p, int Depth, bool LastWasBlock)
 			GHtmlElemInfo *i = GHtmlStatic::Inst->GetTagInfo(Tag);
 			if (i)
 			{
-				if (Props.Find(PropDisplay)
+				if (Props.Get(PropDisplay)
 					&&
 					(
 						(!i->Block() && Display() == DispInline)
@@ -1606,38 +1810,38 @@ bool GTag::CreateSource(GStringPipe &p, int Depth, bool LastWasBlock)
 					case TAG_A:
 					{
 						GCss::ColorDef Blue(GCss::ColorRgb, Rgb32(0, 0, 255));
-						if (Props.Find(PropColor) && Color() == Blue)
+						if (Props.Get(PropColor) && Color() == Blue)
 							DelProp(PropColor);
-						if (Props.Find(PropTextDecoration) && TextDecoration() == GCss::TextDecorUnderline)
+						if (Props.Get(PropTextDecoration) && TextDecoration() == GCss::TextDecorUnderline)
 							DelProp(PropTextDecoration)
 						break;
 					}
 					case TAG_BODY:
 					{
 						GCss::Len FivePx(GCss::LenPx, 5.0f);
-						if (Props.Find(PropPaddingLeft) && PaddingLeft() == FivePx)
+						if (Props.Get(PropPaddingLeft) && PaddingLeft() == FivePx)
 							DelProp(PropPaddingLeft)
-						if (Props.Find(PropPaddingTop) && PaddingTop() == FivePx)
+						if (Props.Get(PropPaddingTop) && PaddingTop() == FivePx)
 							DelProp(PropPaddingTop)
-						if (Props.Find(PropPaddingRight) && PaddingRight() == FivePx)
+						if (Props.Get(PropPaddingRight) && PaddingRight() == FivePx)
 							DelProp(PropPaddingRight)
 						break;
 					}
 					case TAG_B:
 					{
-						if (Props.Find(PropFontWeight) && FontWeight() == GCss::FontWeightBold)
+						if (Props.Get(PropFontWeight) && FontWeight() == GCss::FontWeightBold)
 							DelProp(PropFontWeight);
 						break;
 					}
 					case TAG_U:
 					{
-						if (Props.Find(PropTextDecoration) && TextDecoration() == GCss::TextDecorUnderline)
+						if (Props.Get(PropTextDecoration) && TextDecoration() == GCss::TextDecorUnderline)
 							DelProp(PropTextDecoration);
 						break;
 					}
 					case TAG_I:
 					{
-						if (Props.Find(PropFontStyle) && FontStyle() == GCss::FontStyleItalic)
+						if (Props.Get(PropFontStyle) && FontStyle() == GCss::FontStyleItalic)
 							DelProp(PropFontStyle);
 						break;
 					}
@@ -2020,6 +2224,7 @@ void GTag::Invalidate()
 	{
 		p.Offset(t->Pos.x, t->Pos.y);
 	}
+	p.Offset(0, -Html->ScrollY());
 	Html->Invalidate(&p);
 }
 
@@ -2563,6 +2768,7 @@ void GTag::SetImage(const char *Uri, GSurface *Img)
 {
 	if (Img)
 	{
+		SetLayoutDirty();
 		if (TagId != TAG_IMG)
 		{
 			ImageDef *Def = (ImageDef*)GCss::Props.Find(PropBackgroundImage);
@@ -2730,32 +2936,111 @@ struct GTagElementCallback : public GCss::ElementCallback<GTag>
 	}
 };
 
-void GTag::RestyleAll()
+void GTag::RestyleAll(GCss::Store::AtomFilter *Ancestors)
 {
-	Restyle();
+	Restyle(Ancestors);
+	ShareStyle();
+	if (!Children.Length())
+		return;
+
+	// The children's ancestors are ours plus this tag
+	GCss::Store::AtomFilter Filter;
+	GTagElementCallback Context;
+	if (Ancestors)
+		Filter = *Ancestors;
+	else
+		Filter.AddAncestors(&Context, this);
+	Filter.AddElement(&Context, this);
+
 	for (unsigned i=0; i<Children.Length(); i++)
 	{
 		GHtmlElement *c = Children[i];
 		GTag *t = ToTag(c);
 		if (t)
-			t->RestyleAll();
+			t->RestyleAll(&Filter);
+	}
+}
+
+void GTag::ShareStyle()
+{
+	if (Html->d->SharedStyles.Share(*this))
+	{
+		#if DEBUG_STYLE_SHARING
+		Html->d->StylesShared++;
+		#endif
 	}
 }
 
+GString GTag::StyleShareKey()
+{
+	// The parent's entry stands in for all the ancestors
+	GTag *p = ToTag(Parent);
+	if ((p && !p->StyleShareId) ||
+		!Html->d->CanShare(Html->CssStore))
+		return GString();
+
+	// ':link' depends on the 'href'
+	const char *Href;
+	GString Key;
+	Key.Printf("%u|%s|%s|%s|%i",
+				p ? p->StyleShareId : 0,
+				Tag.Get() ? Tag.Get() : "",
+				HtmlId ? HtmlId : "",
+				GString(" ").Join(Class).Get(),
+				Get("href", Href));
+	return Key;
+}
+
 // After CSS has changed this function scans through the CSS and applies any rules
 // that match the current tag.
-void GTag::Restyle()
+void GTag::Restyle(GCss::Store::AtomFilter *Ancestors)
 {
-	// Use the matching built into the GCss Store.
-	GCss::SelArray Styles;
-	GTagElementCallback Context;
-	if (Html->CssStore.Match(Styles, &Context, this))
+	SetLayoutDirty();
+
+	GString Key = StyleShareKey();
+	GStyleShare *Share = Key ? Html->d->StyleShares.Find(Key) : NULL;
+	#if DEBUG_STYLE_SHARING
+	if (Share) Html->d->StyleHits++;
+	else Html->d->StyleMisses++;
+	#endif
+	if (!Share && Key)
 	{
-		for (unsigned i=0; i<Styles.Length(); i++)
+		// Use the matching built into the GCss Store.
+		GTagElementCallback Context;
+		Share = new GStyleShare;
+		Share->Id = Html->d->NextStyleShare++;
+		Html->CssStore.Match(Share->Styles, &Context, this, Ancestors);
+
+		bool Mergable = true;
+		for (unsigned i=0; Mergable && i<Share->Styles.Length(); i++)
+			Mergable = Share->Styles[i]->Decl != NULL;
+		if (Mergable && Share->Styles.Length() > 1 && Share->Merged.Reset(new GCss))
 		{
-			GCss::Selector *s = Styles[i];
-			if (s)
-				SetCssStyle(s->Style);
+			for (unsigned i=0; i<Share->Styles.Length(); i++)
+				Share->Merged->CopyStyle(*Share->Styles[i]->Decl);
+		}
+
+		Html->d->StyleShares.Add(Key, Share);
+	}
+
+	StyleShareId = Share ? Share->Id : 0;
+	if (Share && Share->Merged)
+	{
+		CopyStyle(*Share->Merged);
+	}
+	else if (Share)
+	{
+		for (unsigned i=0; i<Share->Styles.Length(); i++)
+			Html->CssStore.Apply(*this, Share->Styles[i]);
+	}
+	else
+	{
+		GCss::SelArray Styles;
+		GTagElementCallback Context;
+		if (Html->CssStore.Match(Styles, &Context, this, Ancestors))
+		{
+			for (unsigned i=0; i<Styles.Length(); i++)
+				Html->CssStore.Apply(*this, Styles[i]);
 		}
 	}
 	
@@ -3324,6 +3609,8 @@ void GTag::SetStyle()
 		}
 	}
 
+	ShareStyle();
+
 	if (IsBlock())
 	{
 		GCss::ImageDef bk = BackgroundImage();
@@ -3355,6 +3642,8 @@ void GTag::SetCssStyle(const char *Style)
 {
 	if (Style)
 	{
+		SetLayoutDirty();
+
 		// Strip out comments
 		char *Comment = 0;
 		while ((Comment = strstr((char*)Style, "/*")))
@@ -3812,6 +4101,8 @@ void GTag::ResetCaches()
 	*/
 	if (Cell)
 		DeleteObj(Cell->Cells);
+	LayoutDirty = true;
+	ZeroObj(LayoutCache);
 	for (size_t i=0; i<Children.Length(); i++)
 		ToTag(Children[i])->ResetCaches();
 }
@@ -3850,6 +4141,32 @@ GTag *GTag::GetTableCell(int x, int y)
 // This function gets the largest and smallest piece of content
 // in this cell and all it's children.
 bool GTag::GetWidthMetrics(GTag *Table, uint16 &Min, uint16 &Max)
+{
+	// The metrics don't depend on the view width, so unless something
+	// has changed they are the same as last time.
+	LayoutCacheInfo &c = LayoutCache;
+	if (c.MetricsValid &&
+		c.MetricsTable == Table &&
+		c.InMin == Min &&
+		c.InMax == Max)
+	{
+		Min = c.OutMin;
+		Max = c.OutMax;
+		return c.MetricsStatus;
+	}
+
+	c.MetricsTable = Table;
+	c.InMin = Min;
+	c.InMax = Max;
+	c.MetricsStatus = CalcWidthMetrics(Table, Min, Max);
+	c.OutMin = Min;
+	c.OutMax = Max;
+	c.MetricsValid = true;
+
+	return c.MetricsStatus;
+}
+
+bool GTag::CalcWidthMetrics(GTag *Table, uint16 &Min, uint16 &Max)
 {
 	bool Status = true;
 	int MarginPx = 0;
@@ -4356,8 +4673,22 @@ void GHtmlTableLayout::LayoutTable(GFlowRegion *f, uint16 Depth)
 	}
 	#endif
 
-	// Size detection pass
+	// Size detection pass, the results are kept for the next layout. The
+	// cells' border and padding sizes are stored in the cells themselves.
 	int y;
+	size_t CellIdx = 0;
+	bool Measured = !Table->LayoutDirty && MeasuredX == f->X();
+	if (Measured)
+	{
+		MinCol = MeasuredMin;
+		MaxCol = MeasuredMax;
+		SizeCol = MeasuredSize;
+	}
+	else
+	{
+		MeasuredContent.Length(0);
+	}
+
 	for (y=0; y<s.y; y++)
 	{
 		for (int x=0; x<s.x; )
@@ -4365,6 +4696,20 @@ void GHtmlTableLayout::LayoutTable(GFlowRegion *f, uint16 Depth)
 			GTag *t = Get(x, y);
 			if (t)
 			{
+				if (Measured)
+				{
+					if (t->Cell->Pos.x == x &&
+						t->Cell->Pos.y == y &&
+						t->Display() != GCss::DispNone)
+					{
+						t->Cell->MinContent = MeasuredContent[CellIdx++];
+						t->Cell->MaxContent = MeasuredContent[CellIdx++];
+					}
+
+					x += t->Cell->Span.x;
+					continue;
+				}
+
 				t->Cell->BorderPx = f->ResolveBorder(t, Font);
 				t->Cell->PaddingPx = f->ResolvePadding(t, Font);
 
@@ -4372,7 +4717,10 @@ void GHtmlTableLayout::LayoutTable(GFlowRegion *f, uint16 Depth)
 				{
 					GCss::DisplayType Disp = t->Display();
 					if (Disp == GCss::DispNone)
+					{
+						x += t->Cell->Span.x;
 						continue;
+					}
 
 					GCss::Len Content = t->Width();
 					if (Content.IsValid() && t->Cell->Span.x == 1)
@@ -4397,6 +4745,8 @@ void GHtmlTableLayout::LayoutTable(GFlowRegion *f, uint16 Depth)
 						t->Cell->MinContent = 16;
 						t->Cell->MaxContent = 16;
 					}
+					MeasuredContent.Add(t->Cell->MinContent);
+					MeasuredContent.Add(t->Cell->MaxContent);
 					
 					#if defined(_DEBUG) && DEBUG_TABLE_LAYOUT
 					if (Table->Debug)
@@ -4420,6 +4770,14 @@ void GHtmlTableLayout::LayoutTable(GFlowRegion *f, uint16 Depth)
 			else break;
 		}
 	}
+
+	if (!Measured)
+	{
+		MeasuredX = f->X();
+		MeasuredMin = MinCol;
+		MeasuredMax = MaxCol;
+		MeasuredSize = SizeCol;
+	}
 	
 	// How much space used so far?
 	int TotalX = GetTotalX();
@@ -4706,6 +5064,7 @@ void GHtmlTableLayout::LayoutTable(GFlowRegion *f, uint16 Depth)
 						t->BackgroundColor(GCss::ColorDef(GCss::ColorRgb, DefaultMissingCellColour));
 
 						Set(Table);
+						MeasuredX = -1; // The grid changed
 					}
 					else break;
 				}
@@ -5252,6 +5611,7 @@ void GTag::OnFlow(GFlowRegion *Flow, uint16 Depth)
 
 			Flow->Outdent(f, MarginLeft(), MarginTop(), MarginRight(), MarginBottom(), true);
 			BoundParents();
+			LayoutDirty = false;
 			return;
 			break;
 		}
@@ -5399,6 +5759,7 @@ void GTag::OnFlow(GFlowRegion *Flow, uint16 Depth)
 			Flow->y2 += 16;
 
 			Flow->FinishLine();
+			LayoutDirty = false;
 			return;
 			break;
 		}
@@ -5422,17 +5783,27 @@ void GTag::OnFlow(GFlowRegion *Flow, uint16 Depth)
 
 			Flow->Outdent(f, left, top, right, bottom, true);
 			BoundParents();
+			LayoutDirty = false;
 			return;
 		}
 	}
 
 	// int OldFlowMy = Flow->my;
+	bool SaveFlow = false;
 	if (Disp == DispBlock || Disp == DispInlineBlock)
 	{
 		// This is a block level element, so end the previous non-block elements
 		if (Disp == DispBlock)
 		{		
 			Flow->EndBlock();
+
+			// Table rows and cells are sized by the table layout.
+			if (TagId != TAG_TR && !IsTableCell(TagId))
+			{
+				if (ReuseFlow(Flow))
+					return;
+				SaveFlow = true;
+			}
 		}
 		
 		BlockFlowWidth = Flow->X();
@@ -5823,6 +6194,46 @@ void GTag::OnFlow(GFlowRegion *Flow, uint16 Depth)
 	{
 		Flow->InBody--;
 	}
+
+	if (SaveFlow)
+	{
+		LayoutCache.FlowValid = true;
+		LayoutCache.Pos = Pos;
+		LayoutCache.Size = Size;
+		Flow->Save(LayoutCache.FlowOut);
+	}
+	LayoutDirty = false;
+}
+
+/// Blocks are flowed in their own co-ordinates, so if nothing in a block has
+/// changed and it starts in the same place apart from 'y', the children don't
+/// need flowing again. The block and the flow are moved down instead.
+bool GTag::ReuseFlow(GFlowRegion *Flow)
+{
+	LayoutCacheInfo &c = LayoutCache;
+	bool Reuse =	!LayoutDirty &&
+					c.FlowValid &&
+					c.ViewY == Html->Y() &&
+					Flow->SameAs(c.FlowIn);
+	int Dy = Flow->y1 - c.FlowIn.y1;
+
+	c.FlowValid = false;
+	c.ViewY = Html->Y();
+	Flow->Save(c.FlowIn);
+	if (!Reuse)
+		return false;
+
+	c.Pos.y += Dy;
+	c.FlowOut.y1 += Dy;
+	c.FlowOut.y2 += Dy;
+	c.FlowOut.Max.y += Dy;
+	c.FlowValid = true;
+
+	Pos = c.Pos;
+	Size = c.Size;
+	BoundParents();
+	Flow->Restore(c.FlowOut);
+	return true;
 }
 
 bool GTag::PeekTag(char *s, char *tag)
@@ -6418,6 +6829,48 @@ static void FillRectWithImage(GSurface *pDC, GRect *r, GSurface *Image, GCss::Re
 	pDC->Op(Old);
 }
 
+void GTag::UpdatePaintBounds()
+{
+	// Text can overhang its line, allow a line's height around it.
+	GFont *f = GetFont();
+	int Slop = f ? f->GetHeight() : 0;
+
+	GRect &b = PaintBounds;
+	b.ZOff(Size.x-1, Size.y-1);
+	PaintAlways = TagId == TAG_BODY; // Paints its background offset by 'Pos'
+	if (Ctrl)
+	{
+		PaintAlways = true;
+		Html->d->HasCtrls = true;
+	}
+
+	for (unsigned i=0; i<TextPos.Length(); i++)
+	{
+		GRect r = *TextPos[i];
+		r.Size(-Slop, -Slop);
+		if (b.Valid())
+			b.Union(&r);
+		else
+			b = r;
+	}
+
+	for (unsigned i=0; i<Children.Length(); i++)
+	{
+		GTag *t = ToTag(Children[i]);
+		t->UpdatePaintBounds();
+		PaintAlways |= t->PaintAlways;
+		if (t->PaintBounds.Valid())
+		{
+			GRect r = t->PaintBounds;
+			r.Offset(t->Pos.x, t->Pos.y);
+			if (b.Valid())
+				b.Union(&r);
+			else
+				b = r;
+		}
+	}
+}
+
 void GTag::OnPaint(GSurface *pDC, bool &InSelection, uint16 Depth)
 {
 	if (Depth >= MAX_RECURSION_DEPTH ||
@@ -6848,9 +7301,22 @@ void GTag::OnPaint(GSurface *pDC, bool &InSelection, uint16 Depth)
 	}
 	#endif
 
+	GRect Surface(0, 0, pDC->X()-1, pDC->Y()-1);
 	for (unsigned i=0; i<Children.Length(); i++)
 	{
 		GTag *t = ToTag(Children[i]);
+
+		// Skip children that don't paint anything on the surface
+		if (!t->PaintAlways &&
+			t->PaintBounds.Valid())
+		{
+			GRect r = t->PaintBounds;
+			r.Offset(t->Pos.x - Px, t->Pos.y - Py);
+			if (!r.Overlap(&Surface) &&
+				!Html->d->PaintKeep.HasItem(t))
+				continue;
+		}
+
 		pDC->SetOrigin(Px - t->Pos.x, Py - t->Pos.y);
 		t->OnPaint(pDC, InSelection, Depth + 1);
 		pDC->SetOrigin(Px, Py);
@@ -6935,9 +7401,13 @@ void GHtml::_Delete()
 {
 	LgiAssert(!d->IsParsing);
 
+	d->EmptyStyleShares();
+	d->SharedStyles.Empty();
+	d->EmptyTiles();
 	CssStore.Empty();
 	CssHref.Empty();
 	OpenTags.Length(0);
+	ParseCancel();
 	Source.Reset();
 	DeleteObj(Tag);
 	DeleteObj(FontCache);
@@ -6958,6 +7428,7 @@ void GHtml::OnAddStyle(const char *MimeType, const char *Styles)
 		{
 			d->StyleDirty = true;
 		}
+		d->EmptyStyleShares();
 
 		#if 0 // def _DEBUG
 		bool LogCss = false;
@@ -7009,130 +7480,137 @@ void GHtml::ParseDocument(const char *Doc)
 		if (IsHtml)
 		{
 			Parse(Tag, Doc);
+			FixupDocument();
+		}
+		else
+		{
+			Tag->ParseText(Source);
+		}
+	}
 
-			// Add body tag if not specified...
-			GTag *Html = Tag->GetTagByName("html");
-			GTag *Body = Tag->GetTagByName("body");
+	ViewWidth = -1;
+	if (Tag)
+		Tag->ResetCaches();
+	Invalidate();
+}
 
-			if (!Html && !Body)
-			{
-				if ((Html = new GTag(this, 0)))
-					Html->SetTag("html");
-				if ((Body = new GTag(this, Html)))
-					Body->SetTag("body");
-				
-				Html->Attach(Body);
+void GHtml::FixupDocument()
+{
+	if (!Tag)
+		return;
 
-				if (Tag->Text())
-				{
-					GTag *Content = new GTag(this, Body);
-					if (Content)
-					{
-						Content->TagId = CONTENT;
-						Content->Text(NewStrW(Tag->Text()));
-					}
-				}
-				while (Tag->Children.Length())
-				{
-					GTag *t = ToTag(Tag->Children.First());
-					Body->Attach(t, Body->Children.Length());
-				}
-				DeleteObj(Tag);
-				
-				Tag = Html;
-			}
-			else if (!Body)
+	// Add body tag if not specified...
+	GTag *Html = Tag->GetTagByName("html");
+	GTag *Body = Tag->GetTagByName("body");
+
+	if (!Html && !Body)
+	{
+		if ((Html = new GTag(this, 0)))
+			Html->SetTag("html");
+		if ((Body = new GTag(this, Html)))
+			Body->SetTag("body");
+		
+		Html->Attach(Body);
+
+		if (Tag->Text())
+		{
+			GTag *Content = new GTag(this, Body);
+			if (Content)
 			{
-				if ((Body = new GTag(this, Html)))
-					Body->SetTag("body");
-					
-				for (unsigned i=0; i<Html->Children.Length(); i++)
-				{
-					GTag *t = ToTag(Html->Children[i]);
-					if (t->TagId != TAG_HEAD)
-					{
-						Body->Attach(t);
-						i--;
-					}
-				}
-				
-				Html->Attach(Body);
+				Content->TagId = CONTENT;
+				Content->Text(NewStrW(Tag->Text()));
 			}
+		}
+		while (Tag->Children.Length())
+		{
+			GTag *t = ToTag(Tag->Children.First());
+			Body->Attach(t, Body->Children.Length());
+		}
+		DeleteObj(Tag);
+		
+		Tag = Html;
+	}
+	else if (!Body)
+	{
+		if ((Body = new GTag(this, Html)))
+			Body->SetTag("body");
 			
-			if (Html && Body)
+		for (unsigned i=0; i<Html->Children.Length(); i++)
+		{
+			GTag *t = ToTag(Html->Children[i]);
+			if (t->TagId != TAG_HEAD)
 			{
-				char16 *t = Tag->Text();
-				if (t)
+				Body->Attach(t);
+				i--;
+			}
+		}
+		
+		Html->Attach(Body);
+	}
+	
+	if (Html && Body)
+	{
+		char16 *t = Tag->Text();
+		if (t)
+		{
+			if (ValidStrW(t))
+			{
+				GTag *Content = new GTag(this, 0);
+				if (Content)
 				{
-					if (ValidStrW(t))
-					{
-						GTag *Content = new GTag(this, 0);
-						if (Content)
-						{
-							Content->Text(NewStrW(Tag->Text()));
-							Body->Attach(Content, 0);
-						}
-					}
-					Tag->Text(0);
+					Content->Text(NewStrW(Tag->Text()));
+					Body->Attach(Content, 0);
 				}
+			}
+			Tag->Text(0);
+		}
 
-				#if 0 // Enabling this breaks the test file 'gw2.html'.
-				for (GTag *t = Html->Tags.First(); t; )
+		#if 0 // Enabling this breaks the test file 'gw2.html'.
+		for (GTag *t = Html->Tags.First(); t; )
+		{
+			if (t->Tag && t->Tag[0] == '!')
+			{
+				Tag->Attach(t, 0);
+				t = Html->Tags.Current();
+			}
+			else if (t->TagId != TAG_HEAD &&
+					t != Body)
+			{
+				if (t->TagId == TAG_HTML)
 				{
-					if (t->Tag && t->Tag[0] == '!')
+					GTag *c;
+					while ((c = t->Tags.First()))
 					{
-						Tag->Attach(t, 0);
-						t = Html->Tags.Current();
+						Html->Attach(c, 0);
 					}
-					else if (t->TagId != TAG_HEAD &&
-							t != Body)
-					{
-						if (t->TagId == TAG_HTML)
-						{
-							GTag *c;
-							while ((c = t->Tags.First()))
-							{
-								Html->Attach(c, 0);
-							}
 
-							t->Detach();
-							DeleteObj(t);
-						}
-						else
-						{
-							t->Detach();
-							Body->Attach(t);
-						}
-
-						t = Html->Tags.Current();
-					}
-					else
-					{
-						t = Html->Tags.Next();
-					}
+					t->Detach();
+					DeleteObj(t);
 				}
-				#endif					
-
-				if (Environment)
+				else
 				{
-					const char *OnLoad;
-					if (Body->Get("onload", OnLoad))
-					{
-						Environment->OnExecuteScript(this, (char*)OnLoad);
-					}
+					t->Detach();
+					Body->Attach(t);
 				}
+
+				t = Html->Tags.Current();
+			}
+			else
+			{
+				t = Html->Tags.Next();
 			}
 		}
-		else
+		#endif					
+
+		if (Environment)
 		{
-			Tag->ParseText(Source);
+			const char *OnLoad;
+			if (Body->Get("onload", OnLoad))
+			{
+				Environment->OnExecuteScript(this, (char*)OnLoad);
+			}
 		}
 	}
-
-	ViewWidth = -1;
-	if (Tag)
-		Tag->ResetCaches();
-	Invalidate();
 }
 
 bool GHtml::NameW(const char16 *s)
@@ -7172,6 +7650,10 @@ bool GHtml::Name(const char *s)
 	}
 
 	// Parse
+	#if DEBUG_STYLE_SHARING
+	uint64 StyleStart = LgiMicroTime();
+	d->StyleHits = d->StyleMisses = d->StylesShared = 0;
+	#endif
 	d->IsParsing = true;
 	ParseDocument(s);
 	d->IsParsing = false;
@@ -7181,6 +7663,11 @@ bool GHtml::Name(const char *s)
 		d->StyleDirty = false;
 		Tag->RestyleAll();
 	}
+	#if DEBUG_STYLE_SHARING
+	LgiTrace("%s:%i - Parse+style %.1fms, style sharing: %i hits, %i misses, %i entries, %i computed styles shared\n",
+			_FL, (double)(LgiMicroTime() - StyleStart) / 1000.0,
+			d->StyleHits, d->StyleMisses, (int)d->StyleShares.Length(), d->StylesShared);
+	#endif
 
 	if (d->DeferredLoads == 0)
 	{
@@ -7192,6 +7679,92 @@ bool GHtml::Name(const char *s)
 	return true;
 }
 
+bool GHtml::BeginHtml()
+{
+	SetDocumentUid(GetDocumentUid()+1);
+
+	_Delete();
+	_New();
+
+	if (GetCss())
+		GetCss()->DeleteProp(GCss::PropBackgroundColor);
+	if (!(Tag = new GTag(this, 0)))
+		return false;
+	Tag->TagId = ROOT;
+
+	return ParseBegin(Tag);
+}
+
+bool GHtml::AppendHtml(const char *Data, ssize_t Len)
+{
+	if (!Tag || !IsParsingStream())
+		return false;
+
+	// New markup only goes into the elements still open, everything that
+	// was closed by earlier chunks keeps its layout.
+	GArray<GTag*> Open;
+	for (GTag *t = ToTag(GetOpenElement()); t; t = ToTag(t->Parent))
+		Open.Add(t);
+	if (!Open.Length())
+		Open.Add(Tag);
+
+	d->IsParsing = true;
+	bool Status = ParseChunk(Data, Len);
+	d->IsParsing = false;
+
+	if (d->StyleDirty)
+	{
+		// A style sheet arrived, so any tag can look different.
+		d->StyleDirty = false;
+		Tag->RestyleAll();
+		Tag->ResetCaches();
+	}
+	else
+	{
+		// The new tags start out dirty. The open ones may have new children,
+		// and a table among them new cells, so their layouts are redone.
+		for (unsigned i=0; i<Open.Length(); i++)
+		{
+			if (Open[i]->Cell)
+				DeleteObj(Open[i]->Cell->Cells);
+		}
+		Open[0]->SetLayoutDirty();
+	}
+
+	Invalidate();
+
+	return Status;
+}
+
+bool GHtml::EndHtml()
+{
+	if (!Tag || !IsParsingStream())
+		return false;
+
+	d->IsParsing = true;
+	ParseEnd();
+	FixupDocument();
+	d->IsParsing = false;
+
+	if (Tag && d->StyleDirty)
+	{
+		d->StyleDirty = false;
+		Tag->RestyleAll();
+	}
+
+	ViewWidth = -1;
+	if (Tag)
+		Tag->ResetCaches();
+
+	if (d->DeferredLoads == 0)
+	{
+		OnLoad();
+	}
+
+	Invalidate();
+	return true;
+}
+
 char *GHtml::Name()
 {
 	#if LUIS_DEBUG
@@ -7312,7 +7885,7 @@ int GHtml::OnNotify(GViewI *c, int f)
 				VScroll->SetLimits(0, fy);
 			}
 			
-			Invalidate();
+			GDocView::Invalidate(); // Scrolled, the tiles are still valid
 			break;
 		}
 		default:
@@ -7339,13 +7912,17 @@ void GHtml::OnPosChange()
 GdcPt2 GHtml::Layout(bool ForceLayout)
 {
 	GRect Client = GetClient();
-	if (Tag && (ViewWidth != Client.X() || ForceLayout))
+	if (Tag && (ViewWidth != Client.X() || ForceLayout || Tag->LayoutDirty))
 	{
 		GFlowRegion f(this, Client, false);
 
-		// Flow text, width is different
+		// Flow text, width is different or something changed
 		Tag->OnFlow(&f, 0);
+		Tag->LayoutDirty = false;
 		ViewWidth = Client.X();
+		d->HasCtrls = false;
+		Tag->UpdatePaintBounds();
+		d->EmptyTiles();
 		d->Content.x = f.MAX.x + 1;
 		d->Content.y = f.MAX.y + 1;
 
@@ -7384,33 +7961,6 @@ void GHtml::OnPaint(GSurface *ScreenDC)
 	{
 	#endif
 
-		#if GHTML_USE_DOUBLE_BUFFER
-		GRect Client = GetClient();
-		if (!MemDC ||
-			(MemDC->X() < Client.X() || MemDC->Y() < Client.Y()))
-		{
-			if (MemDC.Reset(new GMemDC))
-			{
-				int Sx = Client.X() + 10;
-				int Sy = Client.Y() + 10;
-				if (!MemDC->Create(Sx, Sy, System32BitColourSpace))
-				{
-					MemDC.Reset();
-				}
-			}
-		}
-		if (MemDC)
-		{
-			MemDC->ClipRgn(NULL);
-			#if 0//def _DEBUG
-			MemDC->Colour(GColour(255, 0, 255));
-			MemDC->Rectangle();
-			#endif
-		}
-		#endif
-
-		GSurface *pDC = MemDC ? MemDC : ScreenDC;
-
 		GColour cBack;
 		if (GetCss())
 		{
@@ -7420,34 +7970,68 @@ void GHtml::OnPaint(GSurface *ScreenDC)
 		}
 		if (!cBack.IsValid())
 			cBack.Set(Enabled() ? LC_WORKSPACE : LC_MED, 24);		
-		pDC->Colour(cBack);
-		pDC->Rectangle();
 
 		if (Tag)
-		{
 			Layout();
 
-			if (VScroll)
+		// The tags holding the cursor and selection edge are always painted,
+		// they track the selection state.
+		d->PaintKeep.Length(0);
+		for (GTag *t = Cursor; t; t = ToTag(t->Parent))
+			d->PaintKeep.Add(t);
+		for (GTag *t = Selection; t; t = ToTag(t->Parent))
+			d->PaintKeep.Add(t);
+
+		#if GHTML_USE_DOUBLE_BUFFER
+		if (!Tag || !PaintTiles(ScreenDC, cBack))
+		{
+			GRect Client = GetClient();
+			if (!MemDC ||
+				(MemDC->X() < Client.X() || MemDC->Y() < Client.Y()))
 			{
-				int LineY = GetFont()->GetHeight();
-				int Vs = (int)VScroll->Value();
-				pDC->SetOrigin(0, Vs * LineY);
+				if (MemDC.Reset(new GMemDC))
+				{
+					int Sx = Client.X() + 10;
+					int Sy = Client.Y() + 10;
+					if (!MemDC->Create(Sx, Sy, System32BitColourSpace))
+					{
+						MemDC.Reset();
+					}
+				}
+			}
+			if (MemDC)
+			{
+				MemDC->ClipRgn(NULL);
+				#if 0//def _DEBUG
+				MemDC->Colour(GColour(255, 0, 255));
+				MemDC->Rectangle();
+				#endif
 			}
+		#endif
 
-			bool InSelection = false;
-			Tag->OnPaint(pDC, InSelection, 0);
-		}
+			GSurface *pDC = MemDC ? MemDC : ScreenDC;
+			pDC->Colour(cBack);
+			pDC->Rectangle();
+
+			if (Tag)
+			{
+				pDC->SetOrigin(0, ScrollY());
+
+				bool InSelection = false;
+				Tag->OnPaint(pDC, InSelection, 0);
+			}
 
 		#if GHTML_USE_DOUBLE_BUFFER
-		if (MemDC)
-		{
-			pDC->SetOrigin(0, 0);
-			#if 0
-			pDC->Colour(Rgb24(255, 0, 0), 24);
-			pDC->Line(0, 0, X()-1, Y()-1);
-			pDC->Line(X()-1, 0, 0, Y()-1);
-			#endif
-			ScreenDC->Blt(0, 0, MemDC);
+			if (MemDC)
+			{
+				pDC->SetOrigin(0, 0);
+				#if 0
+				pDC->Colour(Rgb24(255, 0, 0), 24);
+				pDC->Line(0, 0, X()-1, Y()-1);
+				pDC->Line(X()-1, 0, 0, Y()-1);
+				#endif
+				ScreenDC->Blt(0, 0, MemDC);
+			}
 		}
 		#endif
 	#if LGI_EXCEPTIONS
@@ -7466,6 +8050,72 @@ void GHtml::OnPaint(GSurface *ScreenDC)
 	}
 }
 
+bool GHtml::PaintTiles(GSurface *ScreenDC, GColour &Back)
+{
+	if (d->HasCtrls)
+		return false;
+
+	if (d->TileFocus != Focus() ||
+		d->TileEnabled != Enabled())
+	{
+		d->EmptyTiles();
+		d->TileFocus = Focus();
+		d->TileEnabled = Enabled();
+	}
+
+	GRect Client = GetClient();
+	int Sy = ScrollY();
+	int Col2 = MIN(Client.X() / GHTML_TILE_SIZE, 0xff);
+	int Row1 = Sy / GHTML_TILE_SIZE;
+	int Row2 = (Sy + Client.Y()) / GHTML_TILE_SIZE;
+
+	for (int Row = Row1; Row <= Row2; Row++)
+	{
+		for (int Col = 0; Col <= Col2; Col++)
+		{
+			int Key = (Row << 8) | Col;
+			GSurface *Tile = d->Tiles.Find(Key);
+			if (!Tile)
+			{
+				Tile = new GMemDC(GHTML_TILE_SIZE, GHTML_TILE_SIZE, System32BitColourSpace);
+				if (!Tile || !(*Tile)[0])
+				{
+					DeleteObj(Tile);
+					return false;
+				}
+
+				// Only the tags overlapping the tile paint anything
+				Tile->Colour(Back);
+				Tile->Rectangle();
+				Tile->SetOrigin(Col * GHTML_TILE_SIZE, Row * GHTML_TILE_SIZE);
+				bool InSelection = false;
+				Tag->OnPaint(Tile, InSelection, 0);
+				Tile->SetOrigin(0, 0);
+				Tile->ClipRgn(NULL);
+				d->Tiles.Add(Key, Tile);
+			}
+
+			ScreenDC->Blt(Client.x1 + Col * GHTML_TILE_SIZE, Client.y1 + Row * GHTML_TILE_SIZE - Sy, Tile);
+		}
+	}
+
+	d->TrimTiles(Row1, Row2, (Row2 - Row1 + 1) * (Col2 + 1));
+	return true;
+}
+
+bool GHtml::Invalidate(GRect *r, bool Repaint, bool NonClient)
+{
+	if (r)
+	{
+		GRect Doc = *r;
+		Doc.Offset(0, ScrollY());
+		d->EmptyTiles(&Doc);
+	}
+	else d->EmptyTiles();
+
+	return GDocView::Invalidate(r, Repaint, NonClient);
+}
+
 bool GHtml::HasSelection()
 {
 	if (Cursor && Selection)
@@ -7960,7 +8610,7 @@ bool GHtml::OnKey(GKey &k)
 		if (Dy && VScroll)
 		{
 			VScroll->Value(VScroll->Value() + Dy);
-			Invalidate();
+			GDocView::Invalidate();
 		}
 	}
 
@@ -8441,7 +9091,7 @@ bool GHtml::OnMouseWheel(double Lines)
 	if (VScroll)
 	{
 		VScroll->Value(VScroll->Value() + (int)Lines);
-		Invalidate();
+		GDocView::Invalidate();
 	}
 	
 	return true;
@@ -8996,6 +9646,7 @@ struct BuildContext
 GHtmlTableLayout::GHtmlTableLayout(GTag *table)
 {
 	Table = table;
+	MeasuredX = -1;
 	if (!Table)
 		return;
 
@@ -81,26 +81,29 @@ void GHtmlParser::SkipNonDisplay(char *&s)
 		}
 		else break;
 	}
+
+	// The white space may carry on into the next segment.
+	if (!*s && Stream.Partial)
+		Stream.SkipSpace = true;
 }
 
 char16 *GHtmlParser::DecodeEntities(const char *s, ssize_t len)
 {
-	char16 buf[256];
-	char16 *o = buf;
+	const char16 *w = DecodeEntities(EntityBuf, s, len);
+	return NewStrW(w);
+}
+
+const char16 *GHtmlParser::DecodeEntities(GArray<char16> &Out, const char *s, ssize_t len)
+{
+	// Decoding never makes the string longer, so size the output once
+	// and reuse it for the next value.
+	if (Out.Length() < (size_t)len + 1)
+		Out.Length(len + 1);
+	char16 *o = Out.AddressOf();
 	const char *end = s + len;
-	GStringPipe p(256);
 
 	for (const char *i = s; i < end; )
 	{
-		if (o - buf > CountOf(buf) - 32)
-		{
-			// We are getting near the end of the buffer...
-			// push existing data into the GStringPipe and
-			// reset the output ptr.
-			p.Write(buf, (o - buf) * sizeof(*o) );
-			o = buf;
-		}
-		
 		switch (*i)
 		{
 			case '&':
@@ -196,15 +199,32 @@ char16 *GHtmlParser::DecodeEntities(const char *s, ssize_t len)
 		else break;
 	}
 	*o = 0;
-	
-	if (p.GetSize() > 0)
+
+	return Out.AddressOf();
+}
+
+// Finds the extent of the attribute value at 's', and returns the end of it.
+static char *PropValueSpan(char *s, char *&Start, char *&End)
+{
+	if (*s && strchr("\"\'", *s))
 	{
-		// Long string mode... use the GStringPipe
-		p.Write(buf, (o - buf) * sizeof(*o));
-		return p.NewStrW();
+		char Delim = *s++;
+		Start = s;
+		while (*s && *s != Delim)
+			s++;
+		End = s;
+		if (*s)
+			s++;
 	}
-	
-	return NewStrW(buf, o - buf);
+	else
+	{
+		Start = s;
+		while (*s && !IsWhiteSpace(*s) && *s != '>')
+			s++;
+		End = s;
+	}
+
+	return s;
 }
 
 char *GHtmlParser::ParsePropValue(char *s, char16 *&Value)
@@ -212,23 +232,9 @@ char *GHtmlParser::ParsePropValue(char *s, char16 *&Value)
 	Value = 0;
 	if (s)
 	{
-		if (strchr("\"\'", *s))
-		{
-			char Delim = *s++;
-			char *Start = s;
-			while (*s && *s != Delim)
-				s++;
-			Value = DecodeEntities(Start, s - Start);
-			if (*s)
-				s++;
-		}
-		else
-		{
-			char *Start = s;
-			while (*s && !IsWhiteSpace(*s) && *s != '>')
-				s++;
-			Value = DecodeEntities(Start, s - Start);
-		}
+		char *Start, *End;
+		s = PropValueSpan(s, Start, End);
+		Value = DecodeEntities(Start, End - Start);
 	}
 
 	return s;
@@ -297,10 +303,11 @@ char *GHtmlParser::ParsePropList(char *s, GHtmlElement *Obj, bool &Closed)
 			while (*s && IsWhiteSpace(*s))
 				s++;
 
-			char16 *Value = 0;
-			s = ParsePropValue(s, Value);
+			char *Start, *End;
+			s = PropValueSpan(s, Start, End);
+			const char16 *Value = DecodeEntities(EntityBuf, Start, End - Start);
 
-			if (Name && Value && *Value)
+			if (Name && *Value)
 			{
 				#if defined(_DEBUG) && 0
 				if (!_stricmp(Name, "debug"))
@@ -310,8 +317,6 @@ char *GHtmlParser::ParsePropList(char *s, GHtmlElement *Obj, bool &Closed)
 				#endif
 				Obj->Set(Name, Value);
 			}
-
-			DeleteArray(Value);
 		}
 
 		DeleteArray(Name);
@@ -354,8 +359,28 @@ void DumpDomTree(GHtmlElement *e, int Depth = 0)
 	}
 }
 
+// Removes the empty text at the end of a block element
+static void TrimTrailingText(GHtmlElement *c)
+{
+	while (c->Children.Length())
+	{
+		GHtmlElement *Last = c->Children.Last();
+
+		if (Last->TagId == CONTENT &&
+			!ValidStrW(Last->GetText()))
+		{
+			Last->Detach();
+			DeleteObj(Last);
+		}
+		else break;
+	}
+}
+
 bool GHtmlParser::Parse(GHtmlElement *Root, const char *Doc)
 {
+	Stream.Root = NULL;
+	Stream.Reset();
+
 	SourceData.Empty();
 	CurrentSrc = Doc;
 	OpenTags.Length(0);
@@ -369,7 +394,332 @@ bool GHtmlParser::Parse(GHtmlElement *Root, const char *Doc)
 	return true;
 }
 
-char *GHtmlParser::ParseHtml(GHtmlElement *Elem, char *Doc, int Depth, bool InPreTag, bool *BackOut)
+bool GHtmlParser::ParseBegin(GHtmlElement *Root)
+{
+	if (!Root)
+		return false;
+
+	Stream.Reset();
+	Stream.Root = Root;
+	SourceData.Empty();
+	CurrentSrc = NULL;
+	OpenTags.Length(0);
+	return true;
+}
+
+bool GHtmlParser::ParseChunk(const char *Data, ssize_t Len)
+{
+	if (!Stream.Root)
+		return false;
+
+	if (Data && Len < 0)
+		Len = strlen(Data);
+	if (Data && Len > 0)
+	{
+		size_t Used = Stream.Buf.Length() - 1;
+		if (!Stream.Buf.Length(Used + Len + 1))
+			return false;
+		memcpy(Stream.Buf.AddressOf(Used), Data, Len);
+		Stream.Buf[Used + Len] = 0;
+
+		ScanStream();
+	}
+
+	if (Stream.Safe > 0)
+	{
+		// Parse the complete markup, ending it just before the next tag
+		char *s = Stream.Buf.AddressOf();
+		char Next = s[Stream.Safe];
+		s[Stream.Safe] = 0;
+		Stream.Partial = true;
+		ParseSegment(s);
+		Stream.Partial = false;
+		s[Stream.Safe] = Next;
+
+		// And drop it from the buffer
+		size_t Remaining = Stream.Buf.Length() - Stream.Safe;
+		memmove(s, s + Stream.Safe, Remaining);
+		Stream.Buf.Length(Remaining);
+		Stream.Scanned -= Stream.Safe;
+		Stream.Lt -= Stream.Safe;
+		Stream.Safe = 0;
+	}
+
+	return true;
+}
+
+bool GHtmlParser::ParseEnd()
+{
+	if (!Stream.Root)
+		return false;
+
+	char *s = Stream.Buf.AddressOf();
+	if (*s)
+		ParseSegment(s);
+
+	// The elements still open are closed by the end of the document,
+	// tidy them up the way the recursion would have.
+	for (GHtmlElement *e = Stream.Resume; e && e->Parent; e = e->Parent)
+	{
+		if (IsBlock(e->Display()))
+			TrimTrailingText(e);
+	}
+
+	Source.Reset(SourceData.NewStr());
+	Stream.Root = NULL;
+	Stream.Reset();
+	return true;
+}
+
+void GHtmlParser::ParseSegment(char *s)
+{
+	CurrentSrc = s;
+	if (Stream.SkipSpace)
+	{
+		Stream.SkipSpace = false;
+		SkipNonDisplay(s);
+	}
+
+	// Carry on from the innermost open element. Each time an element is closed
+	// its parent continues from there, like the ParseHtml recursion unwinding.
+	GHtmlElement *e = Stream.Resume;
+	bool Resume = e != NULL;
+	if (!e)
+		e = Stream.Root;
+	Stream.Resume = NULL;
+
+	while (e)
+	{
+		int Depth = 0;
+		bool InPreTag = false;
+		for (GHtmlElement *p = e; p->Parent; p = p->Parent)
+		{
+			Depth++;
+			if (p->TagId == TAG_PRE)
+				InPreTag = true;
+		}
+
+		s = ParseHtml(e, s, Depth, InPreTag, NULL, Resume);
+		if (!s)
+			break;
+
+		Resume = true;
+		if (e->Parent)
+		{
+			if (IsBlock(e->Display()))
+				TrimTrailingText(e);
+			e = e->Parent;
+		}
+	}
+
+	if (!Stream.Resume)
+		Stream.Resume = e;
+
+	if (CurrentSrc)
+		SourceData.Write(CurrentSrc, strlen(CurrentSrc));
+	CurrentSrc = NULL;
+}
+
+void GHtmlParser::ScanStream()
+{
+	GHtmlStream &t = Stream;
+	size_t Len = t.Buf.Length() - 1;
+
+	for (size_t i = t.Scanned; i < Len; i++)
+	{
+		char c = t.Buf[i];
+		switch (t.State)
+		{
+			case GHtmlStream::ScanText:
+			{
+				if (c == '<')
+				{
+					t.Lt = i;
+					t.State = GHtmlStream::ScanLt;
+				}
+				break;
+			}
+			case GHtmlStream::ScanLt:
+			{
+				// Same test as NextTag, anything before a tag is complete.
+				if (c == '<')
+				{
+					t.Lt = i;
+					break;
+				}
+				
+				t.State = GHtmlStream::ScanText;
+				if (IsAlpha(c))
+				{
+					t.Name[0] = tolower(c);
+					t.NameLen = 1;
+					t.State = GHtmlStream::ScanTagName;
+				}
+				else if (c == '/')
+					t.State = GHtmlStream::ScanEndTag;
+				else if (c == '!')
+					t.State = GHtmlStream::ScanBang;
+				else if (c == '?')
+				{
+					t.NameLen = 0;
+					t.Quote = 0;
+					t.Match = 0;
+					t.XmlNs = false;
+					t.State = GHtmlStream::ScanDynamic;
+				}
+
+				if (t.State != GHtmlStream::ScanText)
+					t.Safe = t.Lt;
+				break;
+			}
+			case GHtmlStream::ScanTagName:
+			{
+				if (IsAlpha(c) || IsDigit(c))
+				{
+					if (t.NameLen < (int)sizeof(t.Name) - 1)
+						t.Name[t.NameLen++] = tolower(c);
+					break;
+				}
+
+				t.Name[t.NameLen] = 0;
+				t.Prev = 0;
+				t.State = GHtmlStream::ScanTag;
+				// Fall through
+			}
+			case GHtmlStream::ScanTag:
+			{
+				if (c == '>')
+				{
+					t.State = GHtmlStream::ScanText;
+
+					// ParseHtml needs the whole of a script or style in one go
+					if (!strcmp(t.Name, "script"))
+						t.RawEnd = "</script>";
+					else if (!strcmp(t.Name, "style"))
+						t.RawEnd = "</style>";
+					else
+						break;
+
+					t.Match = 0;
+					t.State = GHtmlStream::ScanRawText;
+				}
+				else if ((c == '\"' || c == '\'') && t.Prev == '=')
+				{
+					t.Quote = c;
+					t.State = GHtmlStream::ScanQuote;
+				}
+				else if (!IsWhiteSpace(c))
+				{
+					t.Prev = c;
+				}
+				break;
+			}
+			case GHtmlStream::ScanQuote:
+			{
+				if (c == t.Quote)
+				{
+					t.Prev = c;
+					t.State = GHtmlStream::ScanTag;
+				}
+				break;
+			}
+			case GHtmlStream::ScanBang:
+			case GHtmlStream::ScanBangDash:
+			{
+				if (c == '-')
+				{
+					if (t.State == GHtmlStream::ScanBang)
+						t.State = GHtmlStream::ScanBangDash;
+					else
+					{
+						// ParseHtml looks for "-->" from the '<', so "<!-->" is complete
+						t.Match = 2;
+						t.State = GHtmlStream::ScanComment;
+					}
+					break;
+				}
+
+				t.State = c == '>' ? GHtmlStream::ScanText : GHtmlStream::ScanDecl;
+				break;
+			}
+			case GHtmlStream::ScanComment:
+			{
+				if (c == '-')
+					t.Match++;
+				else if (c == '>' && t.Match >= 2)
+					t.State = GHtmlStream::ScanText;
+				else
+					t.Match = 0;
+				break;
+			}
+			case GHtmlStream::ScanEndTag:
+			case GHtmlStream::ScanDecl:
+			{
+				if (c == '>')
+					t.State = GHtmlStream::ScanText;
+				break;
+			}
+			case GHtmlStream::ScanDynamic:
+			{
+				if (t.NameLen < 13 && (t.NameLen || !IsWhiteSpace(c)))
+				{
+					t.Name[t.NameLen++] = c;
+					if (t.NameLen == 13)
+						t.XmlNs = !_strnicmp(t.Name, "xml:namespace", 13);
+				}
+
+				if (t.XmlNs)
+				{
+					// Ends with "/>" or "/?>"
+					if (c == '/')
+						t.Match = 1;
+					else if (c == '?' && t.Match == 1)
+						t.Match = 2;
+					else if (c == '>' && t.Match)
+						t.State = GHtmlStream::ScanText;
+					else
+						t.Match = 0;
+				}
+				else if (t.Quote)
+				{
+					if (c == t.Quote)
+						t.Quote = 0;
+				}
+				else if (c == '\"' || c == '\'')
+				{
+					t.Quote = c;
+				}
+				else if (c == '>' && t.Match)
+				{
+					t.State = GHtmlStream::ScanText;
+				}
+				else
+				{
+					t.Match = c == '?';
+				}
+				break;
+			}
+			case GHtmlStream::ScanRawText:
+			{
+				char l = tolower(c);
+				if (l == t.RawEnd[t.Match])
+				{
+					if (!t.RawEnd[++t.Match])
+						t.State = GHtmlStream::ScanText;
+				}
+				else
+				{
+					t.Match = l == t.RawEnd[0];
+				}
+				break;
+			}
+		}
+	}
+
+	t.Scanned = Len;
+}
+
+char *GHtmlParser::ParseHtml(GHtmlElement *Elem, char *Doc, int Depth, bool InPreTag, bool *BackOut, bool Resume)
 {
 	#if CRASH_TRACE
 	LgiTrace("::ParseHtml Doc='%.10s'\n", Doc);
@@ -381,7 +731,8 @@ char *GHtmlParser::ParseHtml(GHtmlElement *Elem, char *Doc, int Depth, bool InPr
 		return Doc + strlen(Doc);
 	}
 
-	bool IsFirst = true;
+	// When resuming an element its own tag has already been parsed.
+	bool IsFirst = !Resume;
 	for (char *s=Doc; s && *s; )
 	{
 		char *StartTag = s;
@@ -459,6 +810,7 @@ char *GHtmlParser::ParseHtml(GHtmlElement *Elem, char *Doc, int Depth, bool InPr
 									SourceData.Write(Result, strlen(Result));
 									
 									// Create some new elements based on the dynamically generated string
+									GHtmlElement *OldResume = Stream.Resume;
 									char *p = Result;
 									do
 									{
@@ -470,6 +822,7 @@ char *GHtmlParser::ParseHtml(GHtmlElement *Elem, char *Doc, int Depth, bool InPr
 										else break;
 									}
 									while (ValidStr(p));
+									Stream.Resume = OldResume;
 								}
 							}
 
@@ -951,10 +1304,12 @@ char *GHtmlParser::ParseHtml(GHtmlElement *Elem, char *Doc, int Depth, bool InPr
 											{
 												bool BackOut = false;
 												GArray<GHtmlElement*> ot = OpenTags;
+												GHtmlElement *OldResume = Stream.Resume;
 
 												ParseHtml(Child, a, Depth + 1, false, &BackOut);
 
 												OpenTags = ot;
+												Stream.Resume = OldResume;
 											}
 										}
 									}
@@ -980,20 +1335,12 @@ char *GHtmlParser::ParseHtml(GHtmlElement *Elem, char *Doc, int Depth, bool InPr
 							DeleteObj(c);
 							return s;
 						}
-						else if (IsBlock(c->Display()))
+						else if (IsBlock(c->Display()) &&
+								(s || !Stream.Partial))
 						{
-							while (c->Children.Length())
-							{
-								GHtmlElement *Last = c->Children.Last();
-
-								if (Last->TagId == CONTENT &&
-									!ValidStrW(Last->Txt))
-								{
-									Last->Detach();
-									DeleteObj(Last);
-								}
-								else break;
-							}
+							// If the data ran out 'c' is still open, it's
+							// tidied up when it closes.
+							TrimTrailingText(c);
 						}
 					}
 				}
@@ -1213,6 +1560,10 @@ char *GHtmlParser::ParseHtml(GHtmlElement *Elem, char *Doc, int Depth, bool InPr
 	LgiTrace("::ParseHtml end\n");
 	#endif
 
+	// Out of data, an incremental parse carries on here next time.
+	if (Stream.Root && !Stream.Resume)
+		Stream.Resume = Elem;
+
 	return 0;
 }
 
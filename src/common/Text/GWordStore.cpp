@@ -3,230 +3,1410 @@
 
 #include "Lgi.h"
 #include "GWordStore.h"
-// #define DBG_MSGS
-
-class GWordStorePriv
-{
-public:
-	char *File;
-	GHashTbl<const char*,int> Table;
-	bool Dirty;
-	int Items;
-
-	GWordStorePriv() : Table(0, false, 0, -1)
-	{
-		Dirty = false;
-		Table.IsCase(false);
-		Items = 0;
-		Table.SetStringPool(true);
-	}
-
-	~GWordStorePriv()
-	{
-		DeleteArray(File);
-	}
-};
+#include "LThreadPool.h"
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define WORDSTORE_SSE2			1
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#else
+#define WORDSTORE_SSE2			0
+#endif
+#ifdef POSIX
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+// #define DBG_MSGS
 
-GWordStore::GWordStore(const char *file)
-{
-	d = new GWordStorePriv;
-	d->File = NewStr(file);
-	if (d->File)
+#define WORDSTORE_MAGIC			"LgiWords"
+#define WORDSTORE_LOG_MAGIC		"LgiWLog1"
+#define WORDSTORE_VERSION		2
+#define WORDSTORE_BLOCK			32			// Words per front-coded block
+#define WORDSTORE_MAX_WORD		256			// Including the NULL
+#define WORDSTORE_LOG_BUF		(64 << 10)	// Log bytes to buffer before writing
+#define WORDSTORE_WRITE_BUF		(1 << 20)	// Bytes to buffer when writing the sorted file
+#define WORDSTORE_MIN_COMPACT	(32 << 10)	// Min overlay words before compacting in the background
+#define WORDSTORE_MIN_TOKEN		3			// Shortest word Tokenise keeps
+#define WORDSTORE_MAX_TOKEN		40			// Longest word Tokenise keeps
+#define WORDSTORE_INTERESTING	15			// Words Classify combines
+#define WORDSTORE_MIN_SEEN		5			// Min (weighted) times a word must be seen to be scored
+#define WORDSTORE_UNKNOWN_PROB	0.4			// Spam probability of a word that hasn't been seen enough
+
+/*
+	File format (native byte order):
+
+	GWordStoreHeader
+	Data:	Words sorted by strcmp of their lower case form, each one:
+				varint	Shared		Bytes in common with the previous word (0 at the start of a block)
+				varint	Len			Bytes that follow
+				uint8	Suffix[Len]
+				varint	Count
+	Index:	uint32 offset into Data for the start of each block of WORDSTORE_BLOCK words
+
+	The log is WORDSTORE_LOG_MAGIC followed by records of:
+				varint	Len			0 for the item count, otherwise the word length
+				uint8	Word[Len]
+				varint	Count		zigzag encoded, the new absolute value
+*/
+struct GWordStoreHeader
+{
+	char Magic[8];
+	uint32 Version;
+	uint32 Items;
+	uint32 Words;
+	uint32 Blocks;
+	uint64 DataOffset;
+	uint64 DataSize;
+	uint64 IndexOffset;
+};
+
+static void WsPutVarint(GArray<uint8> &o, uint64 v)
+{
+	while (v >= 0x80)
 	{
-		Serialize(d->File, true);
+		o.Add((uint8)(v | 0x80));
+		v >>= 7;
 	}
+	o.Add((uint8)v);
 }
 
-GWordStore::~GWordStore()
+static bool WsGetVarint(const uint8 *&p, const uint8 *End, uint64 &v)
 {
-	if (d->Dirty)
-	{
-		Serialize(d->File, false);
-	}
-	DeleteObj(d);
+	v = 0;
+	for (int Shift = 0; p < End && Shift < 64; Shift += 7)
+	{
+		uint8 b = *p++;
+		v |= (uint64)(b & 0x7f) << Shift;
+		if (!(b & 0x80))
+			return true;
+	}
+	return false;
 }
 
-char *GWordStore::GetFile()
-{
-	return d->File;
-}
-
-bool GWordStore::Serialize(const char *FileName, bool Load)
+/// Lower cases 'Word' into 'Key'.
+/// \returns the length or -1 if the word is too long.
+static ssize_t WsMakeKey(char *Key, const char *Word)
+{
+	ssize_t i;
+	for (i=0; Word[i]; i++)
+	{
+		if (i >= WORDSTORE_MAX_WORD - 1)
+			return -1;
+		char c = Word[i];
+		Key[i] = c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+	}
+	Key[i] = 0;
+	return i;
+}
+
+/// Decodes the words in the data section one at a time.
+struct GWordStoreCursor
+{
+	const uint8 *p, *End;
+	char Key[WORDSTORE_MAX_WORD];
+	size_t KeyLen;
+	int64 Count;
+
+	GWordStoreCursor()
+	{
+		Start(NULL, NULL);
+	}
+
+	void Start(const uint8 *s, const uint8 *e)
+	{
+		p = s;
+		End = e;
+		Key[KeyLen = 0] = 0;
+		Count = 0;
+	}
+
+	bool Next()
+	{
+		uint64 Shared, Len, Cnt;
+		if (p >= End ||
+			!WsGetVarint(p, End, Shared) ||
+			!WsGetVarint(p, End, Len) ||
+			Shared > KeyLen ||
+			Shared + Len >= WORDSTORE_MAX_WORD ||
+			Len > (uint64)(End - p))
+			return false;
+
+		memcpy(Key + Shared, p, (size_t)Len);
+		p += Len;
+		KeyLen = (size_t)(Shared + Len);
+		Key[KeyLen] = 0;
+
+		if (!WsGetVarint(p, End, Cnt))
+			return false;
+		Count = (int64)Cnt;
+		return true;
+	}
+};
+
+/// The sorted file, mapped read-only.
+class GWordStoreMap
+{
+	void *Map;
+	size_t MapLen;
+	GArray<uint8> Buf;
+	GArray<char> FirstKeys;		// The first word of each block, separated by NULLs
+	GArray<uint32> FirstOff;	// Offset of each block's first word in 'FirstKeys'
+
+public:
+	GWordStoreHeader Hdr;
+	const uint8 *Data;
+	size_t DataLen;
+	const uint32 *Index;
+
+	GWordStoreMap()
+	{
+		Map = NULL;
+		MapLen = 0;
+		Close();
+	}
+
+	~GWordStoreMap()
+	{
+		Close();
+	}
+
+	void Close()
+	{
+		#ifdef POSIX
+		if (Map)
+			munmap(Map, MapLen);
+		#endif
+		Map = NULL;
+		MapLen = 0;
+		Buf.Length(0);
+		FirstKeys.Length(0);
+		FirstOff.Length(0);
+		ZeroObj(Hdr);
+		Data = NULL;
+		DataLen = 0;
+		Index = NULL;
+	}
+
+	/// \returns true if 'File' is a valid sorted store.
+	bool Open(const char *File)
+	{
+		Close();
+
+		const uint8 *s = NULL;
+		size_t Len = 0;
+
+		#ifdef POSIX
+		int Fd = open(File, O_RDONLY);
+		if (Fd < 0)
+			return false;
+
+		struct stat st;
+		if (fstat(Fd, &st) == 0 && st.st_size >= (off_t)sizeof(Hdr))
+		{
+			void *m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, Fd, 0);
+			if (m != MAP_FAILED)
+			{
+				Map = m;
+				MapLen = (size_t)st.st_size;
+				s = (const uint8*)Map;
+				Len = MapLen;
+			}
+		}
+		close(Fd);
+		#endif
+
+		if (!s)
+		{
+			// Fall back to reading the whole file
+			GFile f;
+			if (!f.Open(File, O_READ))
+				return false;
+			int64 Sz = f.GetSize();
+			if (Sz < (int64)sizeof(Hdr) ||
+				!Buf.Length((size_t)Sz) ||
+				f.Read(&Buf[0], (int)Sz) != Sz)
+			{
+				Buf.Length(0);
+				return false;
+			}
+			s = &Buf[0];
+			Len = (size_t)Sz;
+		}
+
+		memcpy(&Hdr, s, sizeof(Hdr));
+		if (memcmp(Hdr.Magic, WORDSTORE_MAGIC, sizeof(Hdr.Magic)) ||
+			Hdr.Version != WORDSTORE_VERSION ||
+			Hdr.DataOffset + Hdr.DataSize > Len ||
+			Hdr.IndexOffset % sizeof(uint32) != 0 ||
+			Hdr.IndexOffset + (uint64)Hdr.Blocks * sizeof(uint32) > Len)
+		{
+			Close();
+			return false;
+		}
+
+		Data = s + Hdr.DataOffset;
+		DataLen = (size_t)Hdr.DataSize;
+		Index = (const uint32*)(s + Hdr.IndexOffset);
+
+		// Decode the first word of each block up front, so searching the
+		// blocks doesn't have to.
+		GWordStoreCursor c;
+		FirstOff.Length(Hdr.Blocks);
+		for (uint32 b=0; b<Hdr.Blocks; b++)
+		{
+			if (!StartBlock(c, b))
+			{
+				Close();
+				return false;
+			}
+			FirstOff[b] = (uint32)FirstKeys.Length();
+			FirstKeys.Add(c.Key, c.KeyLen + 1);
+		}
+
+		return true;
+	}
+
+	/// Positions 'c' at the first word of block 'b'.
+	bool StartBlock(GWordStoreCursor &c, ssize_t b)
+	{
+		if (Index[b] >= DataLen)
+			return false;
+		c.Start(Data + Index[b], Data + DataLen);
+		return c.Next();
+	}
+
+	const char *FirstKey(ssize_t b)
+	{
+		return &FirstKeys[FirstOff[b]];
+	}
+
+	/// The last block at or after 'Lo' that starts at or before 'Key'.
+	ssize_t FindBlock(const char *Key, ssize_t Lo)
+	{
+		ssize_t Hi = Hdr.Blocks - 1;
+		while (Lo < Hi)
+		{
+			ssize_t Mid = (Lo + Hi + 1) >> 1;
+			if (strcmp(FirstKey(Mid), Key) <= 0)
+				Lo = Mid;
+			else
+				Hi = Mid - 1;
+		}
+		return Lo;
+	}
+
+	bool Find(const char *Key, int64 &Count)
+	{
+		if (!Hdr.Blocks)
+			return false;
+
+		GWordStoreCursor c;
+		c.Start(Data + Index[FindBlock(Key, 0)], Data + DataLen);
+		for (int i=0; i<WORDSTORE_BLOCK && c.Next(); i++)
+		{
+			int r = strcmp(c.Key, Key);
+			if (r == 0)
+			{
+				Count = c.Count;
+				return true;
+			}
+			if (r > 0)
+				break;
+		}
+
+		return false;
+	}
+
+	/// Looks up 'Keys', which must be sorted, in one forward pass. Blocks are
+	/// only searched for when a key is past the start of the next block, so
+	/// keys that are close together are found by decoding on from the last.
+	void FindSorted(const char **Keys, size_t Len, int64 *Counts)
+	{
+		GWordStoreCursor c;
+		ssize_t Block = -1;
+		bool Valid = false;
+
+		for (size_t i=0; i<Len; i++)
+		{
+			const char *Key = Keys[i];
+			Counts[i] = 0;
+			if (!Hdr.Blocks)
+				continue;
+
+			if (Block < 0 ||
+				(Block + 1 < (ssize_t)Hdr.Blocks && strcmp(FirstKey(Block + 1), Key) <= 0))
+			{
+				Block = FindBlock(Key, MAX(Block, 0));
+				Valid = StartBlock(c, Block);
+			}
+
+			int r = -1;
+			while (Valid && (r = strcmp(c.Key, Key)) < 0)
+				Valid = c.Next();
+			if (Valid && r == 0)
+				Counts[i] = c.Count;
+		}
+	}
+};
+
+/// A copy of one overlay entry taken for a compaction.
+struct GWordStoreSnap
+{
+	const char *Key;
+	int64 Count;
+};
+
+static int WsSnapCmp(GWordStoreSnap *a, GWordStoreSnap *b)
+{
+	return strcmp(a->Key, b->Key);
+}
+
+/// Writes the union of 'Base' and 'Snap' to 'Out' as a sorted store.
+/// Words in 'Snap' replace those in 'Base', and zero counts are dropped.
+static bool WsWriteSorted(const char *Out, GWordStoreMap &Base, GArray<GWordStoreSnap> &Snap, int Items)
 {
-	static const char *ObjName = "GWordStore";
-	bool Status = false;
 	GFile f;
-	
-	const char *Name = FileName ? FileName : d->File;
-	if (Load)
+	if (!f.Open(Out, O_WRITE))
+		return false;
+	f.SetSize(0);
+
+	GWordStoreHeader Hdr;
+	ZeroObj(Hdr);
+	memcpy(Hdr.Magic, WORDSTORE_MAGIC, sizeof(Hdr.Magic));
+	Hdr.Version = WORDSTORE_VERSION;
+	Hdr.Items = Items;
+	Hdr.DataOffset = sizeof(Hdr);
+	if (f.Write(&Hdr, sizeof(Hdr)) != sizeof(Hdr))
+		return false;
+
+	GArray<uint32> Index;
+	GArray<uint8> Buf;
+	char Prev[WORDSTORE_MAX_WORD];
+	size_t PrevLen = 0;
+	size_t s = 0;
+
+	GWordStoreCursor c;
+	c.Start(Base.Data, Base.Data + Base.DataLen);
+	bool HasBase = c.Next();
+
+	while (HasBase || s < Snap.Length())
+	{
+		int Cmp = !HasBase ? 1 : s >= Snap.Length() ? -1 : strcmp(c.Key, Snap[s].Key);
+		const char *Key = Cmp < 0 ? c.Key : Snap[s].Key;
+		int64 Count = Cmp < 0 ? c.Count : Snap[s].Count;
+
+		if (Count > 0)
+		{
+			size_t Len = strlen(Key);
+			size_t Shared = 0;
+			if (Hdr.Words % WORDSTORE_BLOCK == 0)
+			{
+				uint64 Off = Hdr.DataSize + Buf.Length();
+				if (Off > 0xffffffff)
+					return false;
+				Index.Add((uint32)Off);
+			}
+			else
+			{
+				while (Shared < Len && Shared < PrevLen && Prev[Shared] == Key[Shared])
+					Shared++;
+			}
+
+			WsPutVarint(Buf, Shared);
+			WsPutVarint(Buf, Len - Shared);
+			if (Len > Shared)
+				Buf.Add((uint8*)Key + Shared, Len - Shared);
+			WsPutVarint(Buf, (uint64)Count);
+
+			memcpy(Prev, Key, Len + 1);
+			PrevLen = Len;
+			Hdr.Words++;
+
+			if (Buf.Length() >= WORDSTORE_WRITE_BUF)
+			{
+				if (f.Write(&Buf[0], (int)Buf.Length()) != Buf.Length())
+					return false;
+				Hdr.DataSize += Buf.Length();
+				Buf.Length(0);
+			}
+		}
+
+		if (Cmp <= 0)
+			HasBase = c.Next();
+		if (Cmp >= 0)
+			s++;
+	}
+
+	// Pad after the data so the index is aligned
+	Hdr.DataSize += Buf.Length();
+	Hdr.IndexOffset = Hdr.DataOffset + Hdr.DataSize;
+	while (Hdr.IndexOffset % sizeof(uint32))
 	{
-		if (f.Open(Name, O_READ))
-		{
-			if (!d->File)
-			{
-				d->File = NewStr(Name);
-			}
-
-			bool GotVer = false;
-			double FileFormat = 0.0;
-			int64 Start = LgiCurrentTime();
-			
-			GStringPipe p;
-			char Buf[4<<10];
-			int Words = 0;
-			while (!f.Eof())
-			{
-				int r = f.Read(Buf, sizeof(Buf));
-				if (r > 0)
+		Buf.Add(0);
+		Hdr.IndexOffset++;
+	}
+	if (Buf.Length() && f.Write(&Buf[0], (int)Buf.Length()) != Buf.Length())
+		return false;
+
+	Hdr.Blocks = (uint32)Index.Length();
+	if (Index.Length())
+	{
+		int Bytes = (int)(Index.Length() * sizeof(uint32));
+		if (f.Write(&Index[0], Bytes) != Bytes)
+			return false;
+	}
+
+	f.SetPos(0);
+	return f.Write(&Hdr, sizeof(Hdr)) == sizeof(Hdr);
+}
+
+class GWordStorePriv : public LMutex
+{
+public:
+	GString File;
+	GWordStoreMap Base;
+	LHashTbl<ConstStrKeyPool<char>, int64> Overlay;	// Changes not yet in 'Base', -1 = not present
+	int Items;
+	size_t Words;
+	bool Unlogged;		// Overlay has changes that aren't in the log
+	bool Compacting;
+	GArray<uint8> LogBuf;
+	GFile Log;
+	LThreadTaskGroup Tasks;
+
+	// Iteration merges 'Base' with a sorted copy of the overlay
+	GWordStoreCursor Iter;
+	bool IterValid;
+	GArray<GWordStoreSnap> IterSnap;
+	char *IterKeys;
+	size_t IterPos;
+	char IterWord[WORDSTORE_MAX_WORD];
+
+	GWordStorePriv() : LMutex("GWordStorePriv"), Overlay(0, -1)
+	{
+		Overlay.SetMaxSize(0x7fffffff);
+		Items = 0;
+		Words = 0;
+		Unlogged = false;
+		Compacting = false;
+		IterValid = false;
+		IterKeys = NULL;
+		IterPos = 0;
+	}
+
+	~GWordStorePriv()
+	{
+		Tasks.Wait();
+		FlushLog();
+		EndIter();
+	}
+
+	GString Sibling(const char *Ext)
+	{
+		GString s = File;
+		return s + Ext;
+	}
+
+	int64 Lookup(const char *Key)
+	{
+		int64 c = Overlay.Find(Key);
+		if (c >= 0)
+			return c;
+		return Base.Find(Key, c) ? c : 0;
+	}
+
+	void Set(const char *Key, size_t KeyLen, int64 Count, bool Log)
+	{
+		if (Count < 0)
+			Count = 0;
+
+		int64 Prev = Lookup(Key);
+		if (Prev == 0 && Count > 0)
+			Words++;
+		else if (Prev > 0 && Count == 0)
+			Words--;
+
+		Overlay.Add(Key, Count);
+		if (Log)
+			AppendLog(Key, KeyLen, Count);
+	}
+
+	bool NeedCompact()
+	{
+		return	!Compacting &&
+				File &&
+				Overlay.Length() > MAX(WORDSTORE_MIN_COMPACT, Base.Hdr.Words / 8);
+	}
+
+	void AppendLog(const char *Key, size_t KeyLen, int64 Count)
+	{
+		if (!File)
+		{
+			Unlogged = true;
+			return;
+		}
+
+		WsPutVarint(LogBuf, KeyLen);
+		if (KeyLen)
+			LogBuf.Add((uint8*)Key, KeyLen);
+		WsPutVarint(LogBuf, ((uint64)Count << 1) ^ (uint64)(Count >> 63));
+		if (LogBuf.Length() >= WORDSTORE_LOG_BUF)
+			FlushLog();
+	}
+
+	bool FlushLog()
+	{
+		if (!LogBuf.Length())
+			return true;
+		if (!File)
+			return false;
+
+		if (!Log.IsOpen())
+		{
+			if (!Log.Open(Sibling(".log"), O_WRITE))
+				return false;
+			if (Log.GetSize() < (int64)strlen(WORDSTORE_LOG_MAGIC))
+			{
+				Log.SetSize(0);
+				Log.Write(WORDSTORE_LOG_MAGIC, (int)strlen(WORDSTORE_LOG_MAGIC));
+			}
+			Log.SetPos(Log.GetSize());
+		}
+
+		bool Status = Log.Write(&LogBuf[0], (int)LogBuf.Length()) == LogBuf.Length();
+		LogBuf.Length(0);
+		return Status;
+	}
+
+	/// Applies a log file to the overlay.
+	/// \returns true if the file existed.
+	bool ReplayLog(const char *Name)
+	{
+		GFile f;
+		if (!FileExists(Name) || !f.Open(Name, O_READ))
+			return false;
+
+		GArray<uint8> b;
+		int64 Sz = f.GetSize();
+		size_t MagicLen = strlen(WORDSTORE_LOG_MAGIC);
+		if (Sz < (int64)MagicLen ||
+			!b.Length((size_t)Sz) ||
+			f.Read(&b[0], (int)Sz) != Sz ||
+			memcmp(&b[0], WORDSTORE_LOG_MAGIC, MagicLen))
+			return true;
+
+		const uint8 *p = &b[0] + MagicLen, *End = &b[0] + b.Length();
+		char Key[WORDSTORE_MAX_WORD];
+		while (p < End)
+		{
+			uint64 Len, v;
+			if (!WsGetVarint(p, End, Len) ||
+				Len >= WORDSTORE_MAX_WORD ||
+				Len > (uint64)(End - p))
+				break;
+			memcpy(Key, p, (size_t)Len);
+			Key[Len] = 0;
+			p += Len;
+			if (!WsGetVarint(p, End, v))
+				break; // Partly written record at the end
+
+			int64 Count = (int64)(v >> 1) ^ -(int64)(v & 1);
+			if (Len)
+				Set(Key, (size_t)Len, Count, false);
+			else
+				Items = (int)Count;
+		}
+
+		return true;
+	}
+
+	/// Moves the current log aside so a compaction can fold it into the sorted file.
+	void RotateLog()
+	{
+		FlushLog();
+		Log.Close();
+
+		GString Cur = Sibling(".log"), Old = Sibling(".log.old");
+		if (!FileExists(Cur))
+			return;
+
+		if (FileExists(Old))
+		{
+			// A previous compaction didn't finish, keep both logs' changes.
+			GFile In, Out;
+			if (In.Open(Cur, O_READ) && Out.Open(Old, O_WRITE))
+			{
+				size_t MagicLen = strlen(WORDSTORE_LOG_MAGIC);
+				GArray<uint8> b;
+				int64 Sz = In.GetSize();
+				if (Sz > (int64)MagicLen &&
+					b.Length((size_t)Sz) &&
+					In.Read(&b[0], (int)Sz) == Sz)
 				{
-					p.Push(Buf, r);
-
-					while (p.Pop(Buf, sizeof(Buf)))
-					{
-						if (GotVer)
-						{
-							char *Comma = strchr(Buf, ',');
-							if (Comma)
-							{
-								*Comma++ = 0;
-								d->Table.Add(Buf, atoi(Comma));
-							}
-							else
-							{
-								LgiAssert(0);
-							}
-						}
-						else
-						{
-							char *Obj;
-							if (Obj = stristr(Buf, (char*)ObjName))
-							{
-								char *v = strchr(Buf + 10, 'v');
-								if (v)
-								{
-									FileFormat = atof(v + 1);
-									GotVer = true;
-								}
-								
-								char *i = stristr(Buf, "Items=");
-								if (i)
-								{
-									d->Items = atoi(i+6);
-								}
-
-								i = stristr(Buf, "Words=");
-								if (i)
-								{
-									Words = atoi(i+6);
-									d->Table.SetSize(Words * 5 / 2);
-								}
-							}
-						}
-					}
+					Out.SetPos(Out.GetSize());
+					Out.Write(&b[MagicLen], (int)(Sz - MagicLen));
 				}
-				else break;
-			}
-
-			#if DBG_MSGS
-			LgiTrace("Load '%s' time: %ims\n", Name, LgiCurrentTime() - Start);
-			#endif
-			
-			Status = GotVer;
+			}
+			In.Close();
+			FileDev->Delete(Cur, false);
 		}
-	}	
-	else
+		else FileDev->Move(Cur, Old);
+	}
+
+	/// Converts an old "GWordStore v1" text file to the sorted format in place.
+	bool ImportText()
 	{
-		if (f.Open(Name, O_WRITE))
-		{
-			f.SetSize(0);
-			
-			f.Print("%s v1.00 Items=%i, Words=%i\n", ObjName, d->Items, d->Table.Length());
-			
-			int i = 0;
-			const char *Word;
-			for (int Count = d->Table.First(&Word); Count; Count = d->Table.Next(&Word))
-			{
-				i++;
-				f.Print("%s,%i\n", Word, (int)Count);
-			}
-
-			#if DBG_MSGS
-			LgiTrace("Write to '%s': %i words in %i lines\n", Name, Table.Length(), i);
-			#endif
-			
-			Status = true;
+		GFile f;
+		if (!f.Open(File, O_READ))
+			return false;
+
+		GArray<char> b;
+		int64 Sz = f.GetSize();
+		if (Sz <= 0 ||
+			!b.Length((size_t)Sz + 1) ||
+			f.Read(&b[0], (int)Sz) != Sz)
+			return false;
+		b[(size_t)Sz] = 0;
+		f.Close();
+
+		char *s = &b[0];
+		char *Eol = strchr(s, '\n');
+		if (!Eol || !stristr(s, "GWordStore"))
+			return false;
+		*Eol = 0;
+		char *i = stristr(s, "Items=");
+		if (i)
+			Items = atoi(i + 6);
+
+		// The keys are lower cased in place and sorted, no hashing needed.
+		GArray<GWordStoreSnap> Snap;
+		for (s = Eol + 1; *s; s = Eol + 1)
+		{
+			Eol = strchr(s, '\n');
+			if (Eol)
+				*Eol = 0;
+			char *Comma = strrchr(s, ',');
+			if (Comma)
+			{
+				*Comma++ = 0;
+				if (WsMakeKey(s, s) > 0)
+				{
+					GWordStoreSnap &e = Snap.New();
+					e.Key = s;
+					e.Count = atoi(Comma);
+				}
+			}
+			if (!Eol)
+				break;
+		}
+
+		Snap.Sort(WsSnapCmp);
+		size_t Out = 0;
+		for (size_t n=0; n<Snap.Length(); n++)
+		{
+			if (Out > 0 && !strcmp(Snap[Out-1].Key, Snap[n].Key))
+				Out--;
+			Snap[Out++] = Snap[n];
+		}
+		Snap.Length(Out);
+
+		// Write the new store beside the text one, then swap them. The text
+		// store is kept as a backup.
+		GString Tmp = Sibling(".tmp"), Backup = Sibling(".v1");
+		if (WsWriteSorted(Tmp, Base, Snap, Items))
+		{
+			FileDev->Delete(Backup, false);
+			if (FileDev->Move(File, Backup))
+			{
+				if (FileDev->Move(Tmp, File) && Base.Open(File))
+				{
+					Words = Base.Hdr.Words;
+					return true;
+				}
+
+				Base.Close();
+				FileDev->Delete(File, false);
+				FileDev->Move(Backup, File);
+			}
+		}
+
+		LgiTrace("%s:%i - Failed to convert '%s'.\n", _FL, File.Get());
+		FileDev->Delete(Tmp, false);
+		return false;
+	}
+
+	/// Moves the new sorted file 'Tmp' over the store and maps it. If that
+	/// fails the current file stays in use.
+	bool ReplaceBase(const char *Tmp)
+	{
+		Base.Close();
+
+		#ifdef POSIX
+		bool Moved = FileDev->Move(Tmp, File);
+		#else
+		// Can't move over an existing file, so move it aside first.
+		GString Old = Sibling(".old");
+		FileDev->Delete(Old, false);
+		bool Moved = FileDev->Move(File, Old);
+		if (Moved)
+		{
+			if ((Moved = FileDev->Move(Tmp, File)))
+				FileDev->Delete(Old, false);
+			else
+				FileDev->Move(Old, File);
 		}
+		#endif
+
+		if (Moved && Base.Open(File))
+			return true;
+
+		Base.Open(File);
+		return false;
+	}
+
+	void Close()
+	{
+		Tasks.Wait();
+		LMutex::Auto Lck(this, _FL);
+		FlushLog();
+		Log.Close();
+		Base.Close();
+		Overlay.Empty();
+		EndIter();
+		Items = 0;
+		Words = 0;
+		Unlogged = false;
+	}
+
+	void EndIter()
+	{
+		Iter.Start(NULL, NULL);
+		IterValid = false;
+		IterSnap.Length(0);
+		DeleteArray(IterKeys);
+		IterPos = 0;
+	}
+
+	const char *IterNext();
+	bool Compact(bool Background);
+	char *CopyOverlay(GArray<GWordStoreSnap> &Snap);
+	char *Snapshot(GArray<GWordStoreSnap> &Snap);
+	bool FinishCompact(GArray<GWordStoreSnap> &Snap, char *Keys);
+};
+
+class GWordStoreCompactTask : public LThreadTask
+{
+	GWordStorePriv *d;
+	GArray<GWordStoreSnap> Snap;
+	char *Keys;
+
+public:
+	GWordStoreCompactTask(GWordStorePriv *priv, GArray<GWordStoreSnap> &snap, char *keys)
+	{
+		d = priv;
+		Snap = snap;
+		Keys = keys;
 	}
-	
+
+	void Do()
+	{
+		d->FinishCompact(Snap, Keys);
+	}
+};
+
+bool GWordStorePriv::Compact(bool Background)
+{
+	if (!Background)
+		Tasks.Wait();
+
+	GArray<GWordStoreSnap> Snap;
+	char *Keys;
+	{
+		LMutex::Auto Lck(this, _FL);
+		if (!File || Compacting)
+			return false;
+
+		Keys = Snapshot(Snap);
+		Compacting = true;
+		if (Background)
+		{
+			Tasks.Add(new GWordStoreCompactTask(this, Snap, Keys));
+			return true;
+		}
+	}
+
+	return FinishCompact(Snap, Keys);
+}
+
+/// Copies the overlay into 'Snap' sorted, the keys are packed into the returned block.
+char *GWordStorePriv::CopyOverlay(GArray<GWordStoreSnap> &Snap)
+{
+	size_t KeyBytes = 0;
+	for (auto p : Overlay)
+		KeyBytes += strlen(p.key) + 1;
+
+	Snap.Length(Overlay.Length());
+	char *Keys = new char[KeyBytes + 1], *k = Keys;
+	size_t n = 0;
+	for (auto p : Overlay)
+	{
+		size_t Len = strlen(p.key) + 1;
+		memcpy(k, p.key, Len);
+		Snap[n].Key = k;
+		Snap[n++].Count = p.value;
+		k += Len;
+	}
+	Snap.Sort(WsSnapCmp);
+	return Keys;
+}
+
+char *GWordStorePriv::Snapshot(GArray<GWordStoreSnap> &Snap)
+{
+	// The log is folded into the new file, newer changes go to a fresh log.
+	RotateLog();
+	return CopyOverlay(Snap);
+}
+
+/// The next word of the merged view, words in the overlay replace those in
+/// 'Base' and zero counts are skipped.
+const char *GWordStorePriv::IterNext()
+{
+	while (IterValid || IterPos < IterSnap.Length())
+	{
+		int Cmp = !IterValid ? 1 : IterPos >= IterSnap.Length() ? -1 : strcmp(Iter.Key, IterSnap[IterPos].Key);
+		const char *Key = Cmp < 0 ? Iter.Key : IterSnap[IterPos].Key;
+		int64 Count = Cmp < 0 ? Iter.Count : IterSnap[IterPos].Count;
+		if (Count > 0)
+			strcpy_s(IterWord, sizeof(IterWord), Key);
+
+		if (Cmp <= 0)
+			IterValid = Iter.Next();
+		if (Cmp >= 0)
+			IterPos++;
+		if (Count > 0)
+			return IterWord;
+	}
+
+	return NULL;
+}
+
+bool GWordStorePriv::FinishCompact(GArray<GWordStoreSnap> &Snap, char *Keys)
+{
+	GString Tmp = Sibling(".tmp");
+
+	// 'Base' isn't changed while Compacting is set, so it's safe to read unlocked.
+	bool Status = WsWriteSorted(Tmp, Base, Snap, Items);
+
+	LMutex::Auto Lck(this, _FL);
 	if (Status)
 	{
-		d->Dirty = false;
+		if ((Status = ReplaceBase(Tmp)))
+		{
+			// Anything changed since the snapshot stays in the overlay.
+			for (unsigned i=0; i<Snap.Length(); i++)
+			{
+				if (Overlay.Find(Snap[i].Key) == Snap[i].Count)
+					Overlay.Delete(Snap[i].Key);
+			}
+			FileDev->Delete(Sibling(".log.old"), false);
+			Unlogged = false;
+		}
+		else LgiTrace("%s:%i - Failed to replace '%s'.\n", _FL, File.Get());
+	}
+	else
+	{
+		FileDev->Delete(Tmp, false);
+		LgiTrace("%s:%i - Failed to write '%s'.\n", _FL, Tmp.Get());
 	}
-	
+
+	Compacting = false;
+	delete [] Keys;
 	return Status;
 }
 
-int GWordStore::GetItems()
+//////////////////////////////////////////////////////////////////////////////
+GWordStore::GWordStore(const char *file)
+{
+	d = new GWordStorePriv;
+	if (file)
+		Serialize(file, true);
+}
+
+GWordStore::~GWordStore()
+{
+	if (d->Unlogged)
+		Compact();
+	DeleteObj(d);
+}
+
+char *GWordStore::GetFile()
+{
+	return d->File.Get();
+}
+
+void GWordStore::SetFile(const char *file)
+{
+	d->Tasks.Wait();
+	LMutex::Auto Lck(d, _FL);
+	if (!d->File.Equals(file, false))
+	{
+		d->FlushLog();
+		d->Log.Close();
+		d->File = file;
+		if (d->Overlay.Length() || d->Base.Hdr.Words)
+			d->Unlogged = true;
+	}
+}
+
+bool GWordStore::Serialize(const char *FileName, bool Load)
+{
+	const char *Name = FileName ? FileName : d->File.Get();
+	if (!Name)
+		return false;
+
+	if (Load)
+	{
+		GString NewFile = Name;
+		d->Close();
+
+		bool Status = false;
+		{
+			LMutex::Auto Lck(d, _FL);
+			d->File = NewFile;
+
+			// Recover from a compaction that was cut off while replacing the file
+			GString Tmp = d->Sibling(".tmp");
+			if (!FileExists(d->File) && FileExists(Tmp))
+				FileDev->Move(Tmp, d->File);
+
+			#ifdef DBG_MSGS
+			uint64 Start = LgiCurrentTime();
+			#endif
+			if (d->Base.Open(d->File))
+			{
+				d->Items = d->Base.Hdr.Items;
+				d->Words = d->Base.Hdr.Words;
+				Status = true;
+			}
+			else if (FileExists(d->File))
+			{
+				Status = d->ImportText();
+			}
+
+			if (d->ReplayLog(d->Sibling(".log.old")))
+				Status = true;
+			if (d->ReplayLog(d->Sibling(".log")))
+				Status = true;
+
+			#ifdef DBG_MSGS
+			LgiTrace("Load '%s' time: %ims\n", Name, (int)(LgiCurrentTime() - Start));
+			#endif
+		}
+
+		return Status;
+	}
+
+	if (d->File.Equals(Name, false))
+	{
+		if (d->Unlogged)
+			return Compact();
+
+		LMutex::Auto Lck(d, _FL);
+		return d->FlushLog();
+	}
+
+	// Write a complete copy somewhere else
+	d->Tasks.Wait();
+	LMutex::Auto Lck(d, _FL);
+	GArray<GWordStoreSnap> Snap;
+	for (auto p : d->Overlay)
+	{
+		GWordStoreSnap &s = Snap.New();
+		s.Key = p.key;
+		s.Count = p.value;
+	}
+	Snap.Sort(WsSnapCmp);
+	return WsWriteSorted(Name, d->Base, Snap, d->Items);
+}
+
+bool GWordStore::Compact(bool Background)
+{
+	return d->Compact(Background);
+}
+
+long GWordStore::GetItems()
 {
 	return d->Items;
 }
 
 bool GWordStore::SetItems(int i)
 {
+	LMutex::Auto Lck(d, _FL);
 	if (i != d->Items)
 	{
 		d->Items = i;
-		d->Dirty = true;
+		d->AppendLog(NULL, 0, i);
 	}
 	return true;
 }
 
 bool GWordStore::Insert(const char *Word)
 {
-	bool Status = false;
-	
-	if (Word)
+	char Key[WORDSTORE_MAX_WORD];
+	ssize_t Len;
+	if (!Word || (Len = WsMakeKey(Key, Word)) <= 0)
+		return false;
+
+	bool Compact;
 	{
-		int c = d->Table.Find(Word);
-		Status = d->Table.Add(Word, c + 1);
-		d->Dirty = true;
+		LMutex::Auto Lck(d, _FL);
+		d->Set(Key, Len, d->Lookup(Key) + 1, true);
+		Compact = d->NeedCompact();
 	}
-	
-	return Status;
+	if (Compact)
+		d->Compact(true);
+	return true;
+}
+
+long GWordStore::GetWordCount(const char *Word)
+{
+	char Key[WORDSTORE_MAX_WORD];
+	if (!Word || WsMakeKey(Key, Word) <= 0)
+		return 0;
+
+	LMutex::Auto Lck(d, _FL);
+	return (long)d->Lookup(Key);
+}
+
+int GWordStore::SetWordCount(const char *Word, ssize_t Count)
+{
+	char Key[WORDSTORE_MAX_WORD];
+	ssize_t Len;
+	if (!Word || (Len = WsMakeKey(Key, Word)) <= 0)
+		return false;
 
+	bool Compact;
+	{
+		LMutex::Auto Lck(d, _FL);
+		d->Set(Key, Len, Count, true);
+		Compact = d->NeedCompact();
+	}
+	if (Compact)
+		d->Compact(true);
+	return true;
 }
 
-uint32 GWordStore::GetWordCount(const char *Word)
+bool GWordStore::GetWordCounts(GWordTokens &t, GArray<int64> &Counts)
 {
-	return Word ? d->Table.Find(Word) : 0;
+	if (!Counts.Length(t.Length()))
+		return false;
+	if (!t.Length())
+		return true;
+
+	LMutex::Auto Lck(d, _FL);
+	d->Base.FindSorted(&t.Words[0], t.Words.Length(), &Counts[0]);
+	if (d->Overlay.Length())
+	{
+		for (size_t i=0; i<t.Words.Length(); i++)
+		{
+			int64 c = d->Overlay.Find(t.Words[i]);
+			if (c >= 0)
+				Counts[i] = c;
+		}
+	}
+
+	return true;
 }
 
 void GWordStore::Empty()
 {
-	d->Table.Empty();
-	d->Dirty = true;
-}
-
-const char *GWordStore::First()
-{
-	const char *key;
-	return d->Table.First(&key) ? key : 0;
-}
-
-const char *GWordStore::Next()
-{
-	const char *key;
-	return d->Table.Next(&key) ? key : 0;
-}
-
-int GWordStore::Length()
-{
-	return d->Table.Length();
-}
-
-#ifdef _DEBUG
-int64 GWordStore::Sizeof()
-{
-	return sizeof(*this) + d->Table.Sizeof();
-}
-#endif
\ No newline at end of file
+	GString File = d->File;
+	int Items = d->Items;
+	d->Close();
+
+	LMutex::Auto Lck(d, _FL);
+	d->File = File;
+	d->Items = Items;
+	if (d->File)
+	{
+		FileDev->Delete(d->Sibling(".log"), false);
+		FileDev->Delete(d->Sibling(".log.old"), false);
+		GArray<GWordStoreSnap> None;
+		WsWriteSorted(d->File, d->Base, None, Items);
+		d->Base.Open(d->File);
+	}
+}
+
+const char *GWordStore::First()
+{
+	if (d->Overlay.Length())
+		Compact();
+
+	// Anything compacting couldn't write is merged in as we go
+	d->Tasks.Wait();
+	LMutex::Auto Lck(d, _FL);
+	d->EndIter();
+	d->IterKeys = d->CopyOverlay(d->IterSnap);
+	d->Iter.Start(d->Base.Data, d->Base.Data + d->Base.DataLen);
+	d->IterValid = d->Iter.Next();
+	return d->IterNext();
+}
+
+const char *GWordStore::Next()
+{
+	LMutex::Auto Lck(d, _FL);
+	return d->IterNext();
+}
+
+unsigned long GWordStore::Length()
+{
+	return (unsigned long)d->Words;
+}
+
+double GWordStore::Classify(GWordStore *Spam, GWordStore *Ham, const char *Body, ssize_t Len, GWordTokens *Buf)
+{
+	GWordTokens Local;
+	GWordTokens &t = Buf ? *Buf : Local;
+	GArray<int64> SpamCounts, HamCounts;
+	if (!Spam ||
+		!Ham ||
+		!t.Tokenise(Body, Len) ||
+		!Spam->GetWordCounts(t, SpamCounts) ||
+		!Ham->GetWordCounts(t, HamCounts))
+		return 0.5;
+
+	double NSpam = MAX(Spam->GetItems(), 1);
+	double NHam = MAX(Ham->GetItems(), 1);
+
+	// Keep the words furthest from neutral, most interesting first
+	double Prob[WORDSTORE_INTERESTING];
+	int Used = 0;
+	for (size_t i=0; i<t.Length(); i++)
+	{
+		double Bad = (double)SpamCounts[i];
+		double Good = 2.0 * HamCounts[i]; // Bias against false positives
+		double p = WORDSTORE_UNKNOWN_PROB;
+		if (Bad + Good >= WORDSTORE_MIN_SEEN)
+		{
+			double b = MIN(1.0, Bad / NSpam);
+			double g = MIN(1.0, Good / NHam);
+			p = MAX(0.01, MIN(0.99, b / (b + g)));
+		}
+
+		double Dist = fabs(p - 0.5);
+		int n = Used;
+		if (n == WORDSTORE_INTERESTING)
+		{
+			if (fabs(Prob[n-1] - 0.5) >= Dist)
+				continue;
+			n--;
+		}
+		else Used++;
+		for (; n > 0 && fabs(Prob[n-1] - 0.5) < Dist; n--)
+			Prob[n] = Prob[n-1];
+		Prob[n] = p;
+	}
+
+	double Yes = 1.0, No = 1.0;
+	for (int i=0; i<Used; i++)
+	{
+		Yes *= Prob[i];
+		No *= 1.0 - Prob[i];
+	}
+
+	return Used ? Yes / (Yes + No) : 0.5;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Bytes that can be part of a word
+static struct GWordChars
+{
+	bool Word[256];
+
+	GWordChars()
+	{
+		for (int c=0; c<256; c++)
+			Word[c] =	c >= 0x80 ||
+						(c >= 'a' && c <= 'z') ||
+						(c >= 'A' && c <= 'Z') ||
+						(c >= '0' && c <= '9') ||
+						c == '-' || c == '\'' || c == '$';
+	}
+}	WsChars;
+
+// Byte wise compares on 8 bytes at a time. WS_GE sets the high bit of each
+// byte of 'x' that is >= 'c', for bytes < 0x80 and 'c' <= 0x80.
+#define WS_ONES					0x0101010101010101ULL
+#define WS_HIGH					0x8080808080808080ULL
+#define WS_GE(x, c)				((((x) | WS_HIGH) - (c) * WS_ONES) & WS_HIGH)
+
+static int WsStrCmp(const char **a, const char **b)
+{
+	return strcmp(*a, *b);
+}
+
+#if WORDSTORE_SSE2
+static inline int WsFirstBit(unsigned m)
+{
+	#ifdef _MSC_VER
+	unsigned long i;
+	_BitScanForward(&i, m);
+	return (int)i;
+	#else
+	return __builtin_ctz(m);
+	#endif
+}
+
+static inline __m128i WsInRange(__m128i x, char Lo, char Hi)
+{
+	// Signed compares, so bytes >= 0x80 are never in an ASCII range
+	return _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8(Lo - 1)), _mm_cmplt_epi8(x, _mm_set1_epi8(Hi + 1)));
+}
+#endif
+
+size_t GWordTokens::Tokenise(const char *Str, ssize_t Len, bool Append)
+{
+	if (!Append)
+		Empty();
+	if (!Str)
+		return Words.Length();
+	if (Len < 0)
+		Len = strlen(Str);
+
+	// Each kept word adds a NULL, and the 8 byte copies need some slack.
+	size_t Used = Text.Length();
+	if (!Text.Length(Used + Len + Len / WORDSTORE_MIN_TOKEN + 16))
+		return 0;
+
+	const uint8 *s = (const uint8*)Str, *e = s + Len;
+	char *Out = &Text[Used];
+	while (s < e)
+	{
+		#if WORDSTORE_SSE2
+		// Skip the separators 16 bytes at a time
+		while (e - s >= 16)
+		{
+			__m128i x = _mm_loadu_si128((const __m128i*)s);
+			__m128i w = _mm_or_si128(
+							_mm_or_si128(WsInRange(x, 'a', 'z'), WsInRange(x, 'A', 'Z')),
+							_mm_or_si128(
+								_mm_or_si128(WsInRange(x, '0', '9'), _mm_cmplt_epi8(x, _mm_setzero_si128())),
+								_mm_or_si128(
+									_mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('-')), _mm_cmpeq_epi8(x, _mm_set1_epi8('\''))),
+									_mm_cmpeq_epi8(x, _mm_set1_epi8('$')))));
+			unsigned m = _mm_movemask_epi8(w);
+			if (m)
+			{
+				s += WsFirstBit(m);
+				break;
+			}
+			s += 16;
+		}
+		#endif
+		while (s < e && !WsChars.Word[*s])
+			s++;
+		if (s >= e)
+			break;
+
+		char *Start = Out;
+		while (true)
+		{
+			#if WORDSTORE_SSE2
+			// Copy runs of letters, digits and UTF-8 16 bytes at a time, lower
+			// casing the ASCII letters as we go. 'Text' has room for a 16 byte
+			// store as long as there's that much input left.
+			while (e - s >= 16)
+			{
+				__m128i x = _mm_loadu_si128((const __m128i*)s);
+				__m128i Upper = WsInRange(x, 'A', 'Z');
+				__m128i w = _mm_or_si128(
+								_mm_or_si128(Upper, WsInRange(x, 'a', 'z')),
+								_mm_or_si128(WsInRange(x, '0', '9'), _mm_cmplt_epi8(x, _mm_setzero_si128())));
+				x = _mm_or_si128(x, _mm_and_si128(Upper, _mm_set1_epi8(0x20)));
+				_mm_storeu_si128((__m128i*)Out, x);
+
+				unsigned m = _mm_movemask_epi8(w);
+				if (m != 0xffff)
+				{
+					int n = WsFirstBit(~m);
+					Out += n;
+					s += n;
+					break;
+				}
+				Out += 16;
+				s += 16;
+			}
+			#endif
+
+			// Copy runs of letters, digits and UTF-8 8 bytes at a time, lower
+			// casing the ASCII letters as we go.
+			while (e - s >= 8)
+			{
+				uint64 x;
+				memcpy(&x, s, 8);
+				uint64 Ascii = ~x & WS_HIGH;
+				uint64 Upper = WS_GE(x, 'A') & ~WS_GE(x, 'Z' + 1) & Ascii;
+				uint64 Lower = WS_GE(x, 'a') & ~WS_GE(x, 'z' + 1) & Ascii;
+				uint64 Digit = WS_GE(x, '0') & ~WS_GE(x, '9' + 1) & Ascii;
+				if ((Upper | Lower | Digit | (x & WS_HIGH)) != WS_HIGH)
+					break;
+				x |= Upper >> 2;
+				memcpy(Out, &x, 8);
+				Out += 8;
+				s += 8;
+			}
+
+			if (s >= e || !WsChars.Word[*s])
+				break;
+			uint8 c = *s++;
+			*Out++ = c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+		}
+
+		// Trim punctuation from the ends
+		char *From = Start;
+		while (From < Out && (*From == '-' || *From == '\''))
+			From++;
+		while (Out > From && (Out[-1] == '-' || Out[-1] == '\''))
+			Out--;
+
+		size_t WordLen = Out - From;
+		if (WordLen >= WORDSTORE_MIN_TOKEN && WordLen <= WORDSTORE_MAX_TOKEN)
+		{
+			if (From > Start)
+				memmove(Start, From, WordLen);
+			Out = Start + WordLen;
+			*Out++ = 0;
+		}
+		else Out = Start;
+	}
+	Text.Length(Out - &Text[0]);
+
+	// Sort and drop the duplicates
+	Words.Length(0);
+	for (char *w = Text.Length() ? &Text[0] : NULL, *End = w + Text.Length(); w < End; w += strlen(w) + 1)
+		Words.Add(w);
+	Words.Sort(WsStrCmp);
+	size_t n = 0;
+	for (size_t i=0; i<Words.Length(); i++)
+	{
+		if (n == 0 || strcmp(Words[n-1], Words[i]))
+			Words[n++] = Words[i];
+	}
+	Words.Length(n);
+
+	return n;
+}
+
+#ifdef _DEBUG
+int64 GWordStore::Sizeof()
+{
+	return	sizeof(*this) +
+			sizeof(*d) +
+			d->Overlay.Sizeof() +
+			d->Base.DataLen +
+			d->LogBuf.Length();
+}
+#endif
@@ -42,6 +42,7 @@ public:
 	int64			DropSelectTime;
     int8            IconTextGap;
     int				LastLayoutPx;
+	int				ColumnPx;
 	GMouse			*CurrentClick;
     
     // Visual style
@@ -52,11 +53,17 @@ public:
 	GTreeItem		*LastHit;
 	List<GTreeItem>	Selection;
 	GTreeItem		*DropTarget;
+	
+	// The visible items in display order, so finding the item for a row or
+	// a y coordinate doesn't have to walk the hierarchy. Each item knows its
+	// own index. Only valid while LayoutDirty is false.
+	GArray<GTreeItem*> Rows;
 
 	GTreePrivate()
 	{
 		CurrentClick = NULL;
 		LastLayoutPx = -1;
+		ColumnPx = 0;
 		DropSelectTime = 0;
 		InPour = false;
 		LastHit = 0;
@@ -91,6 +98,10 @@ public:
 	bool Visible;
 	bool Last;
 	int Depth;
+	int Row;				// Index into GTreePrivate::Rows, or -1 if hidden
+	bool Lazy;				// Children are made by OnPopulate
+	bool ReleaseOnCollapse;
+	bool Populated;
 	
 	GTreeItemPrivate(GTreeItem *it)
 	{
@@ -102,6 +113,10 @@ public:
 		Visible = false;
 		Last = false;
 		Depth = 0;
+		Row = -1;
+		Lazy = false;
+		ReleaseOnCollapse = false;
+		Populated = false;
 		Text.ZOff(-1, -1);
 	}
 
@@ -212,7 +227,15 @@ GTreeItem *GTreeNode::Insert(GTreeItem *Obj, int Idx)
 		Items.Delete(NewObj);
 		Items.Insert(NewObj, Idx);
 
-		if (Tree)
+		GTreeItem *p = Item();
+		if (Tree && p && !(p->d->Open && p->d->Visible))
+		{
+			// Not in view, so the layout doesn't change. At most the parent
+			// gains an expander.
+			if (p->d->Visible)
+				Tree->_Update(&p->d->Pos);
+		}
+		else if (Tree)
 		{
 			Tree->d->LayoutDirty = true;
 			if (Pos() && Pos()->Y() > 0)
@@ -446,7 +469,7 @@ GRect *GTreeItem::_GetRect(GTreeItemRect Which)
 bool GTreeItem::SortChildren(int (*compare)(GTreeItem *a, GTreeItem *b, NativeInt data), NativeInt data)
 {
 	Items.Sort(compare, data);
-	if (Tree)
+	if (Tree && d->Open && d->Visible)
 	{
 		Tree->_Pour();
 		Tree->Invalidate();
@@ -546,6 +569,16 @@ void GTreeItem::_SetTreePtr(GTree *t)
 		{
 			Tree->d->DropTarget = 0;
 		}
+		if (d->Row >= 0)
+		{
+			// Don't leave a dangling pointer in the row index
+			GTreeItem **r = Tree->d->Rows.AddressOf(d->Row);
+			if (r && *r == this)
+				*r = NULL;
+			Tree->d->LayoutDirty = true;
+		}
+		d->Row = -1;
+		d->Visible = false;
 	}
 	Tree = t;
 
@@ -574,7 +607,8 @@ void GTreeItem::_Remove()
 		if (Tree)
 		{
 			LgiAssert(Tree->d);
-			Tree->d->LayoutDirty = true;
+			if (d->Visible)
+				Tree->d->LayoutDirty = true;
 			
 			if (Tree->IsCapturing())
 				Tree->Capture(false);
@@ -634,8 +668,9 @@ void GTreeItem::_PaintText(GItem::ItemPaintCtx &Ctx)
 	}
 }
 
-void GTreeItem::_Pour(GdcPt2 *Limit, int ColumnPx, int Depth, bool Visible)
+void GTreeItem::_Pour(GdcPt2 *Limit, int ColumnPx, int Depth, bool Visible, GArray<GTreeItem*> &Rows)
 {
+	bool WasVisible = d->Visible;
 	d->Visible = Visible;
 	d->Depth = Depth;
 
@@ -661,10 +696,16 @@ void GTreeItem::_Pour(GdcPt2 *Limit, int ColumnPx, int Depth, bool Visible)
 
 		Limit->x = MAX(Limit->x, d->Pos.x2 + 1);
 		Limit->y = MAX(Limit->y, d->Pos.y2 + 1);
+
+		d->Row = (int)Rows.Length();
+		Rows.Add(this);
 	}
 	else
 	{
 		d->Pos.ZOff(-1, -1);
+		d->Row = -1;
+		if (!WasVisible)
+			return; // The children were hidden along with this item
 	}
 
 	GTreeItem *n;
@@ -673,10 +714,71 @@ void GTreeItem::_Pour(GdcPt2 *Limit, int ColumnPx, int Depth, bool Visible)
 	{
 		n = *++it;
 		i->d->Last = n == 0;
-		i->_Pour(Limit, ColumnPx, Depth+1, d->Open && d->Visible);
+		i->_Pour(Limit, ColumnPx, Depth+1, d->Open && d->Visible, Rows);
 	}
 }
 
+void GTreeItem::_ShowChildren(bool Show)
+{
+	// Splice the children in or out of the row index and move the rows below,
+	// instead of pouring the whole tree again.
+	GArray<GTreeItem*> &Rows = Tree->d->Rows;
+	GArray<GTreeItem*> New;
+	ssize_t At = d->Row + 1, Old = 0;
+	GdcPt2 Lim(Tree->d->Limit.x, d->Pos.y2 + 1);
+	int Bottom = Lim.y;
+
+	if (Show)
+	{
+		GTreeItem *n;
+		List<GTreeItem>::I it = Items.begin();
+		for (GTreeItem *i=*it; i; i=n)
+		{
+			n = *++it;
+			i->d->Last = n == 0;
+			i->_Pour(&Lim, Tree->d->ColumnPx, d->Depth+1, true, New);
+		}
+	}
+	else
+	{
+		// Everything deeper than this item up to the next sibling (or
+		// ancestor's sibling) is one of its visible descendants.
+		for (ssize_t r=At; r<(ssize_t)Rows.Length() && Rows[r]->d->Depth > d->Depth; r++)
+		{
+			GTreeItem *i = Rows[r];
+			Bottom = i->d->Pos.y2 + 1;
+			i->d->Visible = false;
+			i->d->Row = -1;
+			i->d->Pos.ZOff(-1, -1);
+			Old++;
+		}
+	}
+
+	ssize_t Add = New.Length();
+	ssize_t Len = Rows.Length();
+	ssize_t Tail = Len - At - Old;
+	if (Add > Old)
+		Rows.Length(Len + Add - Old);
+	if (Tail > 0 && Add != Old)
+		memmove(&Rows[At + Add], &Rows[At + Old], Tail * sizeof(GTreeItem*));
+	for (ssize_t r=0; r<Add; r++)
+		Rows[At + r] = New[r];
+	if (Add < Old)
+		Rows.Length(Len + Add - Old);
+
+	int Dy = Lim.y - Bottom;
+	for (ssize_t r=At; r<(ssize_t)Rows.Length(); r++)
+	{
+		GTreeItem *i = Rows[r];
+		i->d->Row = (int)r;
+		if (r >= At + Add)
+			i->d->Pos.Offset(0, Dy);
+	}
+
+	Tree->d->Limit.y += Dy;
+	Tree->_UpdateScrollBars();
+}
+
 void GTreeItem::_ClearDs(int Col)
 {
 	d->ClearDs(Col);	
@@ -758,20 +860,71 @@ void GTreeItem::Expanded(bool b)
 {
 	if (d->Open != b)
 	{
+		if (b && IsUnpopulated())
+		{
+			// Still closed, so inserting the children doesn't touch the layout
+			d->Populated = true;
+			OnPopulate();
+		}
+
 		d->Open = b;
 
 		if (Items.Length() > 0)
 		{
 			if (Tree)
 			{
-				Tree->d->LayoutDirty = true;
+				GTreeItem **r = d->Row >= 0 ? Tree->d->Rows.AddressOf(d->Row) : NULL;
+				if (!Tree->d->LayoutDirty && r && *r == this)
+					_ShowChildren(b);
+				else
+					Tree->d->LayoutDirty = true;
 				Tree->_UpdateBelow(d->Pos.y1);
 			}
 			OnExpand(b);
 		}
+		else if (d->Lazy && Tree && d->Visible)
+		{
+			// Populated with nothing, remove the expander
+			Tree->_Update(&d->Pos);
+		}
+
+		if (!b && d->ReleaseOnCollapse)
+		{
+			GTreeItem *c;
+			while ((c = Items.First()))
+				delete c;
+			d->Populated = false;
+		}
+	}
+}
+
+void GTreeItem::SetLazyChildren(bool Lazy, bool ReleaseOnCollapse)
+{
+	d->Lazy = Lazy;
+	d->ReleaseOnCollapse = Lazy && ReleaseOnCollapse;
+	d->Populated = false;
+
+	if (Lazy && d->Open)
+	{
+		d->Populated = true;
+		OnPopulate();
+	}
+	else if (Tree && d->Visible)
+	{
+		Tree->_Update(&d->Pos);
 	}
 }
 
+bool GTreeItem::IsUnpopulated()
+{
+	return d->Lazy && !d->Populated;
+}
+
+bool GTreeItem::_HasExpander()
+{
+	return Items.Length() > 0 || IsUnpopulated();
+}
+
 void GTreeItem::OnExpand(bool b)
 {
 	_Visible(b);
@@ -803,7 +956,7 @@ void GTreeItem::_MouseClick(GMouse &m)
 {
 	if (m.Down())
 	{
-		if ((Items.Length() > 0 &&
+		if ((_HasExpander() &&
 			d->Thumb.Overlap(m.x, m.y)) ||
 			m.Double())
 		{
@@ -861,7 +1014,7 @@ void GTreeItem::OnPaint(ItemPaintCtx &Ctx)
 
 	// draw node
 	int cy = Pos.y1 + (Pos.Y() >> 1);
-	if (Items.Length() > 0)
+	if (_HasExpander())
 	{
 		d->Thumb.ZOff(8, 8);
 		d->Thumb.Offset(x + 4, cy - 4);
@@ -1016,38 +1169,6 @@ void GTreeItem::OnPaint(ItemPaintCtx &Ctx)
 	// background after text
 	pDC->Colour(LC_WORKSPACE, 24);
 	pDC->Rectangle(x, Pos.y1, MAX(Tree->X(), Tree->d->Limit.x), Pos.y2);
-
-	// children
-	if (d->Open)
-	{
-		if (!d->Last)
-		{
-			Tree->d->LineFlags[0] |= 1 << d->Depth;
-		}
-
-		COLOUR SelFore = Tree->Focus() ? LC_FOCUS_SEL_FORE : LC_NON_FOCUS_SEL_FORE;
-		COLOUR SelBack = Tree->Focus() ? LC_FOCUS_SEL_BACK : LC_NON_FOCUS_SEL_BACK;
-		List<GTreeItem>::I it = Items.begin();
-		for (GTreeItem *i=*it; i; i=*++it)
-		{
-			bool IsSelected = (Tree->d->DropTarget == i) || (Tree->d->DropTarget == 0 && i->Select());
-
-			// Foreground
-			GCss::ColorDef Fill = i->GetCss(true)->Color();
-			Ctx.Fore.Set(Fill.Type == GCss::ColorRgb ? Rgb32To24(Fill.Rgb32) : (IsSelected ? SelFore : LC_TEXT), 24);
-
-			// Background	
-			Fill = i->GetCss()->BackgroundColor();
-			Ctx.Back.Set(Fill.Type == GCss::ColorRgb ?
-						Rgb32To24(Fill.Rgb32) :
-						(IsSelected ? SelBack : LC_WORKSPACE),
-						24);
-
-			i->OnPaint(Ctx);
-		}
-
-		Tree->d->LineFlags[0] &= ~(1 << d->Depth);
-	}
 }
 
 void GTreeItem::OnPaintColumn(GItem::ItemPaintCtx &Ctx, int i, GItemColumn *c)
@@ -1259,6 +1380,8 @@ void GTree::_Pour()
 		if (ColumnPx < 16)
 			ColumnPx = 16;
 	}
+	d->ColumnPx = ColumnPx;
+	d->Rows.Length(0);
 
 	GTreeItem *n;
 	List<GTreeItem>::I it = Items.begin();
@@ -1266,7 +1389,7 @@ void GTree::_Pour()
 	{
 		n = *++it;
 		i->d->Last = n == 0;
-		i->_Pour(&d->Limit, ColumnPx, 0, true);
+		i->_Pour(&d->Limit, ColumnPx, 0, true, d->Rows);
 	}
 
 	_UpdateScrollBars();
@@ -1274,6 +1397,21 @@ void GTree::_Pour()
 	d->InPour = false;
 }
 
+ssize_t GTree::_RowFromY(int y)
+{
+	// Index of the first row that ends at or below 'y'
+	ssize_t Lo = 0, Hi = d->Rows.Length();
+	while (Lo < Hi)
+	{
+		ssize_t Mid = (Lo + Hi) >> 1;
+		if (d->Rows[Mid]->d->Pos.y2 < y)
+			Lo = Mid + 1;
+		else
+			Hi = Mid;
+	}
+	return Lo;
+}
+
 // External methods and events
 void GTree::OnItemSelect(GTreeItem *Item)
 {
@@ -1296,6 +1434,14 @@ GTreeItem *GTree::GetAdjacent(GTreeItem *i, bool Down)
 {
 	if (i)
 	{
+		if (d->LayoutDirty)
+			_Pour();
+		if (i->d->Row >= 0)
+		{
+			GTreeItem **n = d->Rows.AddressOf(i->d->Row + (Down ? 1 : -1));
+			return n ? *n : NULL;
+		}
+
 		if (Down)
 		{
 			GTreeItem *n = i->GetChild();
@@ -1477,12 +1623,12 @@ bool GTree::OnKey(GKey &k)
 			{
 				if (i)
 				{
+					bool Opening = !i->Expanded() && i->_HasExpander();
 					i->Expanded(true);
 					if (d->LayoutDirty)
-					{
 						_Pour();
+					if (Opening)
 						break;
-					}
 				}
 				// fall thru
 			}
@@ -1548,16 +1694,19 @@ bool GTree::OnKey(GKey &k)
 
 GTreeItem *GTree::ItemAtPoint(int x, int y, bool Debug)
 {
+	if (d->LayoutDirty)
+		_Pour();
+
 	GdcPt2 s = _ScrollPos();
+	x += s.x;
+	y += s.y;
 
-	List<GTreeItem>::I it = Items.begin();
-	for (GTreeItem *i = *it; i; i=*++it)
+	GTreeItem **Hit = d->Rows.AddressOf(_RowFromY(y));
+	if (Hit &&
+		(*Hit)->d->Pos.Overlap(x, y) &&
+		x > (*Hit)->d->Depth * TREE_BLOCK)
 	{
-		GTreeItem *Hit = i->_HitTest(s.x + x, s.y + y, Debug);
-		if (Hit)
-		{
-			return Hit;
-		}
+		return *Hit;
 	}
 
 	return 0;
@@ -1818,11 +1967,22 @@ void GTree::OnPaint(GSurface *pDC)
 		_Pour();
 	}
 
-	// paint items
+	// paint the rows in view
 	ZeroObj(d->LineFlags);
-	List<GTreeItem>::I it = Items.begin();
-	for (GTreeItem *i = *it; i; i=*++it)
+	for (size_t n = _RowFromY(rItems.y1 + s.y); n < d->Rows.Length(); n++)
 	{
+		GTreeItem *i = d->Rows[n];
+		if (i->d->Pos.y1 > rItems.y2 + s.y)
+			break;
+
+		// Joining lines for the ancestors that have more siblings below
+		d->LineFlags[0] = 0;
+		for (GTreeItem *p = i->GetParent(); p; p = p->GetParent())
+		{
+			if (!p->d->Last && p->d->Depth < 32)
+				d->LineFlags[0] |= 1 << p->d->Depth;
+		}
+
 		bool IsSelected = (d->DropTarget == i) || (d->DropTarget == 0 && i->Select());
 
 		// Foreground
@@ -1940,7 +2100,7 @@ void GTree::OnPulse()
 			SetPulse();
 
 			if (!d->DropTarget->Expanded() &&
-				d->DropTarget->GetChild())
+				d->DropTarget->_HasExpander())
 			{
 				d->DropTarget->Expanded(true);
 			}
@@ -1988,10 +2148,14 @@ int GTree::GetContentSize(int ColumnIdx)
 {
 	int MaxPx = 0;
 	
-	List<GTreeItem>::I it = Items.begin();
-	for (GTreeItem *i = *it; i; i=*++it)
+	if (d->LayoutDirty)
+		_Pour();
+
+	// The rows are the items visible when expanded, same as walking
+	// GTreeItem::GetColumnSize from the root.
+	for (size_t n=0; n<d->Rows.Length(); n++)
 	{
-		int ItemPx = i->GetColumnSize(ColumnIdx);
+		int ItemPx = d->Rows[n]->d->GetColumnPx(ColumnIdx);
 		MaxPx = MAX(ItemPx, MaxPx);
 	}
 	
@@ -33,10 +33,13 @@
 #define DOUBLE_BUFFER_PAINT				0
 #define DOUBLE_BUFFER_COLUMN_DRAWING	0
 
+// Virtual mode: rows either side of the visible ones that keep their items
+#define LLIST_ROW_MARGIN				32
+
 #define ForAllItems(Var)				for (auto Var : Items)
 #define ForAllItemsReverse(Var)			Iterator<LListItem> ItemIter(&Items); for (LListItem *Var = ItemIter.Last(); Var; Var = ItemIter.Prev())
 #define VisibleItems()					CompletelyVisible // (LastVisible - FirstVisible + 1)
-#define MaxScroll()						MAX((int)Items.Length() - CompletelyVisible, 0)
+#define MaxScroll()						MAX((int)Length() - CompletelyVisible, 0)
 
 class LListPrivate
 {
@@ -64,6 +67,17 @@ public:
 	// Kayboard search
 	uint64 KeyLast;
 	char16 *KeyBuf;
+
+	// Virtual mode
+	LListDataSource *Source;
+	int Rows;
+	int RowHeight;			// Every row is this high, measured from the first item
+	int WinStart;			// View index of the first item in 'Items'
+	GArray<uint32> Order;	// View index to source row, empty for the source's order
+	GArray<uint32> SelBits;	// Selected source rows
+	int SelFirst;			// View index of the first selected row, -1 if none, -2 if unknown
+	LHashTbl<IntKey<int>, LListItem*> Cache; // Source row to item
+	GArray<int> ContentPx;	// Widest text seen in each column
 	
 	// Class
 	LListPrivate()
@@ -75,6 +89,11 @@ public:
 		VisibleColumns = 0;
 		Mode = LListDetails;
 		NoSelectEvent = false;
+		Source = NULL;
+		Rows = 0;
+		RowHeight = 0;
+		WinStart = 0;
+		SelFirst = -1;
 	}
 	
 	~LListPrivate()
@@ -83,6 +102,52 @@ public:
 			*DeleteFlag = true;
 		DeleteArray(KeyBuf);
 	}
+
+	int RowAt(int View)
+	{
+		return Order.Length() ? (int)Order[View] : View;
+	}
+
+	bool IsSel(int Row)
+	{
+		size_t w = Row >> 5;
+		return w < SelBits.Length() && (SelBits[w] & (1U << (Row & 31))) != 0;
+	}
+
+	void SetSel(int Row, bool b)
+	{
+		SelFirst = -2; // SelectRows knows better and sets it after
+		size_t w = Row >> 5;
+		if (w >= SelBits.Length())
+		{
+			if (!b)
+				return;
+			SelBits.Length(w + 1);
+		}
+
+		if (b)
+			SelBits[w] |= 1U << (Row & 31);
+		else
+			SelBits[w] &= ~(1U << (Row & 31));
+	}
+
+	/// The view index of the first selected row, or -1
+	int FirstSel()
+	{
+		if (SelFirst == -2)
+		{
+			SelFirst = -1;
+			for (int n=0; n<Rows; n++)
+			{
+				if (IsSel(RowAt(n)))
+				{
+					SelFirst = n;
+					break;
+				}
+			}
+		}
+		return SelFirst;
+	}
 };
 
 class LListItemPrivate
@@ -94,12 +159,14 @@ public:
 	GArray<char*> Str;
 	GArray<GDisplayString*> Display;
 	int16 LayoutColumn;
+	int Row; // Source row in virtual mode
 
 	LListItemPrivate()
 	{
 		Selected = 0;
 		ListItem_Image = -1;
 		LayoutColumn = -1;
+		Row = -1;
 	}
 
 	~LListItemPrivate()
@@ -290,6 +357,8 @@ void LListItem::Select(bool b)
 	if (d->Selected != b)
 	{
 		d->Selected = b;
+		if (Parent && Parent->d->Source)
+			Parent->d->SetSel(d->Row, b);
 		Update();
 		
 		if (Parent &&
@@ -309,7 +378,7 @@ void LListItem::ScrollTo()
 	{
 		if (Parent->GetMode() == LListDetails && Parent->VScroll)
 		{
-			ssize_t n = Parent->Items.IndexOf(this);
+			ssize_t n = Parent->ViewIndexOf(this);
 			if (n < Parent->FirstVisible)
 			{
 				Parent->VScroll->Value(n);
@@ -323,7 +392,7 @@ void LListItem::ScrollTo()
 		}
 		else if (Parent->GetMode() == LListColumns && Parent->HScroll)
 		{
-			ssize_t n = Parent->Items.IndexOf(this);
+			ssize_t n = Parent->ViewIndexOf(this);
 			if (n < Parent->FirstVisible)
 			{
 				Parent->HScroll->Value(d->LayoutColumn);
@@ -354,7 +423,7 @@ void LListItem::Update()
 			GRect r = Pos;
 			if (r.Valid())
 			{
-				if (Info.y != r.Y())
+				if (Info.y != r.Y() && !Parent->d->Source) // Virtual rows are all one height
 				{
 					Pos.y2 = Pos.y1 + Info.y - 1;
 					Parent->PourAll();
@@ -645,6 +714,9 @@ LListMode LList::GetMode()
 
 void LList::SetMode(LListMode m)
 {
+	if (d->Source)
+		return; // Virtual mode is always details
+
 	if (d->Mode ^ m)
 	{
 		d->Mode = m;
@@ -673,8 +745,16 @@ void LList::OnItemSelect(GArray<LListItem*> &It)
 {
 	if (It.Length())
 	{
-		Keyboard = (int)Items.IndexOf(It[0]);
+		Keyboard = ViewIndexOf(It[0]);
 		LgiAssert(Keyboard >= 0);
+
+		if (d->Source && !MultiSelect())
+		{
+			// Rows out of view have no items to deselect
+			d->SelBits.Length(0);
+			for (int n=0; n<It.Length(); n++)
+				d->SetSel(It[n]->d->Row, true);
+		}
 		
 		LHashTbl<PtrKey<LListItem*>, bool> Sel;
 		for (int n=0; n<It.Length(); n++)
@@ -800,7 +880,7 @@ LListItem *LList::HitItem(int x, int y, int *Index)
 			)
 		)
 		{
-			if (Index) *Index = n;
+			if (Index) *Index = d->WinStart + n;
 			return i;
 		}
 		n++;
@@ -819,6 +899,40 @@ void LList::ClearDs(int Col)
 
 void LList::KeyScroll(int iTo, int iFrom, bool SelectItems)
 {
+	if (d->Source)
+	{
+		if (d->Rows <= 0)
+			return;
+
+		iTo = limit(iTo, 0, d->Rows-1);
+		iFrom = limit(iFrom, 0, d->Rows-1);
+		if (iTo == iFrom)
+			return;
+
+		if (SelectItems)
+		{
+			// Extend the first run of selected rows
+			int Start = d->FirstSel(), End = Start;
+			while (Start >= 0 && End < d->Rows - 1 && d->IsSel(d->RowAt(End + 1)))
+				End++;
+			if (Start < 0)
+				Start = End = iFrom;
+
+			int OtherEnd = Keyboard == End ? Start : End;
+			SelectRows(OtherEnd, iTo, true);
+		}
+		else
+		{
+			SelectRows(iTo, iTo, true);
+		}
+
+		LListItem *To = ItemAt(iTo);
+		if (To)
+			To->ScrollTo();
+		Keyboard = iTo;
+		return;
+	}
+
 	int Start = -1, End = -1, i = 0;
 	{
 		ForAllItems(n)
@@ -1109,7 +1223,7 @@ bool LList::OnKey(GKey &k)
 				{
 					LList_End:
 					printf("End handler\n");
-					KeyScroll((int)Items.Length()-1, Keyboard, k.Shift());
+					KeyScroll((int)Length()-1, Keyboard, k.Shift());
 					Status = true;
 					break;
 				}
@@ -1152,6 +1266,8 @@ bool LList::OnKey(GKey &k)
 					(
 						!Status
 						&&
+						!d->Source // Would have to load every row
+						&&
 						k.IsChar
 						&&
 						(
@@ -1373,7 +1489,11 @@ void LList::OnMouseClick(GMouse &m)
 				else
 				{
 					// Selection change
-					if (m.Shift() && MultiSelect())
+					if (m.Shift() && MultiSelect() && d->Source)
+					{
+						SelectRows(MAX(MIN(ItemIndex, Keyboard), 0), MAX(ItemIndex, Keyboard), true);
+					}
+					else if (m.Shift() && MultiSelect())
 					{
 						int n = 0;
 						int a = MIN(ItemIndex, Keyboard);
@@ -1394,6 +1514,29 @@ void LList::OnMouseClick(GMouse &m)
 
 						OnItemSelect(Sel);
 					}
+					else if (d->Source)
+					{
+						if (m.Modifier() && MultiSelect())
+						{
+							// Toggle selected state
+							if (Item && !Item->Select())
+								Keyboard = ItemIndex;
+							if (Item)
+								Item->Select(!Item->Select());
+						}
+						else if (SelectRows(Item ? ItemIndex : -1, Item ? ItemIndex : -1, true))
+						{
+							if (Item)
+								Keyboard = ItemIndex;
+						}
+
+						if (!m.Modifier() && d->Rows > 0 && !m.IsContextMenu())
+						{
+							DragMode = SELECT_ITEMS;
+							SetPulse(100);
+							Capture(true);
+						}
+					}
 					else
 					{
 						bool PostSelect = false;
@@ -1504,8 +1647,12 @@ void LList::OnMouseClick(GMouse &m)
 					//
 					// However we also do not want this to select items after the
 					// contents of the list box have changed since the down click
-					LListItem *Item = Items.ItemAt(d->DragData);
-					if (Item)
+					LListItem *Item = ItemAt(d->DragData);
+					if (Item && d->Source)
+					{
+						SelectRows(d->DragData, d->DragData, true);
+					}
+					else if (Item)
 					{
 						bool Change = false;
 						
@@ -1613,6 +1760,21 @@ void LList::OnPulse()
 						int OverIndex = 0;
 						LListItem *Over = 0;
 
+						if (d->Source)
+						{
+							// Rows are all the same height
+							int RowY = MAX(d->RowHeight, 1);
+							if (m.y < 0)
+								OverIndex = MAX(FirstVisible - 1 - (-m.y / RowY), 0);
+							else
+								OverIndex = MIN(LastVisible + 1 + (m.y - Y()) / RowY, d->Rows - 1);
+
+							SelectRows(d->DragData, OverIndex, false);
+							if ((Over = ItemAt(OverIndex)))
+								Over->ScrollTo();
+							break;
+						}
+
 						if (m.y < 0)
 						{
 							int Space = -m.y;
@@ -1821,7 +1983,7 @@ void LList::OnMouseMove(GMouse &m)
 			}
 			case CLICK_ITEM:
 			{
-				LListItem *Cur = Items.ItemAt(d->DragData);
+				LListItem *Cur = ItemAt(d->DragData);
 				if (Cur)
 				{
 					Cur->OnMouseMove(m);
@@ -1860,6 +2022,9 @@ void LList::OnMouseMove(GMouse &m)
 
 int64 LList::Value()
 {
+	if (d->Source)
+		return d->FirstSel();
+
 	int n=0;
 	ForAllItems(i)
 	{
@@ -1874,6 +2039,13 @@ int64 LList::Value()
 
 void LList::Value(int64 Index)
 {
+	if (d->Source)
+	{
+		SelectRows((int)Index, (int)Index, true);
+		Keyboard = (int)Index;
+		return;
+	}
+
 	int n=0;
 	ForAllItems(i)
 	{
@@ -1894,7 +2066,9 @@ void LList::SelectAll()
 {
 	if (Lock(_FL))
 	{
-		ForAllItems(i)
+		if (d->Source)
+			SelectRows(0, d->Rows - 1, true);
+		else ForAllItems(i)
 		{
 			i->d->Selected = true;
 		}
@@ -1907,6 +2081,13 @@ void LList::SelectAll()
 
 bool LList::Select(LListItem *Obj)
 {
+	if (d->Source)
+	{
+		int n = Obj ? ViewIndexOf(Obj) : -1;
+		SelectRows(n, n, true);
+		return true;
+	}
+
 	bool Status = false;
 	ForAllItems(i)
 	{
@@ -1922,7 +2103,9 @@ LListItem *LList::GetSelected()
 
 	if (Lock(_FL))
 	{
-		ForAllItems(i)
+		if (d->Source)
+			n = ItemAt(d->FirstSel());
+		else ForAllItems(i)
 		{
 			if (i->Select())
 			{
@@ -1982,6 +2165,12 @@ bool LList::Insert(List<LListItem> &l, int Index, bool Update)
 {
 	bool Status = false;
 
+	if (d->Source)
+	{
+		LgiAssert(!"Items come from the data source in virtual mode.");
+		return false;
+	}
+
 	if (Lock(_FL))
 	{
 		bool First = Items.Length() == 0;
@@ -2057,7 +2246,16 @@ bool LList::Remove(LListItem *i)
 
 	if (Lock(_FL))
 	{
-		if (i && i->GetList() == this)
+		if (i && i->GetList() == this && d->Source)
+		{
+			// A cached row's item, it'll be made again if needed
+			d->Cache.Delete(i->d->Row);
+			Items.Delete(i);
+			i->Parent = 0;
+			Invalidate(&ItemsPos);
+			Status = true;
+		}
+		else if (i && i->GetList() == this)
 		{
 			GRegion Up;
 			bool Visible = GetUpdateRegion(i, Up);
@@ -2112,17 +2310,46 @@ bool LList::HasItem(LListItem *Obj)
 
 int LList::IndexOf(LListItem *Obj)
 {
-	return (int)Items.IndexOf(Obj);
+	return ViewIndexOf(Obj);
 }
 
 LListItem *LList::ItemAt(int Index)
 {
-	return Items.ItemAt(Index);
+	if (!d->Source)
+		return Items.ItemAt(Index);
+
+	if (Index < 0 || Index >= d->Rows)
+		return NULL;
+
+	int Row = d->RowAt(Index);
+	LListItem *i = d->Cache.Find(Row);
+	if (!i)
+	{
+		i = d->Source->NewItem(Row);
+		if (!i)
+			i = new LListItem; // Keep the rows in step
+
+		i->Parent = this;
+		i->d->Row = Row;
+		i->d->Selected = d->IsSel(Row);
+		d->Cache.Add(Row, i);
+	}
+
+	return i;
 }
 
 void LList::ScrollToSelection()
 {
-	if (VScroll)
+	if (VScroll && d->Source)
+	{
+		int n = d->FirstSel();
+		if (n >= 0 && (n < FirstVisible || n > LastVisible))
+		{
+			VScroll->Value(MAX(n - (VisibleItems() / 2), 0));
+			Invalidate(&ItemsPos);
+		}
+	}
+	else if (VScroll)
 	{
 		int n=0;
 		int Vis = VisibleItems();
@@ -2171,7 +2398,22 @@ void LList::Empty()
 {
 	if (Lock(_FL))
 	{
-		ForAllItems(i)
+		if (d->Source)
+		{
+			// The window's items are all in the cache
+			for (auto p : d->Cache)
+				FreeRow(p.value);
+			d->Cache.Empty();
+			d->Rows = 0;
+			d->RowHeight = 0;
+			d->WinStart = 0;
+			d->Order.Length(0);
+			d->SelBits.Length(0);
+			d->SelFirst = -1;
+			d->ContentPx.Length(0);
+			Keyboard = -1;
+		}
+		else ForAllItems(i)
 		{
 			LgiAssert(i->Parent == this);
 			i->Parent = 0;
@@ -2197,6 +2439,13 @@ void LList::Empty()
 
 void LList::RemoveAll()
 {
+	if (d->Source)
+	{
+		// The list owns the items in virtual mode
+		Empty();
+		return;
+	}
+
 	if (Lock(_FL))
 	{
 		if (Items.Length())
@@ -2253,7 +2502,7 @@ void LList::UpdateScrollBars()
 			}
 
 			VScroll->SetPage(Vis);
-			VScroll->SetLimits(0, Items.Length() - 1);
+			VScroll->SetLimits(0, Length() - 1);
 		}
 		
 		if (HScroll)
@@ -2276,7 +2525,7 @@ void LList::PourAll()
 	GRect Client = GetClient();
 	GFont *Font = GetFont();
 
-	if (d->Mode == LListDetails)
+	if (d->Mode == LListDetails || d->Source)
 	{
 		if (ColumnHeaders)
 		{
@@ -2291,58 +2540,66 @@ void LList::PourAll()
 			ColumnHeader.ZOff(-1, -1);
 		}
 		
-		int n = 0;
-		int y = ItemsPos.y1;
-		int Max = MaxScroll();
-		FirstVisible = (VScroll) ? (int)VScroll->Value() : 0;
-		if (FirstVisible > Max) FirstVisible = Max;
-		LastVisible = 0x7FFFFFFF;
-		CompletelyVisible = 0;
-		bool SomeHidden = false;
-
-		ForAllItems(i)
+		if (d->Source)
 		{
-			if (n < FirstVisible || n > LastVisible)
-			{
-				i->Pos.Set(-1, -1, -2, -2);
-				SomeHidden = true;
-			}
-			else
-			{
-				GdcPt2 Info;
-				
-				i->OnMeasure(&Info);
-				if (i->Pos.Valid() && Info.y != i->Pos.Y())
-				{
-					// This detects changes in item height and invalidates the items below this one.
-					GRect in(0, y+Info.y, X()-1, Y()-1);
-					Invalidate(&in);
-				}
-
-				i->Pos.Set(ItemsPos.x1, y, ItemsPos.x2, y+Info.y-1);
-				y = y+Info.y;
+			// Virtual mode, lay out just the rows in view
+			PourRows();
+		}
+		else
+		{
+			int n = 0;
+			int y = ItemsPos.y1;
+			int Max = MaxScroll();
+			FirstVisible = (VScroll) ? (int)VScroll->Value() : 0;
+			if (FirstVisible > Max) FirstVisible = Max;
+			LastVisible = 0x7FFFFFFF;
+			CompletelyVisible = 0;
+			bool SomeHidden = false;
 
-				if (i->Pos.y2 > ItemsPos.y2)
+			ForAllItems(i)
+			{
+				if (n < FirstVisible || n > LastVisible)
 				{
-					LastVisible = n;
+					i->Pos.Set(-1, -1, -2, -2);
 					SomeHidden = true;
 				}
 				else
 				{
-					CompletelyVisible++;
+					GdcPt2 Info;
+				
+					i->OnMeasure(&Info);
+					if (i->Pos.Valid() && Info.y != i->Pos.Y())
+					{
+						// This detects changes in item height and invalidates the items below this one.
+						GRect in(0, y+Info.y, X()-1, Y()-1);
+						Invalidate(&in);
+					}
+
+					i->Pos.Set(ItemsPos.x1, y, ItemsPos.x2, y+Info.y-1);
+					y = y+Info.y;
+
+					if (i->Pos.y2 > ItemsPos.y2)
+					{
+						LastVisible = n;
+						SomeHidden = true;
+					}
+					else
+					{
+						CompletelyVisible++;
+					}
 				}
+
+				n++;
 			}
 
-			n++;
-		}
+			if (LastVisible >= Items.Length())
+			{
+				LastVisible = (int)Items.Length() - 1;
+			}
 
-		if (LastVisible >= Items.Length())
-		{
-			LastVisible = (int)Items.Length() - 1;
+			SetScrollBars(false, SomeHidden);
+			UpdateScrollBars();
 		}
-
-		SetScrollBars(false, SomeHidden);
-		UpdateScrollBars();
 	}
 	else if (d->Mode == LListColumns)
 	{
@@ -2445,6 +2702,285 @@ void LList::PourAll()
 	#endif
 }
 
+//////////////////////////////////////////////////////////////////////////////
+// Virtual mode
+size_t LList::Length()
+{
+	return d->Source ? d->Rows : Items.Length();
+}
+
+LListDataSource *LList::GetDataSource()
+{
+	return d->Source;
+}
+
+void LList::SetDataSource(LListDataSource *Src)
+{
+	if (!Lock(_FL))
+		return;
+
+	Empty();
+	d->Source = Src;
+	if (Src)
+	{
+		d->Mode = LListDetails;
+		ReloadRows();
+	}
+
+	Unlock();
+}
+
+void LList::ReloadRows()
+{
+	if (!d->Source || !Lock(_FL))
+		return;
+
+	for (auto p : d->Cache)
+		FreeRow(p.value);
+	d->Cache.Empty();
+	Items.Empty();
+
+	d->Rows = (int)MIN(d->Source->GetRows(), 0x7fffffff);
+	d->RowHeight = 0;
+	d->WinStart = 0;
+	d->Order.Length(0);
+	d->SelBits.Length(0);
+	FirstVisible = LastVisible = -1;
+	DragMode = DRAG_NONE;
+	Keyboard = d->Rows > 0 ? 0 : -1;
+	if (Keyboard == 0)
+		d->SetSel(0, true);
+	d->SelFirst = Keyboard;
+	if (VScroll)
+		VScroll->Value(0);
+
+	Unlock();
+
+	PourAll();
+	Invalidate();
+}
+
+int LList::RowAt(int Index)
+{
+	if (!d->Source || Index < 0 || Index >= d->Rows)
+		return -1;
+	return d->RowAt(Index);
+}
+
+bool LList::GetSelectedRows(GArray<int> &Rows)
+{
+	Rows.Length(0);
+	if (!d->Source)
+		return false;
+
+	for (int n=0; n<d->Rows; n++)
+	{
+		int Row = d->RowAt(n);
+		if (d->IsSel(Row))
+			Rows.Add(Row);
+	}
+
+	return Rows.Length() > 0;
+}
+
+struct LListSortParams
+{
+	LListDataSource *Src;
+	int Column;
+	bool Ascend;
+};
+
+DeclGArrayCompare(LListRowCompare, uint32, LListSortParams)
+{
+	int c = param->Src->CompareRows(*a, *b, param->Column);
+	return param->Ascend ? c : -c;
+}
+
+void LList::SortRows(int Column, bool Ascending)
+{
+	if (!d->Source || !Lock(_FL))
+		return;
+
+	int KbRow = RowAt(Keyboard);
+	if (d->Order.Length() != d->Rows)
+	{
+		d->Order.Length(d->Rows);
+		for (int n=0; n<d->Rows; n++)
+			d->Order[n] = n;
+	}
+
+	// Only the index is sorted, the cached items are keyed by source row
+	// so they stay valid.
+	LListSortParams p = { d->Source, Column, Ascending };
+	d->Order.Sort(LListRowCompare, &p);
+	Keyboard = KbRow >= 0 ? (int)d->Order.IndexOf(KbRow) : -1;
+	d->SelFirst = -2;
+
+	Unlock();
+	Invalidate(&ItemsPos);
+}
+
+void LList::PourRows()
+{
+	if (!d->RowHeight)
+	{
+		GdcPt2 Info;
+		LListItem *First = ItemAt(0);
+		if (First)
+			First->OnMeasure(&Info);
+		else
+			Info.y = MAX(16, GetFont()->GetHeight() + 2);
+		d->RowHeight = MAX(Info.y, 1);
+	}
+
+	int RowY = d->RowHeight;
+	int Px = MAX(ItemsPos.Y(), 0);
+	CompletelyVisible = Px / RowY;
+	FirstVisible = limit(VScroll ? (int)VScroll->Value() : 0, 0, MaxScroll());
+	LastVisible = MIN(FirstVisible + (Px + RowY - 1) / RowY, d->Rows) - 1;
+
+	// Items for the visible rows and a margin either side, reusing cached ones
+	int From = MAX(FirstVisible - LLIST_ROW_MARGIN, 0);
+	int To = MIN(LastVisible + LLIST_ROW_MARGIN, d->Rows - 1);
+	LHashTbl<IntKey<int>, bool> InWindow;
+	Items.Empty();
+	d->WinStart = From;
+	for (int n=From; n<=To; n++)
+	{
+		LListItem *i = ItemAt(n);
+		Items.Insert(i);
+		InWindow.Add(i->d->Row, true);
+	}
+
+	// Free everything else
+	GArray<LListItem*> Old;
+	for (auto p : d->Cache)
+	{
+		if (!InWindow.Find(p.key))
+			Old.Add(p.value);
+	}
+	for (unsigned n=0; n<Old.Length(); n++)
+	{
+		d->Cache.Delete(Old[n]->d->Row);
+		FreeRow(Old[n]);
+	}
+
+	int y = ItemsPos.y1;
+	int n = From;
+	ForAllItems(i)
+	{
+		if (n >= FirstVisible && n <= LastVisible)
+		{
+			i->Pos.Set(ItemsPos.x1, y, ItemsPos.x2, y + RowY - 1);
+			y += RowY;
+		}
+		else
+		{
+			i->Pos.Set(-1, -1, -2, -2);
+		}
+		n++;
+	}
+
+	SetScrollBars(false, d->Rows > CompletelyVisible);
+	UpdateScrollBars();
+}
+
+void LList::FreeRow(LListItem *i)
+{
+	// Remember how wide the text was for GetContentSize
+	for (unsigned c=0; c<i->d->Display.Length(); c++)
+	{
+		GDisplayString *Ds = i->d->Display[c];
+		if (Ds && !Ds->IsTruncated())
+			d->ContentPx[c] = MAX(d->ContentPx[c], Ds->X());
+	}
+
+	i->Parent = 0;
+	delete i;
+}
+
+bool LList::SelectRows(int From, int To, bool Others)
+{
+	if (From > To)
+	{
+		int t = From;
+		From = To;
+		To = t;
+	}
+
+	GArray<uint32> Was;
+	if (Others)
+	{
+		Was = d->SelBits;
+		d->SelBits.Length(0);
+	}
+
+	bool Changed = false;
+	int First = Others ? -1 : d->SelFirst;
+	if (From >= 0)
+	{
+		To = MIN(To, d->Rows - 1);
+		for (int n=From; n<=To; n++)
+		{
+			int Row = d->RowAt(n);
+			Changed |= !d->IsSel(Row);
+			d->SetSel(Row, true);
+		}
+		if (From <= To && First != -2)
+			First = First < 0 ? From : MIN(First, From);
+	}
+	d->SelFirst = First;
+
+	if (Others)
+	{
+		size_t Words = MAX(Was.Length(), d->SelBits.Length());
+		for (size_t w=0; w<Words && !Changed; w++)
+		{
+			uint32 a = w < Was.Length() ? Was[w] : 0;
+			uint32 b = w < d->SelBits.Length() ? d->SelBits[w] : 0;
+			Changed = a != b;
+		}
+	}
+
+	if (!Changed)
+		return false;
+
+	// Bring the cached items in line
+	GArray<LListItem*> Sel;
+	for (auto p : d->Cache)
+	{
+		LListItem *i = p.value;
+		bool s = d->IsSel(i->d->Row);
+		if (i->d->Selected != s)
+		{
+			i->d->Selected = s;
+			i->Update();
+		}
+		if (s)
+			Sel.Add(i);
+	}
+
+	OnItemSelect(Sel);
+	return true;
+}
+
+int LList::ViewIndexOf(LListItem *i)
+{
+	ssize_t n = Items.IndexOf(i);
+	if (n >= 0)
+		return d->WinStart + (int)n;
+
+	if (d->Source && i && i->Parent == this && i->d->Row >= 0)
+	{
+		// A cached item outside the window
+		if (!d->Order.Length())
+			return i->d->Row;
+		return (int)d->Order.IndexOf(i->d->Row);
+	}
+
+	return -1;
+}
+
 void LList::OnPaint(GSurface *pDC)
 {
 	#if LList_ONPAINT_PROFILE
@@ -2497,7 +3033,7 @@ void LList::OnPaint(GSurface *pDC)
 		Ctx.pDC = pDC;
 
 		GRegion Rgn(ItemsPos);
-		for (LListItem *i = Items.ItemAt(n); i; i = Items.Next(), n++)
+		for (LListItem *i = Items.ItemAt(n - d->WinStart); i; i = Items.Next(), n++)
 		{
 			if (i->Pos.Valid())
 			{
@@ -2562,14 +3098,14 @@ void LList::OnFocus(bool b)
 	LListItem *s = GetSelected();
 	if (!s)
 	{
-		s = Items.First();
+		s = ItemAt(0);
 		if (s)
 		{
 			s->Select(true);
 		}
 	}
 
-	for (LListItem *i = Items.ItemAt(FirstVisible); i; i = Items.Next())
+	for (LListItem *i = Items.ItemAt(FirstVisible - d->WinStart); i; i = Items.Next())
 	{
 		if (i->Pos.Valid() &&
 			i->d->Selected)
@@ -2602,7 +3138,9 @@ void LList::UpdateAllItems()
 
 int LList::GetContentSize(int Index)
 {
-	int Max = 0;
+	// In virtual mode only the cached rows can be measured, so keep
+	// the widest seen so far.
+	int Max = d->Source ? d->ContentPx[Index] : 0;
 
 	for (List<LListItem>::I It = Items.begin(); It.In(); It++)
 	{
@@ -2636,6 +3174,9 @@ int LList::GetContentSize(int Index)
 		
 		DeleteObj(Mem);
 	}
+
+	if (d->Source)
+		d->ContentPx[Index] = Max;
 	
 	// Measure the heading too
 	GItemColumn *Col = Columns[Index];
@@ -20,6 +20,9 @@
 #include <stdarg.h>
 #include <dirent.h>
 #include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
 
 #include "LgiDefs.h"
 #include "GFile.h"
@@ -34,6 +37,12 @@
 
 // #define FILEDEBUG
 
+#define COPY_CHUNK				(8 << 20)	// Bytes per kernel copy call
+#define COPY_CALLBACK_MS		100			// Min time between copy progress callbacks
+#ifndef FICLONE
+#define FICLONE					_IOW(0x94, 9, int)
+#endif
+
 #define FLOPPY_360K				0x0001
 #define FLOPPY_720K				0x0002
 #define FLOPPY_1_2M				0x0004
@@ -746,58 +755,235 @@ int FloppyType(int Letter)
 	return 0;
 }
 
-bool GFileSystem::Copy(char *From, char *To, int *Status, CopyFileCallback Callback, void *Token)
+// Which method to use to move the data in GFileSystem::Copy
+enum CopyMethod
 {
-	GArray<char> Buf;
-
-	if (Status)
-		*Status = 0;
+	CopyFileRange,
+	CopySendFile,
+	CopySplice,
+	CopyReadWrite,
+};
 
-	if (Buf.Length(2 << 20))
+static ssize_t CopyChunk(CopyMethod &Method, int In, int Out, size_t Len, int *Pipe, GArray<char> &Buf)
+{
+	while (true)
 	{
-		GFile In, Out;
-		if (!In.Open(From, O_READ))
+		ssize_t r = -1;
+		switch (Method)
 		{
-			if (Status)
-				*Status = In.GetError();
-			return false;
+			case CopyFileRange:
+			{
+				#ifdef __NR_copy_file_range
+				r = syscall(__NR_copy_file_range, In, NULL, Out, NULL, Len, 0);
+				#else
+				errno = ENOSYS;
+				#endif
+				break;
+			}
+			case CopySendFile:
+			{
+				r = sendfile(Out, In, NULL, Len);
+				break;
+			}
+			case CopySplice:
+			{
+				if (Pipe[0] < 0 && pipe(Pipe))
+				{
+					Pipe[0] = Pipe[1] = -1;
+					break;
+				}
+
+				r = splice(In, NULL, Pipe[1], NULL, Len, SPLICE_F_MOVE);
+				for (ssize_t Left = r; Left > 0; )
+				{
+					ssize_t w = splice(Pipe[0], NULL, Out, NULL, Left, SPLICE_F_MOVE);
+					if (w <= 0)
+						return -1; // Data is stuck in the pipe, can't fall back now
+					Left -= w;
+				}
+				break;
+			}
+			case CopyReadWrite:
+			{
+				if (Buf.Length() == 0 && !Buf.Length(2 << 20))
+					return -1;
+
+				r = read(In, Buf.AddressOf(), MIN(Len, Buf.Length()));
+				for (ssize_t Pos = 0; Pos < r; )
+				{
+					ssize_t w = write(Out, Buf.AddressOf(Pos), r - Pos);
+					if (w <= 0)
+						return -1;
+					Pos += w;
+				}
+				return r;
+			}
 		}
+
+		if (r >= 0)
+			return r;
+		if (errno == EINTR)
+			continue;
 		
-		if (!Out.Open(To, O_WRITE))
-		{
-			if (Status)
-				*Status = Out.GetError();
-			return false;
-		}
+		// If the kernel or file system doesn't support this method,
+		// drop back to the next one. The file offsets are shared so
+		// it carries on from where the last one stopped.
+		if (errno != ENOSYS &&
+			errno != EXDEV &&
+			errno != EINVAL &&
+			errno != EOPNOTSUPP &&
+			errno != EBADF)
+			return -1;
+		if (Method == CopyReadWrite)
+			return -1;
+		Method = (CopyMethod)(Method + 1);
+	}
+}
+
+bool GFileSystem::Copy(char *From, char *To, int *Status, CopyFileCallback Callback, void *Token)
+{
+	if (Status)
+		*Status = 0;
+	if (!From || !To)
+		return false;
+	if (!strcmp(From, To))
+	{
+		// Opening the destination would truncate the source.
+		if (Status)
+			*Status = EINVAL;
+		return false;
+	}
+
+	int In = open(From, O_RDONLY);
+	if (In < 0)
+	{
+		if (Status)
+			*Status = errno;
+		return false;
+	}
 
-		int64 Size = In.GetSize(), Done = 0;
-		for (int64 i=0; i<Size; i++)
+	struct stat s;
+	if (fstat(In, &s))
+	{
+		if (Status)
+			*Status = errno;
+		close(In);
+		return false;
+	}
+
+	struct stat Dst;
+	if (!stat(To, &Dst) &&
+		Dst.st_dev == s.st_dev &&
+		Dst.st_ino == s.st_ino)
+	{
+		// Same file by another name, e.g. a hard link.
+		if (Status)
+			*Status = EINVAL;
+		close(In);
+		return false;
+	}
+
+	int Out = open(To, O_WRONLY | O_CREAT | O_TRUNC, s.st_mode & 0777);
+	if (Out < 0)
+	{
+		if (Status)
+			*Status = errno;
+		close(In);
+		return false;
+	}
+
+	int64 Size = s.st_size, Done = 0;
+	bool Ok = true;
+	
+	if (Size > 0 && ioctl(Out, FICLONE, In) == 0)
+	{
+		// Copy on write file system shared the extents, nothing to copy
+		Done = Size;
+	}
+	else
+	{
+		if (Size > 0)
+			fallocate(Out, 0, 0, Size); // Just a hint, failure is fine
+
+		// Files like those in /proc report a zero size, but still have data
+		// that the kernel copy calls won't see.
+		CopyMethod Method = Size > 0 ? CopyFileRange : CopyReadWrite;
+		int Pipe[2] = {-1, -1};
+		GArray<char> Buf;
+		uint64 LastCallback = LgiCurrentTime();
+		
+		while (true)
 		{
-			int Copy = MIN(Size - i, Buf.Length());
-			int r = In.Read(&Buf[0], Copy);
-			if (r <= 0)
+			ssize_t r = CopyChunk(Method, In, Out, COPY_CHUNK, Pipe, Buf);
+			if (r < 0)
+			{
+				if (Status)
+					*Status = errno;
+				Ok = false;
+				break;
+			}
+			if (r == 0)
 				break;
-			
-			while (r > 0)
+			Done += r;
+
+			uint64 Now;
+			if (Callback &&
+				(Now = LgiCurrentTime()) - LastCallback >= COPY_CALLBACK_MS)
 			{
-				int w = Out.Write(&Buf[0], r);
-				if (w <= 0)
+				LastCallback = Now;
+				if (!Callback(Token, Done, Size))
+				{
+					if (Status)
+						*Status = ECANCELED;
+					Ok = false;
 					break;
-				
-				r -= w;
-				Done += w;
-				if (Callback)
-					Callback(Token, Done, Size);
+				}
 			}
-			
-			if (r > 0)
-				break;
 		}
-		
-		return Done == Size;
+
+		if (Pipe[0] >= 0)
+		{
+			close(Pipe[0]);
+			close(Pipe[1]);
+		}
+
+		// Trim any space preallocated but not written
+		if (Done < Size)
+			ftruncate(Out, Done);
+
+		// The source changed size or a read came up short. Files that
+		// report a zero size are copied until they run out.
+		if (Ok && Size > 0 && Done != Size)
+		{
+			if (Status)
+				*Status = EIO;
+			Ok = false;
+		}
 	}
-	
-	return false;
+
+	if (Ok)
+	{
+		if (Callback)
+			Callback(Token, Done, MAX(Size, Done));
+
+		// Preserve the ownership (if allowed), permissions and times. The
+		// owner goes first as changing it clears the set-id bits.
+		struct timespec Times[2] = { s.st_atim, s.st_mtim };
+		if (fchown(Out, s.st_uid, s.st_gid))
+			; // Not an error if we don't own the file
+		fchmod(Out, s.st_mode & 07777);
+		futimens(Out, Times);
+	}
+
+	close(In);
+	if (close(Out) && Ok)
+	{
+		if (Status)
+			*Status = errno;
+		Ok = false;
+	}
+
+	return Ok;
 }
 
 bool GFileSystem::Delete(GArray<const char*> &Files, GArray<int> *Status, bool ToTrash)
@@ -1461,6 +1647,7 @@ int64 GFile::SetPos(int64 Pos)
 			Pos, e, GetErrorName(e));
 		
 	}
+	return p;
 	#else
 	return lseek(d->hFile, Pos, SEEK_SET);
 	#endif
@@ -1079,7 +1079,8 @@ bool GApp::IsElevated()
 
 int GApp::GetCpuCount()
 {
-	return 1;
+	long Cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	return Cpus > 0 ? (int)Cpus : 1;
 }
 
 GFontCache *GApp::GetFontCache()
@@ -0,0 +1,180 @@
+#include "Lgi.h"
+#include "UnitTests.h"
+#include "LgiIde.h"
+#include "FindIndex.h"
+
+#define FIDX_TEST_QUERIES	20	// Times each query is run for the latency figure
+
+class FindIndexTestPriv
+{
+public:
+	GString IndexFile;
+	GArray<GString> Files;
+
+	FindIndexTestPriv()
+	{
+		GFile::Path p(LSP_TEMP);
+		p += "FindIndexTest.bin";
+		IndexFile = p.GetFull();
+	}
+
+	~FindIndexTestPriv()
+	{
+		FileDev->Delete(IndexFile, false);
+	}
+
+	bool ListFiles()
+	{
+		// Index Lgi's own source, found relative to this file.
+		GFile::Path Root(__FILE__);
+		if (LgiIsRelativePath(__FILE__))
+		{
+			char Cwd[MAX_PATH];
+			if (!FileDev->GetCurrentFolder(Cwd, sizeof(Cwd)))
+				return false;
+			Root = GFile::Path(Cwd, __FILE__);
+		}
+		Root--; Root--; Root--;
+
+		const char *Folders[] = {"src", "include"};
+		GArray<const char*> Ext;
+		Ext.Add("*.cpp");
+		Ext.Add("*.h");
+		Ext.Add("*.c");
+		for (unsigned i=0; i<CountOf(Folders); i++)
+		{
+			GFile::Path p = Root;
+			p += Folders[i];
+			GArray<char*> Out;
+			LgiRecursiveFileSearch(p.GetFull(), &Ext, &Out);
+			for (unsigned n=0; n<Out.Length(); n++)
+				Files.New() = Out[n];
+			Out.DeleteArrays();
+		}
+
+		return Files.Length() > 0;
+	}
+
+	/// Checks the files the index dropped really don't contain 'Text'.
+	bool Check(const char *Text, GArray<GString> &Kept)
+	{
+		LHashTbl<StrKey<char>, bool> In;
+		for (unsigned i=0; i<Kept.Length(); i++)
+			In.Add(Kept[i], true);
+
+		for (unsigned i=0; i<Files.Length(); i++)
+		{
+			if (In.Find(Files[i]))
+				continue;
+
+			GFile f;
+			if (!f.Open(Files[i], O_READ))
+				return false;
+			GString Data = f.Read();
+			if (Data.Get() && stristr(Data.Get(), Text))
+			{
+				printf("FindIndexTest: '%s' dropped but contains '%s'\n", Files[i].Get(), Text);
+				return false;
+			}
+		}
+
+		return true;
+	}
+};
+
+FindIndexTest::FindIndexTest() : UnitTest("FindIndexTest")
+{
+	d = new FindIndexTestPriv;
+}
+
+FindIndexTest::~FindIndexTest()
+{
+	DeleteObj(d);
+}
+
+bool FindIndexTest::Run()
+{
+	const char *Queries[] = {"LgiTrace", "GEventTargetThread", "OnPaint", "FindIndexTestNotThere"};
+
+	if (!d->ListFiles())
+		return FAIL(_FL, "No files to index.");
+	FileDev->Delete(d->IndexFile, false);
+
+	GArray<GString> Results[CountOf(Queries)];
+	{
+		FindIndex Idx(0, d->IndexFile);
+
+		uint64 Start = LgiCurrentTime();
+		for (unsigned i=0; i<d->Files.Length(); i++)
+			Idx.OnFile(d->Files[i], FindSymbolSystem::FileAdd);
+		if (!Idx.WaitIdle(60000))
+			return FAIL(_FL, "Indexing timed out.");
+		uint64 Build = LgiCurrentTime() - Start;
+
+		Start = LgiCurrentTime();
+		if (!Idx.Save())
+			return FAIL(_FL, "Save failed.");
+		uint64 SaveTime = LgiCurrentTime() - Start;
+
+		printf("FindIndexTest: files=%i build=%ims save=%ims size=%iKB\n",
+			(int)d->Files.Length(), (int)Build, (int)SaveTime,
+			(int)(LgiFileSize(d->IndexFile) >> 10));
+
+		// What the index saves: reading and searching every file.
+		Start = LgiMicroTime();
+		int Hits = 0;
+		for (unsigned i=0; i<d->Files.Length(); i++)
+		{
+			GFile f;
+			GString Data;
+			if (f.Open(d->Files[i], O_READ) && (Data = f.Read()).Get() && stristr(Data.Get(), Queries[0]))
+				Hits++;
+		}
+		printf("FindIndexTest: scan of all files for '%s' hits=%i time=%ius\n",
+			Queries[0], Hits, (int)(LgiMicroTime() - Start));
+
+		for (unsigned q=0; q<CountOf(Queries); q++)
+		{
+			uint64 Time = 0;
+			for (int n=0; n<FIDX_TEST_QUERIES; n++)
+			{
+				GArray<GString> Files = d->Files;
+				Start = LgiMicroTime();
+				if (!Idx.Filter(Queries[q], Files))
+					return FAIL(_FL, "Filter failed.");
+				Time += LgiMicroTime() - Start;
+				Results[q] = Files;
+			}
+
+			printf("FindIndexTest: query='%s' kept=%i/%i latency=%ius\n",
+				Queries[q], (int)Results[q].Length(), (int)d->Files.Length(),
+				(int)(Time / FIDX_TEST_QUERIES));
+
+			if (!d->Check(Queries[q], Results[q]))
+				return FAIL(_FL, "Index dropped a matching file.");
+		}
+
+		if (Results[CountOf(Queries)-1].Length() != 0)
+			return FAIL(_FL, "Missing text should match no files.");
+	}
+
+	// Reload the saved index and check it gives the same answers.
+	{
+		FindIndex Idx(0, d->IndexFile);
+		uint64 Start = LgiCurrentTime();
+		if (!Idx.WaitIdle(60000))
+			return FAIL(_FL, "Loading timed out.");
+		printf("FindIndexTest: load=%ims\n", (int)(LgiCurrentTime() - Start));
+
+		for (unsigned q=0; q<CountOf(Queries); q++)
+		{
+			GArray<GString> Files = d->Files;
+			if (!Idx.Filter(Queries[q], Files))
+				return FAIL(_FL, "Filter failed after reload.");
+			if (Files.Length() != Results[q].Length())
+				return FAIL(_FL, "Reloaded index gives different results.");
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,173 @@
+#include "Lgi.h"
+#include "UnitTests.h"
+
+#define ALPHA_TEST_MAX_PX		37
+
+class GAlphaTestPriv
+{
+public:
+	GColour c;
+	GArray<uint8> Cov;
+
+	GAlphaTestPriv() : c(23, 201, 142)
+	{
+	}
+
+	/// d * (255 - a) + c * a, rounded
+	static int Blend(int d, int c, int a)
+	{
+		return (d * (255 - a) + c * a + 127) / 255;
+	}
+
+	/// Compares a channel that's 'Bits' wide with the 8 bit 'Expected'.
+	static bool Near(int Value, int Bits, int Expected)
+	{
+		int Shift = 8 - Bits;
+		return abs(Value - (Expected >> Shift)) <= 1;
+	}
+
+	static int To8(int v, int Bits)
+	{
+		if (Bits == 5)
+			return G5bitTo8bit(v);
+		if (Bits == 6)
+			return G6bitTo8bit(v);
+		return v;
+	}
+
+	static int AlphaOf(GRgba32 &p) { return p.a; }
+	static int AlphaOf(GBgra32 &p) { return p.a; }
+	static int AlphaOf(GArgb32 &p) { return p.a; }
+	static int AlphaOf(GAbgr32 &p) { return p.a; }
+	template<typename Px>
+	static int AlphaOf(Px &p) { return -1; }
+
+	/// Fills in the coverage for a row of 'Px' pixels. There are whole groups
+	/// of 4 at 255 and 0 for the SSE2 path, and the rest is mixed.
+	void MakeCoverage(int Px)
+	{
+		Cov.Length(Px);
+		for (int i=0; i<Px; i++)
+		{
+			if (i >= 4 && i < 8)
+				Cov[i] = 255;
+			else if (i >= 8 && i < 12)
+				Cov[i] = 0;
+			else if (i % 5 == 0)
+				Cov[i] = 255;
+			else if (i % 5 == 1)
+				Cov[i] = 0;
+			else
+				Cov[i] = (uint8)LgiRand(256);
+		}
+	}
+
+	/// Blends rows of every length up to ALPHA_TEST_MAX_PX, with and without
+	/// coverage, and checks each pixel against a reference blend.
+	template<typename Px, int RBits, int GBits, int BBits>
+	GString Check(GColourSpace Cs)
+	{
+		GString Err;
+		Px Buf[ALPHA_TEST_MAX_PX + 1], Old[ALPHA_TEST_MAX_PX + 1];
+
+		for (int Len=1; Len<=ALPHA_TEST_MAX_PX; Len++)
+		{
+			for (int HasCov=0; HasCov<2; HasCov++)
+			{
+				uint8 *b = (uint8*)Buf;
+				for (unsigned i=0; i<sizeof(Buf); i++)
+					b[i] = (uint8)LgiRand(256);
+				memcpy(Old, Buf, sizeof(Buf));
+				MakeCoverage(Len);
+
+				if (!LgiBlendCoverage((uint8*)Buf, Cs, HasCov ? &Cov[0] : NULL, Len, c))
+				{
+					Err.Printf("%s not supported", GColourSpaceToString(Cs));
+					return Err;
+				}
+
+				if (memcmp(Buf + Len, Old + Len, sizeof(Px)))
+				{
+					Err.Printf("%s len=%i wrote past the end", GColourSpaceToString(Cs), Len);
+					return Err;
+				}
+
+				for (int i=0; i<Len; i++)
+				{
+					int a = HasCov ? Cov[i] : 255;
+					Px &n = Buf[i], &o = Old[i];
+					bool Ok =	Near(n.r, RBits, Blend(To8(o.r, RBits), c.r(), a)) &&
+								Near(n.g, GBits, Blend(To8(o.g, GBits), c.g(), a)) &&
+								Near(n.b, BBits, Blend(To8(o.b, BBits), c.b(), a));
+
+					// Opaque where the colour is all there, otherwise left alone
+					int Alpha = AlphaOf(n);
+					if (Alpha >= 0 && Alpha != (a == 255 ? 255 : AlphaOf(o)))
+						Ok = false;
+
+					if (!Ok)
+					{
+						Err.Printf("%s len=%i px=%i cov=%i: %i,%i,%i,%i -> %i,%i,%i,%i",
+							GColourSpaceToString(Cs), Len, i, a,
+							o.r, o.g, o.b, AlphaOf(o),
+							n.r, n.g, n.b, Alpha);
+						return Err;
+					}
+				}
+			}
+		}
+
+		return Err;
+	}
+};
+
+GAlphaTest::GAlphaTest() : UnitTest("GAlphaTest")
+{
+	d = new GAlphaTestPriv;
+}
+
+GAlphaTest::~GAlphaTest()
+{
+	DeleteObj(d);
+}
+
+bool GAlphaTest::Run()
+{
+	return BlendCoverage();
+}
+
+bool GAlphaTest::BlendCoverage()
+{
+	GString::Array Errs;
+	#define Test(cs, r, g, b) \
+		Errs.New() = d->Check<G##cs, r, g, b>(Cs##cs)
+
+	Test(Rgb16, 5, 6, 5);
+	Test(Bgr16, 5, 6, 5);
+	Test(Rgb24, 8, 8, 8);
+	Test(Bgr24, 8, 8, 8);
+	Test(Rgbx32, 8, 8, 8);
+	Test(Bgrx32, 8, 8, 8);
+	Test(Xrgb32, 8, 8, 8);
+	Test(Xbgr32, 8, 8, 8);
+	Test(Rgba32, 8, 8, 8);
+	Test(Bgra32, 8, 8, 8);
+	Test(Argb32, 8, 8, 8);
+	Test(Abgr32, 8, 8, 8);
+	#undef Test
+
+	for (unsigned i=0; i<Errs.Length(); i++)
+	{
+		if (Errs[i])
+			return FAIL(_FL, Errs[i].Get());
+	}
+
+	// Nothing to do is fine, an unknown colour space isn't
+	uint8 Px[4] = {0};
+	if (!LgiBlendCoverage(Px, CsRgba32, NULL, 0, d->c))
+		return FAIL(_FL, "Zero length row failed.");
+	if (LgiBlendCoverage(Px, CsIndex8, NULL, 1, d->c))
+		return FAIL(_FL, "Blending into 8 bit indexed pixels should fail.");
+
+	return true;
+}
@@ -151,6 +151,48 @@ public:
 
 		return true;
 	}
+
+	bool Test3()
+	{
+		// Copies share their values until one of them is changed
+		GCss a, b;
+		const char *s = "color: #ff0000; margin-left: 5px;";
+		if (!a.Parse(s))
+			return Error("Error: Parse error %s:%i\n", _FL);
+		b = a;
+		if (b.PropAddress(GCss::PropColor) != a.PropAddress(GCss::PropColor))
+			return Error("Error: Values not shared %s:%i\n", _FL);
+
+		b.MarginLeft(GCss::Len(GCss::LenPx, 6.0f));
+		if (!LenIs(a.MarginLeft(), 5, GCss::LenPx) ||
+			!LenIs(b.MarginLeft(), 6, GCss::LenPx))
+			return Error("Error: Change not copied %s:%i\n", _FL);
+		if (b.PropAddress(GCss::PropColor) == a.PropAddress(GCss::PropColor))
+			return Error("Error: Values still shared %s:%i\n", _FL);
+
+		// Identical styles share through a pool, whatever the order
+		GCss::StylePool Pool;
+		GCss x, y, z;
+		const char *sx = "color: red; border-left: 1px solid blue;";
+		const char *sy = "border-left: 1px solid blue; color: red;";
+		const char *sz = "color: red; border-left: 1px solid green;";
+		if (!x.Parse(sx) || !y.Parse(sy) || !z.Parse(sz))
+			return Error("Error: Parse error %s:%i\n", _FL);
+		if (Pool.Share(x))
+			return Error("Error: Nothing to share with %s:%i\n", _FL);
+		if (!Pool.Share(y) ||
+			y.PropAddress(GCss::PropColor) != x.PropAddress(GCss::PropColor))
+			return Error("Error: Identical style not shared %s:%i\n", _FL);
+		if (Pool.Share(z))
+			return Error("Error: Different border shared %s:%i\n", _FL);
+
+		// Changing a pooled style mustn't change the others
+		y.Color(GCss::ColorDef(GCss::ColorRgb, Rgb32(0, 0, 255)));
+		if (x.Color().Rgb32 != Rgb32(255, 0, 0))
+			return Error("Error: Shared style changed %s:%i\n", _FL);
+
+		return true;
+	}
 };
 
 GCssTest::GCssTest() : UnitTest("GCssTest")
@@ -166,5 +208,6 @@ GCssTest::~GCssTest()
 bool GCssTest::Run()
 {
 	return	d->Test1() &&
-			d->Test2();
+			d->Test2() &&
+			d->Test3();
 }
\ No newline at end of file
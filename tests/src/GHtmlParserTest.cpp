@@ -0,0 +1,183 @@
+#include "Lgi.h"
+#include "UnitTests.h"
+#include "GHtmlParser.h"
+
+// Keeps the attributes in the order the parser sets them, so two trees can be
+// compared as text.
+class GHtmlParserTestElem : public GHtmlElement
+{
+public:
+	GString::Array Attr;
+
+	GHtmlParserTestElem(GHtmlElement *parent) : GHtmlElement(parent)
+	{
+	}
+
+	bool Get(const char *attr, const char *&val)
+	{
+		if (!attr)
+			return false;
+
+		size_t Len = strlen(attr);
+		for (unsigned i=0; i<Attr.Length(); i++)
+		{
+			GString &a = Attr[i];
+			if (!strnicmp(a, attr, Len) && a(Len) == '=')
+			{
+				val = a.Get() + Len + 1;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void Set(const char *attr, const char *val)
+	{
+		if (!attr)
+			return;
+
+		GString s;
+		s.Printf("%s=%s", attr, val ? val : "");
+		Attr.New() = s;
+	}
+};
+
+class GHtmlParserTestParser : public GHtmlParser
+{
+public:
+	GHtmlParserTestParser() : GHtmlParser(NULL)
+	{
+	}
+
+	GHtmlElement *CreateElement(GHtmlElement *Parent)
+	{
+		return new GHtmlParserTestElem(Parent);
+	}
+};
+
+class GHtmlParserTestPriv
+{
+public:
+	GHtmlStaticInst Inst;
+
+	/// Writes out the tree under 'e', one element per line.
+	void Dump(GStringPipe &p, GHtmlElement *e, int Depth = 0)
+	{
+		GHtmlParserTestElem *t = dynamic_cast<GHtmlParserTestElem*>(e);
+		p.Print("%*s<%s:%i", Depth * 2, "", e->Tag ? e->Tag.Get() : "", e->TagId);
+		if (t)
+		{
+			for (unsigned i=0; i<t->Attr.Length(); i++)
+				p.Print(" %s", t->Attr[i].Get());
+		}
+		p.Print(">");
+		if (e->GetText())
+		{
+			GAutoString u(WideToUtf8(e->GetText()));
+			p.Print("'%s'", u.Get());
+		}
+		p.Print("\n");
+		for (unsigned i=0; i<e->Children.Length(); i++)
+			Dump(p, e->Children[i], Depth + 1);
+	}
+
+	GString Whole(const char *Doc)
+	{
+		GHtmlParserTestParser Parser;
+		GHtmlParserTestElem Root(NULL);
+		GStringPipe p;
+		if (Parser.Parse(&Root, Doc))
+			Dump(p, &Root);
+		return p.NewGStr();
+	}
+
+	GString Chunked(const char *Doc, int Size)
+	{
+		GHtmlParserTestParser Parser;
+		GHtmlParserTestElem Root(NULL);
+		GStringPipe p;
+		if (!Parser.ParseBegin(&Root))
+			return GString();
+
+		ssize_t Len = strlen(Doc);
+		for (ssize_t i=0; i<Len; i+=Size)
+		{
+			if (!Parser.ParseChunk(Doc + i, MIN(Size, Len - i)))
+				return GString();
+		}
+		if (Parser.ParseEnd())
+			Dump(p, &Root);
+		return p.NewGStr();
+	}
+};
+
+GHtmlParserTest::GHtmlParserTest() : UnitTest("GHtmlParserTest")
+{
+	d = new GHtmlParserTestPriv;
+}
+
+GHtmlParserTest::~GHtmlParserTest()
+{
+	DeleteObj(d);
+}
+
+bool GHtmlParserTest::Run()
+{
+	return Chunked();
+}
+
+bool GHtmlParserTest::Chunked()
+{
+	// Things mail clients send that are easy to split in the wrong place.
+	const char *Doc =
+		"<!DOCTYPE html PUBLIC \"-//W3C//DTD HTML 4.0 Transitional//EN\">\n"
+		"<html xmlns:o=\"urn:schemas-microsoft-com:office:office\">\n"
+		"<head>\n"
+		"<meta http-equiv=Content-Type content=\"text/html; charset=utf-8\">\n"
+		"<style><!--\n"
+		"p.MsoNormal { margin: 0cm; font-size: 11.0pt }\n"
+		"a:link > span { color: blue }\n"
+		"--></style>\n"
+		"<script type=\"text/javascript\">if (a < b && c > d) s = \"</p>\";</script>\n"
+		"</head>\n"
+		"<body lang=EN-AU link=blue vlink=purple>\n"
+		"<!-- <p>Not a paragraph</p> -->\n"
+		"<?xml:namespace prefix = o ns = \"urn:schemas-microsoft-com:office:office\" />\n"
+		"<div class=WordSection1>\n"
+		"<p class=MsoNormal>Hi Bob,<o:p></o:p></p>\n"
+		"<p class=MsoNormal title='a > b'>Is 3 &lt; 4 &amp; 5 &gt; 2?\n"
+		"<p>Unclosed paragraph with <b>bold <i>and italic</b> text\n"
+		"<![if !supportLists]><span>1.</span><![endif]>\n"
+		"<table border=1 cellpadding=0>\n"
+		"<tr><td>One<td>Two\n"
+		"<tr><td colspan=2><img src=\"cid:image001.png@01D1\" width=10 height=10>Three\n"
+		"</table>\n"
+		"<pre>  line one\n"
+		"\tline &amp; two\n"
+		"</pre>\n"
+		"<ul><li>First<li>Second</ul>\n"
+		"<br><br/><hr noshade>\n"
+		"<a href=\"http://example.com/?a=1&amp;b=2\">link</a>\n"
+		"</div>\n"
+		"</body>\n"
+		"</html>\n";
+
+	GString Expected = d->Whole(Doc);
+	if (!Expected)
+		return FAIL(_FL, "Parse failed.");
+
+	int Sizes[] = {1, 2, 3, 5, 8, 13, 64, 1000};
+	for (unsigned i=0; i<CountOf(Sizes); i++)
+	{
+		GString Result = d->Chunked(Doc, Sizes[i]);
+		if (!Result)
+			return FAIL(_FL, "Chunked parse failed.");
+		if (Result != Expected)
+		{
+			printf("GHtmlParserTest: chunk size %i gave:\n%s\nexpected:\n%s\n", Sizes[i], Result.Get(), Expected.Get());
+			return FAIL(_FL, "Chunked parse is different to the whole document.");
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,418 @@
+#include "Lgi.h"
+#include "UnitTests.h"
+#include "GWordStore.h"
+
+#define WORDS_TEST_TEXT			(1 << 20)	// Bytes of generated text
+#define WORDS_TEST_PASSES		20			// Tokenise passes for the benchmark
+
+static int WordsTestCmp(GString *a, GString *b)
+{
+	return strcmp(a->Get(), b->Get());
+}
+
+class GWordStoreTestPriv
+{
+public:
+	GArray<GString> Files;
+	uint32 Seed;
+
+	GWordStoreTestPriv()
+	{
+		Seed = 1;
+	}
+
+	~GWordStoreTestPriv()
+	{
+		const char *Ext[] = {"", ".log", ".log.old", ".tmp", ".v1"};
+		for (unsigned i=0; i<Files.Length(); i++)
+			for (unsigned n=0; n<CountOf(Ext); n++)
+				FileDev->Delete(Files[i] + Ext[n], false);
+	}
+
+	GString TempFile(const char *Leaf)
+	{
+		GFile::Path p(LSP_TEMP);
+		p += Leaf;
+		GString f = p.GetFull();
+		Files.Add(f);
+		return f;
+	}
+
+	uint32 Rand(uint32 Max)
+	{
+		Seed = Seed * 1103515245 + 12345;
+		return (Seed >> 8) % Max;
+	}
+
+	/// Text with words of all lengths, punctuation and UTF-8 mixed in.
+	GString MakeText(size_t Len)
+	{
+		const char *Punct = " \t\r\n.,;:!?()<>\"-'$";
+		GString s;
+		s.Length(Len);
+		char *p = s.Get();
+		for (size_t i=0; i<Len; )
+		{
+			uint32 r = Rand(100);
+			if (r < 70)
+			{
+				int Run = 1 + Rand(20);
+				for (int n=0; n<Run && i<Len; n++)
+				{
+					uint32 c = Rand(64);
+					p[i++] = c < 26 ? 'a' + c : c < 52 ? 'A' + c - 26 : c < 62 ? '0' + c - 52 : (char)(0x80 + Rand(0x80));
+				}
+			}
+			else if (r < 72)
+			{
+				// Long runs for the 16 byte paths
+				int Run = 16 + Rand(40);
+				for (int n=0; n<Run && i<Len; n++)
+					p[i++] = 'A' + Rand(26);
+			}
+			else
+				p[i++] = Punct[Rand((uint32)strlen(Punct))];
+		}
+		p[Len] = 0;
+		return s;
+	}
+
+	/// A plain byte at a time tokeniser to check GWordTokens against.
+	void Reference(const char *s, GArray<GString> &Out)
+	{
+		GArray<GString> All;
+		while (*s)
+		{
+			while (*s && !IsWord((uchar)*s))
+				s++;
+			const char *Start = s;
+			while (*s && IsWord((uchar)*s))
+				s++;
+			if (s == Start)
+				continue;
+
+			const char *a = Start, *b = s;
+			while (a < b && (*a == '-' || *a == '\''))
+				a++;
+			while (b > a && (b[-1] == '-' || b[-1] == '\''))
+				b--;
+			if (b - a >= 3 && b - a <= 40)
+			{
+				GString w(a, b - a);
+				for (char *c = w.Get(); *c; c++)
+					if (*c >= 'A' && *c <= 'Z')
+						*c += 'a' - 'A';
+				All.Add(w);
+			}
+		}
+
+		All.Sort(WordsTestCmp);
+		for (unsigned i=0; i<All.Length(); i++)
+			if (!Out.Length() || strcmp(Out.Last(), All[i]))
+				Out.Add(All[i]);
+	}
+
+	bool IsWord(uchar c)
+	{
+		return	c >= 0x80 ||
+				(c >= 'a' && c <= 'z') ||
+				(c >= 'A' && c <= 'Z') ||
+				(c >= '0' && c <= '9') ||
+				c == '-' || c == '\'' || c == '$';
+	}
+};
+
+GWordStoreTest::GWordStoreTest() : UnitTest("GWordStoreTest")
+{
+	d = new GWordStoreTestPriv;
+}
+
+GWordStoreTest::~GWordStoreTest()
+{
+	DeleteObj(d);
+}
+
+bool GWordStoreTest::Run()
+{
+	// Tokenise
+	GWordTokens t;
+	const char *Expect[] = {"$100", "a-b", "abcdefghijklmnopqrstuvwxyz0123456789", "dash", "don't", "hello", "na\xc3\xafve", "world"};
+	t.Tokenise("Hello, hello WORLD! a-b ab don't --dash-- $100 na\xc3\xafve x "
+				"ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 "
+				"abcdefghijklmnopqrstuvwxyzabcdefghijklmnopq");
+	if (t.Length() != CountOf(Expect))
+		return FAIL(_FL, "Wrong number of tokens.");
+	for (unsigned i=0; i<CountOf(Expect); i++)
+		if (strcmp(t[i], Expect[i]))
+			return FAIL(_FL, "Wrong token.");
+
+	t.Tokenise("zebra hello", -1, true);
+	if (t.Length() != CountOf(Expect) + 1 || strcmp(t[t.Length()-1], "zebra"))
+		return FAIL(_FL, "Append failed.");
+
+	GString Text = d->MakeText(WORDS_TEST_TEXT);
+	GArray<GString> Ref;
+	d->Reference(Text, Ref);
+	t.Tokenise(Text, Text.Length());
+	if (t.Length() != Ref.Length())
+		return FAIL(_FL, "Token count differs from the reference.");
+	for (unsigned i=0; i<Ref.Length(); i++)
+		if (strcmp(t[i], Ref[i]))
+			return FAIL(_FL, "Token differs from the reference.");
+
+	uint64 Start = LgiMicroTime();
+	for (int i=0; i<WORDS_TEST_PASSES; i++)
+		t.Tokenise(Text, Text.Length());
+	uint64 Time = LgiMicroTime() - Start;
+	printf("GWordStoreTest: tokenise %i MB/s (%i unique words)\n",
+		(int)((uint64)WORDS_TEST_TEXT * WORDS_TEST_PASSES / MAX(Time, 1)),
+		(int)t.Length());
+
+	// GetWordCounts, against the sorted file and the overlay
+	GWordStore Store(d->TempFile("GWordStoreTest.words"));
+	Store.Empty();
+	char w[32];
+	for (int i=0; i<2000; i+=2)
+	{
+		sprintf_s(w, sizeof(w), "word%4.4i", i);
+		Store.SetWordCount(w, i + 1);
+	}
+	if (!Store.Compact())
+		return FAIL(_FL, "Compact failed.");
+	Store.SetWordCount("word0010", 99);
+	Store.SetWordCount("word0011", 5);
+	Store.Insert("Extra");
+
+	GString Query = "extra word0000 WORD0010 word0011 word0013 word1998 word1999 word0500 missing";
+	t.Tokenise(Query);
+	GArray<int64> Counts;
+	if (!Store.GetWordCounts(t, Counts) || Counts.Length() != t.Length())
+		return FAIL(_FL, "GetWordCounts failed.");
+	for (unsigned i=0; i<t.Length(); i++)
+	{
+		if (Counts[i] != Store.GetWordCount(t[i]))
+			return FAIL(_FL, "GetWordCounts differs from GetWordCount.");
+	}
+	if (Store.GetWordCount("word0010") != 99 ||
+		Store.GetWordCount("word0011") != 5 ||
+		Store.GetWordCount("word0013") != 0 ||
+		Store.GetWordCount("word1998") != 1999 ||
+		Store.GetWordCount("extra") != 1)
+		return FAIL(_FL, "Wrong word count.");
+
+	// Classify
+	GWordStore Spam(d->TempFile("GWordStoreTest.spam")), Ham(d->TempFile("GWordStoreTest.ham"));
+	Spam.Empty();
+	Ham.Empty();
+	const char *SpamWords[] = {"viagra", "lottery", "winner", "prize", "click", "free"};
+	const char *HamWords[] = {"meeting", "agenda", "project", "report", "thanks", "tomorrow"};
+	for (unsigned i=0; i<CountOf(SpamWords); i++)
+	{
+		Spam.SetWordCount(SpamWords[i], 40);
+		Ham.SetWordCount(HamWords[i], 40);
+	}
+	Spam.SetWordCount("hello", 20);
+	Ham.SetWordCount("hello", 10);
+	Spam.SetItems(50);
+	Ham.SetItems(50);
+
+	double s = GWordStore::Classify(&Spam, &Ham, "Click here, you are a WINNER of our free lottery prize! hello");
+	double h = GWordStore::Classify(&Spam, &Ham, "Thanks for the report, the project meeting agenda is for tomorrow. hello");
+	double u = GWordStore::Classify(&Spam, &Ham, "");
+	printf("GWordStoreTest: spam=%.3f ham=%.3f empty=%.3f\n", s, h, u);
+	if (s < 0.9)
+		return FAIL(_FL, "Spam not detected.");
+	if (h > 0.1)
+		return FAIL(_FL, "Ham classified as spam.");
+	if (u != 0.5)
+		return FAIL(_FL, "No words should be neutral.");
+
+	GWordTokens Buf;
+	GString Msg = Text(0, 4096);
+	Start = LgiMicroTime();
+	for (int i=0; i<1000; i++)
+		GWordStore::Classify(&Store, &Spam, Msg, Msg.Length(), &Buf);
+	Time = LgiMicroTime() - Start;
+	printf("GWordStoreTest: classify 4KB message %ius\n", (int)(Time / 1000));
+
+	return	LogReplay() &&
+			ImportV1() &&
+			BackgroundCompact() &&
+			Iterate();
+}
+
+bool GWordStoreTest::LogReplay()
+{
+	GString File = d->TempFile("GWordStoreTest.replay");
+	{
+		GWordStore s(File);
+		s.Empty();
+		s.SetWordCount("alpha", 3);
+		s.SetWordCount("beta", 4);
+		if (!s.Compact())
+			return FAIL(_FL, "Compact failed.");
+
+		// These only go to the log
+		s.SetWordCount("alpha", 7);
+		s.SetWordCount("beta", 0);
+		s.Insert("Gamma");
+		s.SetItems(12);
+		if (!s.Serialize(File, false))
+			return FAIL(_FL, "Save failed.");
+	}
+	if (!FileExists(File + ".log"))
+		return FAIL(_FL, "The changes weren't logged.");
+
+	GWordStore s(File);
+	if (s.GetWordCount("alpha") != 7 ||
+		s.GetWordCount("beta") != 0 ||
+		s.GetWordCount("gamma") != 1)
+		return FAIL(_FL, "Wrong word count after replaying the log.");
+	if (s.GetItems() != 12 || s.Length() != 2)
+		return FAIL(_FL, "Wrong totals after replaying the log.");
+
+	return true;
+}
+
+bool GWordStoreTest::ImportV1()
+{
+	GString File = d->TempFile("GWordStoreTest.text");
+	{
+		GFile f;
+		if (!f.Open(File, O_WRITE))
+			return FAIL(_FL, "Can't create the text store.");
+		f.SetSize(0);
+		f.Print("GWordStore v1.00 Items=9, Words=3\nZebra,2\napple,5\nMixedCase,1\n");
+	}
+
+	{
+		GWordStore s(File);
+		if (s.GetItems() != 9 || s.Length() != 3)
+			return FAIL(_FL, "Wrong totals after converting.");
+		if (s.GetWordCount("zebra") != 2 ||
+			s.GetWordCount("apple") != 5 ||
+			s.GetWordCount("MIXEDCASE") != 1)
+			return FAIL(_FL, "Wrong word count after converting.");
+		if (!FileExists(File + ".v1"))
+			return FAIL(_FL, "The text store wasn't kept.");
+	}
+
+	// The converted file loads by itself
+	FileDev->Delete(File + ".v1", false);
+	GWordStore s(File);
+	if (s.GetItems() != 9 || s.GetWordCount("apple") != 5)
+		return FAIL(_FL, "The converted store didn't load.");
+
+	return true;
+}
+
+bool GWordStoreTest::BackgroundCompact()
+{
+	GString File = d->TempFile("GWordStoreTest.bg");
+	GWordStore s(File);
+	s.Empty();
+
+	// Fewer words than start a compaction by themselves
+	const int Words = 20000;
+	char w[32];
+	for (int i=0; i<Words; i++)
+	{
+		sprintf_s(w, sizeof(w), "bg%6.6i", i);
+		s.SetWordCount(w, i + 1);
+	}
+	if (!s.Compact(true))
+		return FAIL(_FL, "Background compact failed.");
+
+	// Change words while it runs, they stay in the overlay
+	for (int i=0; i<Words; i+=7)
+	{
+		sprintf_s(w, sizeof(w), "bg%6.6i", i);
+		s.SetWordCount(w, i % 2 ? 0 : i + 2);
+	}
+
+	int Expect = 0;
+	for (int i=0; i<Words; i++)
+	{
+		sprintf_s(w, sizeof(w), "bg%6.6i", i);
+		int Count = i % 7 ? i + 1 : i % 2 ? 0 : i + 2;
+		if (s.GetWordCount(w) != Count)
+			return FAIL(_FL, "Wrong word count while compacting.");
+		if (Count)
+			Expect++;
+	}
+	if (s.Length() != Expect)
+		return FAIL(_FL, "Wrong length while compacting.");
+
+	if (!s.Compact())
+		return FAIL(_FL, "Compact failed.");
+	if (FileExists(File + ".log.old"))
+		return FAIL(_FL, "The old log wasn't removed.");
+
+	GWordStore r(File);
+	if (r.Length() != Expect)
+		return FAIL(_FL, "Wrong length after reopening.");
+	for (int i=0; i<Words; i+=3)
+	{
+		sprintf_s(w, sizeof(w), "bg%6.6i", i);
+		int Count = i % 7 ? i + 1 : i % 2 ? 0 : i + 2;
+		if (r.GetWordCount(w) != Count)
+			return FAIL(_FL, "Wrong word count after reopening.");
+	}
+
+	return true;
+}
+
+bool GWordStoreTest::Iterate()
+{
+	const char *Expect[] = {"apple", "melon", "pear", "plum"};
+
+	// No file to compact into, the overlay is iterated directly
+	GWordStore Mem;
+	Mem.SetWordCount("Pear", 2);
+	Mem.SetWordCount("apple", 1);
+	Mem.SetWordCount("fig", 3);
+	Mem.SetWordCount("fig", 0);
+	Mem.SetWordCount("plum", 1);
+	Mem.Insert("MELON");
+	if (Mem.Length() != CountOf(Expect))
+		return FAIL(_FL, "Wrong length.");
+	unsigned n = 0;
+	for (const char *k = Mem.First(); k; k = Mem.Next(), n++)
+		if (n >= CountOf(Expect) || strcmp(k, Expect[n]))
+			return FAIL(_FL, "Wrong word iterating the overlay.");
+	if (n != CountOf(Expect))
+		return FAIL(_FL, "Missing words iterating the overlay.");
+
+	// Compacting fails, so the sorted file and the overlay are merged
+	GString File = d->TempFile("GWordStoreTest.iter");
+	{
+		GWordStore s(File);
+		s.Empty();
+		s.SetWordCount("apple", 1);
+		s.SetWordCount("fig", 1);
+		s.SetWordCount("pear", 1);
+		if (!s.Compact())
+			return FAIL(_FL, "Compact failed.");
+	}
+
+	GFile::Path Bad(LSP_TEMP);
+	Bad += "GWordStoreTest.missing";
+	Bad += "GWordStoreTest.words";
+	GWordStore s(File);
+	s.SetFile(Bad.GetFull());
+	s.SetWordCount("fig", 0);
+	s.SetWordCount("plum", 1);
+	s.SetWordCount("melon", 1);
+	if (s.Compact())
+		return FAIL(_FL, "Compact should fail without a folder.");
+	if (s.Length() != CountOf(Expect))
+		return FAIL(_FL, "Wrong length.");
+	n = 0;
+	for (const char *k = s.First(); k; k = s.Next(), n++)
+		if (n >= CountOf(Expect) || strcmp(k, Expect[n]))
+			return FAIL(_FL, "Wrong word iterating the merged view.");
+	if (n != CountOf(Expect))
+		return FAIL(_FL, "Missing words iterating the merged view.");
+
+	return true;
+}
@@ -0,0 +1,395 @@
+#include "Lgi.h"
+#include "UnitTests.h"
+#include "LDbTable.h"
+
+#define DBTABLE_TEST_ROWS		4000	// Rows added before the random edits
+#define DBTABLE_TEST_EDITS		6000	// Random edits, deletes and inserts
+
+enum DbTableTestFields
+{
+	DbTestUid = 100,
+	DbTestInt,
+	DbTestStr,
+	DbTestDate,
+};
+
+class LDbTableTestPriv
+{
+public:
+	GString File;
+	uint32 Seed;
+	int64 NextUid;
+	GArray<LDbRow*> Live;	// Rows in the table, in no order
+
+	LDbTableTestPriv()
+	{
+		GFile::Path p(LSP_TEMP);
+		p += "LDbTableTest.db";
+		File = p.GetFull();
+		Seed = 1;
+		NextUid = 0;
+	}
+
+	~LDbTableTestPriv()
+	{
+		FileDev->Delete(File, false);
+		FileDev->Delete(File + ".idx", false);
+	}
+
+	uint32 Rand(uint32 Max)
+	{
+		Seed = Seed * 1103515245 + 12345;
+		return (Seed >> 8) % Max;
+	}
+
+	/// Short words from a few letters, so there are lots of duplicates and
+	/// shared prefixes. Some rows have no string at all.
+	void SetRandom(LDbRow *r)
+	{
+		r->SetInt(DbTestInt, (int)Rand(1000) - 500);
+
+		char s[16];
+		int Len = Rand(7);
+		for (int i=0; i<Len; i++)
+		{
+			char c = 'a' + Rand(4);
+			s[i] = Rand(2) ? c - 'a' + 'A' : c;
+		}
+		s[Len] = 0;
+		r->SetStr(DbTestStr, Len ? s : NULL);
+
+		LDateTime dt;
+		dt.Year(2000 + Rand(20));
+		dt.Month(1 + Rand(12));
+		dt.Day(1 + Rand(28));
+		dt.Hours(Rand(24));
+		dt.Minutes(Rand(60));
+		dt.Seconds(Rand(60));
+		r->SetDate(DbTestDate, &dt);
+	}
+
+	LDbRow *Add(LDbTable &t)
+	{
+		LDbRow *r = t.NewRow();
+		if (!r)
+			return NULL;
+		r->SetInt(DbTestUid, NextUid++);
+		SetRandom(r);
+		Live.Add(r);
+		return r;
+	}
+
+	const char *Str(LDbRow *r)
+	{
+		const char *s = r->GetStr(DbTestStr);
+		return s ? s : "";
+	}
+
+	int64 Key(LDbRow *r, int Id)
+	{
+		if (Id == DbTestInt)
+			return r->GetInt(Id);
+		uint64 t;
+		LDateTime *dt = r->GetDate(Id);
+		return dt && dt->IsValid() && dt->Get(t) ? t : 0;
+	}
+
+	/// Compares the values of field 'Id' the way the index does.
+	int Compare(LDbRow *a, LDbRow *b, int Id)
+	{
+		if (Id == DbTestStr)
+			return stricmp(Str(a), Str(b));
+		int64 ka = Key(a, Id), kb = Key(b, Id);
+		return ka < kb ? -1 : ka > kb;
+	}
+
+	/// Checks 'Rows' has 'Expect' different rows, in order of field 'Id'.
+	bool CheckOrder(GArray<LDbRow*> &Rows, size_t Expect, int Id)
+	{
+		if (Rows.Length() != Expect)
+			return false;
+
+		GArray<bool> Seen;
+		Seen.Length((size_t)NextUid);
+		for (unsigned i=0; i<Rows.Length(); i++)
+		{
+			int64 Uid = Rows[i]->GetInt(DbTestUid);
+			if (Uid < 0 || Uid >= NextUid || Seen[(size_t)Uid])
+				return false;
+			Seen[(size_t)Uid] = true;
+			if (i && Compare(Rows[i-1], Rows[i], Id) > 0)
+				return false;
+		}
+		return true;
+	}
+
+	void Uids(GArray<LDbRow*> &Rows, GArray<int64> &Out)
+	{
+		Out.Length(0);
+		for (unsigned i=0; i<Rows.Length(); i++)
+			Out.Add(Rows[i]->GetInt(DbTestUid));
+	}
+};
+
+LDbTableTest::LDbTableTest() : UnitTest("LDbTableTest")
+{
+	d = new LDbTableTestPriv;
+}
+
+LDbTableTest::~LDbTableTest()
+{
+	DeleteObj(d);
+}
+
+bool LDbTableTest::Run()
+{
+	return	RandomEdits() &&
+			DeleteField();
+}
+
+bool LDbTableTest::Check(LDbTable &t)
+{
+	int Ids[] = {DbTestInt, DbTestStr, DbTestDate};
+	size_t Rows = (size_t)t.GetRows();
+	if (Rows != d->Live.Length())
+		return FAIL(_FL, "Wrong row count.");
+
+	for (unsigned n=0; n<CountOf(Ids); n++)
+	{
+		int Id = Ids[n];
+		DbTreeIndex *Idx = t.GetIndex(Id);
+		if (!Idx)
+			return FAIL(_FL, "Missing index.");
+		if (Idx->Length() != Rows)
+			return FAIL(_FL, "Wrong index length.");
+
+		GArray<LDbRow*> Up, Down;
+		Idx->Get(Up);
+		if (!d->CheckOrder(Up, Rows, Id))
+			return FAIL(_FL, "Rows out of order.");
+		Idx->Get(Down, false);
+		if (Down.Length() != Rows)
+			return FAIL(_FL, "Wrong descending length.");
+		for (size_t i=0; i<Rows; i++)
+			if (Down[i] != Up[Rows - 1 - i])
+				return FAIL(_FL, "Descending order isn't the reverse.");
+
+		// Cursors walk the same rows both ways
+		DbTreeIndex::Cursor c;
+		size_t i = 0;
+		for (bool b = Idx->First(c); b; b = Idx->Next(c), i++)
+			if (i >= Rows || Idx->Row(c) != Up[i])
+				return FAIL(_FL, "Cursor differs from Get.");
+		if (i != Rows)
+			return FAIL(_FL, "Cursor missed rows.");
+		for (bool b = Idx->Last(c); b; b = Idx->Prev(c))
+			if (!i || Idx->Row(c) != Up[--i])
+				return FAIL(_FL, "Reverse cursor differs from Get.");
+		if (i)
+			return FAIL(_FL, "Reverse cursor missed rows.");
+	}
+
+	// Ranges and prefixes against a search of all the rows
+	DbTreeIndex *Int = t.GetIndex(DbTestInt);
+	DbTreeIndex *Str = t.GetIndex(DbTestStr);
+	DbTreeIndex *Date = t.GetIndex(DbTestDate);
+	for (int Pass=0; Pass<20; Pass++)
+	{
+		int64 Lo = (int)d->Rand(1100) - 550, Hi = Lo + d->Rand(200);
+		size_t Expect = 0;
+		for (unsigned i=0; i<d->Live.Length(); i++)
+		{
+			int64 v = d->Live[i]->GetInt(DbTestInt);
+			if (v >= Lo && v <= Hi)
+				Expect++;
+		}
+		GArray<LDbRow*> r;
+		if (Int->Range(r, Lo, Hi) != Expect ||
+			!d->CheckOrder(r, Expect, DbTestInt))
+			return FAIL(_FL, "Wrong int range.");
+		for (unsigned i=0; i<r.Length(); i++)
+		{
+			int64 v = r[i]->GetInt(DbTestInt);
+			if (v < Lo || v > Hi)
+				return FAIL(_FL, "Row outside the int range.");
+		}
+
+		char Pre[4], Max[4];
+		int Len = d->Rand(3);
+		for (int i=0; i<Len; i++)
+			Pre[i] = (d->Rand(2) ? 'A' : 'a') + d->Rand(4);
+		Pre[Len] = 0;
+		Max[0] = 'a' + d->Rand(4);
+		Max[1] = 0;
+		size_t ExpectPre = 0, ExpectStr = 0;
+		for (unsigned i=0; i<d->Live.Length(); i++)
+		{
+			const char *s = d->Str(d->Live[i]);
+			if (!strnicmp(s, Pre, Len))
+				ExpectPre++;
+			if (stricmp(s, Pre) >= 0 && stricmp(s, Max) <= 0)
+				ExpectStr++;
+		}
+		r.Length(0);
+		if (Str->Prefix(r, Pre) != ExpectPre ||
+			!d->CheckOrder(r, ExpectPre, DbTestStr))
+			return FAIL(_FL, "Wrong prefix rows.");
+		for (unsigned i=0; i<r.Length(); i++)
+			if (strnicmp(d->Str(r[i]), Pre, Len))
+				return FAIL(_FL, "Row doesn't have the prefix.");
+		r.Length(0);
+		if (Str->Range(r, Pre, Max) != ExpectStr ||
+			!d->CheckOrder(r, ExpectStr, DbTestStr))
+			return FAIL(_FL, "Wrong string range.");
+
+		LDbRow *a = d->Live[d->Rand((uint32)d->Live.Length())];
+		LDbRow *b = d->Live[d->Rand((uint32)d->Live.Length())];
+		if (d->Compare(a, b, DbTestDate) > 0)
+		{
+			LDbRow *Tmp = a;
+			a = b;
+			b = Tmp;
+		}
+		LDateTime DtLo = *a->GetDate(DbTestDate);
+		LDateTime DtHi = *b->GetDate(DbTestDate);
+		int64 KeyLo = d->Key(a, DbTestDate), KeyHi = d->Key(b, DbTestDate);
+		size_t ExpectDate = 0;
+		for (unsigned i=0; i<d->Live.Length(); i++)
+		{
+			int64 k = d->Key(d->Live[i], DbTestDate);
+			if (k >= KeyLo && k <= KeyHi)
+				ExpectDate++;
+		}
+		r.Length(0);
+		if (Date->Range(r, DtLo, DtHi) != ExpectDate ||
+			!d->CheckOrder(r, ExpectDate, DbTestDate))
+			return FAIL(_FL, "Wrong date range.");
+	}
+
+	return true;
+}
+
+bool LDbTableTest::Reload(LDbTable &t, LDbTable &In)
+{
+	int Ids[] = {DbTestInt, DbTestStr, DbTestDate};
+	GArray<int64> Before[CountOf(Ids)];
+
+	if (!t.Serialize(d->File, true))
+		return FAIL(_FL, "Write failed.");
+	if (!FileExists(d->File + ".idx"))
+		return FAIL(_FL, "The indexes weren't saved.");
+	for (unsigned n=0; n<CountOf(Ids); n++)
+	{
+		GArray<LDbRow*> Rows;
+		t.GetIndex(Ids[n])->Get(Rows);
+		d->Uids(Rows, Before[n]);
+	}
+
+	if (!In.Serialize(d->File, false))
+		return FAIL(_FL, "Read failed.");
+	d->Live.Length(0);
+	for (LDbRow *r = NULL; In.Iterate(r); )
+		d->Live.Add(r);
+
+	// Rows with equal values keep their order too
+	for (unsigned n=0; n<CountOf(Ids); n++)
+	{
+		DbTreeIndex *Idx = In.GetIndex(Ids[n]);
+		if (!Idx)
+			return FAIL(_FL, "Index not loaded.");
+		GArray<LDbRow*> Rows;
+		GArray<int64> After;
+		Idx->Get(Rows);
+		d->Uids(Rows, After);
+		if (After.Length() != Before[n].Length())
+			return FAIL(_FL, "Wrong length after reloading.");
+		for (unsigned i=0; i<After.Length(); i++)
+			if (After[i] != Before[n][i])
+				return FAIL(_FL, "Order changed after reloading.");
+	}
+
+	return Check(In);
+}
+
+bool LDbTableTest::RandomEdits()
+{
+	LDbTable t;
+	if (!t.AddField(DbTestUid, GV_INT64) ||
+		!t.AddField(DbTestInt, GV_INT32) ||
+		!t.AddField(DbTestStr, GV_STRING) ||
+		!t.AddField(DbTestDate, GV_DATETIME))
+		return FAIL(_FL, "AddField failed.");
+
+	// Half the rows go in before the indexes are built, half after
+	for (int i=0; i<DBTABLE_TEST_ROWS/2; i++)
+		if (!d->Add(t))
+			return FAIL(_FL, "NewRow failed.");
+	if (!t.AddIndex(DbTestInt) ||
+		!t.AddIndex(DbTestStr) ||
+		!t.AddIndex(DbTestDate))
+		return FAIL(_FL, "AddIndex failed.");
+	if (t.AddIndex(DbTestInt) != t.GetIndex(DbTestInt))
+		return FAIL(_FL, "AddIndex should return the existing index.");
+	for (int i=0; i<DBTABLE_TEST_ROWS/2; i++)
+		if (!d->Add(t))
+			return FAIL(_FL, "NewRow failed.");
+	if (!Check(t))
+		return false;
+
+	LDbTable In, Again;
+	if (!Reload(t, In))
+		return false;
+
+	// Edit, delete and add at random, the indexes must keep up
+	for (int i=0; i<DBTABLE_TEST_EDITS; i++)
+	{
+		uint32 Op = d->Rand(4);
+		if (Op == 0 || !d->Live.Length())
+		{
+			if (!d->Add(In))
+				return FAIL(_FL, "NewRow failed.");
+		}
+		else
+		{
+			size_t n = d->Rand((uint32)d->Live.Length());
+			LDbRow *r = d->Live[n];
+			if (Op == 1)
+			{
+				d->Live.DeleteAt(n);
+				if (!In.DeleteRow(r))
+					return FAIL(_FL, "DeleteRow failed.");
+			}
+			else
+			{
+				LDbRow *Src = d->Live[d->Rand((uint32)d->Live.Length())];
+				if (Op == 2)
+					r->SetStr(DbTestStr, Src->GetStr(DbTestStr)); // Duplicate values
+				else
+					d->SetRandom(r);
+			}
+		}
+	}
+	if (!Check(In))
+		return false;
+
+	return Reload(In, Again);
+}
+
+bool LDbTableTest::DeleteField()
+{
+	LDbTable t;
+	if (!t.AddField(DbTestUid, GV_INT64) ||
+		!t.AddField(DbTestStr, GV_STRING) ||
+		!t.AddIndex(DbTestStr) ||
+		!t.AddIndex(DbTestUid))
+		return FAIL(_FL, "Setup failed.");
+
+	if (!t.DeleteField(DbTestStr))
+		return FAIL(_FL, "DeleteField failed.");
+	if (t.GetIndex(DbTestStr))
+		return FAIL(_FL, "The index outlived its field.");
+	if (!t.GetIndex(DbTestUid))
+		return FAIL(_FL, "The wrong index was deleted.");
+
+	return true;
+}
@@ -0,0 +1,125 @@
+#include "Lgi.h"
+#include "UnitTests.h"
+#include "LMutexProfile.h"
+
+#define MUTEX_TEST_OPS		2000000
+#define MUTEX_PROF_THREADS	8
+
+class LMutexTestPriv
+{
+public:
+	LMutex Lock;
+	volatile int64 Counter;
+
+	LMutexTestPriv() : Lock("LMutexTest")
+	{
+		Counter = 0;
+	}
+};
+
+class LMutexTestThread : public LThread
+{
+	LMutexTestPriv *d;
+	int Ops;
+
+public:
+	LMutexTestThread(LMutexTestPriv *priv, int ops) : LThread("LMutexTestThread")
+	{
+		d = priv;
+		Ops = ops;
+		Run();
+	}
+
+	int Main()
+	{
+		for (int i=0; i<Ops; i++)
+		{
+			// Nested to exercise the recursive path as well
+			LMutex::Auto Outer(&d->Lock, _FL);
+			LMutex::Auto Inner(&d->Lock, _FL);
+			d->Counter++;
+		}
+		return 0;
+	}
+};
+
+static uint64 LMutexTestRun(LMutexTestPriv *d, int Threads, int Ops)
+{
+	d->Counter = 0;
+
+	uint64 Start = LgiMicroTime();
+	GArray<LMutexTestThread*> t;
+	for (int i=0; i<Threads; i++)
+		t.Add(new LMutexTestThread(d, Ops));
+	for (unsigned i=0; i<t.Length(); i++)
+	{
+		while (!t[i]->IsExited())
+			LgiSleep(1);
+	}
+	uint64 Time = LgiMicroTime() - Start;
+	t.DeleteObjects();
+	return Time;
+}
+
+LMutexTest::LMutexTest() : UnitTest("LMutexTest")
+{
+	d = new LMutexTestPriv;
+}
+
+LMutexTest::~LMutexTest()
+{
+	DeleteObj(d);
+}
+
+bool LMutexTest::Run()
+{
+	// Timeouts
+	if (!d->Lock.LockWithTimeout(10, _FL))
+		return FAIL(_FL, "LockWithTimeout failed on a free lock.");
+	if (!d->Lock.Lock(_FL))
+		return FAIL(_FL, "Recursive lock failed.");
+	d->Lock.Unlock();
+	d->Lock.Unlock();
+
+	// Contention benchmark: the total work is split across the threads
+	for (int Threads=1; Threads<=64; Threads<<=1)
+	{
+		int Ops = MUTEX_TEST_OPS / Threads;
+		uint64 Time = LMutexTestRun(d, Threads, Ops);
+		if (d->Counter != (int64)Ops * Threads)
+			return FAIL(_FL, "Counter mismatch, lock isn't exclusive.");
+
+		printf("LMutexTest: threads=%i ops=%i time=%ims ns/op=%i\n",
+			Threads,
+			Ops * Threads,
+			(int)(Time / 1000),
+			(int)(Time * 1000 / (Ops * Threads)));
+	}
+
+	// Profiling: every outermost lock is counted once
+	LMutexProfile::Enable();
+	LMutexProfile::Reset();
+	int Ops = MUTEX_TEST_OPS / MUTEX_PROF_THREADS;
+	uint64 Time = LMutexTestRun(d, MUTEX_PROF_THREADS, Ops);
+	GString Report = LMutexProfile::Report();
+	LMutexProfile::Enable(false);
+	LMutexProfile::Reset();
+
+	printf("LMutexTest: profiled threads=%i ops=%i time=%ims ns/op=%i\n",
+		MUTEX_PROF_THREADS,
+		Ops * MUTEX_PROF_THREADS,
+		(int)(Time / 1000),
+		(int)(Time * 1000 / (Ops * MUTEX_PROF_THREADS)));
+
+	if (d->Counter != (int64)Ops * MUTEX_PROF_THREADS)
+		return FAIL(_FL, "Counter mismatch while profiling.");
+
+	GString Expect;
+	Expect.Printf("  LMutexTest\n      locks=%i ", Ops * MUTEX_PROF_THREADS);
+	if (Report.Find(Expect) < 0)
+		return FAIL(_FL, "Report is missing the test mutex's lock count.");
+	if (Report.Find("LMutexTest.cpp:") < 0)
+		return FAIL(_FL, "Report is missing the test's call site.");
+
+	return true;
+}
@@ -0,0 +1,144 @@
+#include "Lgi.h"
+#include "UnitTests.h"
+#include "LThreadPool.h"
+
+#define POOL_TEST_SIZE			4000000	// Items to sum
+#define POOL_TEST_NESTED		64		// Outer ranges for the nested test
+#define POOL_TEST_TASKS			200		// Tasks for the cancel test
+#define M_POOL_TEST				(M_USER + 101)
+
+class LThreadPoolTestPriv : public LMutex, public GEventSinkI
+{
+public:
+	GArray<int64> Data;
+	int64 Total;
+	int Posted;
+	GMessage::Param PostedCancel;
+
+	LThreadPoolTestPriv() : LMutex("LThreadPoolTestPriv")
+	{
+		Total = 0;
+		Posted = 0;
+		PostedCancel = 0;
+	}
+
+	void Add(int64 i)
+	{
+		LMutex::Auto Lck(this, _FL);
+		Total += i;
+	}
+
+	bool PostEvent(int Cmd, GMessage::Param a, GMessage::Param b)
+	{
+		LMutex::Auto Lck(this, _FL);
+		if (Cmd == M_POOL_TEST)
+		{
+			Posted++;
+			PostedCancel = b;
+		}
+		return true;
+	}
+};
+
+struct PoolSum
+{
+	LThreadPoolTestPriv *d;
+
+	void operator()(ssize_t From, ssize_t To)
+	{
+		int64 s = 0;
+		for (ssize_t i=From; i<To; i++)
+			s += d->Data[i];
+		d->Add(s);
+	}
+};
+
+struct PoolNested
+{
+	LThreadPoolTestPriv *d;
+
+	void operator()(ssize_t From, ssize_t To)
+	{
+		for (ssize_t i=From; i<To; i++)
+		{
+			PoolSum Inner = { d };
+			LThreadPool::ParallelFor(0, 1000, Inner, 50);
+		}
+	}
+};
+
+class PoolSlowTask : public LThreadTask
+{
+	LThreadPoolTestPriv *d;
+
+public:
+	PoolSlowTask(LThreadPoolTestPriv *priv) { d = priv; }
+
+	void Do()
+	{
+		LgiSleep(1);
+		d->Add(1);
+	}
+};
+
+LThreadPoolTest::LThreadPoolTest() : UnitTest("LThreadPoolTest")
+{
+	d = new LThreadPoolTestPriv;
+}
+
+LThreadPoolTest::~LThreadPoolTest()
+{
+	DeleteObj(d);
+}
+
+bool LThreadPoolTest::Run()
+{
+	if (LThreadPool::Inst()->GetThreads() < 1)
+		return FAIL(_FL, "No pool threads.");
+
+	// Parallel sum
+	int64 Expected = 0;
+	d->Data.Length(POOL_TEST_SIZE);
+	for (int i=0; i<POOL_TEST_SIZE; i++)
+		Expected += d->Data[i] = i;
+
+	PoolSum Sum = { d };
+	uint64 Start = LgiMicroTime();
+	if (!LThreadPool::ParallelFor(0, POOL_TEST_SIZE, Sum))
+		return FAIL(_FL, "ParallelFor failed.");
+	uint64 Time = LgiMicroTime() - Start;
+	if (d->Total != Expected)
+		return FAIL(_FL, "Wrong parallel sum.");
+
+	// Nested groups, the outer tasks wait on inner groups
+	d->Total = 0;
+	PoolNested Nested = { d };
+	if (!LThreadPool::ParallelFor(0, POOL_TEST_NESTED, Nested, 1))
+		return FAIL(_FL, "Nested ParallelFor failed.");
+	if (d->Total != (int64)POOL_TEST_NESTED * 999 * 1000 / 2)
+		return FAIL(_FL, "Wrong nested sum.");
+
+	// Cancelling skips the tasks not yet started and still posts completion
+	d->Total = 0;
+	{
+		LThreadTaskGroup Group;
+		Group.SetSink(d, M_POOL_TEST);
+		for (int i=0; i<POOL_TEST_TASKS; i++)
+			Group.Add(new PoolSlowTask(d));
+		Group.Cancel();
+		if (Group.Wait())
+			return FAIL(_FL, "Group not cancelled.");
+		if (Group.GetPending() != 0)
+			return FAIL(_FL, "Tasks still pending.");
+	}
+	if (d->Total >= POOL_TEST_TASKS)
+		return FAIL(_FL, "Cancelled tasks still ran.");
+	if (d->Posted != 1 || !d->PostedCancel)
+		return FAIL(_FL, "Completion not posted.");
+
+	printf("LThreadPoolTest: threads=%i sum=%ius\n",
+		LThreadPool::Inst()->GetThreads(),
+		(int)Time);
+
+	return true;
+}
@@ -0,0 +1,126 @@
+#include "Lgi.h"
+#include "UnitTests.h"
+#include "GEventTargetThread.h"
+
+#define THREAD_TEST_LATENCY		1000	// Round trips to time
+#define THREAD_TEST_MSGS		200000	// Messages for the throughput test
+#define M_THREAD_TEST			(M_USER + 100)
+
+class LThreadTestPriv : public LThreadOwner
+{
+public:
+	LThreadEvent Done;
+	volatile int Count;
+	uint64 Sent;
+	uint64 LatencyTotal;
+
+	LThreadTestPriv()
+	{
+		Count = 0;
+		Sent = 0;
+		LatencyTotal = 0;
+	}
+
+	void Received()
+	{
+		if (Sent)
+		{
+			LatencyTotal += LgiMicroTime() - Sent;
+			Sent = 0;
+		}
+		if (--Count == 0)
+			Done.Signal();
+	}
+};
+
+class LThreadTestJob : public LThreadJob
+{
+	LThreadTestPriv *d;
+
+public:
+	LThreadTestJob(LThreadTestPriv *priv) : LThreadJob(priv)
+	{
+		d = priv;
+	}
+
+	void Do()
+	{
+		d->Received();
+	}
+};
+
+class LThreadTestTarget : public GEventTargetThread
+{
+	LThreadTestPriv *d;
+
+public:
+	LThreadTestTarget(LThreadTestPriv *priv) : GEventTargetThread("LThreadTestTarget")
+	{
+		d = priv;
+	}
+
+	GMessage::Result OnEvent(GMessage *Msg)
+	{
+		if (Msg->Msg() == M_THREAD_TEST)
+			d->Received();
+		return 0;
+	}
+};
+
+LThreadTest::LThreadTest() : UnitTest("LThreadTest")
+{
+	d = new LThreadTestPriv;
+}
+
+LThreadTest::~LThreadTest()
+{
+	DeleteObj(d);
+}
+
+bool LThreadTest::Run()
+{
+	LThreadWorker Worker(NULL, "LThreadTestWorker");
+	d->SetWorker(&Worker);
+	LThreadTestTarget Target(d);
+
+	for (int Mode=0; Mode<2; Mode++)
+	{
+		const char *Name = Mode ? "PostEvent" : "AddJob";
+
+		// Latency: one message in flight at a time
+		d->LatencyTotal = 0;
+		for (int i=0; i<THREAD_TEST_LATENCY; i++)
+		{
+			d->Count = 1;
+			d->Sent = LgiMicroTime();
+			if (Mode)
+				Target.PostEvent(M_THREAD_TEST);
+			else
+				Worker.AddJob(new LThreadTestJob(d));
+			if (d->Done.Wait(5000) != LThreadEvent::WaitSignaled)
+				return FAIL(_FL, "Message not received.");
+		}
+
+		// Throughput: queue a lot of messages as fast as possible
+		d->Count = THREAD_TEST_MSGS;
+		uint64 Start = LgiMicroTime();
+		for (int i=0; i<THREAD_TEST_MSGS; i++)
+		{
+			if (Mode)
+				Target.PostEvent(M_THREAD_TEST);
+			else
+				Worker.AddJob(new LThreadTestJob(d));
+		}
+		if (d->Done.Wait(30000) != LThreadEvent::WaitSignaled)
+			return FAIL(_FL, "Messages not received.");
+		uint64 Time = LgiMicroTime() - Start;
+
+		printf("LThreadTest: %s latency=%ius throughput=%i/s\n",
+			Name,
+			(int)(d->LatencyTotal / THREAD_TEST_LATENCY),
+			(int)(Time ? (uint64)THREAD_TEST_MSGS * 1000000 / Time : 0));
+	}
+
+	Worker.Stop();
+	return true;
+}
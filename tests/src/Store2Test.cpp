@@ -0,0 +1,397 @@
+#include "Lgi.h"
+#include "UnitTests.h"
+#include "Store2.h"
+
+using namespace Storage2;
+
+#define STORE2_TEST_TYPE		0xAAFF0001
+
+// An object whose bytes can be checked after it's been moved around.
+class Store2TestObj : public StorageObj
+{
+	int Id, Len;
+
+public:
+	Store2TestObj(int id, int len)
+	{
+		Id = id;
+		Len = len;
+	}
+
+	static uint8 Byte(int Id, int i)
+	{
+		return (uint8)(Id * 7 + i);
+	}
+
+	int Type() { return STORE2_TEST_TYPE; }
+	int Sizeof() { return Len + 8; }
+
+	bool Serialize(GFile &f, bool Write)
+	{
+		if (!Write)
+			return false;
+
+		GArray<uint8> b;
+		b.Length(Len + 8);
+		memcpy(&b[0], &Id, 4);
+		memcpy(&b[4], &Len, 4);
+		for (int i=0; i<Len; i++)
+			b[8+i] = Byte(Id, i);
+		return f.Write(&b[0], b.Length()) == b.Length();
+	}
+};
+
+class Store2TestPriv
+{
+public:
+	GString File, Journal;
+
+	Store2TestPriv()
+	{
+		GFile::Path p(LSP_TEMP);
+		p += "Store2Test.store";
+		File = p.GetFull();
+		Journal = File + ".journal";
+	}
+
+	~Store2TestPriv()
+	{
+		Delete();
+	}
+
+	void Delete()
+	{
+		FileDev->Delete(File, false);
+		FileDev->Delete(Journal, false);
+	}
+
+	/// Creates a store with 'Count' objects of mixed sizes under the root.
+	bool Create(int Count)
+	{
+		Delete();
+
+		StorageKitImpl k(File);
+		StorageItem *Root = k.CreateRoot(new Store2TestObj(0, 10));
+		if (!Root)
+			return false;
+		for (int i=1; i<=Count; i++)
+		{
+			if (!Root->CreateSub(new Store2TestObj(i, 1000 + (i * 97) % 4000)))
+				return false;
+		}
+		return true;
+	}
+
+	/// Reads back every object under the root.
+	/// \returns the number of objects or -1 if any are damaged.
+	int Check(StorageKitImpl &k)
+	{
+		StorageItem *Root = k.GetRoot();
+		if (!Root)
+			return -1;
+
+		int Count = 0;
+		for (StorageItem *i = Root->GetChild(); i; i = i->GetNext())
+		{
+			GAutoPtr<GFile> f(i->GotoObject(_FL));
+			int Id = 0, Len = -1;
+			if (!f ||
+				f->Read(&Id, 4) != 4 ||
+				f->Read(&Len, 4) != 4 ||
+				Len < 0 ||
+				i->GetObjectSize() != Len + 8)
+				return -1;
+
+			GArray<uint8> b;
+			b.Length(Len);
+			if (Len && f->Read(&b[0], Len) != Len)
+				return -1;
+			for (int n=0; n<Len; n++)
+			{
+				if (b[n] != Store2TestObj::Byte(Id, n))
+					return -1;
+			}
+			Count++;
+		}
+
+		return Count;
+	}
+
+	/// The magic number at the start of the file.
+	uint32 Magic()
+	{
+		uint8 b[4] = {0};
+		GFile f;
+		if (!f.Open(File, O_READ) || f.Read(b, 4) != 4)
+			return 0;
+		return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32)b[3] << 24);
+	}
+
+	static void Put32(uint8 *p, uint32 v)
+	{
+		for (int i=0; i<4; i++)
+			p[i] = (uint8)(v >> (i * 8));
+	}
+
+	static void Put64(uint8 *p, uint64 v)
+	{
+		for (int i=0; i<8; i++)
+			p[i] = (uint8)(v >> (i * 8));
+	}
+};
+
+Store2Test::Store2Test() : UnitTest("Store2Test")
+{
+	d = new Store2TestPriv;
+}
+
+Store2Test::~Store2Test()
+{
+	DeleteObj(d);
+}
+
+bool Store2Test::Run()
+{
+	return	FreeMap() &&
+			JournalReplay() &&
+			Versions() &&
+			Views();
+}
+
+bool Store2Test::FreeMap()
+{
+	if (!d->Create(50))
+		return FAIL(_FL, "Create failed.");
+
+	uint64 Free;
+	{
+		StorageKitImpl k(d->File);
+		StorageItem *Root = k.GetRoot();
+		int n = 0;
+		for (StorageItem *i = Root->GetChild(), *Next; i; i = Next)
+		{
+			Next = i->GetNext();
+			if (n++ % 3 == 0)
+			{
+				k.DeleteItem(i);
+				DeleteObj(i);
+			}
+		}
+
+		Free = k.GetFreeSpace();
+		if (!Free)
+			return FAIL(_FL, "Deleting objects left no free space.");
+		if (d->Check(k) != 33)
+			return FAIL(_FL, "Objects damaged by deleting.");
+	}
+
+	{
+		// The map is saved on close, so the holes can be used straight away.
+		StorageKitImpl k(d->File);
+		if (k.GetFreeSpace() != Free)
+			return FAIL(_FL, "The free map wasn't reloaded.");
+
+		StorageItem *Root = k.GetRoot();
+		uint64 Size = k.GetFileSize();
+		for (int i=100; i<110; i++)
+		{
+			if (!Root->CreateSub(new Store2TestObj(i, 500 + i)))
+				return FAIL(_FL, "CreateSub failed.");
+		}
+		if (k.GetFileSize() > Size)
+			return FAIL(_FL, "New objects didn't go into the holes.");
+		if (k.GetFreeSpace() >= Free)
+			return FAIL(_FL, "Free space wasn't used.");
+		if (d->Check(k) != 43)
+			return FAIL(_FL, "Objects damaged by adding.");
+
+		// Let the idle compaction run to completion.
+		int Steps = 0;
+		while (k.OnIdle())
+		{
+			if (++Steps > 1000)
+				return FAIL(_FL, "OnIdle never finished.");
+		}
+		if (k.GetFileSize() >= Size)
+			return FAIL(_FL, "Compacting didn't shrink the file.");
+		if (d->Check(k) != 43)
+			return FAIL(_FL, "Objects damaged by compacting.");
+
+		printf("Store2Test: compacted %iKB to %iKB in %i steps, %iKB free\n",
+			(int)(Size >> 10), (int)(k.GetFileSize() >> 10), Steps, (int)(k.GetFreeSpace() >> 10));
+	}
+
+	{
+		StorageKitImpl k(d->File);
+		if (d->Check(k) != 43)
+			return FAIL(_FL, "Objects damaged after reopening.");
+	}
+
+	return true;
+}
+
+bool Store2Test::JournalReplay()
+{
+	if (!d->Create(10))
+		return FAIL(_FL, "Create failed.");
+
+	uint64 HeaderLoc = 0;
+	int Version = 0;
+	{
+		StorageKitImpl k(d->File);
+		StorageItem *i = k.GetRoot()->GetChild();
+		for (int n=0; i && n<3; n++)
+			i = i->GetNext();
+		StorageItemImpl *Impl = dynamic_cast<StorageItemImpl*>(i);
+		if (!Impl)
+			return FAIL(_FL, "No item to move.");
+		HeaderLoc = Impl->GetStoreLoc();
+		Version = k.GetVersion();
+	}
+
+	// Do the first half of a CompactStep move by hand: copy the object's
+	// bytes to the end of the file and write the journal, then "crash"
+	// before the header is updated. The old copy is overwritten so only
+	// a finished move reads back correctly.
+	{
+		GFile f;
+		if (!f.Open(d->File, O_READWRITE))
+			return FAIL(_FL, "Open failed.");
+
+		int HeaderSize = StorageItemHeader::DiskSize(Version);
+		uint8 Raw[STORAGE2_HEADER_V3];
+		StorageItemHeader h;
+		if (f.SetPos(HeaderLoc) != HeaderLoc ||
+			f.Read(Raw, HeaderSize) != HeaderSize)
+			return FAIL(_FL, "Reading the item header failed.");
+		h.Decode(Raw, Version);
+		if (h.Magic != STORAGE2_ITEM_MAGIC || !h.DataSize)
+			return FAIL(_FL, "Bad item header.");
+
+		GArray<uint8> Data;
+		Data.Length(h.DataSize);
+		uint64 End = f.GetSize();
+		if (f.SetPos(h.DataLoc) != h.DataLoc ||
+			f.Read(&Data[0], h.DataSize) != h.DataSize ||
+			f.SetPos(End) != End ||
+			f.Write(&Data[0], h.DataSize) != h.DataSize)
+			return FAIL(_FL, "Copying the object failed.");
+
+		memset(&Data[0], 0xcc, Data.Length());
+		if (f.SetPos(h.DataLoc) != h.DataLoc ||
+			f.Write(&Data[0], h.DataSize) != h.DataSize)
+			return FAIL(_FL, "Overwriting the old copy failed.");
+
+		// Magic, header size, header location, then the encoded header.
+		uint8 j[16 + STORAGE2_HEADER_V3];
+		ZeroObj(j);
+		h.DataLoc = End;
+		Store2TestPriv::Put32(j, STORAGE2_JOURNAL_MAGIC);
+		Store2TestPriv::Put32(j + 4, HeaderSize);
+		Store2TestPriv::Put64(j + 8, HeaderLoc);
+		h.Encode(j + 16, Version);
+
+		GFile Jf;
+		if (!Jf.Open(d->Journal, O_WRITE) ||
+			Jf.Write(j, sizeof(j)) != sizeof(j))
+			return FAIL(_FL, "Writing the journal failed.");
+	}
+
+	{
+		StorageKitImpl k(d->File);
+		if (FileExists(d->Journal))
+			return FAIL(_FL, "The journal wasn't cleared.");
+		if (d->Check(k) != 10)
+			return FAIL(_FL, "The move wasn't finished from the journal.");
+	}
+
+	return true;
+}
+
+bool Store2Test::Versions()
+{
+	if (!d->Create(20))
+		return FAIL(_FL, "Create failed.");
+
+	// New files stay v2 so older builds can still open them.
+	if (d->Magic() != STORAGE2_MAGIC)
+		return FAIL(_FL, "New files should be v2.");
+
+	{
+		StorageKitImpl k(d->File);
+		if (k.GetVersion() != STORAGE2_VERSION2)
+			return FAIL(_FL, "Wrong version.");
+		if (!k.Upgrade())
+			return FAIL(_FL, "Upgrade failed.");
+		if (k.GetVersion() != STORAGE2_VERSION3)
+			return FAIL(_FL, "Upgrade didn't change the version.");
+		if (d->Check(k) != 20)
+			return FAIL(_FL, "Objects damaged by upgrading.");
+		if (!k.GetRoot()->CreateSub(new Store2TestObj(100, 3000)))
+			return FAIL(_FL, "CreateSub failed after upgrading.");
+	}
+
+	// v3 files get their own magic so that older builds refuse them.
+	if (d->Magic() != STORAGE2_MAGIC_V3)
+		return FAIL(_FL, "v3 files should have their own magic.");
+
+	{
+		StorageKitImpl k(d->File);
+		if (k.GetVersion() != STORAGE2_VERSION3)
+			return FAIL(_FL, "Reopened with the wrong version.");
+		if (d->Check(k) != 21)
+			return FAIL(_FL, "Objects damaged after reopening v3.");
+	}
+
+	return true;
+}
+
+bool Store2Test::Views()
+{
+	if (!d->Create(20))
+		return FAIL(_FL, "Create failed.");
+
+	StorageKitImpl k(d->File);
+	StorageItem *Root = k.GetRoot();
+	GArray<const uint8*> Ptrs;
+	GArray<int> Lens;
+	for (StorageItem *i = Root->GetChild(); i; i = i->GetNext())
+	{
+		const uint8 *Ptr = NULL;
+		int Len = 0;
+		if (!i->GetView(Ptr, Len))
+		{
+			#ifdef POSIX
+			return FAIL(_FL, "GetView failed.");
+			#else
+			return true; // Only POSIX maps the file
+			#endif
+		}
+		Ptrs.Add(Ptr);
+		Lens.Add(Len);
+	}
+
+	// Grow the file, the views have to stay valid and the new objects have
+	// to read back through the mapping.
+	for (int i=100; i<140; i++)
+	{
+		if (!Root->CreateSub(new Store2TestObj(i, 64 << 10)))
+			return FAIL(_FL, "CreateSub failed.");
+	}
+	if (d->Check(k) != 60)
+		return FAIL(_FL, "Objects damaged reading through the mapping.");
+
+	int n = 0;
+	for (StorageItem *i = Root->GetChild(); i && n < (int)Ptrs.Length(); i = i->GetNext(), n++)
+	{
+		GAutoPtr<GFile> f(i->GotoObject(_FL));
+		GArray<uint8> b;
+		b.Length(Lens[n]);
+		if (!f ||
+			f->Read(&b[0], Lens[n]) != Lens[n] ||
+			memcmp(&b[0], Ptrs[n], Lens[n]))
+			return FAIL(_FL, "View doesn't match the object.");
+	}
+
+	return true;
+}
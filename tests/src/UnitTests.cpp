@@ -6,9 +6,18 @@ void UnitTests()
 	GArray<UnitTest*> Tests;
 
 	Tests.Add(new GContainers);
+	Tests.Add(new LMutexTest);
+	Tests.Add(new LThreadTest);
+	Tests.Add(new LThreadPoolTest);
+	Tests.Add(new GWordStoreTest);
+	Tests.Add(new Store2Test);
+	Tests.Add(new FindIndexTest);
+	Tests.Add(new GHtmlParserTest);
+	Tests.Add(new GCssTest);
+	Tests.Add(new GAlphaTest);
+	Tests.Add(new LDbTableTest);
 	#if 0
 	Tests.Add(new GAutoPtrTest);
-	Tests.Add(new GCssTest);
 	Tests.Add(new GMatrixTest);
 	Tests.Add(new GStringClassTest);
 	Tests.Add(new LDateTimeTest);
@@ -86,6 +86,125 @@ public:
 	bool Run();
 };
 
+class LMutexTest : public UnitTest
+{
+	class LMutexTestPriv *d;
+
+public:
+	LMutexTest();
+	~LMutexTest();
+
+	bool Run();
+};
+
+class LThreadTest : public UnitTest
+{
+	class LThreadTestPriv *d;
+
+public:
+	LThreadTest();
+	~LThreadTest();
+
+	bool Run();
+};
+
+class LThreadPoolTest : public UnitTest
+{
+	class LThreadPoolTestPriv *d;
+
+public:
+	LThreadPoolTest();
+	~LThreadPoolTest();
+
+	bool Run();
+};
+
+class GWordStoreTest : public UnitTest
+{
+	class GWordStoreTestPriv *d;
+
+	bool LogReplay();
+	bool ImportV1();
+	bool BackgroundCompact();
+	bool Iterate();
+
+public:
+	GWordStoreTest();
+	~GWordStoreTest();
+
+	bool Run();
+};
+
+class Store2Test : public UnitTest
+{
+	class Store2TestPriv *d;
+
+	bool FreeMap();
+	bool JournalReplay();
+	bool Versions();
+	bool Views();
+
+public:
+	Store2Test();
+	~Store2Test();
+
+	bool Run();
+};
+
+class LDbTable;
+class LDbTableTest : public UnitTest
+{
+	class LDbTableTestPriv *d;
+
+	bool Check(LDbTable &t);
+	bool Reload(LDbTable &t, LDbTable &In);
+	bool RandomEdits();
+	bool DeleteField();
+
+public:
+	LDbTableTest();
+	~LDbTableTest();
+
+	bool Run();
+};
+
+class GAlphaTest : public UnitTest
+{
+	class GAlphaTestPriv *d;
+
+	bool BlendCoverage();
+
+public:
+	GAlphaTest();
+	~GAlphaTest();
+
+	bool Run();
+};
+
+class GHtmlParserTest : public UnitTest
+{
+	class GHtmlParserTestPriv *d;
+
+	bool Chunked();
+
+public:
+	GHtmlParserTest();
+	~GHtmlParserTest();
+
+	bool Run();
+};
+
+class FindIndexTest : public UnitTest
+{
+	class FindIndexTestPriv *d;
+
+public:
+	FindIndexTest();
+	~FindIndexTest();
+
+	bool Run();
+};
+
 class LDateTimeTest : public UnitTest
 {
 public: